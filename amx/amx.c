@@ -38,10 +38,21 @@
   #if !defined AMX_NODYNALOAD
     #include <dlfcn.h>
   #endif
-  #if defined AMX_JIT
+  #if defined AMX_JIT || defined AMX_GUARDPAGES || defined AMX_GROWABLE || defined AMX_SANDBOX
     #include <sys/types.h>
     #include <sys/mman.h>
   #endif
+  #if defined AMX_GUARDPAGES || defined AMX_SANDBOX
+    #include <setjmp.h>
+    #include <signal.h>
+  #endif
+  #if defined AMX_GUARDPAGES || defined AMX_GROWABLE || defined AMX_SANDBOX
+    #include <unistd.h>
+  #endif
+#elif defined AMX_GUARDPAGES || defined AMX_SANDBOX
+  #error Guard pages (AMX_GUARDPAGES) and the sandbox (AMX_SANDBOX) need mprotect() and a SIGSEGV handler
+#elif defined AMX_GROWABLE && !defined __WIN32__
+  #error A growable data block (AMX_GROWABLE) needs mprotect() or VirtualAlloc()
 #endif
 #if defined __LCC__ || defined __LINUX__
   #include <wchar.h>    /* for wcslen() */
@@ -53,8 +64,14 @@
 #else
   #include "amx.h"
 #endif
+#if defined AMX_GUARDPAGES && defined AMX_GROWABLE
+  #error AMX_GUARDPAGES and AMX_GROWABLE (or AMX_SANDBOX) cannot be combined
+#endif
+#if defined AMX_SANDBOX && (PAWN_CELL_SIZE!=32 || !defined __LP64__)
+  #error The sandbox (AMX_SANDBOX) needs 32-bit cells and 64-bit pointers
+#endif
 
-#if (defined _Windows && !defined AMX_NODYNALOAD) || (defined AMX_JIT && __WIN32__)
+#if (defined _Windows && !defined AMX_NODYNALOAD) || ((defined AMX_JIT || defined AMX_GROWABLE) && __WIN32__)
   #include <windows.h>
 #endif
 
@@ -78,7 +95,10 @@
 #if defined AMX_RAISEERROR   || defined AMX_REGISTER    || defined AMX_SETCALLBACK
   #define AMX_EXPLIT_FUNCTIONS
 #endif
-#if defined AMX_SETDEBUGHOOK || defined AMX_UTF8XXX     || defined AMX_XXXNATIVES
+#if defined AMX_SETDEBUGHOOK || defined AMX_SETFUEL     || defined AMX_UTF8XXX
+  #define AMX_EXPLIT_FUNCTIONS
+#endif
+#if defined AMX_XXXNATIVES
   #define AMX_EXPLIT_FUNCTIONS
 #endif
 #if defined AMX_XXXPUBLICS  || defined AMX_XXXPUBVARS   || defined AMX_XXXSTRING
@@ -93,22 +113,23 @@
   #define AMX_ALLOT             /* amx_Allot() and amx_Release() */
   #define AMX_DEFCALLBACK       /* amx_Callback() */
   #define AMX_CLEANUP           /* amx_Cleanup() */
-  #define AMX_CLONE             /* amx_Clone() */
-  #define AMX_EXEC              /* amx_Exec() */
+  #define AMX_CLONE             /* amx_Clone() and amx_Freeze() */
+  #define AMX_EXEC              /* amx_Exec() and amx_ExecBatch() */
   #define AMX_FLAGS             /* amx_Flags() */
-  #define AMX_INIT              /* amx_Init() and amx_InitJIT() */
+  #define AMX_INIT              /* amx_Init(), amx_InitJIT() and amx_GetPrepared() */
   #define AMX_MEMINFO           /* amx_MemInfo() */
   #define AMX_NAMELENGTH        /* amx_NameLength() */
   #define AMX_NATIVEINFO        /* amx_NativeInfo() */
   #define AMX_PUSHXXX           /* amx_Push(), amx_PushAddress(), amx_PushArray() and amx_PushString() */
   #define AMX_RAISEERROR        /* amx_RaiseError() */
-  #define AMX_REGISTER          /* amx_Register() */
+  #define AMX_REGISTER          /* amx_Register(), amx_RegisterAll(), amx_SetNatives() and the registry functions */
   #define AMX_SETCALLBACK       /* amx_SetCallback() */
   #define AMX_SETDEBUGHOOK      /* amx_SetDebugHook() */
-  #define AMX_UTF8XXX           /* amx_UTF8Check(), amx_UTF8Get(), amx_UTF8Len() and amx_UTF8Put() */
+  #define AMX_SETFUEL           /* amx_SetFuel() and amx_SetFuelHook() */
+  #define AMX_UTF8XXX           /* amx_UTF8Check(), amx_UTF8Decode(), amx_UTF8Encode(), amx_UTF8Get(), amx_UTF8Len() and amx_UTF8Put() */
   #define AMX_XXXNATIVES        /* amx_NumNatives(), amx_GetNative() and amx_FindNative() */
-  #define AMX_XXXPUBLICS        /* amx_NumPublics(), amx_GetPublic() and amx_FindPublic() */
-  #define AMX_XXXPUBVARS        /* amx_NumPubVars(), amx_GetPubVar() and amx_FindPubVar() */
+  #define AMX_XXXPUBLICS        /* amx_NumPublics(), amx_GetPublic(), amx_FindPublic(), amx_ResolvePublic() and the name index */
+  #define AMX_XXXPUBVARS        /* amx_NumPubVars(), amx_GetPubVar(), amx_FindPubVar(), amx_ResolvePubVar() and the name index */
   #define AMX_XXXSTRING         /* amx_StrLen(), amx_GetString() and amx_SetString() */
   #define AMX_XXXTAGS           /* amx_NumTags(), amx_GetTag() and amx_FindTagId() */
   #define AMX_XXXUSERDATA       /* amx_GetUserData() and amx_SetUserData() */
@@ -123,7 +144,23 @@
 #if AMX_USERNUM <= 0
   #undef AMX_XXXUSERDATA
 #endif
-#if defined AMX_JIT
+#if defined AMX_JIT && (defined __x86_64__ || defined __amd64__) && !defined _WIN64
+  /* the x86-64 JIT (amxjit_x64.c) runs next to the ANSI-C core; it handles
+   * macro instructions and packed opcodes, but not overlays */
+  #define AMX_JIT_X64
+#endif
+#if defined AMX_DONT_RELOCATE && !defined AMX_NO_SUPERINSTR
+  #define AMX_NO_SUPERINSTR     /* superinstructions are created by patching the P-code */
+#endif
+#if (defined AMX_XXXSTRING || defined AMX_PUSHXXX) && !defined AMX_NO_SIMD && PAWN_CELL_SIZE==32 \
+    && (defined __x86_64__ || defined __amd64__ || (defined __i386__ && defined __SSE2__)) \
+    && (defined __clang__ || __GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=9))
+  /* SSE2 and AVX2 kernels for amx_StrLen(), amx_GetString() and amx_SetString();
+   * AVX2 is selected at run time */
+  #define AMX_SIMDSTRING
+  #include <immintrin.h>
+#endif
+#if defined AMX_JIT && !defined AMX_JIT_X64
   /* JIT is incompatible with macro instructions, packed opcodes and overlays */
   #if !defined AMX_NO_MACRO_INSTR
     #define AMX_NO_MACRO_INSTR
@@ -135,7 +172,7 @@
     #define AMX_NO_OVERLAY
   #endif
 #endif
-#if (defined AMX_ASM || defined AMX_JIT) && !defined AMX_ALTCORE
+#if (defined AMX_ASM || defined AMX_JIT) && !defined AMX_JIT_X64 && !defined AMX_ALTCORE
   /* do not use the standard ANSI-C amx_Exec() function */
   #define AMX_ALTCORE
 #endif
@@ -197,6 +234,11 @@
   #endif /* __WIN32__ */
 #else
   int amx_exec_list(AMX *amx,const cell **opcodelist,int *numopcodes);
+  #if defined AMX_JIT_X64
+    extern cell amx_jit_compile(void *pcode, void *jumparray, void *nativecode);
+    extern cell amx_jit_run(AMX *amx,cell *retval,unsigned char *data);
+    extern int  amx_jit_list(const AMX *amx,const cell **opcodelist,int *numopcodes);
+  #endif
 #endif /* AMX_ALTCORE */
 
 typedef enum {
@@ -383,11 +425,287 @@ typedef enum {
   OP_FILL_P,
   OP_HALT_P,
   OP_BOUNDS_P,
+#endif
+#if !defined AMX_NO_SUPERINSTR
+  /* superinstructions (created by VerifyPcode(), invalid in P-code files) */
+  OP_LOAD_S_PUSH,       /* load.s.pri + push.pri */
+  OP_CONST_PUSH,        /* const.pri + push.pri */
+  OP_PUSH_LOAD_S,       /* push.pri + load.s.pri */
+  OP_LOAD_S_CONST_ALT,  /* load.s.pri + const.alt */
+  OP_CONST_ALT_ADD,     /* const.alt + add */
+  OP_POP_ALT_ADD,       /* pop.alt + add */
+  OP_ADD_PUSH,          /* add + push.pri */
+  OP_CONST_STOR_S,      /* const.pri + stor.s */
+  OP_LOAD_I_POP_ALT,    /* load.i + pop.alt */
+  OP_BOUNDS_SHL_C,      /* bounds + shl.c.pri */
+  OP_EQ_JZER,           /* eq + jzer */
+  OP_NEQ_JZER,          /* neq + jzer */
+  OP_SLESS_JZER,        /* sless + jzer */
+  OP_SLEQ_JZER,         /* sleq + jzer */
+  OP_SGRTR_JZER,        /* sgrtr + jzer */
+  OP_SGEQ_JZER,         /* sgeq + jzer */
+#if !defined AMX_NO_MACRO_INSTR
+  OP_PUSH_C_CALL,       /* push.c + call */
+  OP_ZERO_RETN,         /* zero.pri + retn */
+  OP_LOAD_S_ADD_C,      /* load.s.pri + add.c */
+  OP_IDXADDR_B_LOAD_I,  /* idxaddr.b + load.i */
+#endif
+  /* preprocessed case tables (created by VerifyPcode(), see casetable()) */
+  OP_CASETBL_DENSE,     /* casetbl with a jump table */
+  OP_CASETBL_SORTED,    /* casetbl with the records sorted on value */
+  /* intrinsics (replace a SYSREQ(.N) of a native function, see set_intrinsic()) */
+  OP_FLOAT,             /* float() */
+  OP_FLOATADD,          /* floatadd() */
+  OP_FLOATSUB,          /* floatsub() */
+  OP_FLOATMUL,          /* floatmul() */
+  OP_FLOATDIV,          /* floatdiv() */
+  OP_FLOATCMP,          /* floatcmp() */
+  OP_FLOATABS,          /* floatabs() */
+  OP_FLOATROUND,        /* floatround() */
+  OP_FLOATINT,          /* floatint() */
+  OP_FIXED,             /* fixed() */
+  OP_FMUL,              /* fmul() */
+  OP_FDIV,              /* fdiv() */
+  OP_FABS,              /* fabs() */
+  OP_FINT,              /* fint() */
 #endif
   /* ----- */
   OP_NUM_OPCODES
 } OPCODE;
 
+#if defined AMX_OPSTATS
+/* names of the opcodes, for amx_OpcodeName(); a superinstruction is shown as
+ * the instructions that it replaces
+ */
+static const char * const opnames[] = {
+  "nop",
+  "load.pri",
+  "load.alt",
+  "load.s.pri",
+  "load.s.alt",
+  "lref.s.pri",
+  "lref.s.alt",
+  "load.i",
+  "lodb.i",
+  "const.pri",
+  "const.alt",
+  "addr.pri",
+  "addr.alt",
+  "stor",
+  "stor.s",
+  "sref.s",
+  "stor.i",
+  "strb.i",
+  "align.pri",
+  "lctrl",
+  "sctrl",
+  "xchg",
+  "push.pri",
+  "push.alt",
+  "pushr.pri",
+  "pop.pri",
+  "pop.alt",
+  "pick",
+  "stack",
+  "heap",
+  "proc",
+  "ret",
+  "retn",
+  "call",
+  "jump",
+  "jzer",
+  "jnz",
+  "shl",
+  "shr",
+  "sshr",
+  "shl.c.pri",
+  "shl.c.alt",
+  "smul",
+  "sdiv",
+  "add",
+  "sub",
+  "and",
+  "or",
+  "xor",
+  "not",
+  "neg",
+  "invert",
+  "eq",
+  "neq",
+  "sless",
+  "sleq",
+  "sgrtr",
+  "sgeq",
+  "inc.pri",
+  "inc.alt",
+  "inc.i",
+  "dec.pri",
+  "dec.alt",
+  "dec.i",
+  "movs",
+  "cmps",
+  "fill",
+  "halt",
+  "bounds",
+  "sysreq",
+  "switch",
+  "swap.pri",
+  "swap.alt",
+  "break",
+  "casetbl",
+  /* patched instructions */
+  "sysreq.d",
+  "sysreq.nd",
+  /* overlay instructions */
+  "call.ovl",
+  "retn.ovl",
+  "switch.ovl",
+  "casetbl.ovl",
+#if !defined AMX_NO_MACRO_INSTR
+  /* supplemental & macro instructions */
+  "lidx",
+  "lidx.b",
+  "idxaddr",
+  "idxaddr.b",
+  "push.c",
+  "push",
+  "push.s",
+  "push.adr",
+  "pushr.c",
+  "pushr.s",
+  "pushr.adr",
+  "jeq",
+  "jneq",
+  "jsless",
+  "jsleq",
+  "jsgrtr",
+  "jsgeq",
+  "sdiv.inv",
+  "sub.inv",
+  "add.c",
+  "smul.c",
+  "zero.pri",
+  "zero.alt",
+  "zero",
+  "zero.s",
+  "eq.c.pri",
+  "eq.c.alt",
+  "inc",
+  "inc.s",
+  "dec",
+  "dec.s",
+  /* macro instructions */
+  "sysreq.n",
+  "pushm.c",
+  "pushm",
+  "pushm.s",
+  "pushm.adr",
+  "pushrm.c",
+  "pushrm.s",
+  "pushrm.adr",
+  "load2",
+  "load2.s",
+  "const",
+  "const.s",
+#endif
+#if !defined AMX_NO_PACKED_OPC
+  /* packed instructions */
+  "load.p.pri",
+  "load.p.alt",
+  "load.p.s.pri",
+  "load.p.s.alt",
+  "lref.p.s.pri",
+  "lref.p.s.alt",
+  "lodb.p.i",
+  "const.p.pri",
+  "const.p.alt",
+  "addr.p.pri",
+  "addr.p.alt",
+  "stor.p",
+  "stor.p.s",
+  "sref.p.s",
+  "strb.p.i",
+  "lidx.p.b",
+  "idxaddr.p.b",
+  "align.p.pri",
+  "push.p.c",
+  "push.p",
+  "push.p.s",
+  "push.p.adr",
+  "pushr.p.c",
+  "pushr.p.s",
+  "pushr.p.adr",
+  "pushm.p.c",
+  "pushm.p",
+  "pushm.p.s",
+  "pushm.p.adr",
+  "pushrm.p.c",
+  "pushrm.p.s",
+  "pushrm.p.adr",
+  "stack.p",
+  "heap.p",
+  "shl.p.c.pri",
+  "shl.p.c.alt",
+  "add.p.c",
+  "smul.p.c",
+  "zero.p",
+  "zero.p.s",
+  "eq.p.c.pri",
+  "eq.p.c.alt",
+  "inc.p",
+  "inc.p.s",
+  "dec.p",
+  "dec.p.s",
+  "movs.p",
+  "cmps.p",
+  "fill.p",
+  "halt.p",
+  "bounds.p",
+#endif
+#if !defined AMX_NO_SUPERINSTR
+  /* superinstructions (created by VerifyPcode(), invalid in P-code files) */
+  "load.s.pri+push.pri",
+  "const.pri+push.pri",
+  "push.pri+load.s.pri",
+  "load.s.pri+const.alt",
+  "const.alt+add",
+  "pop.alt+add",
+  "add+push.pri",
+  "const.pri+stor.s",
+  "load.i+pop.alt",
+  "bounds+shl.c.pri",
+  "eq+jzer",
+  "neq+jzer",
+  "sless+jzer",
+  "sleq+jzer",
+  "sgrtr+jzer",
+  "sgeq+jzer",
+#if !defined AMX_NO_MACRO_INSTR
+  "push.c+call",
+  "zero.pri+retn",
+  "load.s.pri+add.c",
+  "idxaddr.b+load.i",
+#endif
+  "casetbl.dense",
+  "casetbl.sorted",
+  "sysreq.float",
+  "sysreq.floatadd",
+  "sysreq.floatsub",
+  "sysreq.floatmul",
+  "sysreq.floatdiv",
+  "sysreq.floatcmp",
+  "sysreq.floatabs",
+  "sysreq.floatround",
+  "sysreq.floatint",
+  "sysreq.fixed",
+  "sysreq.fmul",
+  "sysreq.fdiv",
+  "sysreq.fabs",
+  "sysreq.fint",
+#endif
+};
+#endif
+
 #define NUMENTRIES(hdr,field,nextfield) \
                         (unsigned)(((hdr)->nextfield - (hdr)->field) / (hdr)->defsize)
 #define GETENTRY(hdr,table,index) \
@@ -523,6 +841,62 @@ int AMXAPI amx_Flags(AMX *amx,uint16_t *flags)
 }
 #endif /* AMX_FLAGS */
 
+#if !defined AMX_NO_SUPERINSTR && !defined AMX_NO_INTRINSICS
+#define AMX_INTRINSICS
+#if PAWN_CELL_SIZE==32 && (defined _MSC_VER || defined __BORLANDC__ || defined __GNUC__ && !defined __ARM_ARCH_4T__)
+  #define FIXED64       /* fmul() and fdiv() use 64-bit integers, see amxfixed.c */
+#endif
+/* Native functions that VerifyPcode() replaces by an instruction, so that the
+ * call (and the callback) is gone; the JIT inlines some of these too. An
+ * intrinsic must give exactly the same result as the native function in
+ * amxfloat.c or amxfixed.c. The natives are bound by name only, before the
+ * host registers its functions, so VerifyPcode() only creates intrinsics if
+ * the host set AMX_FLAG_INTRINSICS before amx_Init(): a host that registers
+ * other functions under these names, or that handles them in its own
+ * callback, must leave the flag clear.
+ */
+static const struct {
+  const char *name;
+  unsigned char opcode, numargs;
+} intrinsics[] = {
+#if PAWN_CELL_SIZE>=32
+  { "float",      OP_FLOAT,      1 },
+  { "floatadd",   OP_FLOATADD,   2 },
+  { "floatsub",   OP_FLOATSUB,   2 },
+  { "floatmul",   OP_FLOATMUL,   2 },
+  { "floatdiv",   OP_FLOATDIV,   2 },
+  { "floatcmp",   OP_FLOATCMP,   2 },
+  { "floatabs",   OP_FLOATABS,   1 },
+  { "floatround", OP_FLOATROUND, 2 },
+  { "floatint",   OP_FLOATINT,   1 },
+#endif
+  { "fixed",      OP_FIXED,      1 },
+#if defined FIXED64
+  { "fmul",       OP_FMUL,       2 },
+  { "fdiv",       OP_FDIV,       2 },
+#endif
+  { "fabs",       OP_FABS,       1 },
+  { "fint",       OP_FINT,       1 },
+};
+#define NUM_INTRINSICS  (int)(sizeof intrinsics / sizeof intrinsics[0])
+#endif /* AMX_INTRINSICS */
+
+#if defined AMX_JIT_X64
+/* amx_jit_intrinsic() returns the name of an intrinsic, for the JIT; the
+ * index is stored in the SYSREQ(.N) opcode, see set_intrinsic()
+ */
+const char *amx_jit_intrinsic(int index)
+{
+  #if defined AMX_INTRINSICS
+    if (index>=0 && index<NUM_INTRINSICS)
+      return intrinsics[index].name;
+  #else
+    (void)index;
+  #endif
+  return NULL;
+}
+#endif
+
 #if defined AMX_DEFCALLBACK
 int AMXAPI amx_Callback(AMX *amx, cell index, cell *result, const cell *params)
 {
@@ -559,7 +933,7 @@ int AMXAPI amx_Callback(AMX *amx, cell index, cell *result, const cell *params)
    * be re-JIT-compiled after patching a P-code instruction.
    */
   assert((amx->flags & AMX_FLAG_JITC)==0 || amx->sysreq_d==0);
-  if (amx->sysreq_d!=0) {
+  if (amx->sysreq_d!=0 && (amx->flags & AMX_FLAG_FROZEN)==0) {
     /* at the point of the call, the CIP pseudo-register points directly
      * behind the SYSREQ(.N) instruction and its parameter(s)
      */
@@ -591,13 +965,13 @@ int AMXAPI amx_Callback(AMX *amx, cell index, cell *result, const cell *params)
 #endif /* defined AMX_DEFCALLBACK */
 
 
-#if defined AMX_JIT
+#if defined AMX_JIT && !defined AMX_JIT_X64
   /* convert from relative addresses to absolute physical addresses */
   #define RELOC_ABS(base,off)   (*(ucell *)((base)+(int)(off)) += (ucell)(base)+(int)(off)-sizeof(cell))
 #else
   #define JUMPREL(ip)           ((cell*)((intptr_t)(ip)+*(cell*)(ip)-sizeof(cell)))
 #endif
-#if defined AMX_ASM || defined AMX_JIT
+#if defined AMX_ASM || (defined AMX_JIT && !defined AMX_JIT_X64)
   #define RELOCATE_ADDR(base,v) ((v)+((ucell)(base)))
 #else
   #define RELOCATE_ADDR(base,v) (v)
@@ -616,8 +990,458 @@ int AMXAPI amx_Callback(AMX *amx, cell index, cell *result, const cell *params)
   #define GETPARAM_P(v,o) ( v=((cell)(o) >> (int)(sizeof(cell)*4)) )
 #endif
 
+#if !defined AMX_NO_SUPERINSTR && (defined AMX_INIT || defined AMX_CLONE)
+/* Pairs of instructions that VerifyPcode() replaces by a superinstruction.
+ * Only the opcode of the first instruction is replaced; the parameters and the
+ * opcode of the second instruction stay in place (the superinstruction skips
+ * the second opcode). Hence, the code size and all addresses stay the same,
+ * and a jump to the second instruction still executes only that instruction.
+ */
+static const struct {
+  unsigned char first, second, fused;
+} superinstr[] = {
+  { OP_LOAD_S_PRI, OP_PUSH_PRI,  OP_LOAD_S_PUSH },
+  { OP_CONST_PRI,  OP_PUSH_PRI,  OP_CONST_PUSH },
+  { OP_PUSH_PRI,   OP_LOAD_S_PRI,OP_PUSH_LOAD_S },
+  { OP_LOAD_S_PRI, OP_CONST_ALT, OP_LOAD_S_CONST_ALT },
+  { OP_CONST_ALT,  OP_ADD,       OP_CONST_ALT_ADD },
+  { OP_POP_ALT,    OP_ADD,       OP_POP_ALT_ADD },
+  { OP_ADD,        OP_PUSH_PRI,  OP_ADD_PUSH },
+  { OP_CONST_PRI,  OP_STOR_S,    OP_CONST_STOR_S },
+  { OP_LOAD_I,     OP_POP_ALT,   OP_LOAD_I_POP_ALT },
+  { OP_BOUNDS,     OP_SHL_C_PRI, OP_BOUNDS_SHL_C },
+  { OP_EQ,         OP_JZER,      OP_EQ_JZER },
+  { OP_NEQ,        OP_JZER,      OP_NEQ_JZER },
+  { OP_SLESS,      OP_JZER,      OP_SLESS_JZER },
+  { OP_SLEQ,       OP_JZER,      OP_SLEQ_JZER },
+  { OP_SGRTR,      OP_JZER,      OP_SGRTR_JZER },
+  { OP_SGEQ,       OP_JZER,      OP_SGEQ_JZER },
+#if !defined AMX_NO_MACRO_INSTR
+  { OP_PUSH_C,     OP_CALL,      OP_PUSH_C_CALL },
+  { OP_ZERO_PRI,   OP_RETN,      OP_ZERO_RETN },
+  { OP_LOAD_S_PRI, OP_ADD_C,     OP_LOAD_S_ADD_C },
+  { OP_IDXADDR_B,  OP_LOAD_I,    OP_IDXADDR_B_LOAD_I },
+#endif
+};
+#endif
+
+#if defined AMX_GUARDPAGES || defined AMX_SANDBOX
+/* a guard frame is set up for every (nested) call to amx_Exec() */
+typedef struct tagGUARDFRAME {
+  struct tagGUARDFRAME *prev;
+  unsigned char *lo,*hi;        /* guard page or sandbox of the abstract machine */
+  int core;                     /* value of amx_guardcore in the caller */
+  sigjmp_buf jmp;
+} GUARDFRAME;
+
+/* amx_guardcore is set while the abstract machine runs the script, and the
+ * cores clear it while they call a native function or a hook (see HOSTCALL());
+ * only a fault in the script itself returns from amx_Exec()
+ */
+#if defined __GNUC__
+  static __thread GUARDFRAME *guardframe;   /* innermost amx_Exec() of this thread */
+  __thread int amx_guardcore;
+#else
+  static GUARDFRAME *guardframe;
+  int amx_guardcore;
+#endif
+static struct sigaction guardaction;        /* the SIGSEGV handler to chain to */
+static int guardhandler=0;
+
+/* guard_fault() is the SIGSEGV handler: a fault of the script in the guard
+ * page (or the sandbox) of the abstract machine that is running returns from
+ * amx_Exec(); any other fault, including one in a native function or in other
+ * host code, is passed on to the previous handler
+ */
+static void guard_fault(int sig,siginfo_t *info,void *context)
+{
+  GUARDFRAME *frame=guardframe;
+  unsigned char *addr=(unsigned char *)info->si_addr;
+
+  if (frame!=NULL && amx_guardcore && addr>=frame->lo && addr<frame->hi)
+    siglongjmp(frame->jmp,1);
+  if ((guardaction.sa_flags & SA_SIGINFO)!=0) {
+    guardaction.sa_sigaction(sig,info,context);
+  } else if (guardaction.sa_handler==SIG_DFL || guardaction.sa_handler==SIG_IGN) {
+    /* restore the default handler and return; the fault then happens again */
+    sigaction(SIGSEGV,&guardaction,NULL);
+  } else {
+    guardaction.sa_handler(sig);
+  } /* if */
+}
+
+/* guard_install() installs the SIGSEGV handler, on the first call; this
+ * should be done before other threads run
+ */
+static int guard_install(void)
+{
+  if (!guardhandler) {
+    struct sigaction action;
+    memset(&action,0,sizeof action);
+    action.sa_sigaction=guard_fault;
+    action.sa_flags=SA_SIGINFO | SA_NODEFER;  /* the handler leaves with siglongjmp() */
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV,&action,&guardaction)!=0)
+      return 0;
+    guardhandler=1;
+  } /* if */
+  return 1;
+}
+#endif
+
+#if defined AMX_GROWABLE
+static size_t syspagesize(void)
+{
+  #if defined __WIN32__
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t)info.dwPageSize;
+  #else
+    return (size_t)sysconf(_SC_PAGESIZE);
+  #endif
+}
+
+/* commit() makes reserved pages of a growable data block accessible */
+static int commit(unsigned char *addr,size_t size)
+{
+  #if defined __WIN32__
+    return VirtualAlloc(addr,size,MEM_COMMIT,PAGE_READWRITE)!=NULL;
+  #else
+    return mprotect(addr,size,PROT_READ | PROT_WRITE)==0;
+  #endif
+}
+#endif
+
+#if defined AMX_GROWABLE && (defined AMX_INIT || defined AMX_CLONE)
+/* growinit() sets up a growable data block: "amx->reserve" bytes of address
+ * space at "amx->data" that the host has reserved, but not committed (for
+ * example with mmap() and PROT_NONE, or with VirtualAlloc() and MEM_RESERVE).
+ * The stack starts at the top of the reserved block rather than at the size
+ * in the header. Only the pages with the data section and the top of the
+ * stack are committed here; amx_Grow() commits more as the heap and the
+ * stack grow towards each other.
+ * With AMX_SANDBOX, the reserved block must lie AMX_SANDBOX_OFFSET bytes
+ * into a window of AMX_SANDBOX_SIZE bytes that the host has reserved (and
+ * does not otherwise use); the whole window stays inaccessible, except for
+ * the committed pages of the data block.
+ */
+static int growinit(AMX *amx,const AMX_HEADER *hdr)
+{
+  cell pagesize=(cell)syspagesize();
+
+  if (amx->data==NULL || ((uintptr_t)amx->data & (pagesize-1))!=0)
+    return AMX_ERR_PARAMS;
+  if ((amx->flags & AMX_FLAG_JITC)!=0)
+    return AMX_ERR_INIT_JIT;    /* the JIT copies the data into its own block */
+  if (amx->reserve<hdr->stp-hdr->dat || (amx->reserve & (pagesize-1))!=0)
+    return AMX_ERR_PARAMS;
+  #if defined CELLMASK
+    /* amx_Address() takes the upper bits of a pointer from the data block */
+    if ((((uintptr_t)amx->data ^ ((uintptr_t)amx->data+amx->reserve-1)) & ~(uintptr_t)CELLMASK)!=0)
+      return AMX_ERR_PARAMS;
+  #endif
+  #if defined AMX_SANDBOX
+    if (!guard_install())
+      return AMX_ERR_GENERAL;
+  #endif
+  amx->guard=0;                 /* nothing is committed yet */
+  amx->guardsize=amx->reserve;
+  amx->stp=amx->stk=amx->reserve-(cell)sizeof(cell);
+  return amx_Grow(amx,amx->hlw,amx->stp);
+}
+#endif
+
 #if defined AMX_INIT
 
+#if !defined AMX_NO_SUPERINSTR
+static int superinstruction(cell first,cell second)
+{
+  int i;
+  for (i=0; i<(int)(sizeof superinstr / sizeof superinstr[0]); i++)
+    if (superinstr[i].first==first && superinstr[i].second==second)
+      return superinstr[i].fused;
+  return -1;
+}
+
+/* casetable() preprocesses a case table, so that OP_SWITCH need not scan
+ * all records. On entry, "tbl" points to the default target, which is
+ * followed by "num" records with a value and a target; every target is
+ * relative to its own cell. The records are sorted on value first (the sort
+ * is stable, so that the first of duplicate values still wins). If the
+ * range of values is small enough, the records are then replaced by a jump
+ * table with a target for every value in the range:
+ *   default, minimum, maximum, <unused>, ..., target[minimum]...target[maximum]
+ * The jump table is filled in from the end, and it is only created if it
+ * never overwrites records that it still needs (which holds unless the gaps
+ * between the values are mostly at the top of the range). The function
+ * returns the opcode for the table: OP_CASETBL_DENSE for a jump table and
+ * OP_CASETBL_SORTED for sorted records (which OP_SWITCH searches with a
+ * binary search). The size of the case table does not change.
+ */
+static int casetable(cell *tbl,cell num)
+{
+  #define CASEVAL(i)  tbl[2*(i)+1]
+  #define CASETGT(i)  tbl[2*(i)+2]
+  cell i,j,val,tgt,k,next,range,first;
+
+  assert(num>0);
+  /* make the targets relative to the start of the table, and sort (with an
+   * insertion sort: the compiler already sorts the records) */
+  for (i=0; i<num; i++) {
+    val=CASEVAL(i);
+    tgt=CASETGT(i)+(2*i+1)*(cell)sizeof(cell);
+    for (j=i; j>0 && CASEVAL(j-1)>val; j--) {
+      CASEVAL(j)=CASEVAL(j-1);
+      CASETGT(j)=CASETGT(j-1);
+    } /* for */
+    CASEVAL(j)=val;
+    CASETGT(j)=tgt;
+  } /* for */
+
+  /* the jump table would start at cell "first" of the table, and filling
+   * in the entry for record i writes from cell first+k, where k is the
+   * distance of its value to the minimum; the records below i end at cell
+   * 2*i
+   */
+  range=-1;
+  if (num>=2 && (ucell)CASEVAL(num-1)-(ucell)CASEVAL(0)<=(ucell)(2*num-3)) {
+    range=(cell)((ucell)CASEVAL(num-1)-(ucell)CASEVAL(0))+1;
+    first=2*num+1-range;
+    for (i=0; i<num && first+(cell)((ucell)CASEVAL(i)-(ucell)CASEVAL(0))>2*i; i++)
+      /* nothing */;
+    if (i<num)
+      range=-1;
+  } /* if */
+
+  if (range<0) {
+    for (i=0; i<num; i++)
+      CASETGT(i)-=(2*i+1)*(cell)sizeof(cell);
+    return OP_CASETBL_SORTED;
+  } /* if */
+
+  val=CASEVAL(0);
+  first=2*num+1-range;
+  next=range;
+  for (i=num-1; i>=0; i--) {
+    k=(cell)((ucell)CASEVAL(i)-(ucell)val);
+    tgt=CASETGT(i);
+    /* the values between this record and the one above it go to "default" */
+    while (--next>k)
+      tbl[first+next]=tbl[0]-(first+next)*(cell)sizeof(cell);
+    tbl[first+k]=tgt-(first+k-1)*(cell)sizeof(cell);
+    next=k;     /* a duplicate value overwrites the same entry */
+  } /* for */
+  tbl[1]=val;
+  tbl[2]=val+(range-1);
+  return OP_CASETBL_DENSE;
+  #undef CASEVAL
+  #undef CASETGT
+}
+#endif
+
+#if defined AMX_INTRINSICS
+/* set_intrinsic() replaces the SYSREQ(.N) instruction whose parameter is at
+ * "cip" by the intrinsic for its native function, if there is one and if the
+ * size of the arguments ("numbytes", -1 if unknown) is as expected. This must
+ * be done before the native functions are registered, because registration
+ * overwrites the names in 64-bit builds. The parameter of the intrinsic is
+ * zero for SYSREQ (the arguments are behind the argument count) and the size
+ * of the arguments for SYSREQ.N (the intrinsic removes them); the third cell
+ * of SYSREQ.N stays. The JIT gets the index in intrinsics[] (plus one) in the
+ * upper half of the SYSREQ(.N) opcode instead, see amx_jit_intrinsic().
+ */
+static void set_intrinsic(AMX *amx,const cell *opcode_list,cell cip,cell numbytes,int sysreq_n)
+{
+  AMX_HEADER *hdr=(AMX_HEADER *)amx->base;
+  cell *code=(cell *)(amx->code+(int)cip);
+  const char *name;
+  int i;
+
+  if (*code<0 || *code>=(cell)NUMENTRIES(hdr,natives,libraries))
+    return;
+  name=GETENTRYNAME(hdr,GETENTRY(hdr,natives,*code));
+  for (i=0; i<NUM_INTRINSICS && strcmp(intrinsics[i].name,name)!=0; i++)
+    /* nothing */;
+  if (i>=NUM_INTRINSICS || numbytes!=(cell)(intrinsics[i].numargs*sizeof(cell)))
+    return;
+  if ((amx->flags & AMX_FLAG_JITC)!=0) {
+    code[-1]|=(cell)(i+1) << (int)(sizeof(cell)*4);
+  } else {
+    code[-1]=(opcode_list!=NULL) ? opcode_list[intrinsics[i].opcode] : intrinsics[i].opcode;
+    code[0]=sysreq_n ? numbytes : 0;
+  } /* if */
+}
+#endif
+
+#if AMX_COMPACTMARGIN > 2
+/* expand() decodes the compact encoding in place. Each cell is stored as a
+ * sequence of 7-bit groups, most significant group first; all bytes but the
+ * last have the high bit set, and bit 6 of the first byte is the sign. The
+ * block is expanded from the end backwards, so an expanded cell normally
+ * overwrites bytes that were already decoded; a cell that would overwrite
+ * bytes that are still to be decoded waits in the "spare" ring until the
+ * decoder has passed its location.
+ */
+static int expand(unsigned char *code,long codesize,long memsize)
+{
+  struct {
+    long memloc;
+    cell c;
+  } spare[AMX_COMPACTMARGIN];
+  int head=0,count=0;
+  ucell c;
+  int shift,b;
+
+  assert(memsize % sizeof(cell) == 0);
+  while (memsize>0) {
+    if (codesize<=0)
+      return AMX_ERR_FORMAT;    /* fewer cells in the block than in the header */
+    b=code[--codesize];
+    if (codesize==0 || (code[codesize-1] & 0x80)==0) {
+      /* most cells (opcodes, small operands) are a single byte */
+      c=(ucell)((cell)(b ^ 0x40) - 0x40);
+    } else {
+      /* gather the groups of the sequence, from its last byte towards its
+       * first */
+      c=(ucell)(b & 0x7f);
+      shift=7;
+      do {
+        if (shift>=(int)(8*sizeof(cell)))
+          return AMX_ERR_FORMAT;/* sequence too long for a cell */
+        b=code[--codesize];
+        c|=(ucell)(b & 0x7f) << shift;
+        shift+=7;
+      } while (codesize>0 && (code[codesize-1] & 0x80)!=0);
+      if ((b & 0x40)!=0 && shift<(int)(8*sizeof(cell)))
+        c|=~(ucell)0 << shift;  /* sign extension */
+    } /* if */
+    memsize-=sizeof(cell);
+    /* store the waiting cells whose locations are now free */
+    while (count>0 && spare[head].memloc>=codesize) {
+      *(cell *)(code+spare[head].memloc)=spare[head].c;
+      head=(head+1) % AMX_COMPACTMARGIN;
+      count--;
+    } /* while */
+    if (memsize>=codesize) {
+      *(cell *)(code+memsize)=(cell)c;
+    } else {
+      int idx;
+      if (count>=AMX_COMPACTMARGIN)
+        return AMX_ERR_FORMAT;
+      idx=(head+count) % AMX_COMPACTMARGIN;
+      spare[idx].memloc=memsize;
+      spare[idx].c=(cell)c;
+      count++;
+    } /* if */
+  } /* while */
+  if (codesize!=0)
+    return AMX_ERR_FORMAT;      /* more cells in the block than in the header */
+  while (count>0) {
+    *(cell *)(code+spare[head].memloc)=spare[head].c;
+    head=(head+1) % AMX_COMPACTMARGIN;
+    count--;
+  } /* while */
+  return AMX_ERR_NONE;
+}
+#endif
+
+/* checksum() is a Fletcher-style checksum on 32-bit words (which is several
+ * times faster than a byte-wise hash)
+ */
+static uint32_t checksum(uint32_t seed,const void *block,size_t size)
+{
+  const unsigned char *ptr=(const unsigned char *)block;
+  uint32_t sum1=seed,sum2=0;
+
+  for ( ; size>=4; size-=4, ptr+=4) {
+    sum1+=(uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+    sum2+=sum1;
+  } /* for */
+  while (size-->0) {
+    sum1+=*ptr++;
+    sum2+=sum1;
+  } /* while */
+  return sum1 ^ (sum2 << 7 | sum2 >> 25);
+}
+
+/* core_signature() identifies the abstract machine cores that can run the
+ * code of a prepared image: the byte order, the set of opcodes, the
+ * superinstructions and the intrinsics must be the same. Cores that relocate
+ * the opcodes to addresses cannot run prepared code, because these addresses
+ * change with every run.
+ */
+static int core_signature(AMX *amx,uint32_t *signature)
+{
+  #if !defined AMX_JIT || defined AMX_ASM || defined AMX_JIT_X64
+    const cell *opcode_list;
+    int max_opcode;
+    uint32_t info[3];
+    #if defined AMX_INTRINSICS
+      int i;
+    #endif
+
+    amx_exec_list(amx,&opcode_list,&max_opcode);
+    #if defined AMX_TOKENTHREADING
+      opcode_list=NULL;
+    #endif
+    if (opcode_list!=NULL)
+      return AMX_ERR_INIT;
+    info[0]=0x01020304;   /* stored in native byte order */
+    info[1]=(uint32_t)max_opcode;
+    info[2]=CUR_FILE_VERSION;
+    *signature=checksum(0,info,sizeof info);
+    #if !defined AMX_NO_SUPERINSTR
+      if (max_opcode>=OP_NUM_OPCODES)
+        *signature=checksum(*signature,superinstr,sizeof superinstr);
+    #endif
+    #if defined AMX_INTRINSICS
+      /* the intrinsics are bound by name */
+      for (i=0; i<NUM_INTRINSICS; i++) {
+        *signature=checksum(*signature,intrinsics[i].name,strlen(intrinsics[i].name));
+        *signature=checksum(*signature,&intrinsics[i].opcode,2*sizeof(unsigned char));
+      } /* for */
+    #endif
+    return AMX_ERR_NONE;
+  #else
+    (void)amx;
+    (void)signature;
+    return AMX_ERR_INIT;
+  #endif
+}
+
+/* UsePrepared() takes the place of VerifyPcode() for a prepared image: it
+ * checks the record in front of the code and sets the fields that
+ * VerifyPcode() would have set. The code itself is not verified again, so
+ * the image must come from a trusted source.
+ */
+static int UsePrepared(AMX *amx)
+{
+  AMX_HEADER *hdr=(AMX_HEADER *)amx->base;
+  const AMX_PREPARED *prep;
+  uint32_t signature;
+
+  if ((amx->flags & AMX_FLAG_JITC)!=0)
+    return AMX_ERR_INIT_JIT;  /* the JIT must browse through the code */
+  if ((hdr->flags & AMX_FLAG_OVERLAY)!=0 || hdr->cod-hdr->nametable<(int32_t)sizeof(AMX_PREPARED))
+    return AMX_ERR_FORMAT;
+  prep=(const AMX_PREPARED *)(amx->base+(int)hdr->cod-sizeof(AMX_PREPARED));
+  if (core_signature(amx,&signature)!=AMX_ERR_NONE || prep->core!=signature)
+    return AMX_ERR_VERSION;   /* prepared for a different core */
+  if (prep->checksum!=checksum(0,amx->code,(size_t)amx->codesize))
+    return AMX_ERR_FORMAT;
+  if ((prep->flags & AMX_FLAG_INTRINSICS)!=0 && (amx->flags & AMX_FLAG_INTRINSICS)==0)
+    return AMX_ERR_INIT;      /* the code has intrinsics, the host did not ask for them */
+
+  amx->sysreq_d=0;
+  #if !defined AMX_DONT_RELOCATE
+    if ((amx->flags & AMX_FLAG_SHARED)==0 && sizeof(AMX_NATIVE)<=sizeof(cell))
+      amx->sysreq_d=(cell)prep->sysreq_d;
+  #endif
+  amx->flags&= ~AMX_FLAG_INTRINSICS;
+  amx->flags|=AMX_FLAG_INIT | (int)(prep->flags & (AMX_FLAG_SYSREQN | AMX_FLAG_INTRINSICS));
+  return AMX_ERR_NONE;
+}
+
 static int VerifyPcode(AMX *amx)
 {
   AMX_HEADER *hdr;
@@ -630,6 +1454,14 @@ static int VerifyPcode(AMX *amx)
     int reloc_count=0;
     int jit_codesize=0;
   #endif
+  #if !defined AMX_NO_SUPERINSTR
+    int fuse;
+    cell prev_op,prev_cip;
+  #endif
+  #if defined AMX_INTRINSICS
+    int intrinsic;
+    cell pushed,constant,numbytes;
+  #endif
 
   assert(amx!=NULL);
   hdr=(AMX_HEADER *)amx->base;
@@ -638,8 +1470,12 @@ static int VerifyPcode(AMX *amx)
   amx->flags|=AMX_FLAG_VERIFY;
   datasize=hdr->hea-hdr->dat;
   stacksize=hdr->stp-hdr->hea;
+  #if defined AMX_GROWABLE
+    if (amx->reserve!=0)
+      stacksize=amx->reserve-datasize;  /* see growinit() */
+  #endif
 
-  #if defined AMX_ASM && defined AMX_JIT
+  #if (defined AMX_ASM || defined AMX_JIT_X64) && defined AMX_JIT
     if ((amx->flags & AMX_FLAG_JITC)!=0)
       jit_codesize=amx_jit_list(amx,&opcode_list,&max_opcode);
     else
@@ -652,6 +1488,10 @@ static int VerifyPcode(AMX *amx)
   #if defined AMX_TOKENTHREADING
     opcode_list=NULL; /* avoid token translation if token threading is in effect */
   #endif
+  if (opcode_list!=NULL && (amx->flags & AMX_FLAG_SHARED)!=0) {
+    amx->flags &= ~AMX_FLAG_VERIFY;
+    return AMX_ERR_INIT;  /* this core must translate the opcodes, it cannot run shared code */
+  } /* if */
   #if defined AMX_NO_PACKED_OPC
     opmask= ~0;
   #else
@@ -687,6 +1527,34 @@ static int VerifyPcode(AMX *amx)
   } /* if */
   amx->sysreq_d=0;      /* preset */
 
+  #if !defined AMX_NO_SUPERINSTR
+    /* superinstructions (and preprocessed case tables) are only created if
+     * the abstract machine core supports them (the JIT and the assembler
+     * cores do not), and if the code block is not shared (writing to it would
+     * give each process a private copy)
+     */
+    fuse=((amx->flags & (AMX_FLAG_JITC | AMX_FLAG_SHARED))==0 && max_opcode>=OP_NUM_OPCODES);
+    prev_op=-1;
+    prev_cip=0;
+  #endif
+  #if defined AMX_INTRINSICS
+    /* intrinsics are created under the same conditions, except that the JIT
+     * for x86-64 gets them too (it inlines them)
+     */
+    #if defined AMX_JIT_X64
+      intrinsic=fuse || (amx->flags & (AMX_FLAG_JITC | AMX_FLAG_SHARED))==AMX_FLAG_JITC;
+    #else
+      intrinsic=fuse;
+    #endif
+    if ((amx->flags & AMX_FLAG_INTRINSICS)==0)
+      intrinsic=0;      /* the host did not ask for them */
+    else if (!intrinsic)
+      amx->flags &= ~AMX_FLAG_INTRINSICS;
+  #else
+    amx->flags &= ~AMX_FLAG_INTRINSICS;
+    pushed=constant=-1;
+  #endif
+
   /* start browsing code */
   assert(amx->code!=NULL);  /* should already have been set in amx_Init() */
   for (cip=0; cip<amx->codesize; ) {
@@ -695,6 +1563,43 @@ static int VerifyPcode(AMX *amx)
       amx->flags &= ~AMX_FLAG_VERIFY;
       return AMX_ERR_INVINSTR;
     } /* if */
+    #if !defined AMX_NO_SUPERINSTR
+      if (fuse) {
+        int fused=superinstruction(prev_op,op);
+        if (fused>=0)
+          *(cell *)(amx->code+(int)prev_cip)=(opcode_list!=NULL) ? opcode_list[fused] : fused;
+        prev_op=op;
+        prev_cip=cip;
+      } /* if */
+    #endif
+    #if defined AMX_INTRINSICS
+      /* the argument count for a SYSREQ is pushed just before it, with PUSH.C
+       * or with CONST.PRI and PUSH.PRI
+       */
+      numbytes=pushed;
+      pushed=-1;
+      tgt=(cip+(cell)sizeof(cell)<amx->codesize) ? *(cell *)(amx->code+(int)cip+sizeof(cell)) : -1;
+      switch (op & opmask) {
+      case OP_PUSH_C:
+        pushed=tgt;
+        break;
+      #if !defined AMX_NO_PACKED_OPC
+        case OP_PUSH_P_C:
+          pushed=op>>(int)(sizeof(cell)*4);
+          break;
+      #endif
+      case OP_PUSH_PRI:
+        pushed=constant;
+        break;
+      } /* switch */
+      constant=-1;
+      if ((op & opmask)==OP_CONST_PRI)
+        constant=tgt;
+      #if !defined AMX_NO_PACKED_OPC
+        else if ((op & opmask)==OP_CONST_P_PRI)
+          constant=op>>(int)(sizeof(cell)*4);
+      #endif
+    #endif
     /* relocate opcode (only works if the size of an opcode is at least
      * as big as the size of a pointer (jump address); so basically we
      * rely on the opcode and a pointer being 32-bit
@@ -800,9 +1705,6 @@ static int VerifyPcode(AMX *amx)
     case OP_ZERO_P_S:
     case OP_EQ_P_C_PRI:
     case OP_EQ_P_C_ALT:
-    case OP_MOVS_P:
-    case OP_CMPS_P:
-    case OP_FILL_P:
     case OP_HALT_P:
     case OP_BOUNDS_P:
       break;
@@ -819,6 +1721,16 @@ static int VerifyPcode(AMX *amx)
       } /* if */
       break;
 
+    case OP_MOVS_P:     /* block instructions with the size packed inside the same cell */
+    case OP_CMPS_P:
+    case OP_FILL_P:
+      GETPARAM_P(tgt,op); /* verify size */
+      if (tgt<0 || tgt>datasize+stacksize) {
+        amx->flags &= ~AMX_FLAG_VERIFY;
+        return AMX_ERR_BOUNDS;
+      } /* if */
+      break;
+
     case OP_LOAD_P_S_PRI: /* stack instructions with 1 parameter packed inside the same cell */
     case OP_LOAD_P_S_ALT:
     case OP_LREF_P_S_PRI:
@@ -860,9 +1772,6 @@ static int VerifyPcode(AMX *amx)
     case OP_HEAP:
     case OP_SHL_C_PRI:
     case OP_SHL_C_ALT:
-    case OP_MOVS:
-    case OP_CMPS:
-    case OP_FILL:
     case OP_HALT:
     case OP_BOUNDS:
 #if !defined AMX_NO_MACRO_INSTR
@@ -898,6 +1807,17 @@ static int VerifyPcode(AMX *amx)
       cip+=sizeof(cell);
       break;
 
+    case OP_MOVS:
+    case OP_CMPS:
+    case OP_FILL:
+      tgt=*(cell*)(amx->code+(int)cip); /* verify size */
+      if (tgt<0 || tgt>datasize+stacksize) {
+        amx->flags &= ~AMX_FLAG_VERIFY;
+        return AMX_ERR_BOUNDS;
+      } /* if */
+      cip+=sizeof(cell);
+      break;
+
     case OP_LOAD_S_PRI:
     case OP_LOAD_S_ALT:
     case OP_LREF_S_PRI:
@@ -988,7 +1908,9 @@ static int VerifyPcode(AMX *amx)
       } /* if */
       #if defined AMX_JIT
         reloc_count++;
-        RELOC_ABS(amx->code, cip);  /* change to absolute physical address */
+        #if !defined AMX_JIT_X64
+          RELOC_ABS(amx->code, cip);  /* change to absolute physical address */
+        #endif
       #endif
       cip+=sizeof(cell);
       break;
@@ -1026,11 +1948,19 @@ static int VerifyPcode(AMX *amx)
 #endif
 
     case OP_SYSREQ:
+      #if defined AMX_INTRINSICS
+        if (intrinsic && cip<amx->codesize)
+          set_intrinsic(amx,opcode_list,cip,numbytes,0);
+      #endif
       cip+=sizeof(cell);
       sysreq_flg|=0x01; /* mark SYSREQ found */
       break;
 #if !defined AMX_NO_MACRO_INSTR
     case OP_SYSREQ_N:
+      #if defined AMX_INTRINSICS
+        if (intrinsic && cip+(cell)sizeof(cell)<amx->codesize)
+          set_intrinsic(amx,opcode_list,cip,*(cell *)(amx->code+(int)cip+sizeof(cell)),1);
+      #endif
       cip+=sizeof(cell)*2;
       sysreq_flg|=0x02; /* mark SYSREQ.N found */
       break;
@@ -1040,6 +1970,11 @@ static int VerifyPcode(AMX *amx)
       cell num,offs;
       int i;
       DBGPARAM(num);    /* number of records follows the opcode */
+      if (num<0 || num>(amx->codesize-cip)/(cell)(2*sizeof(cell))
+          || cip+(2*num+1)*(cell)sizeof(cell)>amx->codesize) {
+        amx->flags &= ~AMX_FLAG_VERIFY;
+        return AMX_ERR_BOUNDS;  /* the table must lie inside the code */
+      } /* if */
       for (i=0; i<=num; i++) {
         offs=cip+2*i*sizeof(cell);
         tgt=*(cell*)(amx->code+(int)offs)+offs-sizeof(cell);
@@ -1048,10 +1983,18 @@ static int VerifyPcode(AMX *amx)
           return AMX_ERR_BOUNDS;
         } /* if */
         #if defined AMX_JIT
-          RELOC_ABS(amx->code, cip+2*i*sizeof(cell));
+          #if !defined AMX_JIT_X64
+            RELOC_ABS(amx->code, cip+2*i*sizeof(cell));
+          #endif
           reloc_count++;
         #endif
       } /* for */
+      #if !defined AMX_NO_SUPERINSTR
+        if (fuse && num>0) {
+          int tblop=casetable((cell *)(amx->code+(int)cip),num);
+          *(cell *)(amx->code+(int)cip-2*sizeof(cell))=(opcode_list!=NULL) ? opcode_list[tblop] : tblop;
+        } /* if */
+      #endif
       cip+=(2*num + 1)*sizeof(cell);
       break;
     } /* case */
@@ -1064,9 +2007,10 @@ static int VerifyPcode(AMX *amx)
 
   #if !defined AMX_DONT_RELOCATE
     /* only either type of system request opcode should be found (otherwise,
-     * we probably have a non-conforming compiler
+     * we probably have a non-conforming compiler; a shared code block is
+     * never patched to direct system requests
      */
-    if ((sysreq_flg==0x01 || sysreq_flg==0x02) && (amx->flags & AMX_FLAG_JITC)==0) {
+    if ((sysreq_flg==0x01 || sysreq_flg==0x02) && (amx->flags & (AMX_FLAG_JITC | AMX_FLAG_SHARED))==0) {
       /* to use direct system requests, a function pointer must fit in a cell;
        * because the native function's address will be stored as the parameter
        * of SYSREQ.(N)D
@@ -1084,8 +2028,21 @@ static int VerifyPcode(AMX *amx)
     /* adjust the code size to mean: estimated code size of the native code
      * (instead of the size of the P-code)
      */
-    amx->codesize=jit_codesize*opcode_count + hdr->cod + (hdr->stp - hdr->dat);
-    amx->reloc_size=2*sizeof(cell)*reloc_count;
+    #if defined AMX_JIT_X64
+      /* the x86-64 JIT also stores a map with a native address for every
+       * cell of P-code, plus a few stubs, in front of the native code; it
+       * does not change the code when the JIT is not used
+       */
+      if ((amx->flags & AMX_FLAG_JITC)!=0) {
+        amx->codesize=jit_codesize*(amx->codesize/sizeof(cell) + 16) + amx->codesize
+                      + hdr->cod + (hdr->stp - hdr->dat) + 64;
+        amx->reloc_size=2*sizeof(cell)*reloc_count;
+      } /* if */
+      (void)opcode_count;
+    #else
+      amx->codesize=jit_codesize*opcode_count + hdr->cod + (hdr->stp - hdr->dat);
+      amx->reloc_size=2*sizeof(cell)*reloc_count;
+    #endif
   #endif
 
   amx->flags &= ~AMX_FLAG_VERIFY;
@@ -1128,7 +2085,7 @@ static int VerifyPcode(AMX *amx)
 int AMXAPI amx_Init(AMX *amx,void *program)
 {
   AMX_HEADER *hdr;
-  int err;
+  int err,prepared;
   uint16_t *namelength;
   unsigned char *data;
 
@@ -1136,11 +2093,24 @@ int AMXAPI amx_Init(AMX *amx,void *program)
     return AMX_ERR_INIT;  /* already initialized (may not do so twice) */
 
   hdr=(AMX_HEADER *)program;
+  /* a prepared image (see amx_GetPrepared()) is already in native byte order
+   * and its code is not verified again; it is therefore only accepted if the
+   * caller has set AMX_FLAG_PREPARED, and the flag is cleared for a plain image
+   */
+  prepared=(hdr->magic==AMX_MAGIC && (hdr->flags & AMX_FLAG_PREPARED)!=0);
+  if (prepared && (amx->flags & AMX_FLAG_PREPARED)==0)
+    return AMX_ERR_FORMAT;
+  if (!prepared)
+    amx->flags &= ~AMX_FLAG_PREPARED;
+
   /* the header is in Little Endian, on a Big Endian machine, swap all
-   * multi-byte words
+   * multi-byte words (including the code, which therefore cannot be shared)
    */
   assert(check_endian());
   #if BYTE_ORDER==BIG_ENDIAN
+  if (!prepared) {
+    if ((amx->flags & AMX_FLAG_SHARED)!=0)
+      return AMX_ERR_INIT;
     amx_Align32((uint32_t*)&hdr->size);
     amx_Align16(&hdr->magic);
     amx_Align16((uint16_t*)&hdr->flags);
@@ -1157,6 +2127,7 @@ int AMXAPI amx_Init(AMX *amx,void *program)
     amx_Align32((uint32_t*)&hdr->tags);
     if (hdr->file_version>=10)
       amx_Align32((uint32_t*)&hdr->overlays);
+  } /* if */
   #endif
 
   if (hdr->magic!=AMX_MAGIC)
@@ -1167,23 +2138,46 @@ int AMXAPI amx_Init(AMX *amx,void *program)
     return AMX_ERR_FORMAT;
   /* check the maximum name length in the separate name table */
   #if BYTE_ORDER==BIG_ENDIAN
-    amx_Align32((uint32_t*)&hdr->nametable);
+    if (!prepared)
+      amx_Align32((uint32_t*)&hdr->nametable);
   #endif
   namelength=(uint16_t*)((unsigned char*)program + (unsigned)hdr->nametable);
-  amx_Align16(namelength);
+  if (!prepared)
+    amx_Align16(namelength);
   if (*namelength>sNAMEMAX)
     return AMX_ERR_FORMAT;
   if (hdr->stp<=0)
     return AMX_ERR_FORMAT;
-  assert(hdr->hea == hdr->size);
+  assert(hdr->hea == hdr->size || (hdr->flags & AMX_FLAG_COMPACT)!=0);
   #if BYTE_ORDER==BIG_ENDIAN
-    if ((hdr->flags & AMX_FLAG_COMPACT)==0) {
+    if ((hdr->flags & AMX_FLAG_COMPACT)==0 && !prepared) {
       ucell *code=(ucell *)((unsigned char *)program+(int)hdr->cod);
       while (code<(ucell *)((unsigned char *)program+(int)hdr->hea))
         amx_SwapCell(code++);
     } /* if */
   #endif
 
+  /* a program in compact encoding holds hdr->size bytes in a block that must
+   * be large enough for the expanded code and data sections (up to hdr->hea);
+   * the expanded cells are in native byte order; in an overlay scheme, the
+   * overlay callback expands every overlay that it loads
+   */
+  if ((hdr->flags & AMX_FLAG_COMPACT)!=0) {
+    #if AMX_COMPACTMARGIN > 2
+      if ((amx->flags & AMX_FLAG_SHARED)!=0)
+        return AMX_ERR_INIT;
+      if ((hdr->flags & AMX_FLAG_OVERLAY)==0) {
+        err=expand((unsigned char *)program+(int)hdr->cod,
+                   (long)(hdr->size-hdr->cod),(long)(hdr->hea-hdr->cod));
+        if (err!=AMX_ERR_NONE)
+          return err;
+        hdr->flags&=~AMX_FLAG_COMPACT;
+      } /* if */
+    #else
+      return AMX_ERR_FORMAT;
+    #endif
+  } /* if */
+
   amx->base=(unsigned char *)program;
 
   /* set initial values */
@@ -1209,8 +2203,16 @@ int AMXAPI amx_Init(AMX *amx,void *program)
   /* to split the data segment off the code segment, the "data" field must
    * be set to a non-NULL value on initialization, before calling amx_Init();
    * you may also need to explicitly initialize the data section with the
-   * contents read from the AMX file
+   * contents read from the AMX file; if the "reserve" field is set as well,
+   * the data block may grow up to that size (see growinit())
    */
+  #if defined AMX_GROWABLE
+    if (amx->reserve!=0 && (err=growinit(amx,hdr))!=AMX_ERR_NONE)
+      return err;
+  #else
+    if (amx->reserve!=0)
+      return AMX_ERR_PARAMS;    /* no support for a growable data block */
+  #endif
   if (amx->data!=NULL) {
     data=amx->data;
     if ((amx->flags & AMX_FLAG_DSEG_INIT)==0 && amx->overlay==NULL)
@@ -1222,14 +2224,14 @@ int AMXAPI amx_Init(AMX *amx,void *program)
   /* Set a zero cell at the top of the stack, which functions
    * as a sentinel for strings.
    */
-  * (cell *)(data+(int)(hdr->stp-hdr->dat-sizeof(cell)))=0;
+  * (cell *)(data+(int)amx->stp)=0;
 
   /* also align all addresses in the public function, public variable,
    * public tag and native function tables --offsets into the name table
    * (if present) must also be swapped.
    */
   #if BYTE_ORDER==BIG_ENDIAN
-  { /* local */
+  if (!prepared) {
     AMX_FUNCSTUB *fs;
     int i,num;
 
@@ -1272,11 +2274,13 @@ int AMXAPI amx_Init(AMX *amx,void *program)
       amx_Align32(&fs->nameofs);
       fs=(AMX_FUNCSTUB*)((unsigned char *)fs+hdr->defsize);
     } /* for */
-  } /* local */
+  } /* if */
   #endif
 
   /* verify P-code and relocate address in the case of the JIT */
-  if ((hdr->flags & AMX_FLAG_OVERLAY)==0) {
+  if (prepared) {
+    err=UsePrepared(amx);
+  } else if ((hdr->flags & AMX_FLAG_OVERLAY)==0) {
     err=VerifyPcode(amx);
   } else {
     int i;
@@ -1346,6 +2350,34 @@ int AMXAPI amx_Init(AMX *amx,void *program)
   return AMX_ERR_NONE;
 }
 
+/* amx_GetPrepared() fills in the record for a prepared image of the program.
+ * A prepared image holds the code as amx_Init() left it, in native byte
+ * order, so that amx_Init() does not need to verify it again. It must be
+ * called directly after amx_Init(), before the program runs (because the
+ * abstract machine may patch the code at run time). The record is stored in
+ * front of the code, see AMX_PREPARED and aux_PrepareProgram().
+ */
+int AMXAPI amx_GetPrepared(AMX *amx,AMX_PREPARED *prep)
+{
+  AMX_HEADER *hdr;
+  int err;
+
+  assert(amx!=NULL);
+  assert(prep!=NULL);
+  if ((amx->flags & AMX_FLAG_INIT)==0)
+    return AMX_ERR_INIT;
+  hdr=(AMX_HEADER *)amx->base;
+  assert(hdr!=NULL && hdr->magic==AMX_MAGIC);
+  if ((amx->flags & (AMX_FLAG_JITC | AMX_FLAG_FROZEN))!=0 || (hdr->flags & AMX_FLAG_OVERLAY)!=0)
+    return AMX_ERR_INIT;  /* the code is no longer P-code, or it is not in memory */
+  if ((err=core_signature(amx,&prep->core))!=AMX_ERR_NONE)
+    return err;
+  prep->checksum=checksum(0,amx->code,(size_t)amx->codesize);
+  prep->sysreq_d=(uint32_t)amx->sysreq_d;
+  prep->flags=(uint32_t)(amx->flags & (AMX_FLAG_SYSREQN | AMX_FLAG_INTRINSICS));
+  return AMX_ERR_NONE;
+}
+
 #if defined AMX_JIT
 
   #define CODESIZE_JIT    8192  /* approximate size of the code for the JIT */
@@ -1409,15 +2441,22 @@ int AMXAPI amx_InitJIT(AMX *amx, void *reloc_table, void *native_code)
    */
   assert(amx->sysreq_d==0);
 
-  if (mprotect(ALIGN(amx_jit_compile), CODESIZE_JIT, PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
-    return AMX_ERR_INIT_JIT;
+  #if !defined AMX_JIT_X64
+    /* the assembler JIT patches its own code, the x86-64 JIT does not */
+    if (mprotect(ALIGN(amx_jit_compile), CODESIZE_JIT, PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
+      return AMX_ERR_INIT_JIT;
+  #endif
 
   /* MP: added check for correct compilation */
   if ((res = amx_jit_compile(amx->base, reloc_table, native_code)) == 0) {
     /* update the required memory size (the previous value was a
      * conservative estimate, now we know the exact size)
      */
-    amx->codesize = (hdr->dat + hdr->stp + sizeof(cell)) & ~(sizeof(cell)-1);
+    #if defined AMX_JIT_X64
+      amx->codesize = hdr->stp;   /* the data, stack and heap follow the code */
+    #else
+      amx->codesize = (hdr->dat + hdr->stp + sizeof(cell)) & ~(sizeof(cell)-1);
+    #endif
     /* The compiled code is relocatable, since only relative jumps are
      * used for destinations within the generated code, and absolute
      * addresses are only for jumps into the runtime, which is fixed
@@ -1506,15 +2545,196 @@ int AMXAPI amx_Cleanup(AMX *amx)
   #else
     (void)amx;
   #endif
+
+  #if defined AMX_GUARDPAGES
+    /* make the guard page accessible again, before the host frees the block */
+    if (amx->guardsize!=0) {
+      AMX_HEADER *ghdr=(AMX_HEADER *)amx->base;
+      unsigned char *data=(amx->data!=NULL) ? amx->data : amx->base+(int)ghdr->dat;
+      mprotect(data+(int)amx->guard,(size_t)amx->guardsize,PROT_READ | PROT_WRITE);
+      amx->guardsize=0;
+    } /* if */
+  #endif
   return AMX_ERR_NONE;
 }
 #endif /* AMX_CLEANUP */
 
+#if defined AMX_REGISTER || defined AMX_XXXPUBLICS || defined AMX_XXXPUBVARS
+/* FNV-1a hash of a name, for the native function registry and the name index */
+static uint32_t namehash(const char *name)
+{
+  uint32_t hash=2166136261u;
+  while (*name!='\0')
+    hash=(hash ^ (unsigned char)*name++) * 16777619u;
+  return hash;
+}
+#endif
+
+#if defined AMX_XXXPUBLICS || defined AMX_XXXPUBVARS
+/* The name index holds a hash table for the public functions, followed by one
+ * for the public variables. A slot holds the entry number plus 1, or 0 if it
+ * is empty. Each table has at least twice as many slots as there are entries.
+ */
+typedef struct tagAMX_NAMEINDEX {
+  unsigned char _FAR *base; /* image that the index was built for, NULL if not yet built */
+  int pubmask;              /* number of slots for the public functions, minus 1 */
+  int varmask;              /* number of slots for the public variables, minus 1 */
+} AMX_NAMEINDEX;
+
+static int indexslots(int count)
+{
+  int size=1;
+  while (size<2*count)
+    size*=2;
+  return size;
+}
+
+static void indexbuild(AMX_HEADER *hdr, int *slots, int mask, unsigned table, int count)
+{
+  AMX_FUNCSTUB *entry;
+  int i,idx;
+
+  memset(slots,0,(mask+1)*sizeof(int));
+  for (i=0; i<count; i++) {
+    entry=(AMX_FUNCSTUB *)((unsigned char*)hdr + table + (unsigned)i*hdr->defsize);
+    idx=(int)(namehash(GETENTRYNAME(hdr,entry)) & mask);
+    while (slots[idx]!=0)
+      idx=(idx+1) & mask;
+    slots[idx]=i+1;
+  } /* for */
+}
+
+/* indexlookup() returns the entry number of the name, or -1 if it is absent */
+static int indexlookup(AMX_HEADER *hdr, const int *slots, int mask, unsigned table, const char *name)
+{
+  AMX_FUNCSTUB *entry;
+  int idx;
+
+  idx=(int)(namehash(name) & mask);
+  while (slots[idx]!=0) {
+    entry=(AMX_FUNCSTUB *)((unsigned char*)hdr + table + (unsigned)(slots[idx]-1)*hdr->defsize);
+    if (strcmp(GETENTRYNAME(hdr,entry),name)==0)
+      return slots[idx]-1;
+    idx=(idx+1) & mask;
+  } /* while */
+  return -1;
+}
+
+/* getindex() returns the name index of the abstract machine; it returns NULL
+ * if the abstract machine has no name index, or if the index was built for
+ * another image. The index is only read here (it is built by amx_SetIndex()),
+ * so clones in other threads may use it at the same time.
+ */
+static AMX_NAMEINDEX *getindex(AMX *amx)
+{
+  AMX_NAMEINDEX *index=(AMX_NAMEINDEX *)amx->nameindex;
+
+  if (index!=NULL && index->base!=amx->base)
+    return NULL;
+  return index;
+}
+
+/* amx_IndexSize() returns the size in bytes of the buffer for the name index
+ * of the script.
+ */
+int AMXAPI amx_IndexSize(AMX *amx, long *size)
+{
+  AMX_HEADER *hdr;
+
+  assert(amx!=NULL);
+  if (size==NULL)
+    return AMX_ERR_PARAMS;
+  hdr=(AMX_HEADER *)amx->base;
+  if (hdr==NULL || hdr->magic!=AMX_MAGIC)
+    return AMX_ERR_FORMAT;
+  *size=(long)sizeof(AMX_NAMEINDEX)
+        + (long)(indexslots((int)NUMENTRIES(hdr,publics,natives))
+                 + indexslots((int)NUMENTRIES(hdr,pubvars,tags)))*(long)sizeof(int);
+  return AMX_ERR_NONE;
+}
+
+/* amx_SetIndex() attaches a buffer of amx_IndexSize() bytes to the abstract
+ * machine, for a hash index on the names of the public functions and public
+ * variables; amx_FindPublic() and amx_FindPubVar() then no longer need a
+ * binary search. The index is built here, and clones made with amx_Clone()
+ * share it (read-only). Pass NULL to remove the index.
+ */
+int AMXAPI amx_SetIndex(AMX *amx, void *buffer)
+{
+  AMX_NAMEINDEX *index=(AMX_NAMEINDEX *)buffer;
+  AMX_HEADER *hdr;
+  int *slots;
+
+  assert(amx!=NULL);
+  if (index!=NULL) {
+    hdr=(AMX_HEADER *)amx->base;
+    if (hdr==NULL || hdr->magic!=AMX_MAGIC)
+      return AMX_ERR_FORMAT;
+    index->pubmask=indexslots((int)NUMENTRIES(hdr,publics,natives))-1;
+    index->varmask=indexslots((int)NUMENTRIES(hdr,pubvars,tags))-1;
+    slots=(int *)(index+1);
+    indexbuild(hdr,slots,index->pubmask,(unsigned)hdr->publics,(int)NUMENTRIES(hdr,publics,natives));
+    indexbuild(hdr,slots+index->pubmask+1,index->varmask,(unsigned)hdr->pubvars,(int)NUMENTRIES(hdr,pubvars,tags));
+    index->base=amx->base;
+  } /* if */
+  amx->nameindex=index;
+  return AMX_ERR_NONE;
+}
+
+/* A handle may be shared by clones that run in different threads. The index is
+ * stored before the image pointer, and the image pointer is read before the
+ * index (release and acquire), so a thread that finds its own image in the
+ * handle also finds the index that goes with it. Threads that resolve the
+ * handle for the same image at the same time all store the same values.
+ */
+#if (defined __GNUC__ && (__GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=7))) || defined __clang__
+  #define handle_loadbase(h)      __atomic_load_n(&(h)->base,__ATOMIC_ACQUIRE)
+  #define handle_storebase(h,b)   __atomic_store_n(&(h)->base,(b),__ATOMIC_RELEASE)
+  #define handle_loadindex(h)     __atomic_load_n(&(h)->index,__ATOMIC_RELAXED)
+  #define handle_storeindex(h,i)  __atomic_store_n(&(h)->index,(i),__ATOMIC_RELAXED)
+#else
+  /* volatile accesses are not reordered by the compiler; on x86 (the target
+   * of the other compilers that build multi-threaded hosts), the processor
+   * keeps stores and loads in order, too
+   */
+  #define handle_loadbase(h)      (*(unsigned char _FAR * volatile *)&(h)->base)
+  #define handle_storebase(h,b)   (*(unsigned char _FAR * volatile *)&(h)->base=(b))
+  #define handle_loadindex(h)     (*(volatile int *)&(h)->index)
+  #define handle_storeindex(h,i)  (*(volatile int *)&(h)->index=(i))
+#endif
+
+/* handle_get() returns the cached index, or INT_MIN if the handle was not yet
+ * resolved for this image
+ */
+static int handle_get(AMX_HANDLE *handle, unsigned char _FAR *base)
+{
+  if (handle_loadbase(handle)!=base)
+    return INT_MIN;
+  return handle_loadindex(handle);
+}
+
+static void handle_set(AMX_HANDLE *handle, unsigned char _FAR *base, int index)
+{
+  handle_storeindex(handle,index);
+  handle_storebase(handle,base);
+}
+#endif /* AMX_XXXPUBLICS || AMX_XXXPUBVARS */
+
 #if defined AMX_CLONE
+/* amx_Clone() copies the data section into the data block, unless the flag
+ * AMX_FLAG_DSEG_INIT is set in amxClone->flags on entry (as for amx_Init());
+ * the block must then already hold the data section and the zero cell at the
+ * top of the stack. As with amx_Init(), the data block is growable if
+ * amxClone->reserve is set on entry.
+ */
 int AMXAPI amx_Clone(AMX *amxClone, AMX *amxSource, void *data)
 {
   AMX_HEADER *hdr;
   unsigned char _FAR *dataSource;
+  int dseg_init;
+  #if defined AMX_GROWABLE
+    int err;
+  #endif
 
   if (amxSource==NULL)
     return AMX_ERR_FORMAT;
@@ -1529,6 +2749,7 @@ int AMXAPI amx_Clone(AMX *amxClone, AMX *amxSource, void *data)
     return AMX_ERR_VERSION;
 
   /* set initial values */
+  dseg_init=(amxClone->flags & AMX_FLAG_DSEG_INIT)!=0;
   amxClone->base=amxSource->base;
   amxClone->code=amxSource->code;
   amxClone->codesize=amxSource->codesize;
@@ -1540,19 +2761,185 @@ int AMXAPI amx_Clone(AMX *amxClone, AMX *amxSource, void *data)
     amxClone->callback=amxSource->callback;
   if (amxClone->debug==NULL)
     amxClone->debug=amxSource->debug;
-  amxClone->flags=amxSource->flags;
+  amxClone->flags=amxSource->flags & ~AMX_FLAG_FUEL; /* the clone has its own budget */
+  amxClone->guard=amxClone->guardsize=0;  /* see amx_SetGuard() and growinit() */
+  #if defined AMX_XXXPUBLICS || defined AMX_XXXPUBVARS
+    /* the name index was built by amx_SetIndex() and is only read */
+    if (amxClone->nameindex==NULL)
+      amxClone->nameindex=amxSource->nameindex;
+  #endif
+  if (amxClone->natives==NULL && amxClone->callback==amxSource->callback)
+    amxClone->natives=amxSource->natives;
 
   /* copy the data segment; the stack and the heap can be left uninitialized */
   assert(data!=NULL);
   amxClone->data=(unsigned char _FAR *)data;
-  dataSource=(amxSource->data!=NULL) ? amxSource->data : amxSource->base+(int)hdr->dat;
-  memcpy(amxClone->data,dataSource,(size_t)(hdr->hea-hdr->dat));
+  #if defined AMX_GROWABLE
+    if (amxClone->reserve!=0 && (err=growinit(amxClone,hdr))!=AMX_ERR_NONE)
+      return err;
+  #else
+    if (amxClone->reserve!=0)
+      return AMX_ERR_PARAMS;    /* no support for a growable data block */
+  #endif
+  if (!dseg_init) {
+    dataSource=(amxSource->data!=NULL) ? amxSource->data : amxSource->base+(int)hdr->dat;
+    memcpy(amxClone->data,dataSource,(size_t)(hdr->hea-hdr->dat));
 
-  /* Set a zero cell at the top of the stack, which functions
-   * as a sentinel for strings.
-   */
-  * (cell *)(amxClone->data+(int)amxClone->stp) = 0;
+    /* Set a zero cell at the top of the stack, which functions
+     * as a sentinel for strings.
+     */
+    * (cell *)(amxClone->data+(int)amxClone->stp) = 0;
+  } /* if */
+
+  return AMX_ERR_NONE;
+}
+
+/* The number of parameters for every opcode, in the numbering of the P-code
+ * file; -1 for the instructions with a variable number of parameters.
+ */
+static const signed char opcode_params[] = {
+  /*   0 */  0, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+  /*  16 */  0, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 1, 1, 1, 0, 0,
+  /*  32 */  0, 1, 1, 1, 1, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0,
+  /*  48 */  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  /*  64 */  1, 1, 1, 1, 1, 1, 1, 0, 0, 0,-1, 1, 2, 1, 0, 1,
+  /*  80 */ -1, 0, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  /*  96 */  1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+  /* 112 */  2,-1,-1,-1,-1,-1,-1,-1, 2, 2, 2, 2, 0, 0, 0, 0,
+  /* 128 */  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  /* 144 */  0, 0, 0, 0, 0,-1,-1,-1,-1,-1,-1,-1, 0, 0, 0, 0,
+  /* 160 */  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* amx_Freeze() binds all native functions and makes sure that amx_Exec()
+ * no longer modifies the code block. After this call, the abstract machine
+ * can be cloned, and the clones may run concurrently in separate threads
+ * (each on its own data block), without locking.
+ *
+ * All native functions must have been registered. The SYSREQ instructions
+ * are replaced by direct calls here (instead of at the first call, see
+ * amx_Callback()), but only if the default callback is in use.
+ */
+int AMXAPI amx_Freeze(AMX *amx)
+{
+  AMX_HEADER *hdr;
+  AMX_FUNCSTUB *func;
+  int i,numnatives;
+
+  if (amx==NULL)
+    return AMX_ERR_FORMAT;
+  if ((amx->flags & AMX_FLAG_INIT)==0)
+    return AMX_ERR_INIT;
+  hdr=(AMX_HEADER *)amx->base;
+  assert(hdr!=NULL && hdr->magic==AMX_MAGIC);
+  if ((hdr->flags & AMX_FLAG_OVERLAY)!=0)
+    return AMX_ERR_OVERLAY;     /* overlays are loaded into the code block at run time */
+
+  /* verify that all native functions have been registered */
+  assert(hdr->natives<=hdr->libraries);
+  numnatives=NUMENTRIES(hdr,natives,libraries);
+  func=GETENTRY(hdr,natives,0);
+  for (i=0; i<numnatives && func->address!=0; i++)
+    func=(AMX_FUNCSTUB*)((unsigned char*)func+hdr->defsize);
+  if (i<numnatives)
+    return AMX_ERR_NOTFOUND;
+  amx->flags|=AMX_FLAG_NTVREG;
+
+  #if defined AMX_DEFCALLBACK && (!defined AMX_JIT || defined AMX_ASM || defined AMX_JIT_X64)
+    if (amx->sysreq_d!=0 && amx->callback==amx_Callback) {
+      const cell *opcode_list;
+      int max_opcode,sysreq_op;
+      cell cip,op,num;
+
+      assert((amx->flags & AMX_FLAG_JITC)==0);
+      amx_exec_list(amx,&opcode_list,&max_opcode);
+      #if defined AMX_TOKENTHREADING
+        opcode_list=NULL;
+      #endif
+      sysreq_op=(amx->flags & AMX_FLAG_SYSREQN) ? OP_SYSREQ_N : OP_SYSREQ;
+      for (cip=0; cip<amx->codesize; ) {
+        op=*(cell *)(amx->code+(int)cip);
+        if (opcode_list!=NULL) {
+          /* the opcodes were relocated in VerifyPcode(), look them up */
+          for (i=0; i<max_opcode && opcode_list[i]!=op; i++)
+            /* nothing */;
+          assert(i<max_opcode);
+          op=i;
+        } else {
+          #if !defined AMX_NO_PACKED_OPC
+            op&=(1 << sizeof(cell)*4)-1;
+          #endif
+        } /* if */
+        #if !defined AMX_NO_SUPERINSTR
+          if (op>=OP_FLOAT) {
+            /* an intrinsic has the size of the SYSREQ(.N) that it replaced,
+             * see set_intrinsic()
+             */
+            cip+=((*(cell *)(amx->code+(int)cip+sizeof(cell))==0) ? 2 : 3)*sizeof(cell);
+            continue;
+          } /* if */
+          if (op==OP_CASETBL_DENSE || op==OP_CASETBL_SORTED) {
+            op=OP_CASETBL;  /* the size of a case table does not change */
+          } else if (op>=OP_LOAD_S_PUSH) {
+            /* a superinstruction is followed by the opcode of its second
+             * instruction, so only skip the parameters of the first one
+             */
+            for (i=0; superinstr[i].fused!=op; i++)
+              /* nothing */;
+            op=superinstr[i].first;
+          } /* if */
+        #endif
+        assert(op>=0 && op<(cell)(sizeof opcode_params / sizeof opcode_params[0]));
+        if (op==sysreq_op) {
+          cell *params=(cell *)(amx->code+(int)cip)+1;
+          AMX_NATIVE f;
+          #if defined AMX_NATIVETABLE
+            if (*params<0)
+              f=(AMX_NATIVETABLE)[-(*params+1)];
+            else
+          #endif
+          {
+            assert(*params>=0 && *params<numnatives);
+            func=GETENTRY(hdr,natives,*params);
+            f=NATIVEADDR(func->address,func->nameofs);
+          }
+          assert(f!=NULL);
+          *params=(cell)(intptr_t)f;
+          *(cell *)(amx->code+(int)cip)=amx->sysreq_d;
+        } /* if */
+        cip+=sizeof(cell);
+        switch (op) {
+        case OP_CASETBL:
+        case OP_CASETBL_OVL:
+          num=*(cell *)(amx->code+(int)cip);
+          cip+=(2*num + 1)*sizeof(cell);
+          break;
+        #if !defined AMX_NO_PACKED_OPC
+          case OP_PUSHM_P_C:
+          case OP_PUSHM_P:
+          case OP_PUSHM_P_S:
+          case OP_PUSHM_P_ADR:
+          case OP_PUSHRM_P_C:
+          case OP_PUSHRM_P_S:
+          case OP_PUSHRM_P_ADR:
+            num=(cell)((ucell)*(cell *)(amx->code+(int)cip-sizeof(cell)) >> (int)(sizeof(cell)*4));
+            cip+=num*sizeof(cell);
+            break;
+        #endif
+        default:
+          if (opcode_params[op]<0) {
+            num=*(cell *)(amx->code+(int)cip);  /* PUSHM and variants */
+            cip+=(num + 1)*sizeof(cell);
+          } else {
+            cip+=opcode_params[op]*sizeof(cell);
+          } /* if */
+        } /* switch */
+      } /* for */
+    } /* if */
+  #endif
 
+  amx->sysreq_d=0;      /* amx_Callback() must no longer patch the code */
+  amx->flags|=AMX_FLAG_FROZEN;
   return AMX_ERR_NONE;
 }
 #endif /* AMX_CLONE */
@@ -1675,33 +3062,68 @@ int AMXAPI amx_GetPublic(AMX *amx, int index, char *name, ucell *address)
   return AMX_ERR_NONE;
 }
 
-int AMXAPI amx_FindPublic(AMX *amx, const char *name, int *index)
+static int findpublic(AMX *amx, const char *name)
 {
+  AMX_HEADER *hdr;
+  AMX_NAMEINDEX *nameindex;
   int first,last,result;
-  char pname[sNAMEMAX+1];
 
-  amx_NumPublics(amx, &last);
-  last--;       /* last valid index is 1 less than the number of functions */
+  hdr=(AMX_HEADER *)amx->base;
+  assert(hdr!=NULL);
+  assert(hdr->magic==AMX_MAGIC);
+  if ((nameindex=getindex(amx))!=NULL)
+    return indexlookup(hdr,(int *)(nameindex+1),nameindex->pubmask,(unsigned)hdr->publics,name);
+
+  last=(int)NUMENTRIES(hdr,publics,natives)-1;
   first=0;
-  /* binary search */
+  /* binary search, comparing against the name table in place */
   while (first<=last) {
     int mid=(first+last)/2;
-    amx_GetPublic(amx,mid,pname,NULL);
-    result=strcmp(pname,name);
-    if (result>0) {
+    result=strcmp(GETENTRYNAME(hdr,GETENTRY(hdr,publics,mid)),name);
+    if (result>0)
       last=mid-1;
-    } else if (result<0) {
+    else if (result<0)
       first=mid+1;
-    } else {
-      *index=mid;
-      return AMX_ERR_NONE;
-    } /* if */
+    else
+      return mid;
   } /* while */
-  /* not found, set to an invalid index, so amx_Exec() on this index will fail
-   * with an error
-   */
-  *index=INT_MAX;
-  return AMX_ERR_NOTFOUND;
+  return -1;
+}
+
+int AMXAPI amx_FindPublic(AMX *amx, const char *name, int *index)
+{
+  int result=findpublic(amx,name);
+  if (result<0) {
+    /* not found, set to an invalid index, so amx_Exec() on this index will
+     * fail with an error
+     */
+    *index=INT_MAX;
+    return AMX_ERR_NOTFOUND;
+  } /* if */
+  *index=result;
+  return AMX_ERR_NONE;
+}
+
+/* amx_ResolvePublic() is amx_FindPublic() on a handle; the look-up is done
+ * only on the first call (a failed look-up is cached as well).
+ */
+int AMXAPI amx_ResolvePublic(AMX *amx, AMX_HANDLE *handle, int *index)
+{
+  int result;
+
+  assert(amx!=NULL);
+  if (handle==NULL || handle->name==NULL)
+    return AMX_ERR_PARAMS;
+  if ((result=handle_get(handle,amx->base))==INT_MIN) {
+    result=findpublic(amx,handle->name);
+    handle_set(handle,amx->base,result);
+  } /* if */
+  if (result<0) {
+    *index=INT_MAX;
+    return AMX_ERR_NOTFOUND;
+  } /* if */
+  *index=result;
+  return AMX_ERR_NONE;
 }
 #endif /* AMX_XXXPUBLICS */
 
@@ -1741,30 +3163,78 @@ int AMXAPI amx_GetPubVar(AMX *amx, int index, char *name, cell **address)
   return AMX_ERR_NONE;
 }
 
-int AMXAPI amx_FindPubVar(AMX *amx, const char *name, cell **address)
+static int findpubvar(AMX *amx, const char *name)
 {
+  AMX_HEADER *hdr;
+  AMX_NAMEINDEX *nameindex;
   int first,last,result;
-  char pname[sNAMEMAX+1];
 
-  amx_NumPubVars(amx,&last);
-  last--;       /* last valid index is 1 less than the number of functions */
+  hdr=(AMX_HEADER *)amx->base;
+  assert(hdr!=NULL);
+  assert(hdr->magic==AMX_MAGIC);
+  if ((nameindex=getindex(amx))!=NULL)
+    return indexlookup(hdr,(int *)(nameindex+1)+nameindex->pubmask+1,nameindex->varmask,(unsigned)hdr->pubvars,name);
+
+  last=(int)NUMENTRIES(hdr,pubvars,tags)-1;
   first=0;
-  /* binary search */
+  /* binary search, comparing against the name table in place */
   while (first<=last) {
     int mid=(first+last)/2;
-    amx_GetPubVar(amx,mid,pname,address);
-    result=strcmp(pname,name);
+    result=strcmp(GETENTRYNAME(hdr,GETENTRY(hdr,pubvars,mid)),name);
     if (result>0)
       last=mid-1;
     else if (result<0)
       first=mid+1;
     else
-      return AMX_ERR_NONE;
+      return mid;
   } /* while */
-  /* not found */
+  return -1;
+}
+
+static cell *pubvaraddress(AMX *amx, int index)
+{
+  AMX_HEADER *hdr=(AMX_HEADER *)amx->base;
+  AMX_FUNCSTUB *var=GETENTRY(hdr,pubvars,index);
+  unsigned char *data=(amx->data!=NULL) ? amx->data : amx->base+(int)hdr->dat;
+  return (cell *)(data+(int)var->address);
+}
+
+int AMXAPI amx_FindPubVar(AMX *amx, const char *name, cell **address)
+{
+  int index;
+
+  assert(amx!=NULL);
   assert(address!=NULL);
-  *address=NULL;
-  return AMX_ERR_NOTFOUND;
+  if ((index=findpubvar(amx,name))<0) {
+    *address=NULL;
+    return AMX_ERR_NOTFOUND;
+  } /* if */
+  *address=pubvaraddress(amx,index);
+  return AMX_ERR_NONE;
+}
+
+/* amx_ResolvePubVar() is amx_FindPubVar() on a handle; the handle is shared
+ * by all clones of a script, and each clone gets the address of the variable
+ * in its own data section.
+ */
+int AMXAPI amx_ResolvePubVar(AMX *amx, AMX_HANDLE *handle, cell **address)
+{
+  int result;
+
+  assert(amx!=NULL);
+  assert(address!=NULL);
+  if (handle==NULL || handle->name==NULL)
+    return AMX_ERR_PARAMS;
+  if ((result=handle_get(handle,amx->base))==INT_MIN) {
+    result=findpubvar(amx,handle->name);
+    handle_set(handle,amx->base,result);
+  } /* if */
+  if (result<0) {
+    *address=NULL;
+    return AMX_ERR_NOTFOUND;
+  } /* if */
+  *address=pubvaraddress(amx,result);
+  return AMX_ERR_NONE;
 }
 #endif /* AMX_XXXPUBVARS */
 
@@ -1908,6 +3378,7 @@ static AMX_NATIVE findfunction(char *name, const AMX_NATIVE_INFO *list, int numb
   return NULL;
 }
 
+
 int AMXAPI amx_Register(AMX *amx, const AMX_NATIVE_INFO *list, int number)
 {
   AMX_FUNCSTUB *func;
@@ -1929,6 +3400,96 @@ int AMXAPI amx_Register(AMX *amx, const AMX_NATIVE_INFO *list, int number)
       /* this function is not yet located */
       funcptr=(list!=NULL) ? findfunction(GETENTRYNAME(hdr,func),list,number) : NULL;
       if (funcptr!=NULL) {
+
+        func->address=(uint32_t)(intptr_t)funcptr;
+        #if defined _I64_MAX || defined __x86_64__ || defined HAVE_I64
+          /* for 64-bit version the high part of the pointer must be stored too */
+          func->nameofs=(uint32_t)((intptr_t)funcptr >> 32);
+        #endif
+      } else {
+        err=AMX_ERR_NOTFOUND;
+      }
+    } /* if */
+    func=(AMX_FUNCSTUB*)((unsigned char*)func+hdr->defsize);
+  } /* for */
+  if (err==AMX_ERR_NONE)
+    amx->flags|=AMX_FLAG_NTVREG;
+  return err;
+}
+
+/* amx_InitRegistry() sets up an empty registry in the table of slots that
+ * the caller provides; "size" must be a power of 2, and the registry holds up
+ * to 3/4 of "size" native functions.
+ */
+int AMXAPI amx_InitRegistry(AMX_REGISTRY *registry, const AMX_NATIVE_INFO **slots, int size)
+{
+  int i;
+
+  if (registry==NULL || slots==NULL || size<=0 || (size & (size-1))!=0)
+    return AMX_ERR_PARAMS;
+  for (i=0; i<size; i++)
+    slots[i]=NULL;
+  registry->slots=slots;
+  registry->size=size;
+  registry->count=0;
+  return AMX_ERR_NONE;
+}
+
+/* amx_AddNatives() adds the functions in the list to the registry; as with
+ * amx_Register(), "number" may be -1 for a list that ends with a NULL name.
+ * When a name was already added, the first function stays in effect.
+ */
+int AMXAPI amx_AddNatives(AMX_REGISTRY *registry, const AMX_NATIVE_INFO *list, int number)
+{
+  int i,idx;
+
+  if (registry==NULL || list==NULL)
+    return AMX_ERR_PARAMS;
+  for (i=0; (i<number || number==-1) && list[i].name!=NULL; i++) {
+    idx=(int)(namehash(list[i].name) & (registry->size-1));
+    while (registry->slots[idx]!=NULL && strcmp(registry->slots[idx]->name,list[i].name)!=0)
+      idx=(idx+1) & (registry->size-1);
+    if (registry->slots[idx]==NULL) {
+      if (registry->count>=registry->size-registry->size/4)
+        return AMX_ERR_MEMORY;  /* registry is full */
+      registry->slots[idx]=&list[i];
+      registry->count++;
+    } /* if */
+  } /* for */
+  return AMX_ERR_NONE;
+}
+
+/* amx_RegisterAll() binds all (not yet registered) native functions of the
+ * script from the registry. The registry is not modified, so it can be
+ * shared by many scripts.
+ */
+int AMXAPI amx_RegisterAll(AMX *amx, const AMX_REGISTRY *registry)
+{
+  AMX_FUNCSTUB *func;
+  AMX_HEADER *hdr;
+  int i,idx,numnatives,err;
+  const char *name;
+
+  assert(amx!=NULL);
+  if (registry==NULL || registry->slots==NULL)
+    return AMX_ERR_PARAMS;
+  hdr=(AMX_HEADER *)amx->base;
+  assert(hdr!=NULL);
+  assert(hdr->magic==AMX_MAGIC);
+  assert(hdr->natives<=hdr->libraries);
+  numnatives=NUMENTRIES(hdr,natives,libraries);
+
+  err=AMX_ERR_NONE;
+  func=GETENTRY(hdr,natives,0);
+  for (i=0; i<numnatives; i++) {
+    if (func->address==0) {
+      name=GETENTRYNAME(hdr,func);
+      idx=(int)(namehash(name) & (registry->size-1));
+      while (registry->slots[idx]!=NULL && strcmp(registry->slots[idx]->name,name)!=0)
+        idx=(idx+1) & (registry->size-1);
+      if (registry->slots[idx]!=NULL) {
+        AMX_NATIVE funcptr=registry->slots[idx]->func;
+
         func->address=(uint32_t)(intptr_t)funcptr;
         #if defined _I64_MAX || defined __x86_64__ || defined HAVE_I64
           /* for 64-bit version the high part of the pointer must be stored too */
@@ -1944,6 +3505,43 @@ int AMXAPI amx_Register(AMX *amx, const AMX_NATIVE_INFO *list, int number)
     amx->flags|=AMX_FLAG_NTVREG;
   return err;
 }
+
+#if defined AMX_DEFCALLBACK
+/* amx_SetNatives() fills a table of amx_NumNatives() function pointers with
+ * the registered native functions, and attaches it to the abstract machine;
+ * SYSREQ then calls a native function through this table, instead of going
+ * through the callback (and patching the code). All native functions must be
+ * registered, and the default callback must be in use; amx_SetCallback()
+ * with another callback removes the table. Clones made with amx_Clone() share
+ * the table. Pass NULL to remove the table.
+ */
+int AMXAPI amx_SetNatives(AMX *amx, AMX_NATIVE *table)
+{
+  AMX_FUNCSTUB *func;
+  AMX_HEADER *hdr;
+  int i,numnatives;
+
+  assert(amx!=NULL);
+  if (table!=NULL) {
+    hdr=(AMX_HEADER *)amx->base;
+    if (hdr==NULL || hdr->magic!=AMX_MAGIC)
+      return AMX_ERR_FORMAT;
+    if (amx->callback!=amx_Callback)
+      return AMX_ERR_CALLBACK;
+    assert(hdr->natives<=hdr->libraries);
+    numnatives=NUMENTRIES(hdr,natives,libraries);
+    func=GETENTRY(hdr,natives,0);
+    for (i=0; i<numnatives; i++) {
+      if (func->address==0)
+        return AMX_ERR_NOTFOUND;
+      table[i]=NATIVEADDR(func->address,func->nameofs);
+      func=(AMX_FUNCSTUB*)((unsigned char*)func+hdr->defsize);
+    } /* for */
+  } /* if */
+  amx->natives=table;
+  return AMX_ERR_NONE;
+}
+#endif
 #endif /* AMX_REGISTER */
 
 #if defined AMX_NATIVEINFO
@@ -1958,6 +3556,26 @@ AMX_NATIVE_INFO * AMXAPI amx_NativeInfo(const char *name, AMX_NATIVE func)
 
 
 #define STKMARGIN       ((cell)(16*sizeof(cell)))
+#if defined AMX_GUARDPAGES
+  /* the heap grows up to the guard page and the stack grows down to it;
+   * between two checks, the stack may only move by a few cells, so that an
+   * overflow runs into the guard page (see amx_SetGuard()); the JIT runs
+   * without guard pages
+   */
+  #define STKOVERFLOW(amx,hea,stk)  ((amx)->guardsize!=0 ? ((hea)>(amx)->guard || (stk)<(amx)->guard+(amx)->guardsize) \
+                                                         : ((hea)+STKMARGIN>(stk)))
+#elif defined AMX_GROWABLE
+  /* in a growable data block, the memory between "guard" and "guard+guardsize"
+   * is not committed; when the heap or the stack (with its margin) runs into
+   * it, amx_Grow() commits more memory, and only if that fails is there an
+   * overflow
+   */
+  #define STKOVERFLOW(amx,hea,stk)  ((amx)->guardsize!=0 ? (((hea)>(amx)->guard || (stk)-STKMARGIN<(amx)->guard+(amx)->guardsize) \
+                                                            && amx_Grow((amx),(hea),(stk))!=AMX_ERR_NONE) \
+                                                         : ((hea)+STKMARGIN>(stk)))
+#else
+  #define STKOVERFLOW(amx,hea,stk)  ((hea)+STKMARGIN>(stk))
+#endif
 
 #if defined AMX_PUSHXXX
 
@@ -1966,7 +3584,7 @@ int AMXAPI amx_Push(AMX *amx, cell value)
   AMX_HEADER *hdr;
   unsigned char *data;
 
-  if (amx->hea+STKMARGIN>amx->stk)
+  if (STKOVERFLOW(amx,amx->hea,amx->stk-(cell)sizeof(cell)))
     return AMX_ERR_STACKERR;
   hdr=(AMX_HEADER *)amx->base;
   data=(amx->data!=NULL) ? amx->data : amx->base+(int)hdr->dat;
@@ -2085,10 +3703,32 @@ int AMXAPI amx_PushString(AMX *amx, cell **address, const char *string, int pack
 #if !defined SKIPPARAM
   #define SKIPPARAM(n)  ( cip=(cell *)cip+(n) ) /* for obsolete opcodes */
 #endif
+#if !defined SKIPOPCODE
+  #define SKIPOPCODE()  ( cip=(cell *)cip+1 )   /* for superinstructions */
+#endif
 
 #define AMXPUSH(v)      ( amx->stk-=sizeof(cell), *(cell*)(data+amx->stk)=(v) )
 #define ABORT(amx,v)    { (amx)->stk=reset_stk; (amx)->hea=reset_hea; return v; }
 
+/* SYSREQ calls the native function through the table of amx_SetNatives() if
+ * there is one (a negative index is for AMX_NATIVETABLE), and through the
+ * callback otherwise; either way, the result is the error code
+ */
+#define CALLNATIVE(amx,index,result,params) \
+        (((amx)->natives!=NULL && (index)>=0) \
+          ? ((amx)->error=AMX_ERR_NONE, *(result)=(amx)->natives[(int)(index)]((amx),(params)), (amx)->error) \
+          : (amx)->callback((amx),(index),(result),(params)))
+
+/* HOSTCALL() calls host code: a native function, a hook or the overlay
+ * callback; a fault in host code is not a fault of the script (see
+ * guard_fault())
+ */
+#if defined AMX_GUARDPAGES || defined AMX_SANDBOX
+  #define HOSTCALL(call)  (amx_guardcore=0, (call), amx_guardcore=1)
+#else
+  #define HOSTCALL(call)  (call)
+#endif
+
 
 #if !defined AMX_ALTCORE
 int amx_exec_list(AMX *amx,const cell **opcodelist,int *numopcodes)
@@ -2102,7 +3742,98 @@ int amx_exec_list(AMX *amx,const cell **opcodelist,int *numopcodes)
 }
 #endif
 
-int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
+#if !defined AMX_ALTCORE && !defined AMX_NO_SUPERINSTR
+/* The arguments of an intrinsic are where the native function would find
+ * them: behind the argument count for SYSREQ, or on top of the stack for
+ * SYSREQ.N, in which case the intrinsic removes them (see set_intrinsic()).
+ * The macro sets "a" to the address of the first argument.
+ */
+#define GETARGS(a)      { GETPARAM(a); if (a==0) { a=stk+sizeof(cell); } else { stk+=a; a=stk-a; SKIPPARAM(1); } }
+
+#if PAWN_CELL_SIZE==32
+  #define REAL          float
+#elif PAWN_CELL_SIZE==64
+  #define REAL          double
+#endif
+#if defined REAL
+static REAL ctof(cell c)
+{
+  REAL f;
+  memcpy(&f,&c,sizeof f);
+  return f;
+}
+
+static cell ftoc(REAL f)
+{
+  cell c;
+  memcpy(&c,&f,sizeof c);
+  return c;
+}
+
+/* roundreal() converts a value to an integer in the same way as floatround()
+ * in amxfloat.c, for the modes 1 (floor), 2 (ceil), 3 (truncate) and any
+ * other (round), but without the maths library
+ */
+static cell roundreal(REAL f,cell mode)
+{
+  double lim=(double)((ucell)1 << (PAWN_CELL_SIZE-1));
+  double d=(double)f;
+  cell c;
+
+  if (mode<1 || mode>3)
+    d+=.5;              /* round = floor(f+.5) */
+  if (!(d>-lim-1.0 && d<lim))
+    return (cell)(REAL)d; /* out of range (or NaN), as undefined as in amxfloat.c */
+  c=(cell)d;            /* truncates */
+  if (mode!=2 && mode!=3 && (double)c>d)
+    c=(cell)((ucell)c-1);
+  else if (mode==2 && (double)c<d)
+    c=(cell)((ucell)c+1);
+  return c;
+}
+#endif
+#endif
+
+/* a series of calls to the same public function, see amx_ExecBatch() */
+typedef struct tagBATCH {
+  const cell *args;         /* "numargs" arguments for each call */
+  int numargs;
+  int count;                /* number of calls */
+  int done;                 /* number of completed calls */
+  cell *results;            /* may be NULL */
+  cell cip;                 /* start address of the function */
+  int ovl_index;
+} BATCH;
+
+/* batchcall() sets up the stack for the next call in the batch, and it sets
+ * "retval" to the address for its return value (or NULL)
+ */
+static int batchcall(AMX *amx, unsigned char *data, BATCH *batch, cell reset_stk, cell reset_hea, cell **retval)
+{
+  AMX_HEADER *hdr=(AMX_HEADER *)amx->base;
+  const cell *args;
+  int i;
+
+  assert(batch->done<batch->count);
+  amx->stk=reset_stk;
+  amx->hea=reset_hea;
+  args=batch->args+batch->done*batch->numargs;
+  for (i=batch->numargs-1; i>=0; i--)
+    AMXPUSH(args[i]);
+  AMXPUSH(batch->numargs*sizeof(cell));
+  AMXPUSH(0);                   /* return address (for overlays: overlay 0, offset 0) */
+  amx->cip=batch->cip;
+  *retval=(batch->results!=NULL) ? &batch->results[batch->done] : NULL;
+  if (batch->done>0 && hdr->overlays!=hdr->nametable) {
+    /* the previous call returned to overlay 0 */
+    amx->ovl_index=batch->ovl_index;
+    HOSTCALL(i=amx->overlay(amx,amx->ovl_index));
+    return i;
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+static int execute(AMX *amx, cell *retval, int index, BATCH *batch)
 {
   AMX_HEADER *hdr;
   AMX_FUNCSTUB *func;
@@ -2112,6 +3843,9 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
 #if !defined AMX_ALTCORE
   cell pri,alt,stk,frm,hea;
   cell *cip,op,offs,val;
+  #if defined AMX_OPSTATS
+    uint64_t (*pairs)[AMX_STATS_OPCODES],*row;
+  #endif
 #endif
 
   assert(amx!=NULL);
@@ -2157,7 +3891,8 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       assert(hdr->overlays!=0);
       assert(amx->overlay!=NULL);
       amx->ovl_index=(int)hdr->cip;
-      if ((i=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
+      HOSTCALL(i=amx->overlay(amx,amx->ovl_index));
+      if (i!=AMX_ERR_NONE)
         return i;
       amx->cip=0;
     } /* if */
@@ -2168,7 +3903,8 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
     if (hdr->overlays!=hdr->nametable) {
       assert(hdr->overlays!=0);
       assert(amx->overlay!=NULL);
-      if ((i=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
+      HOSTCALL(i=amx->overlay(amx,amx->ovl_index));
+      if (i!=AMX_ERR_NONE)
         return i;
     } /* if */
   } else if (index<0) {
@@ -2182,7 +3918,8 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       assert(hdr->overlays!=0);
       assert(amx->overlay!=NULL);
       amx->ovl_index=func->address;
-      if ((i=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
+      HOSTCALL(i=amx->overlay(amx,amx->ovl_index));
+      if (i!=AMX_ERR_NONE)
         return i;
       amx->cip=0;
     } /* if */
@@ -2218,31 +3955,66 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
     #error Unsupported cell size
   #endif
 
-  if (index!=AMX_EXEC_CONT) {
+  if (batch!=NULL) {
+    assert(index!=AMX_EXEC_CONT && amx->paramcount==0);
+    batch->cip=amx->cip;
+    batch->ovl_index=amx->ovl_index;
+    batch->done=0;
+    batchcall(amx,data,batch,reset_stk,reset_hea,&retval);
+  } else if (index!=AMX_EXEC_CONT) {
     reset_stk+=amx->paramcount*sizeof(cell);
     AMXPUSH(amx->paramcount*sizeof(cell));
     amx->paramcount=0;          /* push the parameter count to the stack & reset */
     AMXPUSH(0);                 /* return address (for overlays: overlay 0, offset 0) */
   } /* if */
   /* check stack/heap before starting to run */
-  if (amx->hea+STKMARGIN>amx->stk)
+  if (STKOVERFLOW(amx,amx->hea,amx->stk))
     return AMX_ERR_STACKERR;
 
+#if defined AMX_JIT_X64
+  /* the compiled code runs next to the ANSI-C core */
+  if ((amx->flags & AMX_FLAG_JITC)!=0) {
+    for ( ;; ) {
+      i=(int)amx_jit_run(amx,retval,data);
+      if (i!=AMX_ERR_NONE || batch==NULL || ++batch->done>=batch->count)
+        break;
+      if ((i=batchcall(amx,data,batch,reset_stk,reset_hea,&retval))!=AMX_ERR_NONE)
+        break;
+    } /* for */
+    if (i==AMX_ERR_SLEEP) {
+      amx->reset_stk=reset_stk;
+      amx->reset_hea=reset_hea;
+    } else {
+      amx->stk=reset_stk;
+      amx->hea=reset_hea;
+    } /* if */
+    return i;
+  } /* if */
+#endif
+
 #if defined AMX_ALTCORE
 
-  /* start running either the ARM or 80x86 assembler abstract machine or the JIT */
-  #if defined AMX_ASM && defined AMX_JIT
-    if ((amx->flags & AMX_FLAG_JITC)!=0)
+  /* start running either the ARM or 80x86 assembler abstract machine or the JIT;
+   * for a batch, the abstract machine is restarted for every call
+   */
+  for ( ;; ) {
+    #if defined AMX_ASM && defined AMX_JIT
+      if ((amx->flags & AMX_FLAG_JITC)!=0)
+        i = amx_jit_run(amx,retval,data);
+      else
+        i = amx_exec_run(amx,retval,data);
+    #elif defined AMX_JIT
       i = amx_jit_run(amx,retval,data);
-    else
+    #else
+      /* also for GNU GCC and Intel C/C++ versions */
       i = amx_exec_run(amx,retval,data);
-  #elif defined AMX_JIT
-    i = amx_jit_run(amx,retval,data);
-  #else
-    /* also for GNU GCC and Intel C/C++ versions */
-    i = amx_exec_run(amx,retval,data);
-  #endif
-  if (i == AMX_ERR_SLEEP) {
+    #endif
+    if (i != AMX_ERR_NONE || batch == NULL || ++batch->done >= batch->count)
+      break;
+    if ((i = batchcall(amx,data,batch,reset_stk,reset_hea,&retval)) != AMX_ERR_NONE)
+      break;
+  } /* for */
+  if (i == AMX_ERR_SLEEP || i == AMX_ERR_FUEL) {
     amx->reset_stk=reset_stk;
     amx->reset_hea=reset_hea;
   } else {
@@ -2257,9 +4029,32 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
 
 #else
 
-  #define CHKMARGIN()   if (hea+STKMARGIN>stk) return AMX_ERR_STACKERR
+  #define CHKMARGIN()   if (STKOVERFLOW(amx,hea,stk)) return AMX_ERR_STACKERR
   #define CHKSTACK()    if (stk>amx->stp) return AMX_ERR_STACKLOW
   #define CHKHEAP()     if (hea<amx->hlw) return AMX_ERR_HEAPLOW
+  #if defined AMX_SANDBOX
+    /* an invalid address faults, see guard_execute() */
+    #define CHKADDR(a)
+    #define CHKEND(a)
+  #else
+    /* an address must lie in the data section, the heap or the stack;
+     * CHKEND() verifies the end of a range (exclusive) */
+    #define CHKADDR(a)  if (((a)>=hea && (a)<stk) || (ucell)(a)>=(ucell)amx->stp) ABORT(amx,AMX_ERR_MEMACCESS)
+    #define CHKEND(a)   if (((a)>hea && (a)<stk) || (ucell)(a)>(ucell)amx->stp) ABORT(amx,AMX_ERR_MEMACCESS)
+  #endif
+  #if defined AMX_NO_FUEL
+    #define CHKFUEL()
+  #else
+    /* taken branches and calls are counted against the budget, see amx_SetFuel() */
+    #define CHKFUEL()   if (--amx->fuel<=0) goto __fuel
+  #endif
+  #if defined AMX_OPSTATS
+    /* count the pairs of opcodes (the counts per opcode are derived from the
+     * pairs), see amx_SetStats() */
+    #define COUNTOP(o)  if (row!=NULL) { row[o]++; row=pairs[o]; }
+  #else
+    #define COUNTOP(o)
+  #endif
 
   /* PUSH() and POP() are defined in terms of the _R() and _W() macros */
   #define PUSH(v)       ( stk-=sizeof(cell), _W(data,stk,v) )
@@ -2272,10 +4067,15 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
   cip=(cell *)(amx->code+(int)amx->cip);
   hea=amx->hea;
   stk=amx->stk;
+  #if defined AMX_OPSTATS
+    pairs=(amx->opstats!=NULL) ? ((AMX_STATS *)amx->opstats)->pairs : NULL;
+    row=(pairs!=NULL) ? pairs[AMX_STATS_ENTRY] : NULL;
+  #endif
 
   /* start running */
   for ( ;; ) {
     op=_RCODE();
+    COUNTOP((int)GETOPCODE(op));
     switch (GETOPCODE(op)) {
     /* core instruction set */
     case OP_NOP:
@@ -2308,16 +4108,14 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       break;
     case OP_LOAD_I:
       /* verify address */
-      if (pri>=hea && pri<stk || (ucell)pri>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
+      CHKADDR(pri);
       pri=_R(data,pri);
       break;
     case OP_LODB_I:
       GETPARAM(offs);
     __lodb_i:
       /* verify address */
-      if (pri>=hea && pri<stk || (ucell)pri>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
+      CHKADDR(pri);
       switch ((int)offs) {
       case 1:
         pri=_R8(data,pri);
@@ -2359,16 +4157,14 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       break;
     case OP_STOR_I:
       /* verify address */
-      if (alt>=hea && alt<stk || (ucell)alt>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
+      CHKADDR(alt);
       _W(data,alt,pri);
       break;
     case OP_STRB_I:
       GETPARAM(offs);
     __strb_i:
       /* verify address */
-      if (alt>=hea && alt<stk || (ucell)alt>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
+      CHKADDR(alt);
       switch ((int)offs) {
       case 1:
         _W8(data,alt,pri);
@@ -2477,7 +4273,9 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
     case OP_PROC:
       PUSH(frm);
       frm=stk;
-      CHKMARGIN();
+      #if !defined AMX_GUARDPAGES
+        CHKMARGIN();            /* with guard pages, an overflow faults */
+      #endif
       break;
     case OP_RET:
       POP(frm);
@@ -2499,23 +4297,29 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
     case OP_CALL:
       PUSH(((unsigned char *)cip-amx->code)+sizeof(cell));/* skip address */
       cip=JUMPREL(cip);                 /* jump to the address */
+      CHKFUEL();
       break;
     case OP_JUMP:
       /* since the GETPARAM() macro modifies cip, you cannot
        * do GETPARAM(cip) directly */
       cip=JUMPREL(cip);
+      CHKFUEL();
       break;
     case OP_JZER:
-      if (pri==0)
+      if (pri==0) {
         cip=JUMPREL(cip);
-      else
+        CHKFUEL();
+      } else {
         SKIPPARAM(1);
+      } /* if */
       break;
     case OP_JNZ:
-      if (pri!=0)
+      if (pri!=0) {
         cip=JUMPREL(cip);
-      else
+        CHKFUEL();
+      } else {
         SKIPPARAM(1);
+      } /* if */
       break;
     case OP_SHL:
       pri<<=alt;
@@ -2634,14 +4438,10 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       /* verify top & bottom memory addresses, for both source and destination
        * addresses
        */
-      if (pri>=hea && pri<stk || (ucell)pri>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
-      if ((pri+offs)>hea && (pri+offs)<stk || (ucell)(pri+offs)>(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
-      if (alt>=hea && alt<stk || (ucell)alt>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
-      if ((alt+offs)>hea && (alt+offs)<stk || (ucell)(alt+offs)>(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
+      CHKADDR(pri);
+      CHKEND(pri+offs);
+      CHKADDR(alt);
+      CHKEND(alt+offs);
       #if defined _R_DEFAULT
         memcpy(data+(int)alt, data+(int)pri, (int)offs);
       #else
@@ -2661,14 +4461,10 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       /* verify top & bottom memory addresses, for both source and destination
        * addresses
        */
-      if (pri>=hea && pri<stk || (ucell)pri>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
-      if ((pri+offs)>hea && (pri+offs)<stk || (ucell)(pri+offs)>(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
-      if (alt>=hea && alt<stk || (ucell)alt>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
-      if ((alt+offs)>hea && (alt+offs)<stk || (ucell)(alt+offs)>(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
+      CHKADDR(pri);
+      CHKEND(pri+offs);
+      CHKADDR(alt);
+      CHKEND(alt+offs);
       #if defined _R_DEFAULT
         pri=memcmp(data+(int)alt, data+(int)pri, (int)offs);
       #else
@@ -2683,10 +4479,8 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       GETPARAM(offs);
     __fill:
       /* verify top & bottom memory addresses (destination only) */
-      if (alt>=hea && alt<stk || (ucell)alt>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
-      if ((alt+offs)>hea && (alt+offs)<stk || (ucell)(alt+offs)>(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
+      CHKADDR(alt);
+      CHKEND(alt+offs);
       for (i=(int)alt; (size_t)offs>=sizeof(cell); i+=sizeof(cell), offs-=sizeof(cell))
         _W32(data,i,pri);
       break;
@@ -2695,6 +4489,15 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
     __halt:
       if (retval!=NULL)
         *retval=pri;
+      if (batch!=NULL && offs==AMX_ERR_NONE && ++batch->done<batch->count) {
+        /* start the next call of the batch, without leaving the interpreter */
+        if ((i=batchcall(amx,data,batch,reset_stk,reset_hea,&retval))!=AMX_ERR_NONE)
+          ABORT(amx,i);
+        stk=amx->stk;
+        hea=amx->hea;
+        cip=(cell *)(amx->code+(int)amx->cip);
+        break;
+      } /* if */
       /* store complete status (stk and hea are already set in the ABORT macro) */
       amx->frm=frm;
       amx->pri=pri;
@@ -2708,6 +4511,35 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
         return (int)offs;
       } /* if */
       ABORT(amx,(int)offs);
+#if !defined AMX_NO_FUEL
+    __fuel:
+      if (amx->fuelhook!=NULL) {
+        /* store the registers, so that the hook can walk the stack */
+        amx->frm=frm;
+        amx->pri=pri;
+        amx->alt=alt;
+        amx->cip=(cell)((unsigned char*)cip-amx->code);
+        amx->stk=stk;
+        amx->hea=hea;
+        HOSTCALL(amx->fuelhook(amx));
+        if (amx->fuel>0)
+          break;                /* the hook set a new count */
+      } /* if */
+      if ((amx->flags & AMX_FLAG_FUEL)==0) {
+        amx->fuel=LONG_MAX;     /* no budget was set, just restart the counter */
+        break;
+      } /* if */
+      /* store complete status, so that AMX_EXEC_CONT continues at cip */
+      amx->frm=frm;
+      amx->pri=pri;
+      amx->alt=alt;
+      amx->cip=(cell)((unsigned char*)cip-amx->code);
+      amx->stk=stk;
+      amx->hea=hea;
+      amx->reset_stk=reset_stk;
+      amx->reset_hea=reset_hea;
+      return AMX_ERR_FUEL;
+#endif
     case OP_BOUNDS:
       GETPARAM(offs);
       if ((ucell)pri>(ucell)offs) {
@@ -2722,7 +4554,7 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       amx->hea=hea;
       amx->frm=frm;
       amx->stk=stk;
-      i=amx->callback(amx,offs,&pri,(cell *)(data+(int)stk));
+      HOSTCALL(i=CALLNATIVE(amx,offs,&pri,(cell *)(data+(int)stk)));
       if (i!=AMX_ERR_NONE) {
         if (i==AMX_ERR_SLEEP) {
           amx->pri=pri;
@@ -2736,13 +4568,38 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       break;
     case OP_SWITCH: {
       cell *cptr=JUMPREL(cip)+1;/* +1, to skip the "casetbl" opcode */
-      assert(*JUMPREL(cip)==OP_CASETBL);
       cip=JUMPREL(cptr+1);      /* preset to "none-matched" case */
       i=(int)*cptr;             /* number of records in the case table */
-      for (cptr+=2; i>0 && *cptr!=pri; i--,cptr+=2)
-        /* nothing */;
-      if (i>0)
-        cip=JUMPREL(cptr+1);    /* case found */
+#if !defined AMX_NO_SUPERINSTR
+      if (cptr[-1]==OP_CASETBL_DENSE) {
+        /* the jump table is at the end of the case table, see casetable() */
+        if ((ucell)pri-(ucell)cptr[2]<=(ucell)cptr[3]-(ucell)cptr[2])
+          cip=JUMPREL(cptr+2*i+1-(cell)((ucell)cptr[3]-(ucell)pri));
+      } else if (cptr[-1]==OP_CASETBL_SORTED) {
+        /* binary search for the first record with the value */
+        cell *end=cptr+2*i+2;
+        int half;
+        for (cptr+=2; i>0; ) {
+          half=i/2;
+          if (cptr[2*half]<pri) {
+            cptr+=2*half+2;
+            i-=half+1;
+          } else {
+            i=half;
+          } /* if */
+        } /* for */
+        if (cptr<end && *cptr==pri)
+          cip=JUMPREL(cptr+1);  /* case found */
+      } else
+#endif
+      {
+        assert(cptr[-1]==OP_CASETBL);
+        for (cptr+=2; i>0 && *cptr!=pri; i--,cptr+=2)
+          /* nothing */;
+        if (i>0)
+          cip=JUMPREL(cptr+1);  /* case found */
+      }
+      CHKFUEL();
       break;
     } /* case */
     case OP_SWAP_PRI:
@@ -2763,7 +4620,7 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
         amx->stk=stk;
         amx->hea=hea;
         amx->cip=(cell)((unsigned char*)cip-amx->code);
-        i=amx->debug(amx);
+        HOSTCALL(i=amx->debug(amx));
         if (i!=AMX_ERR_NONE) {
           if (i==AMX_ERR_SLEEP) {
             amx->pri=pri;
@@ -2831,9 +4688,11 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       PUSH((offs<<(sizeof(cell)*4)) | amx->ovl_index);
       amx->ovl_index=(int)*cip;
       assert(amx->overlay!=NULL);
-      if ((i=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
+      HOSTCALL(i=amx->overlay(amx,amx->ovl_index));
+      if (i!=AMX_ERR_NONE)
         ABORT(amx,i);
       cip=(cell*)amx->code;
+      CHKFUEL();
       break;
     case OP_RETN_OVL:
       assert(amx->overlay!=NULL);
@@ -2843,7 +4702,7 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       offs=(ucell)offs >> (sizeof(cell)*4);
       /* verify the index */
       stk+=_R(data,stk)+sizeof(cell);   /* remove parameters from the stack */
-      i=amx->overlay(amx,amx->ovl_index); /* reload overlay */
+      HOSTCALL(i=amx->overlay(amx,amx->ovl_index)); /* reload overlay */
       if (i!=AMX_ERR_NONE || (long)offs>=amx->codesize)
         ABORT(amx,AMX_ERR_MEMACCESS);
       cip=(cell *)(amx->code+(int)offs);
@@ -2858,9 +4717,11 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       if (i>0)
         amx->ovl_index=*(cptr+1); /* case found */
       assert(amx->overlay!=NULL);
-      if ((i=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
+      HOSTCALL(i=amx->overlay(amx,amx->ovl_index));
+      if (i!=AMX_ERR_NONE)
         ABORT(amx,i);
       cip=(cell*)amx->code;
+      CHKFUEL();
       break;
     } /* case */
 #endif
@@ -2870,16 +4731,14 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
     case OP_LIDX:
       offs=pri*sizeof(cell)+alt;
       /* verify address */
-      if (offs>=hea && offs<stk || (ucell)offs>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
+      CHKADDR(offs);
       pri=_R(data,offs);
       break;
     case OP_LIDX_B:
       GETPARAM(offs);
       offs=(pri << (int)offs)+alt;
       /* verify address */
-      if (offs>=hea && offs<stk || (ucell)offs>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
+      CHKADDR(offs);
       pri=_R(data,offs);
       break;
     case OP_IDXADDR:
@@ -2918,40 +4777,52 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       PUSH((intptr_t)data+frm+offs);
       break;
     case OP_JEQ:
-      if (pri==alt)
+      if (pri==alt) {
         cip=JUMPREL(cip);
-      else
+        CHKFUEL();
+      } else {
         SKIPPARAM(1);
+      } /* if */
       break;
     case OP_JNEQ:
-      if (pri!=alt)
+      if (pri!=alt) {
         cip=JUMPREL(cip);
-      else
+        CHKFUEL();
+      } else {
         SKIPPARAM(1);
+      } /* if */
       break;
     case OP_JSLESS:
-      if (pri<alt)
+      if (pri<alt) {
         cip=JUMPREL(cip);
-      else
+        CHKFUEL();
+      } else {
         SKIPPARAM(1);
+      } /* if */
       break;
     case OP_JSLEQ:
-      if (pri<=alt)
+      if (pri<=alt) {
         cip=JUMPREL(cip);
-      else
+        CHKFUEL();
+      } else {
         SKIPPARAM(1);
+      } /* if */
       break;
     case OP_JSGRTR:
-      if (pri>alt)
+      if (pri>alt) {
         cip=JUMPREL(cip);
-      else
+        CHKFUEL();
+      } else {
         SKIPPARAM(1);
+      } /* if */
       break;
     case OP_JSGEQ:
-      if (pri>=alt)
+      if (pri>=alt) {
         cip=JUMPREL(cip);
-      else
+        CHKFUEL();
+      } else {
         SKIPPARAM(1);
+      } /* if */
       break;
     case OP_SDIV_INV:
       if (alt==0)
@@ -3052,7 +4923,7 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       amx->hea=hea;
       amx->frm=frm;
       amx->stk=stk;
-      i=amx->callback(amx,offs,&pri,(cell *)(data+(int)stk));
+      HOSTCALL(i=CALLNATIVE(amx,offs,&pri,(cell *)(data+(int)stk)));
       stk+=val+4;
       if (i!=AMX_ERR_NONE) {
         if (i==AMX_ERR_SLEEP) {
@@ -3203,8 +5074,7 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       GETPARAM_P(offs,op);
       offs=(pri << (int)offs)+alt;
       /* verify address */
-      if (offs>=hea && offs<stk || (ucell)offs>=(ucell)amx->stp)
-        ABORT(amx,AMX_ERR_MEMACCESS);
+      CHKADDR(offs);
       pri=_R(data,offs);
       break;
     case OP_IDXADDR_P_B:
@@ -3397,6 +5267,209 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
       } /* if */
       break;
 #endif /* AMX_NO_PACKED_OPC */
+#if !defined AMX_NO_SUPERINSTR
+    /* superinstructions: the opcode of the second instruction is skipped */
+    case OP_LOAD_S_PUSH:
+      GETPARAM(offs);
+      pri=_R(data,frm+offs);
+      SKIPOPCODE();
+      PUSH(pri);
+      break;
+    case OP_CONST_PUSH:
+      GETPARAM(pri);
+      SKIPOPCODE();
+      PUSH(pri);
+      break;
+    case OP_PUSH_LOAD_S:
+      PUSH(pri);
+      SKIPOPCODE();
+      GETPARAM(offs);
+      pri=_R(data,frm+offs);
+      break;
+    case OP_LOAD_S_CONST_ALT:
+      GETPARAM(offs);
+      pri=_R(data,frm+offs);
+      SKIPOPCODE();
+      GETPARAM(alt);
+      break;
+    case OP_CONST_ALT_ADD:
+      GETPARAM(alt);
+      SKIPOPCODE();
+      pri+=alt;
+      break;
+    case OP_POP_ALT_ADD:
+      POP(alt);
+      SKIPOPCODE();
+      pri+=alt;
+      break;
+    case OP_ADD_PUSH:
+      pri+=alt;
+      SKIPOPCODE();
+      PUSH(pri);
+      break;
+    case OP_CONST_STOR_S:
+      GETPARAM(pri);
+      SKIPOPCODE();
+      GETPARAM(offs);
+      _W(data,frm+offs,pri);
+      break;
+    case OP_LOAD_I_POP_ALT:
+      /* verify address */
+      CHKADDR(pri);
+      pri=_R(data,pri);
+      SKIPOPCODE();
+      POP(alt);
+      break;
+    case OP_BOUNDS_SHL_C:
+      GETPARAM(offs);
+      if ((ucell)pri>(ucell)offs) {
+        amx->cip=(cell)((unsigned char *)cip-amx->code);
+        ABORT(amx,AMX_ERR_BOUNDS);
+      } /* if */
+      SKIPOPCODE();
+      GETPARAM(offs);
+      pri<<=offs;
+      break;
+    case OP_EQ_JZER:
+      pri= pri==alt ? 1 : 0;
+      goto __jzer;
+    case OP_NEQ_JZER:
+      pri= pri!=alt ? 1 : 0;
+      goto __jzer;
+    case OP_SLESS_JZER:
+      pri= pri<alt ? 1 : 0;
+      goto __jzer;
+    case OP_SLEQ_JZER:
+      pri= pri<=alt ? 1 : 0;
+      goto __jzer;
+    case OP_SGRTR_JZER:
+      pri= pri>alt ? 1 : 0;
+      goto __jzer;
+    case OP_SGEQ_JZER:
+      pri= pri>=alt ? 1 : 0;
+    __jzer:
+      SKIPOPCODE();
+      if (pri==0) {
+        cip=JUMPREL(cip);
+        CHKFUEL();
+      } else {
+        SKIPPARAM(1);
+      } /* if */
+      break;
+#if !defined AMX_NO_MACRO_INSTR
+    case OP_PUSH_C_CALL:
+      GETPARAM(offs);
+      PUSH(offs);
+      SKIPOPCODE();
+      PUSH(((unsigned char *)cip-amx->code)+sizeof(cell));/* skip address */
+      cip=JUMPREL(cip);                 /* jump to the address */
+      CHKFUEL();
+      break;
+    case OP_ZERO_RETN:
+      pri=0;
+      POP(frm);
+      POP(offs);
+      /* verify the return address */
+      if ((long)offs>=amx->codesize)
+        ABORT(amx,AMX_ERR_MEMACCESS);
+      cip=(cell *)(amx->code+(int)offs);
+      stk+=_R(data,stk)+sizeof(cell);   /* remove parameters from the stack */
+      break;
+    case OP_LOAD_S_ADD_C:
+      GETPARAM(offs);
+      pri=_R(data,frm+offs);
+      SKIPOPCODE();
+      GETPARAM(offs);
+      pri+=offs;
+      break;
+    case OP_IDXADDR_B_LOAD_I:
+      GETPARAM(offs);
+      pri=(pri << (int)offs)+alt;
+      SKIPOPCODE();
+      /* verify address */
+      CHKADDR(pri);
+      pri=_R(data,pri);
+      break;
+#endif
+  /* intrinsics: see set_intrinsic() */
+#if defined REAL
+    case OP_FLOAT:
+      GETARGS(offs);
+      pri=ftoc((REAL)_R(data,offs));
+      break;
+    case OP_FLOATADD:
+      GETARGS(offs);
+      pri=ftoc(ctof(_R(data,offs))+ctof(_R(data,offs+sizeof(cell))));
+      break;
+    case OP_FLOATSUB:
+      GETARGS(offs);
+      pri=ftoc(ctof(_R(data,offs))-ctof(_R(data,offs+sizeof(cell))));
+      break;
+    case OP_FLOATMUL:
+      GETARGS(offs);
+      pri=ftoc(ctof(_R(data,offs))*ctof(_R(data,offs+sizeof(cell))));
+      break;
+    case OP_FLOATDIV:
+      GETARGS(offs);
+      pri=ftoc(ctof(_R(data,offs))/ctof(_R(data,offs+sizeof(cell))));
+      break;
+    case OP_FLOATCMP: {
+      REAL a,b;
+      GETARGS(offs);
+      a=ctof(_R(data,offs));
+      b=ctof(_R(data,offs+sizeof(cell)));
+      pri=(a==b) ? 0 : (a>b) ? 1 : -1;
+      break;
+    } /* case */
+    case OP_FLOATABS: {
+      REAL a;
+      GETARGS(offs);
+      a=ctof(_R(data,offs));
+      pri=ftoc((a>=0) ? a : -a);
+      break;
+    } /* case */
+    case OP_FLOATROUND:
+      GETARGS(offs);
+      pri=roundreal(ctof(_R(data,offs)),_R(data,offs+sizeof(cell)));
+      break;
+    case OP_FLOATINT:
+      GETARGS(offs);
+      pri=roundreal(ctof(_R(data,offs)),3);
+      break;
+#endif
+    case OP_FIXED:
+      GETARGS(offs);
+      pri=(cell)(_R(data,offs)*1000L);
+      break;
+#if defined FIXED64
+    case OP_FMUL: {
+      int64_t a;
+      GETARGS(offs);
+      a=(int64_t)_R(data,offs)*(int64_t)_R(data,offs+sizeof(cell));
+      pri=(cell)((a+500)/1000);
+      break;
+    } /* case */
+    case OP_FDIV:
+      GETARGS(offs);
+      val=_R(data,offs+sizeof(cell));
+      if (val==0) {
+        amx->cip=(cell)((unsigned char *)cip-amx->code);
+        ABORT(amx,AMX_ERR_DIVIDE);
+      } /* if */
+      pri=(cell)(((int64_t)_R(data,offs)*1000+(int64_t)(val/2))/(int64_t)val);
+      break;
+#endif
+    case OP_FABS:
+      GETARGS(offs);
+      pri=_R(data,offs);
+      if (pri<0)
+        pri=-pri;
+      break;
+    case OP_FINT:
+      GETARGS(offs);
+      pri=_R(data,offs)/1000L;
+      break;
+#endif /* AMX_NO_SUPERINSTR */
     default:
       assert(0);  /* invalid instructions should already have been caught in VerifyPcode() */
       ABORT(amx,AMX_ERR_INVINSTR);
@@ -3405,38 +5478,362 @@ int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
 #endif /* AMX_ALTCORE */
 }
 
-#endif /* AMX_EXEC */
-
-#if defined AMX_SETCALLBACK
-int AMXAPI amx_SetCallback(AMX *amx,AMX_CALLBACK callback)
-{
-  assert(amx!=NULL);
-  assert(callback!=NULL);
-  amx->callback=callback;
-  return AMX_ERR_NONE;
-}
-#endif /* AMX_SETCALLBACK */
-
-#if defined AMX_SETDEBUGHOOK
-int AMXAPI amx_SetDebugHook(AMX *amx,AMX_DEBUG debug)
-{
-  assert(amx!=NULL);
-  amx->debug=debug;
-  return AMX_ERR_NONE;
-}
-#endif /* AMX_SETDEBUGHOOK */
-
-#if defined AMX_RAISEERROR
-int AMXAPI amx_RaiseError(AMX *amx, int error)
-{
-  assert(error>0);
-  amx->error=error;
-  return AMX_ERR_NONE;
-}
-#endif /* AMX_RAISEERROR */
-
-#if defined AMX_ALLOT || defined AMX_PUSHXXX
-int AMXAPI amx_Allot(AMX *amx,int cells,cell **address)
+#if defined AMX_GUARDPAGES || defined AMX_SANDBOX
+/* guard_execute() runs execute() in a guard frame: with AMX_GUARDPAGES, a
+ * fault in the guard page is a stack overflow; with AMX_SANDBOX, a fault in
+ * the window around the data block is an invalid memory access
+ */
+static int guard_execute(AMX *amx, cell *retval, int index, BATCH *batch)
+{
+  AMX_HEADER *hdr;
+  GUARDFRAME frame;
+  unsigned char *data;
+  cell reset_stk,reset_hea;
+  int err;
+
+  if ((amx->flags & AMX_FLAG_INIT)==0)
+    return AMX_ERR_INIT;
+  if ((amx->flags & AMX_FLAG_JITC)!=0)
+    return execute(amx,retval,index,batch);   /* the JIT does its own checks */
+  #if defined AMX_GUARDPAGES
+    if (amx->guardsize==0)
+      return AMX_ERR_INIT;      /* the interpreter relies on the guard page */
+  #else
+    if (amx->reserve==0)
+      return AMX_ERR_INIT;      /* the interpreter relies on the sandbox */
+  #endif
+
+  /* on a fault, restore the stack and the heap like execute() does on an error */
+  hdr=(AMX_HEADER *)amx->base;
+  data=(amx->data!=NULL) ? amx->data : amx->base+(int)hdr->dat;
+  if (index==AMX_EXEC_CONT) {
+    reset_stk=amx->reset_stk;
+    reset_hea=amx->reset_hea;
+  } else {
+    reset_stk=amx->stk+amx->paramcount*sizeof(cell);
+    reset_hea=amx->hea;
+  } /* if */
+  #if defined AMX_GUARDPAGES
+    frame.lo=data+(int)amx->guard;
+    frame.hi=frame.lo+(int)amx->guardsize;
+  #else
+    frame.lo=data-AMX_SANDBOX_OFFSET;
+    frame.hi=frame.lo+AMX_SANDBOX_SIZE;
+  #endif
+  frame.prev=guardframe;
+  frame.core=amx_guardcore;
+  if (sigsetjmp(frame.jmp,0)!=0) {
+    guardframe=frame.prev;
+    amx_guardcore=frame.core;
+    amx->stk=reset_stk;
+    amx->hea=reset_hea;
+    amx->paramcount=0;
+    #if defined AMX_GUARDPAGES
+      return AMX_ERR_STACKERR;
+    #else
+      return AMX_ERR_MEMACCESS;
+    #endif
+  } /* if */
+  guardframe=&frame;
+  amx_guardcore=1;
+  err=execute(amx,retval,index,batch);
+  guardframe=frame.prev;
+  amx_guardcore=frame.core;
+  return err;
+}
+#endif
+
+int AMXAPI amx_Exec(AMX *amx, cell *retval, int index)
+{
+  #if defined AMX_GUARDPAGES || defined AMX_SANDBOX
+    return guard_execute(amx,retval,index,NULL);
+  #else
+    return execute(amx,retval,index,NULL);
+  #endif
+}
+
+/* amx_ExecBatch() calls the public function "index" once for each set of
+ * arguments, without the set-up cost of amx_Exec() for every call. On entry,
+ * "count" holds the number of calls; the arguments for call n are at
+ * args[n*numargs] up to args[n*numargs+numargs-1], in the order of the
+ * function's parameters, and they are passed by value. The return value of
+ * call n is stored in results[n] (when "results" is not NULL). The batch
+ * stops at the first call that fails, and on return "count" holds the number
+ * of calls that completed. When a call goes into sleep mode, amx_Exec() with
+ * AMX_EXEC_CONT completes it, and the remaining calls must be submitted in a
+ * new batch.
+ */
+int AMXAPI amx_ExecBatch(AMX *amx, int index, const cell *args, int numargs, cell *results, int *count)
+{
+  BATCH batch;
+  int err;
+
+  assert(amx!=NULL);
+  if (count==NULL || numargs<0 || (args==NULL && numargs>0) || amx->paramcount!=0)
+    return AMX_ERR_PARAMS;
+  if (index<0 && index!=AMX_EXEC_MAIN)
+    return AMX_ERR_INDEX;
+  if (*count<=0) {
+    *count=0;
+    return AMX_ERR_NONE;
+  } /* if */
+  /* the arguments of a call are pushed before execute() checks the stack */
+  if ((cell)numargs>(amx->stk-amx->hea)/(cell)sizeof(cell)
+      || STKOVERFLOW(amx,amx->hea,amx->stk-(cell)(numargs+2)*(cell)sizeof(cell))) {
+    *count=0;
+    return AMX_ERR_STACKERR;
+  } /* if */
+  batch.args=args;
+  batch.numargs=numargs;
+  batch.count=*count;
+  batch.done=0;
+  batch.results=results;
+  #if defined AMX_GUARDPAGES || defined AMX_SANDBOX
+    err=guard_execute(amx,NULL,index,&batch);
+  #else
+    err=execute(amx,NULL,index,&batch);
+  #endif
+  *count=batch.done;
+  return err;
+}
+
+#endif /* AMX_EXEC */
+
+#if defined AMX_SETCALLBACK
+int AMXAPI amx_SetCallback(AMX *amx,AMX_CALLBACK callback)
+{
+  assert(amx!=NULL);
+  assert(callback!=NULL);
+  amx->callback=callback;
+  #if defined AMX_DEFCALLBACK
+    if (callback!=amx_Callback)
+      amx->natives=NULL;  /* the table bypasses the callback, see amx_SetNatives() */
+  #endif
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_SETCALLBACK */
+
+#if defined AMX_SETFUEL
+/* amx_SetFuel() sets the number of taken branches and calls that the script
+ * may run before amx_Exec() returns with AMX_ERR_FUEL; amx_Exec() with
+ * AMX_EXEC_CONT then resumes the script (after a new budget is set). The
+ * remaining budget is in amx->fuel. A budget of 0 switches the metering off.
+ * The JIT does not meter the code, so a budget for a JIT-compiled abstract
+ * machine is refused with AMX_ERR_INIT.
+ */
+int AMXAPI amx_SetFuel(AMX *amx,long fuel)
+{
+  assert(amx!=NULL);
+  if (fuel<0)
+    return AMX_ERR_PARAMS;
+  if (fuel>0) {
+    if ((amx->flags & AMX_FLAG_JITC)!=0)
+      return AMX_ERR_INIT;
+    amx->flags|=AMX_FLAG_FUEL;
+    amx->fuel=fuel;
+  } else {
+    amx->flags&=~AMX_FLAG_FUEL;
+    amx->fuel=LONG_MAX;
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+/* amx_SetFuelHook() sets a function that is called when amx->fuel drops to
+ * zero, before the budget is checked. The registers are stored in the AMX
+ * structure at that point. If the hook sets amx->fuel to a positive value,
+ * the script continues (and the budget is not checked). A profiler uses this
+ * to take a sample every so many branches, or it sets amx->fuel to zero from
+ * a timer signal. The JIT never calls the hook, so it cannot be set for a
+ * JIT-compiled abstract machine (AMX_ERR_INIT).
+ */
+int AMXAPI amx_SetFuelHook(AMX *amx,AMX_FUELHOOK hook)
+{
+  assert(amx!=NULL);
+  if (hook!=NULL && (amx->flags & AMX_FLAG_JITC)!=0)
+    return AMX_ERR_INIT;
+  amx->fuelhook=hook;
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_SETFUEL */
+
+#if defined AMX_GUARDPAGES && defined AMX_EXEC
+/* amx_SetGuard() puts an inaccessible page (a guard page) between the heap
+ * and the stack, so that the interpreter does not check for a stack overflow
+ * on every function entry: an overflow runs into the guard page, the SIGSEGV
+ * handler catches it and amx_Exec() returns with AMX_ERR_STACKERR. The heap
+ * and the stack then no longer share the free space: the heap gets "heapsize"
+ * bytes (or a little more) and the stack gets the remainder.
+ * The data block must be "extra" bytes larger than the size in the header
+ * (hdr->stp - hdr->dat) and the stack top moves up by "extra" bytes. Of these,
+ * up to two memory pages are taken by the guard page and its alignment (the
+ * block need not be page-aligned); so with "extra" set to "heapsize" plus two
+ * pages, the stack keeps all of the original free space.
+ * Call this after amx_Init() or amx_Clone() and before amx_Exec(); the SIGSEGV
+ * handler is installed on the first call, which should be made before other
+ * threads run. amx_Cleanup() makes the page accessible again. An abstract
+ * machine that is built with AMX_GUARDPAGES refuses to run a script without
+ * a guard page, except on the JIT (which checks the stack itself).
+ */
+int AMXAPI amx_SetGuard(AMX *amx,long heapsize,long extra)
+{
+  AMX_HEADER *hdr;
+  unsigned char *data;
+  uintptr_t pagesize,start;
+  cell guard,top;
+
+  assert(amx!=NULL);
+  if ((amx->flags & AMX_FLAG_INIT)==0 || amx->guardsize!=0 || amx->stk!=amx->stp || amx->hea!=amx->hlw)
+    return AMX_ERR_INIT;
+  if ((amx->flags & AMX_FLAG_JITC)!=0)
+    return AMX_ERR_INIT_JIT;
+  pagesize=(uintptr_t)sysconf(_SC_PAGESIZE);
+  if (heapsize<0 || extra<2*(long)pagesize)
+    return AMX_ERR_PARAMS;
+  hdr=(AMX_HEADER *)amx->base;
+  data=(amx->data!=NULL) ? amx->data : amx->base+(int)hdr->dat;
+
+  /* the guard page is at the first page boundary above the heap */
+  start=((uintptr_t)data+amx->hlw+heapsize+pagesize-1) & ~(pagesize-1);
+  guard=(cell)(start-(uintptr_t)data);
+  top=amx->stp+(cell)extra;
+  if (guard+(cell)pagesize+STKMARGIN>top)
+    return AMX_ERR_MEMORY;      /* no room left for the stack */
+  if (!guard_install() || mprotect((void *)start,(size_t)pagesize,PROT_NONE)!=0)
+    return AMX_ERR_GENERAL;
+
+  amx->guard=guard;
+  amx->guardsize=(cell)pagesize;
+  amx->stp=amx->stk=top;
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_GUARDPAGES */
+
+#if defined AMX_GROWABLE && defined AMX_EXEC
+#define GROWSTEP        ((cell)0x10000)   /* commit at least 64 kiB at a time */
+
+/* amx_Grow() commits memory in a growable data block (see amx_Init()), so
+ * that the heap may reach up to "hea" and the stack (plus its margin) down to
+ * "stk". The abstract machine calls it when the heap or the stack crosses the
+ * committed part; a host may call it to commit memory in advance. It fails
+ * with AMX_ERR_STACKERR when the heap and the stack would collide, which
+ * happens when the block has grown to its reserved size.
+ */
+int AMXAPI amx_Grow(AMX *amx,cell hea,cell stk)
+{
+  cell pagesize,lo,hi,newlo,newhi;
+
+  assert(amx!=NULL);
+  if (hea+STKMARGIN>stk)
+    return AMX_ERR_STACKERR;
+  if (amx->guardsize==0)
+    return AMX_ERR_NONE;        /* fixed data block, or completely committed */
+  assert(amx->data!=NULL);
+  pagesize=(cell)syspagesize();
+  lo=amx->guard;
+  hi=amx->guard+amx->guardsize;
+  stk-=STKMARGIN;
+
+  /* grow in steps, so that this is not done for every page */
+  newlo=lo;
+  if (hea>lo)
+    newlo=((hea>lo+GROWSTEP ? hea : lo+GROWSTEP)+pagesize-1) & ~(pagesize-1);
+  newhi=hi;
+  if (stk<hi)
+    newhi=(stk<hi-GROWSTEP ? stk : hi-GROWSTEP) & ~(pagesize-1);
+  if (newlo>=newhi)
+    newlo=newhi=hi;             /* the heap and the stack meet, commit the rest */
+
+  if (newlo>lo) {
+    if (!commit(amx->data+(int)lo,(size_t)(newlo-lo)))
+      return AMX_ERR_MEMORY;
+    amx->guard=newlo;
+    amx->guardsize=hi-newlo;
+  } /* if */
+  if (newhi<hi) {
+    if (!commit(amx->data+(int)newhi,(size_t)(hi-newhi)))
+      return AMX_ERR_MEMORY;
+    amx->guardsize=newhi-amx->guard;
+  } /* if */
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_GROWABLE */
+
+#if defined AMX_OPSTATS
+/* amx_SetStats() attaches a block of counters to the abstract machine (or
+ * detaches the counters if "stats" is NULL) and clears them. From then on,
+ * amx_Exec() counts how often every opcode runs, and how often every opcode
+ * follows another opcode; the first instruction after entry is counted in
+ * row AMX_STATS_ENTRY of the pairs. The counters are only available when the
+ * abstract machine is compiled with AMX_OPSTATS; the JIT does not count.
+ * Without counters, AMX_OPSTATS costs a well-predicted test per instruction
+ * in the ANSI-C core and nothing in the GCC core (which then dispatches
+ * through its normal label table).
+ */
+int AMXAPI amx_SetStats(AMX *amx,AMX_STATS *stats)
+{
+  assert(amx!=NULL);
+  assert_static(OP_NUM_OPCODES<AMX_STATS_ENTRY);
+  assert_static(sizeof opnames / sizeof opnames[0] == OP_NUM_OPCODES);
+  if (stats!=NULL) {
+    memset(stats,0,sizeof(AMX_STATS));
+    stats->numopcodes=OP_NUM_OPCODES;
+  } /* if */
+  amx->opstats=stats;
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI amx_GetStats(AMX *amx,AMX_STATS **stats)
+{
+  AMX_STATS *s;
+  int i,j;
+
+  assert(amx!=NULL);
+  assert(stats!=NULL);
+  *stats=s=(AMX_STATS *)amx->opstats;
+  if (s==NULL)
+    return AMX_ERR_NOTFOUND;
+  /* only the pairs are counted while running, the count of an opcode is the
+   * sum of its column */
+  for (j=0; j<AMX_STATS_OPCODES; j++) {
+    s->count[j]=0;
+    for (i=0; i<AMX_STATS_OPCODES; i++)
+      s->count[j]+=s->pairs[i][j];
+  } /* for */
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI amx_OpcodeName(int opcode,const char **name)
+{
+  assert(name!=NULL);
+  if (opcode<0 || opcode>=OP_NUM_OPCODES) {
+    *name=NULL;
+    return AMX_ERR_PARAMS;
+  } /* if */
+  *name=opnames[opcode];
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_OPSTATS */
+
+#if defined AMX_SETDEBUGHOOK
+int AMXAPI amx_SetDebugHook(AMX *amx,AMX_DEBUG debug)
+{
+  assert(amx!=NULL);
+  amx->debug=debug;
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_SETDEBUGHOOK */
+
+#if defined AMX_RAISEERROR
+int AMXAPI amx_RaiseError(AMX *amx, int error)
+{
+  assert(error>0);
+  amx->error=error;
+  return AMX_ERR_NONE;
+}
+#endif /* AMX_RAISEERROR */
+
+#if defined AMX_ALLOT || defined AMX_PUSHXXX
+int AMXAPI amx_Allot(AMX *amx,int cells,cell **address)
 {
   AMX_HEADER *hdr;
   unsigned char *data;
@@ -3447,6 +5844,14 @@ int AMXAPI amx_Allot(AMX *amx,int cells,cell **address)
   assert(hdr->magic==AMX_MAGIC);
   data=(amx->data!=NULL) ? amx->data : amx->base+(int)hdr->dat;
 
+  #if defined AMX_GUARDPAGES
+    if (amx->guardsize!=0 && amx->hea + cells*sizeof(cell) > (ucell)amx->guard)
+      return AMX_ERR_MEMORY;
+  #elif defined AMX_GROWABLE
+    if (amx->guardsize!=0 && amx->hea + cells*sizeof(cell) > (ucell)amx->guard
+        && amx_Grow(amx,amx->hea+cells*(cell)sizeof(cell),amx->stk)!=AMX_ERR_NONE)
+      return AMX_ERR_MEMORY;
+  #endif
   if (amx->stk - amx->hea - cells*sizeof(cell) < STKMARGIN)
     return AMX_ERR_MEMORY;
   if (address!=NULL)
@@ -3473,6 +5878,365 @@ int AMXAPI amx_Release(AMX *amx,cell *address)
 }
 #endif /* AMX_ALLOT || AMX_PUSHXXX */
 
+#if defined AMX_SIMDSTRING
+/* String kernels for 32-bit cells on x86. SSE2 is always present (on x86-64
+ * it is part of the base instruction set); the AVX2 variants are used when
+ * the processor supports them. The scans for a terminating zero read whole
+ * aligned blocks, which never straddle a page boundary; the conversions read
+ * and write exactly "num" elements.
+ */
+static int simd_avx2=-1;        /* -1 = not yet checked */
+
+static int has_avx2(void)
+{
+  if (simd_avx2<0) {
+    __builtin_cpu_init();
+    simd_avx2=__builtin_cpu_supports("avx2") ? 1 : 0;
+  } /* if */
+  return simd_avx2;
+}
+
+/* short strings are quicker with a plain loop than with the set-up of the
+ * SIMD kernels */
+#define SHORTSTRING     16
+
+#if defined AMX_XXXSTRING
+#define HASZEROBYTE(c)  ((((ucell)(c)-0x01010101u) & ~(ucell)(c) & 0x80808080u)!=0)
+
+/* scan_sse2() and scan_avx2() return the index of the first cell that is zero
+ * (or that has a zero byte, if "bytes" is true); they return "max" if there
+ * is none in the first "max" cells. Once the pointer is suitably aligned, the
+ * loop checks four blocks at a time.
+ */
+#define CMPZERO_SSE2(v,bytes)   ((bytes) ? _mm_cmpeq_epi8((v),zero) : _mm_cmpeq_epi32((v),zero))
+#define CMPZERO_AVX2(v,bytes)   ((bytes) ? _mm256_cmpeq_epi8((v),zero) : _mm256_cmpeq_epi32((v),zero))
+
+static size_t scan_sse2(const cell *str,size_t max,int bytes)
+{
+  const __m128i zero=_mm_setzero_si128();
+  const __m128i *block;
+  size_t i;
+  int mask;
+
+  for (i=0; ((uintptr_t)(str+i) & 15)!=0; i++)
+    if (i>=max || (bytes ? HASZEROBYTE(str[i]) : str[i]==0))
+      return i;
+  for ( ; i<max; i+=16/sizeof(cell)) {
+    if (((uintptr_t)(str+i) & 63)==0) {
+      for ( ; i<max; i+=64/sizeof(cell)) {
+        block=(const __m128i*)(str+i);
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(CMPZERO_SSE2(_mm_load_si128(block),bytes),
+                                                        CMPZERO_SSE2(_mm_load_si128(block+1),bytes)),
+                                           _mm_or_si128(CMPZERO_SSE2(_mm_load_si128(block+2),bytes),
+                                                        CMPZERO_SSE2(_mm_load_si128(block+3),bytes))))!=0)
+          break;        /* the single-block loop finds the exact position */
+      } /* for */
+      if (i>=max)
+        break;
+    } /* if */
+    mask=_mm_movemask_epi8(CMPZERO_SSE2(_mm_load_si128((const __m128i*)(str+i)),bytes));
+    if (mask!=0) {
+      i+=__builtin_ctz(mask)/sizeof(cell);
+      return (i<max) ? i : max;
+    } /* if */
+  } /* for */
+  return max;
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const cell *str,size_t max,int bytes)
+{
+  const __m256i zero=_mm256_setzero_si256();
+  const __m256i *block;
+  size_t i;
+  unsigned mask;
+
+  for (i=0; ((uintptr_t)(str+i) & 31)!=0; i++)
+    if (i>=max || (bytes ? HASZEROBYTE(str[i]) : str[i]==0))
+      return i;
+  for ( ; i<max; i+=32/sizeof(cell)) {
+    if (((uintptr_t)(str+i) & 127)==0) {
+      for ( ; i<max; i+=128/sizeof(cell)) {
+        __m256i v;
+        block=(const __m256i*)(str+i);
+        v=_mm256_or_si256(_mm256_or_si256(CMPZERO_AVX2(_mm256_load_si256(block),bytes),
+                                          CMPZERO_AVX2(_mm256_load_si256(block+1),bytes)),
+                          _mm256_or_si256(CMPZERO_AVX2(_mm256_load_si256(block+2),bytes),
+                                          CMPZERO_AVX2(_mm256_load_si256(block+3),bytes)));
+        if (!_mm256_testz_si256(v,v))
+          break;        /* the single-block loop finds the exact position */
+      } /* for */
+      if (i>=max)
+        break;
+    } /* if */
+    mask=(unsigned)_mm256_movemask_epi8(CMPZERO_AVX2(_mm256_load_si256((const __m256i*)(str+i)),bytes));
+    if (mask!=0) {
+      i+=__builtin_ctz(mask)/sizeof(cell);
+      return (i<max) ? i : max;
+    } /* if */
+  } /* for */
+  return max;
+}
+
+/* str_celllen() returns the length of an unpacked string, at most "max" */
+static size_t str_celllen(const cell *str,size_t max)
+{
+  return has_avx2() ? scan_avx2(str,max,0) : scan_sse2(str,max,0);
+}
+
+/* str_packedlen() returns the length of a packed string, at most "max" */
+static size_t str_packedlen(const cell *str,size_t max)
+{
+  size_t i,len;
+  ucell c;
+
+  i= has_avx2() ? scan_avx2(str,max/sizeof(cell)+1,1) : scan_sse2(str,max/sizeof(cell)+1,1);
+  assert(i<=max/sizeof(cell)+1);
+  if (i>max/sizeof(cell))
+    return max;
+  /* the characters are stored from the high byte down */
+  len=i*sizeof(cell);
+  for (c=(ucell)str[i]; (c & 0xff000000u)!=0; c<<=8)
+    len++;
+  return (len<max) ? len : max;
+}
+
+#endif /* AMX_XXXSTRING */
+
+#if defined AMX_XXXSTRING || defined AMX_UTF8XXX
+/* narrow_sse2() and narrow_avx2() store the low byte of every cell */
+static void narrow_sse2(char *dest,const cell *source,size_t num)
+{
+  const __m128i low=_mm_set1_epi32(0xff);
+  size_t i;
+
+  for (i=0; i+16<=num; i+=16) {
+    __m128i a=_mm_and_si128(_mm_loadu_si128((const __m128i*)(source+i)),low);
+    __m128i b=_mm_and_si128(_mm_loadu_si128((const __m128i*)(source+i+4)),low);
+    __m128i c=_mm_and_si128(_mm_loadu_si128((const __m128i*)(source+i+8)),low);
+    __m128i d=_mm_and_si128(_mm_loadu_si128((const __m128i*)(source+i+12)),low);
+    _mm_storeu_si128((__m128i*)(dest+i),_mm_packus_epi16(_mm_packs_epi32(a,b),_mm_packs_epi32(c,d)));
+  } /* for */
+  if (i+8<=num) {
+    __m128i a=_mm_and_si128(_mm_loadu_si128((const __m128i*)(source+i)),low);
+    __m128i b=_mm_and_si128(_mm_loadu_si128((const __m128i*)(source+i+4)),low);
+    __m128i v=_mm_packs_epi32(a,b);
+    _mm_storel_epi64((__m128i*)(dest+i),_mm_packus_epi16(v,v));
+    i+=8;
+  } /* if */
+  for ( ; i<num; i++)
+    dest[i]=(char)source[i];
+}
+
+__attribute__((target("avx2")))
+static void narrow_avx2(char *dest,const cell *source,size_t num)
+{
+  const __m256i low=_mm256_set1_epi32(0xff);
+  const __m256i order=_mm256_setr_epi32(0,4,1,5,2,6,3,7);
+  size_t i;
+
+  for (i=0; i+32<=num; i+=32) {
+    __m256i a=_mm256_and_si256(_mm256_loadu_si256((const __m256i*)(source+i)),low);
+    __m256i b=_mm256_and_si256(_mm256_loadu_si256((const __m256i*)(source+i+8)),low);
+    __m256i c=_mm256_and_si256(_mm256_loadu_si256((const __m256i*)(source+i+16)),low);
+    __m256i d=_mm256_and_si256(_mm256_loadu_si256((const __m256i*)(source+i+24)),low);
+    /* the packs work per 128-bit lane, so the result must be reordered */
+    __m256i v=_mm256_packus_epi16(_mm256_packs_epi32(a,b),_mm256_packs_epi32(c,d));
+    _mm256_storeu_si256((__m256i*)(dest+i),_mm256_permutevar8x32_epi32(v,order));
+  } /* for */
+  _mm256_zeroupper();   /* GCC may make the call below a jump, without VZEROUPPER */
+  narrow_sse2(dest+i,source+i,num-i);
+}
+
+static void str_narrow(char *dest,const cell *source,size_t num)
+{
+  size_t i;
+
+  if (num<SHORTSTRING)
+    for (i=0; i<num; i++)
+      dest[i]=(char)source[i];
+  else if (has_avx2())
+    narrow_avx2(dest,source,num);
+  else
+    narrow_sse2(dest,source,num);
+}
+#endif /* AMX_XXXSTRING || AMX_UTF8XXX */
+
+/* widen_sse2() and widen_avx2() extend every character to a cell, with the
+ * signedness of "char" (as in the plain C loop)
+ */
+static void widen_sse2(cell *dest,const char *source,size_t num)
+{
+  size_t i;
+
+  for (i=0; i+16<=num; i+=16) {
+    __m128i v=_mm_loadu_si128((const __m128i*)(source+i));
+    #if CHAR_MIN<0
+      __m128i lo=_mm_srai_epi16(_mm_unpacklo_epi8(v,v),8);
+      __m128i hi=_mm_srai_epi16(_mm_unpackhi_epi8(v,v),8);
+      _mm_storeu_si128((__m128i*)(dest+i),_mm_srai_epi32(_mm_unpacklo_epi16(lo,lo),16));
+      _mm_storeu_si128((__m128i*)(dest+i+4),_mm_srai_epi32(_mm_unpackhi_epi16(lo,lo),16));
+      _mm_storeu_si128((__m128i*)(dest+i+8),_mm_srai_epi32(_mm_unpacklo_epi16(hi,hi),16));
+      _mm_storeu_si128((__m128i*)(dest+i+12),_mm_srai_epi32(_mm_unpackhi_epi16(hi,hi),16));
+    #else
+      const __m128i zero=_mm_setzero_si128();
+      __m128i lo=_mm_unpacklo_epi8(v,zero);
+      __m128i hi=_mm_unpackhi_epi8(v,zero);
+      _mm_storeu_si128((__m128i*)(dest+i),_mm_unpacklo_epi16(lo,zero));
+      _mm_storeu_si128((__m128i*)(dest+i+4),_mm_unpackhi_epi16(lo,zero));
+      _mm_storeu_si128((__m128i*)(dest+i+8),_mm_unpacklo_epi16(hi,zero));
+      _mm_storeu_si128((__m128i*)(dest+i+12),_mm_unpackhi_epi16(hi,zero));
+    #endif
+  } /* for */
+  for ( ; i<num; i++)
+    dest[i]=(cell)source[i];
+}
+
+__attribute__((target("avx2")))
+static void widen_avx2(cell *dest,const char *source,size_t num)
+{
+  size_t i;
+
+  for (i=0; i+16<=num; i+=16) {
+    __m128i v=_mm_loadu_si128((const __m128i*)(source+i));
+    #if CHAR_MIN<0
+      _mm256_storeu_si256((__m256i*)(dest+i),_mm256_cvtepi8_epi32(v));
+      _mm256_storeu_si256((__m256i*)(dest+i+8),_mm256_cvtepi8_epi32(_mm_srli_si128(v,8)));
+    #else
+      _mm256_storeu_si256((__m256i*)(dest+i),_mm256_cvtepu8_epi32(v));
+      _mm256_storeu_si256((__m256i*)(dest+i+8),_mm256_cvtepu8_epi32(_mm_srli_si128(v,8)));
+    #endif
+  } /* for */
+  if (i+8<=num) {
+    __m128i v=_mm_loadl_epi64((const __m128i*)(source+i));
+    #if CHAR_MIN<0
+      _mm256_storeu_si256((__m256i*)(dest+i),_mm256_cvtepi8_epi32(v));
+    #else
+      _mm256_storeu_si256((__m256i*)(dest+i),_mm256_cvtepu8_epi32(v));
+    #endif
+    i+=8;
+  } /* if */
+  for ( ; i<num; i++)
+    dest[i]=(cell)source[i];
+}
+
+static void str_widen(cell *dest,const char *source,size_t num)
+{
+  size_t i;
+
+  if (num<SHORTSTRING)
+    for (i=0; i<num; i++)
+      dest[i]=(cell)source[i];
+  else if (has_avx2())
+    widen_avx2(dest,source,num);
+  else
+    widen_sse2(dest,source,num);
+}
+
+/* swap_sse2() and swap_avx2() copy "num" cells while reversing the bytes in
+ * each cell (to convert between packed strings and C strings); "dest" may be
+ * the same as "source", and neither needs to be aligned
+ */
+static void swap_sse2(void *dest,const void *source,size_t num)
+{
+  size_t i;
+  uint32_t c;
+
+  for (i=0; i+4<=num; i+=4) {
+    __m128i v=_mm_loadu_si128((const __m128i*)((const char*)source+i*sizeof(cell)));
+    v=_mm_or_si128(_mm_slli_epi16(v,8),_mm_srli_epi16(v,8));
+    v=_mm_shufflehi_epi16(_mm_shufflelo_epi16(v,_MM_SHUFFLE(2,3,0,1)),_MM_SHUFFLE(2,3,0,1));
+    _mm_storeu_si128((__m128i*)((char*)dest+i*sizeof(cell)),v);
+  } /* for */
+  for ( ; i<num; i++) {
+    memcpy(&c,(const char*)source+i*sizeof(cell),sizeof c);
+    c=__builtin_bswap32(c);
+    memcpy((char*)dest+i*sizeof(cell),&c,sizeof c);
+  } /* for */
+}
+
+__attribute__((target("avx2")))
+static void swap_avx2(void *dest,const void *source,size_t num)
+{
+  const __m256i order=_mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+                                       3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+  size_t i;
+  uint32_t c;
+
+  for (i=0; i+8<=num; i+=8) {
+    __m256i v=_mm256_loadu_si256((const __m256i*)((const char*)source+i*sizeof(cell)));
+    _mm256_storeu_si256((__m256i*)((char*)dest+i*sizeof(cell)),_mm256_shuffle_epi8(v,order));
+  } /* for */
+  for ( ; i<num; i++) {
+    memcpy(&c,(const char*)source+i*sizeof(cell),sizeof c);
+    c=__builtin_bswap32(c);
+    memcpy((char*)dest+i*sizeof(cell),&c,sizeof c);
+  } /* for */
+}
+
+static void str_swapcells(void *dest,const void *source,size_t num)
+{
+  if (num<SHORTSTRING/sizeof(cell))
+    swap_sse2(dest,source,num);   /* does only the plain loop */
+  else if (has_avx2())
+    swap_avx2(dest,source,num);
+  else
+    swap_sse2(dest,source,num);
+}
+
+#if defined AMX_UTF8XXX
+/* utf8_asciispan() returns the number of bytes at the start of "string" that
+ * are 7-bit ASCII (and not zero), at most "max"; it reads aligned blocks,
+ * like scan_sse2()
+ */
+static size_t utf8_asciispan(const char *string,size_t max)
+{
+  const __m128i zero=_mm_setzero_si128();
+  size_t i;
+  int mask;
+
+  for (i=0; ((uintptr_t)(string+i) & 15)!=0; i++)
+    if (i>=max || (signed char)string[i]<=0)
+      return i;
+  for ( ; i<max; i+=16) {
+    /* a byte is ASCII (and not zero) if it is above zero as a signed value */
+    mask=~_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_load_si128((const __m128i*)(string+i)),zero)) & 0xffff;
+    if (mask!=0) {
+      i+=__builtin_ctz(mask);
+      return (i<max) ? i : max;
+    } /* if */
+  } /* for */
+  return max;
+}
+
+/* utf8_cellspan() returns the number of cells at the start of "cstr" that
+ * hold a 7-bit ASCII character (and not zero), at most "max"
+ */
+static size_t utf8_cellspan(const cell *cstr,size_t max)
+{
+  const __m128i one=_mm_set1_epi32(1);
+  const __m128i limit=_mm_set1_epi32(0x7f);
+  const __m128i below=_mm_set1_epi32(-1);
+  size_t i;
+  int mask;
+
+  for (i=0; ((uintptr_t)(cstr+i) & 15)!=0; i++)
+    if (i>=max || (ucell)(cstr[i]-1)>=0x7f)
+      return i;
+  for ( ; i<max; i+=16/sizeof(cell)) {
+    /* c is in 1..0x7f if c-1 is in 0..0x7e */
+    __m128i v=_mm_sub_epi32(_mm_load_si128((const __m128i*)(cstr+i)),one);
+    mask=~_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi32(v,below),_mm_cmplt_epi32(v,limit))) & 0xffff;
+    if (mask!=0) {
+      i+=__builtin_ctz(mask)/sizeof(cell);
+      return (i<max) ? i : max;
+    } /* if */
+  } /* for */
+  return max;
+}
+#endif /* AMX_UTF8XXX */
+#endif /* AMX_SIMDSTRING */
+
 #if defined AMX_XXXSTRING || defined AMX_UTF8XXX
 
 #define CHARBITS        (8*sizeof(char))
@@ -3514,8 +6278,15 @@ int AMXAPI amx_StrLen(const cell *cstr, int *length)
       } /* if */
     #endif
   } else {
-    for (len=0; cstr[len]!=0; len++)
-      /* nothing */;
+    #if defined AMX_SIMDSTRING
+      for (len=0; len<SHORTSTRING && cstr[len]!=0; len++)
+        /* nothing */;
+      if (len==SHORTSTRING)
+        len+=(int)str_celllen(cstr+len,UNLIMITED-len);
+    #else
+      for (len=0; cstr[len]!=0; len++)
+        /* nothing */;
+    #endif
   } /* if */
   *length = len;
   return AMX_ERR_NONE;
@@ -3523,12 +6294,43 @@ int AMXAPI amx_StrLen(const cell *cstr, int *length)
 #endif
 
 #if defined AMX_XXXSTRING || defined AMX_PUSHXXX
+#if defined AMX_SIMDSTRING
+static int setstring_simd(cell *dest,const char *source,int pack,size_t size)
+{
+  size_t len=strlen(source);
+  size_t i,num;
+  ucell c;
+
+  if (pack) {
+    if (size<UNLIMITED/sizeof(cell) && len>=size*sizeof(cell))
+      len=size*sizeof(cell)-1;
+    /* swap whole cells, then build the last (semi-filled) cell */
+    num=len/sizeof(cell);
+    str_swapcells(dest,source,num);
+    c=0;
+    for (i=num*sizeof(cell); i<len; i++)
+      c|=(ucell)(unsigned char)source[i] << (sizeof(cell)-1-i%sizeof(cell))*8;
+    dest[num]=(cell)c;
+  } else {
+    if (size<UNLIMITED && len>=size)
+      len=size-1;
+    str_widen(dest,source,len);
+    dest[len]=0;
+  } /* if */
+  return AMX_ERR_NONE;
+}
+#endif
+
 int AMXAPI amx_SetString(cell *dest,const char *source,int pack,int use_wchar,size_t size)
 {                 /* the memory blocks should not overlap */
   int i;
   size_t len;
 
   assert_static(UNLIMITED>0);
+  #if defined AMX_SIMDSTRING
+    if (!use_wchar)
+      return setstring_simd(dest,source,pack,size);
+  #endif
   #if defined AMX_ANSIONLY
     (void)use_wchar;
     len=strlen(source);
@@ -3581,12 +6383,46 @@ int AMXAPI amx_SetString(cell *dest,const char *source,int pack,int use_wchar,si
 #endif
 
 #if defined AMX_XXXSTRING
+#if defined AMX_SIMDSTRING
+static int getstring_simd(char *dest,const cell *source,size_t size)
+{
+  size_t len,i;
+
+  if ((ucell)*source>UNPACKEDMAX) {
+    /* source string is packed: swap whole cells, then copy the remaining
+     * characters of the last cell */
+    len=str_packedlen(source,size);
+    str_swapcells(dest,source,len/sizeof(cell));
+    for (i=len-len%sizeof(cell); i<len; i++)
+      dest[i]=(char)(source[i/sizeof(cell)] >> (sizeof(cell)-1-i%sizeof(cell))*CHARBITS);
+  } else {
+    /* copy the start of the string while looking for the terminator, so that
+     * short strings are handled in a single pass */
+    for (len=0; len<SHORTSTRING && len<size && source[len]!=0; len++)
+      dest[len]=(char)source[len];
+    if (len==SHORTSTRING) {
+      i=str_celllen(source+len,size-len);
+      str_narrow(dest+len,source+len,i);
+      len+=i;
+    } /* if */
+  } /* if */
+  /* store terminator */
+  if (size>0)
+    dest[(len<size) ? len : size-1]='\0';
+  return AMX_ERR_NONE;
+}
+#endif
+
 int AMXAPI amx_GetString(char *dest,const cell *source,int use_wchar,size_t size)
 {
   int len=0;
   #if defined AMX_ANSIONLY
     (void)use_wchar;    /* unused parameter (if ANSI only) */
   #endif
+  #if defined AMX_SIMDSTRING
+    if (!use_wchar)
+      return getstring_simd(dest,source,size);
+  #endif
   if ((ucell)*source>UNPACKEDMAX) {
     /* source string is packed */
     cell c=0;           /* initialize to 0 to avoid a compiler warning */
@@ -3644,6 +6480,39 @@ int AMXAPI amx_GetString(char *dest,const cell *source,int use_wchar,size_t size
   #if defined __BORLANDC__
     #pragma warn -amb -8000     /* ambiguous operators need parentheses */
   #endif
+#if !defined AMX_SIMDSTRING
+/* plain C versions of the helpers for the bulk UTF-8 functions */
+static size_t utf8_asciispan(const char *string,size_t max)
+{
+  size_t i;
+  for (i=0; i<max && (unsigned char)(string[i]-1)<0x7f; i++)
+    /* nothing */;
+  return i;
+}
+
+static size_t utf8_cellspan(const cell *cstr,size_t max)
+{
+  size_t i;
+  for (i=0; i<max && (ucell)(cstr[i]-1)<0x7f; i++)
+    /* nothing */;
+  return i;
+}
+
+static void str_widen(cell *dest,const char *source,size_t num)
+{
+  size_t i;
+  for (i=0; i<num; i++)
+    dest[i]=(cell)source[i];
+}
+
+static void str_narrow(char *dest,const cell *source,size_t num)
+{
+  size_t i;
+  for (i=0; i<num; i++)
+    dest[i]=(char)source[i];
+}
+#endif
+
 /* amx_UTF8Get()
  * Extract a single UTF-8 encoded character from a string and return a pointer
  * to the character just behind that UTF-8 character. The parameters "endptr"
@@ -3791,6 +6660,85 @@ error:
   return AMX_ERR_PARAMS;
 }
 
+/* amx_UTF8Decode()
+ * Convert a zero-terminated UTF-8 string to an unpacked string of at most
+ * "maxcells" cells, including the terminating zero. Runs of ASCII characters
+ * are copied in bulk. The parameter "endptr" is set to the first byte that was
+ * not converted: the terminating zero byte, the first character that did not
+ * fit or an invalid UTF-8 code. The parameters "endptr" and "length" (which
+ * receives the number of characters stored) may be NULL.
+ * The function returns an error code if the string is not valid UTF-8; the
+ * characters before the error are stored (and zero-terminated).
+ */
+int AMXAPI amx_UTF8Decode(const char *string, const char **endptr, cell *dest, int maxcells, int *length)
+{
+  int err=AMX_ERR_NONE;
+  int len=0;
+  size_t num;
+
+  assert(string!=NULL);
+  assert(dest!=NULL || maxcells<=0);
+  while (len<maxcells-1 && *string!='\0') {
+    num=utf8_asciispan(string,(size_t)(maxcells-1-len));
+    if (num>0) {
+      str_widen(dest+len,string,num);
+      string+=num;
+      len+=(int)num;
+    } else {
+      if ((err=amx_UTF8Get(string,&string,&dest[len]))!=AMX_ERR_NONE)
+        break;
+      len++;
+    } /* if */
+  } /* while */
+  if (maxcells>0)
+    dest[len]=0;
+  if (endptr!=NULL)
+    *endptr=string;
+  if (length!=NULL)
+    *length=len;
+  return err;
+}
+
+/* amx_UTF8Encode()
+ * Convert a zero-terminated unpacked string to UTF-8, storing at most
+ * "maxchars" bytes. Runs of ASCII characters are copied in bulk. Like
+ * amx_UTF8Put(), the function does not zero-terminate the string. The
+ * parameter "endptr" is set behind the last byte stored and "cstrend" to the
+ * first cell that was not converted: the terminating zero cell, the first
+ * character that did not fit or a value that cannot be encoded. Both may be
+ * NULL.
+ * The function returns an error code if not all characters were converted.
+ */
+int AMXAPI amx_UTF8Encode(char *string, char **endptr, int maxchars, const cell *cstr, const cell **cstrend)
+{
+  int err=AMX_ERR_NONE;
+  size_t num;
+  char *ptr;
+
+  assert(string!=NULL);
+  assert(cstr!=NULL);
+  while (*cstr!=0) {
+    num= (maxchars>0) ? utf8_cellspan(cstr,(size_t)maxchars) : 0;
+    if (num>0) {
+      str_narrow(string,cstr,num);
+      string+=num;
+      cstr+=num;
+      maxchars-=(int)num;
+    } else {
+      if ((err=amx_UTF8Put(string,&ptr,maxchars,*cstr))!=AMX_ERR_NONE)
+        break;
+      maxchars-=(int)(ptr-string);
+      string=ptr;
+      cstr++;
+    } /* if */
+  } /* while */
+  if (endptr!=NULL)
+    *endptr=string;
+  if (cstrend!=NULL)
+    *cstrend=cstr;
+  return err;
+}
+
 /* amx_UTF8Check()
  * Run through a zero-terminated string and check the validity of the UTF-8
  * encoding. The function returns an error code, it is AMX_ERR_NONE if the
@@ -3800,9 +6748,15 @@ int AMXAPI amx_UTF8Check(const char *string, int *length)
 {
   int err=AMX_ERR_NONE;
   int len=0;
+  size_t num;
   while (err==AMX_ERR_NONE && *string!='\0') {
-    err=amx_UTF8Get(string,&string,NULL);
-    len++;
+    if ((num=utf8_asciispan(string,UNLIMITED))>0) {
+      string+=num;      /* skip a run of ASCII characters */
+      len+=(int)num;
+    } else {
+      err=amx_UTF8Get(string,&string,NULL);
+      len++;
+    } /* if */
   } /* while */
   if (length!=NULL)
     *length=len;
@@ -3824,9 +6778,17 @@ int AMXAPI amx_UTF8Len(const cell *cstr, int *length)
     char buffer[10];  /* maximum UTF-8 code is 6 characters */
     char *endptr;
     int len=*length, count=0;
-    while (len-->0) {
-      amx_UTF8Put(buffer, &endptr, sizeof buffer, *cstr++);
-      count+=(int)(endptr-buffer);
+    size_t num;
+    while (len>0) {
+      if ((num=utf8_cellspan(cstr,(size_t)len))>0) {
+        cstr+=num;      /* a run of ASCII characters, one byte each */
+        len-=(int)num;
+        count+=(int)num;
+      } else {
+        amx_UTF8Put(buffer, &endptr, sizeof buffer, *cstr++);
+        count+=(int)(endptr-buffer);
+        len--;
+      } /* if */
     } /* while */
     *length=count;
   } /* while */
@@ -203,11 +203,35 @@ extern  "C" {
 #define UNPACKEDMAX   (((cell)1 << (sizeof(cell)-1)*8) - 1)
 #define UNLIMITED     (~1u >> 1)
 
+/* amx_Init() expands a program in compact encoding (AMX_FLAG_COMPACT) in
+ * place; cells that cannot be stored yet are held in a buffer with room for
+ * AMX_COMPACTMARGIN cells (the compiler refuses to write a program that needs
+ * more); set it to zero to drop support for the compact encoding
+ */
+#if !defined AMX_COMPACTMARGIN
+  #define AMX_COMPACTMARGIN 64
+#endif
+
+/* with AMX_SANDBOX, the interpreter does not check the addresses that a
+ * script reads or writes; instead, the (growable) data block lies at
+ * AMX_SANDBOX_OFFSET bytes into a window of AMX_SANDBOX_SIZE bytes of
+ * reserved memory, so that any 32-bit address falls inside the window, and
+ * an invalid address faults; see amx_Init()
+ */
+#if defined AMX_SANDBOX
+  #if !defined AMX_GROWABLE
+    #define AMX_GROWABLE
+  #endif
+  #define AMX_SANDBOX_OFFSET  ((size_t)1 << 31)
+  #define AMX_SANDBOX_SIZE    ((size_t)3 << 31)
+#endif
+
 struct tagAMX;
 typedef cell (AMX_NATIVE_CALL *AMX_NATIVE)(struct tagAMX *amx, const cell *params);
 typedef int (AMXAPI *AMX_CALLBACK)(struct tagAMX *amx, cell index,
                                    cell *result, const cell *params);
 typedef int (AMXAPI *AMX_DEBUG)(struct tagAMX *amx);
+typedef int (AMXAPI *AMX_FUELHOOK)(struct tagAMX *amx);
 typedef int (AMXAPI *AMX_OVERLAY)(struct tagAMX *amx, int index);
 typedef int (AMXAPI *AMX_IDLE)(struct tagAMX *amx, int AMXAPI Exec(struct tagAMX *, cell *, int));
 #if !defined _FAR
@@ -258,6 +282,35 @@ typedef struct tagAMX_NATIVE_INFO {
   AMX_NATIVE func;
 } PACKED AMX_NATIVE_INFO;
 
+/* A registry is a hash table with native functions, collected from any number
+ * of AMX_NATIVE_INFO lists. It binds all native functions of a script in a
+ * single pass (see amx_RegisterAll()) and it can be shared by many scripts.
+ * The caller allocates the slots, see amx_InitRegistry().
+ */
+typedef struct tagAMX_REGISTRY {
+  const AMX_NATIVE_INFO **slots;
+  int size;                 /* number of slots, a power of 2 */
+  int count;                /* number of used slots */
+} AMX_REGISTRY;
+
+/* A handle caches the look-up of a public function or a public variable by
+ * name, for hosts that call the same function many times. Initialize it with
+ * AMX_HANDLE_INIT("name"). A handle is valid for the script and all of its
+ * clones; it is resolved again when it is used with a different script, but
+ * if a script is unloaded and another one is loaded at the same address, the
+ * handle must be reset with AMX_HANDLE_RESET(). Clones in different threads
+ * may share a handle; different scripts that run at the same time need
+ * separate handles.
+ */
+typedef struct tagAMX_HANDLE {
+  const char _FAR *name;
+  unsigned char _FAR *base; /* image for which "index" is valid, NULL if not yet resolved */
+  int index;                /* index of the public function or variable, -1 if not found */
+} AMX_HANDLE;
+
+#define AMX_HANDLE_INIT(name)   { (name), NULL, -1 }
+#define AMX_HANDLE_RESET(h)     ((h)->base = NULL)
+
 #if !defined AMX_USERNUM
 #define AMX_USERNUM     4
 #endif
@@ -315,8 +368,33 @@ typedef struct tagAMX {
     /* support variables for the JIT */
     int reloc_size;         /* required temporary buffer for relocations */
   #endif
+  /* hash index on the names of public functions and variables */
+  void _FAR *nameindex;     /* see amx_SetIndex(), may be NULL */
+  /* budget of taken branches and calls, see amx_SetFuel(); a signal handler
+   * may clear it (to make the abstract machine call the fuel hook) */
+  volatile long fuel;
+  AMX_FUELHOOK fuelhook;    /* called when "fuel" drops to zero, see amx_SetFuelHook() */
+  void _FAR *opstats;       /* opcode counters, see amx_SetStats(), may be NULL */
+  cell guard;               /* start of the guard page (or of the uncommitted memory) between heap and stack, see amx_SetGuard() */
+  cell guardsize;           /* size of the guard page or the uncommitted memory, zero if there is none */
+  cell reserve;             /* size of a growable data block, set before amx_Init(); zero for a fixed block */
+  AMX_NATIVE _FAR *natives; /* native functions by index, see amx_SetNatives(), may be NULL */
 } PACKED AMX;
 
+#if defined _I64_MAX || defined INT64_MAX || defined HAVE_I64
+/* Counters for an abstract machine that is compiled with AMX_OPSTATS, see
+ * amx_SetStats(). The opcodes are those of the abstract machine (which
+ * include packed opcodes and superinstructions), see amx_OpcodeName().
+ */
+#define AMX_STATS_OPCODES 256
+#define AMX_STATS_ENTRY   (AMX_STATS_OPCODES-1) /* "previous opcode" of the first instruction */
+typedef struct tagAMX_STATS {
+  uint64_t count[AMX_STATS_OPCODES];  /* executions per opcode */
+  uint64_t pairs[AMX_STATS_OPCODES][AMX_STATS_OPCODES]; /* [opcode][next opcode] */
+  int numopcodes;           /* number of opcodes of the abstract machine */
+} PACKED AMX_STATS;
+#endif
+
 /* The AMX_HEADER structure is both the memory format as the file format. The
  * structure is used internaly.
  */
@@ -341,6 +419,16 @@ typedef struct tagAMX_HEADER {
   int32_t overlays;         /* offset to the overlay table */
 } PACKED AMX_HEADER;
 
+/* A prepared image stores this record directly in front of the code; the
+ * "cod", "dat", "hea", "stp" and "size" fields of the header include it.
+ */
+typedef struct tagAMX_PREPARED {
+  uint32_t core;            /* signature of the abstract machine core */
+  uint32_t checksum;        /* checksum of the prepared code */
+  uint32_t sysreq_d;        /* opcode for direct native function calls (or zero) */
+  uint32_t flags;           /* flags that VerifyPcode() sets (AMX_FLAG_SYSREQN) */
+} PACKED AMX_PREPARED;
+
 #define AMX_MAGIC_16    0xf1e2
 #define AMX_MAGIC_32    0xf1e0
 #define AMX_MAGIC_64    0xf1e1
@@ -368,6 +456,7 @@ enum {
   AMX_ERR_DIVIDE,       /* divide by zero */
   AMX_ERR_SLEEP,        /* go into sleepmode - code can be restarted */
   AMX_ERR_INVSTATE,     /* no implementation for this state, no fall-back */
+  AMX_ERR_FUEL,         /* instruction budget exhausted - code can be restarted */
 
   AMX_ERR_MEMORY = 16,  /* out of memory */
   AMX_ERR_FORMAT,       /* invalid file format */
@@ -390,11 +479,17 @@ enum {
 #define AMX_FLAG_SLEEP    0x08  /* script uses the sleep instruction (possible re-entry or power-down mode) */
 #define AMX_FLAG_CRYPT    0x10  /* file is encrypted */
 #define AMX_FLAG_DSEG_INIT 0x20 /* data section is explicitly initialized */
+#define AMX_FLAG_FUEL     0x40  /* the run time is metered (see amx_SetFuel()) */
+#define AMX_FLAG_COMPACT  0x80  /* code and data sections use the compact encoding */
+#define AMX_FLAG_PREPARED 0x100 /* code is already verified for this core (see amx_GetPrepared()) */
+#define AMX_FLAG_SHARED  0x200  /* code is shared (read-only), amx_Init() and amx_Exec() do not patch it */
+#define AMX_FLAG_FROZEN  0x400  /* code is fully bound and read-only (see amx_Freeze()) */
 #define AMX_FLAG_SYSREQN 0x800  /* script uses new (optimized) version of SYSREQ opcode */
 #define AMX_FLAG_NTVREG 0x1000  /* all native functions are registered */
 #define AMX_FLAG_JITC   0x2000  /* abstract machine is JIT compiled */
 #define AMX_FLAG_VERIFY 0x4000  /* busy verifying P-code */
 #define AMX_FLAG_INIT   0x8000  /* AMX has been initialized */
+#define AMX_FLAG_INTRINSICS 0x10000L /* set before amx_Init(): the float/fixed point natives are those of amxfloat.c/amxfixed.c and may be replaced by instructions */
 
 #define AMX_EXEC_MAIN   (-1)    /* start at program entry point */
 #define AMX_EXEC_CONT   (-2)    /* continue from last address */
@@ -462,24 +557,31 @@ uint32_t * AMXAPI amx_Align32(uint32_t *v);
 #if defined _I64_MAX || defined INT64_MAX || defined HAVE_I64
   uint64_t * AMXAPI amx_Align64(uint64_t *v);
 #endif
+int AMXAPI amx_AddNatives(AMX_REGISTRY *registry, const AMX_NATIVE_INFO *list, int number);
 int AMXAPI amx_Allot(AMX *amx, int cells, cell **address);
 int AMXAPI amx_Callback(AMX *amx, cell index, cell *result, const cell *params);
 int AMXAPI amx_Cleanup(AMX *amx);
 int AMXAPI amx_Clone(AMX *amxClone, AMX *amxSource, void *data);
 int AMXAPI amx_Exec(AMX *amx, cell *retval, int index);
+int AMXAPI amx_ExecBatch(AMX *amx, int index, const cell *args, int numargs, cell *results, int *count);
 int AMXAPI amx_FindNative(AMX *amx, const char *name, int *index);
 int AMXAPI amx_FindPublic(AMX *amx, const char *name, int *index);
 int AMXAPI amx_FindPubVar(AMX *amx, const char *name, cell **address);
 int AMXAPI amx_FindTagId(AMX *amx, cell tag_id, char *tagname);
 int AMXAPI amx_Flags(AMX *amx,uint16_t *flags);
+int AMXAPI amx_Freeze(AMX *amx);
 int AMXAPI amx_GetNative(AMX *amx, int index, char *name);
+int AMXAPI amx_GetPrepared(AMX *amx, AMX_PREPARED *prep);
 int AMXAPI amx_GetPublic(AMX *amx, int index, char *name, ucell *address);
 int AMXAPI amx_GetPubVar(AMX *amx, int index, char *name, cell **address);
 int AMXAPI amx_GetString(char *dest,const cell *source, int use_wchar, size_t size);
 int AMXAPI amx_GetTag(AMX *amx, int index, char *tagname, cell *tag_id);
 int AMXAPI amx_GetUserData(AMX *amx, long tag, void **ptr);
+int AMXAPI amx_Grow(AMX *amx, cell hea, cell stk);
+int AMXAPI amx_IndexSize(AMX *amx, long *size);
 int AMXAPI amx_Init(AMX *amx, void *program);
 int AMXAPI amx_InitJIT(AMX *amx, void *reloc_table, void *native_code);
+int AMXAPI amx_InitRegistry(AMX_REGISTRY *registry, const AMX_NATIVE_INFO **slots, int size);
 int AMXAPI amx_MemInfo(AMX *amx, long *codesize, long *datasize, long *stackheap);
 int AMXAPI amx_NameLength(AMX *amx, int *length);
 AMX_NATIVE_INFO * AMXAPI amx_NativeInfo(const char *name, AMX_NATIVE func);
@@ -493,13 +595,28 @@ int AMXAPI amx_PushArray(AMX *amx, cell **address, const cell array[], int numce
 int AMXAPI amx_PushString(AMX *amx, cell **address, const char *string, int pack, int use_wchar);
 int AMXAPI amx_RaiseError(AMX *amx, int error);
 int AMXAPI amx_Register(AMX *amx, const AMX_NATIVE_INFO *nativelist, int number);
+int AMXAPI amx_RegisterAll(AMX *amx, const AMX_REGISTRY *registry);
 int AMXAPI amx_Release(AMX *amx, cell *address);
+int AMXAPI amx_ResolvePublic(AMX *amx, AMX_HANDLE *handle, int *index);
+int AMXAPI amx_ResolvePubVar(AMX *amx, AMX_HANDLE *handle, cell **address);
 int AMXAPI amx_SetCallback(AMX *amx, AMX_CALLBACK callback);
 int AMXAPI amx_SetDebugHook(AMX *amx, AMX_DEBUG debug);
+int AMXAPI amx_SetFuel(AMX *amx, long fuel);
+int AMXAPI amx_SetFuelHook(AMX *amx, AMX_FUELHOOK hook);
+int AMXAPI amx_SetGuard(AMX *amx, long heapsize, long extra);
+#if defined _I64_MAX || defined INT64_MAX || defined HAVE_I64
+  int AMXAPI amx_SetStats(AMX *amx, AMX_STATS *stats);
+  int AMXAPI amx_GetStats(AMX *amx, AMX_STATS **stats);
+#endif
+int AMXAPI amx_OpcodeName(int opcode, const char **name);
+int AMXAPI amx_SetIndex(AMX *amx, void *buffer);
+int AMXAPI amx_SetNatives(AMX *amx, AMX_NATIVE *table);
 int AMXAPI amx_SetString(cell *dest, const char *source, int pack, int use_wchar, size_t size);
 int AMXAPI amx_SetUserData(AMX *amx, long tag, void *ptr);
 int AMXAPI amx_StrLen(const cell *cstring, int *length);
 int AMXAPI amx_UTF8Check(const char *string, int *length);
+int AMXAPI amx_UTF8Decode(const char *string, const char **endptr, cell *dest, int maxcells, int *length);
+int AMXAPI amx_UTF8Encode(char *string, char **endptr, int maxchars, const cell *cstr, const cell **cstrend);
 int AMXAPI amx_UTF8Get(const char *string, const char **endptr, cell *value);
 int AMXAPI amx_UTF8Len(const cell *cstr, int *length);
 int AMXAPI amx_UTF8Put(char *string, char **endptr, int maxchars, cell value);
@@ -16,11 +16,104 @@
  *
  *  Version: $Id: amxaux.c 6131 2020-04-29 19:47:15Z thiadmer $
  */
+#include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "amx.h"
 #include "amxaux.h"
+#if defined AMXOVL
+  #include "amxpool.h"
+#endif
+#if defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+  #include <fcntl.h>
+  #include <signal.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+  #define AUX_LOAD_MMAP
+  #define AUX_POOL_MMAP
+  #define AUX_SNAPSHOT_MPROTECT
+  #include <pthread.h>
+  #define AUX_POOL_LOCK         pthread_mutex_t
+  #define pool_lockinit(l)      pthread_mutex_init((l), NULL)
+  #define pool_lockdelete(l)    pthread_mutex_destroy(l)
+  #define pool_lock(l)          pthread_mutex_lock(l)
+  #define pool_unlock(l)        pthread_mutex_unlock(l)
+#elif defined __WIN32__ || defined _WIN32 || defined WIN32
+  #include <windows.h>
+  #define AUX_POOL_LOCK         CRITICAL_SECTION
+  #define pool_lockinit(l)      InitializeCriticalSection(l)
+  #define pool_lockdelete(l)    DeleteCriticalSection(l)
+  #define pool_lock(l)          EnterCriticalSection(l)
+  #define pool_unlock(l)        LeaveCriticalSection(l)
+#endif
+
+struct tagAUX_POOL {
+  AMX *amx;               /* the program that the instances are cloned from */
+  size_t size;            /* size of the data block of an instance (data, heap & stack) */
+  #if defined AUX_POOL_MMAP
+    int fd;               /* file with the pristine data block */
+    FILE *fp;             /* only set if tmpfile() was used */
+  #else
+    unsigned char *image; /* the pristine data block */
+  #endif
+  void **freelist;        /* data blocks of released instances, for re-use */
+  int numfree, maxfree;
+  #if defined AUX_POOL_LOCK
+    AUX_POOL_LOCK lock;   /* protects the free list */
+  #endif
+};
+
+struct tagAUX_SNAPSHOT {
+  struct tagAUX_SNAPSHOT *next;   /* list of snapshots, for the fault handler */
+  AMX *amx;
+  unsigned char *data;    /* the data section of the abstract machine */
+  size_t size;            /* size of the data section */
+  unsigned char *copy;    /* the data section at the time of the snapshot */
+  cell hea, stk;          /* heap and stack pointers at the time of the snapshot */
+  unsigned char *pages;   /* first whole page in the data section */
+  size_t numpages;        /* number of whole pages in the data section */
+  volatile unsigned char *dirty;  /* a flag for each page */
+};
+
+#if defined AMXOVL
+#if !defined AUX_OVLPOOLSIZE
+  #define AUX_OVLPOOLSIZE 16384   /* size of the pool for the overlays */
+#endif
+#define AUX_OVLTAG  AMX_USERTAG('O','v','l','y')
+
+typedef struct tagAUX_OVERLAYS {
+  AMX_POOL *pool;         /* the overlays that are in memory */
+  FILE *fp;               /* the program file, kept open if it is not mapped */
+  const unsigned char *image; /* the program file mapped in memory (or NULL) */
+  size_t imagesize;
+  long pos;               /* read position in the mapped file */
+  long *filepos;          /* file positions of the overlays, only for a program
+                           * in compact encoding (NULL otherwise) */
+  int *successor;         /* for each overlay, the one that was switched to next
+                           * (the last time), or -1 */
+  int numoverlays;
+  int current;            /* overlay that is currently loaded, or -1 */
+} AUX_OVERLAYS;
+#endif
+
+/* align_header() swaps the header fields that the loaders use; a plain image
+ * is in Little Endian, but a prepared image is in native byte order
+ */
+static void align_header(AMX_HEADER *hdr)
+{
+  if (hdr->magic == AMX_MAGIC && (hdr->flags & AMX_FLAG_PREPARED) != 0)
+    return;
+  amx_Align16(&hdr->magic);
+  amx_Align16((uint16_t *)&hdr->flags);
+  amx_Align32((uint32_t *)&hdr->size);
+  amx_Align32((uint32_t *)&hdr->cod);
+  amx_Align32((uint32_t *)&hdr->dat);
+  amx_Align32((uint32_t *)&hdr->hea);
+  amx_Align32((uint32_t *)&hdr->stp);
+}
 
 size_t AMXAPI aux_ProgramSize(const char *filename)
 {
@@ -32,12 +125,390 @@ size_t AMXAPI aux_ProgramSize(const char *filename)
   fread(&hdr, sizeof hdr, 1, fp);
   fclose(fp);
 
-  amx_Align16(&hdr.magic);
-  amx_Align32((uint32_t *)&hdr.stp);
-  return (hdr.magic==AMX_MAGIC) ? (size_t)hdr.stp : 0;
+  align_header(&hdr);
+  if (hdr.magic!=AMX_MAGIC)
+    return 0;
+  #if defined AMXOVL
+    /* header, data section with stack and heap, and the overlay pool */
+    if ((hdr.flags & AMX_FLAG_OVERLAY)!=0)
+      return (size_t)(hdr.cod + (hdr.stp - hdr.dat)) + AUX_OVLPOOLSIZE;
+  #endif
+  return (size_t)hdr.stp;
+}
+
+#if defined AUX_LOAD_MMAP
+/* map_program() maps the file (header, code and initialized data) into memory
+ * and allocates only the data section with the stack and heap.
+ * By default, the mapping is private and writable: amx_Init() patches the
+ * code as usual (superinstructions, case tables, intrinsics and, on some
+ * cores, relocation) and every page that it writes to becomes a private copy;
+ * the pages that it leaves alone stay shared with the page cache.
+ * With AMX_FLAG_SHARED in "flags", the code is mapped read-only, so that all
+ * processes running the same script share all of its pages, but amx_Init()
+ * then leaves the code as it is and the script runs without these
+ * optimizations. Only the pages with the header are writable (the native
+ * function table is filled in when the functions are registered).
+ */
+static int map_program(AMX *amx, FILE *fp, const AMX_HEADER *hdr, int flags)
+{
+  struct stat st;
+  unsigned char *image, *data;
+  size_t pagesize, prefix;
+  int result;
+
+  if (fstat(fileno(fp), &st) != 0 || st.st_size < (off_t)hdr->size || hdr->cod >= hdr->size)
+    return AMX_ERR_FORMAT;
+  image = (unsigned char *)mmap(NULL, (size_t)hdr->size,
+                                ((flags & AMX_FLAG_SHARED) != 0) ? PROT_READ : PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE, fileno(fp), 0);
+  if (image == MAP_FAILED)
+    return AMX_ERR_MEMORY;
+  pagesize = (size_t)sysconf(_SC_PAGESIZE);
+  prefix = ((size_t)hdr->cod + pagesize - 1) & ~(pagesize - 1);
+  if ((flags & AMX_FLAG_SHARED) != 0 && mprotect(image, prefix, PROT_READ | PROT_WRITE) != 0) {
+    munmap(image, (size_t)hdr->size);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  if ((data = (unsigned char *)malloc((size_t)(hdr->stp - hdr->dat))) == NULL) {
+    munmap(image, (size_t)hdr->size);
+    return AMX_ERR_MEMORY;
+  } /* if */
+
+  /* amx_Init() copies the initialized data from the file into the data block */
+  memset(amx, 0, sizeof *amx);
+  amx->data = data;
+  amx->flags = flags & (AMX_FLAG_SHARED | AMX_FLAG_PREPARED | AMX_FLAG_INTRINSICS);
+  result = amx_Init(amx, image);
+  if (result != AMX_ERR_NONE) {
+    munmap(image, (size_t)hdr->size);
+    free(data);
+    memset(amx, 0, sizeof *amx);
+  } /* if */
+  return result;
+}
+#endif
+
+#if defined AMXOVL
+static void ovl_seek(AUX_OVERLAYS *ovl, long pos)
+{
+  if (ovl->image != NULL)
+    ovl->pos = pos;
+  else
+    fseek(ovl->fp, pos, SEEK_SET);
+}
+
+static int ovl_getc(AUX_OVERLAYS *ovl)
+{
+  if (ovl->image != NULL)
+    return ((size_t)ovl->pos < ovl->imagesize) ? ovl->image[ovl->pos++] : EOF;
+  return getc(ovl->fp);
+}
+
+/* ovl_read() reads "size" bytes of code or data from the file into "dest";
+ * in compact encoding (see expand() in AMX.C), "pos" is the position of the
+ * compressed cells and "size" is the expanded size
+ */
+static int ovl_read(AUX_OVERLAYS *ovl, long pos, cell *dest, long size, int compact)
+{
+  long count;
+  ucell c;
+  int b;
+
+  if (!compact) {
+    if (ovl->image != NULL) {
+      if (pos < 0 || (size_t)pos + (size_t)size > ovl->imagesize)
+        return AMX_ERR_FORMAT;
+      memcpy(dest, ovl->image + pos, (size_t)size);
+      return AMX_ERR_NONE;
+    } /* if */
+    fseek(ovl->fp, pos, SEEK_SET);
+    return (fread(dest, 1, (size_t)size, ovl->fp) == (size_t)size) ? AMX_ERR_NONE : AMX_ERR_FORMAT;
+  } /* if */
+
+  ovl_seek(ovl, pos);
+  for (count = size / (long)sizeof(cell); count > 0; count--) {
+    b = ovl_getc(ovl);
+    c = ((b & 0x40) != 0) ? ~(ucell)0 : 0;  /* sign extension */
+    for ( ;; ) {
+      if (b == EOF)
+        return AMX_ERR_FORMAT;
+      c = (c << 7) | (ucell)(b & 0x7f);
+      if ((b & 0x80) == 0)
+        break;
+      b = ovl_getc(ovl);
+    } /* for */
+    *dest++ = (cell)c;
+  } /* for */
+  return AMX_ERR_NONE;
+}
+
+/* ovl_index() looks up the file positions of the overlays and of the data
+ * section of a program in compact encoding (the overlay table holds the
+ * offsets in the expanded code); it returns the position of the data section,
+ * or -1 on failure
+ */
+static long ovl_index(AUX_OVERLAYS *ovl, const unsigned char *header, const AMX_HEADER *hdr)
+{
+  const AMX_OVERLAYINFO *tbl = (const AMX_OVERLAYINFO *)(header + ((const AMX_HEADER *)header)->overlays);
+  long pos = 0, cellnum = 0, target;
+  int i, b;
+
+  if ((ovl->filepos = (long *)malloc((ovl->numoverlays + 1) * sizeof(long))) == NULL)
+    return -1;
+  /* overlays are normally in the order of the code, so this is usually a
+   * single pass through the file; the data section comes last; the last byte
+   * of every cell has the high bit clear
+   */
+  for (i = 0; i <= ovl->numoverlays; i++) {
+    if (i < ovl->numoverlays)
+      target = tbl[i].offset / (long)sizeof(cell);
+    else
+      target = (hdr->dat - hdr->cod) / (long)sizeof(cell);
+    if (i == 0 || target < cellnum) {
+      pos = hdr->cod;
+      cellnum = 0;
+      ovl_seek(ovl, pos);
+    } /* if */
+    while (cellnum < target) {
+      if ((b = ovl_getc(ovl)) == EOF)
+        return -1;
+      pos++;
+      if ((b & 0x80) == 0)
+        cellnum++;
+    } /* while */
+    ovl->filepos[i] = pos;
+  } /* for */
+  return ovl->filepos[ovl->numoverlays];
+}
+
+/* ovl_prefetch() asks the operating system to read the file range of an
+ * overlay ahead, so that loading it later does not wait for the disk; the
+ * read-ahead runs asynchronously in the kernel
+ */
+static void ovl_prefetch(AUX_OVERLAYS *ovl, const AMX_HEADER *hdr, int index)
+{
+  #if defined AUX_LOAD_MMAP
+    const AMX_OVERLAYINFO *tbl = (const AMX_OVERLAYINFO *)((const unsigned char *)hdr + hdr->overlays) + index;
+    long start, size;
+
+    if (ovl->filepos != NULL) {
+      start = ovl->filepos[index];
+      size = ovl->filepos[index + 1] - start; /* if the overlays are in order */
+      if (size <= 0)
+        size = tbl->size;
+    } else {
+      start = hdr->cod + tbl->offset;
+      size = tbl->size;
+    } /* if */
+    if (ovl->image != NULL) {
+      size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+      size_t first = (size_t)start & ~(pagesize - 1);
+      size_t last = (size_t)(start + size);
+      if (last > ovl->imagesize)
+        last = ovl->imagesize;
+      if (first < last)
+        madvise((void *)(ovl->image + first), last - first, MADV_WILLNEED);
+    } else {
+      #if defined POSIX_FADV_WILLNEED
+        posix_fadvise(fileno(ovl->fp), (off_t)start, (off_t)size, POSIX_FADV_WILLNEED);
+      #endif
+    } /* if */
+  #else
+    (void)ovl;
+    (void)hdr;
+    (void)index;
+  #endif
+}
+
+static int AMXAPI ovl_load(AMX *amx, int index)
+{
+  AUX_OVERLAYS *ovl;
+  AMX_HEADER *hdr;
+  AMX_OVERLAYINFO *tbl;
+  long pos;
+  int next;
+
+  if (amx_GetUserData(amx, AUX_OVLTAG, (void **)&ovl) != AMX_ERR_NONE)
+    return AMX_ERR_OVERLAY;
+  if (index < 0 || index >= ovl->numoverlays)
+    return AMX_ERR_OVERLAY;
+  hdr = (AMX_HEADER *)amx->base;
+  tbl = (AMX_OVERLAYINFO *)(amx->base + hdr->overlays) + index;
+
+  /* record the call graph as it is walked: calls and returns both switch
+   * overlays, so this is the overlay that is likely to be needed after the
+   * current one
+   */
+  if (ovl->current >= 0)
+    ovl->successor[ovl->current] = index;
+  ovl->current = index;
+
+  amx->codesize = tbl->size;
+  if ((amx->code = amx_poolfind(ovl->pool, index)) != NULL)
+    return AMX_ERR_NONE;
+  if ((amx->code = amx_poolalloc(ovl->pool, tbl->size, index)) == NULL)
+    return AMX_ERR_OVERLAY;     /* failure allocating memory for the overlay */
+  pos = (ovl->filepos != NULL) ? ovl->filepos[index] : hdr->cod + tbl->offset;
+  if (ovl_read(ovl, pos, (cell *)amx->code, tbl->size, ovl->filepos != NULL) != AMX_ERR_NONE) {
+    amx_poolfree(ovl->pool, amx->code);
+    amx->code = NULL;
+    return AMX_ERR_OVERLAY;
+  } /* if */
+
+  /* this overlay was not in the pool, so the one that followed it the last
+   * time may have been evicted too: have it read ahead
+   */
+  if ((next = ovl->successor[index]) >= 0 && next != index)
+    ovl_prefetch(ovl, hdr, next);
+  return AMX_ERR_NONE;
+}
+
+static void ovl_free(AUX_OVERLAYS *ovl)
+{
+  #if defined AUX_LOAD_MMAP
+    if (ovl->image != NULL)
+      munmap((void *)ovl->image, ovl->imagesize);
+  #endif
+  if (ovl->fp != NULL)
+    fclose(ovl->fp);
+  free(ovl->filepos);
+  free(ovl->successor);
+  free(ovl);
+}
+
+/* load_overlays() loads the header and the data section of a program with
+ * overlays; the overlays are loaded on demand into a pool behind the data
+ * section (with the stack and heap). The program file stays mapped in memory
+ * (or open, if it cannot be mapped) until aux_FreeProgram(), so that an
+ * overlay that is not in the pool is a copy from the page cache rather than
+ * a file open, seek and read. The overlay loader records which overlay
+ * follows which at run time, and on a miss it has the predicted next overlay
+ * read ahead.
+ * The function takes over the FILE pointer.
+ */
+static int load_overlays(AMX *amx, FILE *fp, const AMX_HEADER *hdr, void *memblock)
+{
+  AUX_OVERLAYS *ovl;
+  unsigned char *block;
+  uint32_t overlays, nametable;
+  long datapos;
+  int i, result, compact;
+
+  if ((ovl = (AUX_OVERLAYS *)calloc(1, sizeof(AUX_OVERLAYS))) == NULL) {
+    fclose(fp);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  ovl->fp = fp;
+  ovl->current = -1;
+  block = (unsigned char *)memblock;
+  if (block == NULL && (block = (unsigned char *)malloc((size_t)(hdr->cod + (hdr->stp - hdr->dat)) + AUX_OVLPOOLSIZE)) == NULL) {
+    ovl_free(ovl);
+    return AMX_ERR_MEMORY;
+  } /* if */
+
+  /* read the complete header, with the overlay table */
+  result = AMX_ERR_FORMAT;
+  rewind(fp);
+  if (fread(block, 1, (size_t)hdr->cod, fp) != (size_t)hdr->cod)
+    goto error;
+  overlays = (uint32_t)((AMX_HEADER *)block)->overlays;
+  nametable = (uint32_t)((AMX_HEADER *)block)->nametable;
+  if ((hdr->flags & AMX_FLAG_PREPARED) == 0) {
+    amx_Align32(&overlays);
+    amx_Align32(&nametable);
+  } /* if */
+  if (nametable < overlays || nametable > (uint32_t)hdr->cod)
+    goto error;
+  ovl->numoverlays = (int)((nametable - overlays) / sizeof(AMX_OVERLAYINFO));
+  result = AMX_ERR_MEMORY;
+  if ((ovl->successor = (int *)malloc((ovl->numoverlays + 1) * sizeof(int))) == NULL)
+    goto error;
+
+  #if defined AUX_LOAD_MMAP
+  {
+    struct stat st;
+    void *image;
+    if (fstat(fileno(fp), &st) == 0 && st.st_size >= (off_t)hdr->size) {
+      image = mmap(NULL, (size_t)hdr->size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+      if (image != MAP_FAILED) {
+        ovl->image = (const unsigned char *)image;
+        ovl->imagesize = (size_t)hdr->size;
+        fclose(fp);
+        ovl->fp = NULL;
+      } /* if */
+    } /* if */
+  }
+  #endif
+
+  /* read (or expand) the data section, put it behind the header */
+  result = AMX_ERR_FORMAT;
+  compact = (hdr->flags & AMX_FLAG_COMPACT) != 0;
+  datapos = compact ? ovl_index(ovl, block, hdr) : hdr->dat;
+  if (datapos < 0 || ovl_read(ovl, datapos, (cell *)(block + hdr->cod), hdr->hea - hdr->dat, compact) != AMX_ERR_NONE)
+    goto error;
+
+  memset(amx, 0, sizeof *amx);
+  amx->data = block + hdr->cod;
+  amx->overlay = ovl_load;
+  ovl->pool = amx_poolinit(block + hdr->cod + (hdr->stp - hdr->dat), AUX_OVLPOOLSIZE);
+  if (ovl->pool == NULL) {
+    result = AMX_ERR_MEMORY;
+    goto error;
+  } /* if */
+  if ((result = amx_SetUserData(amx, AUX_OVLTAG, ovl)) == AMX_ERR_NONE)
+    result = amx_Init(amx, block);
+  if (result == AMX_ERR_NONE) {
+    /* amx_Init() has loaded every overlay in turn, which is not how they are
+     * called
+     */
+    for (i = 0; i < ovl->numoverlays; i++)
+      ovl->successor[i] = -1;
+    ovl->current = -1;
+    return AMX_ERR_NONE;
+  } /* if */
+
+error:
+  ovl_free(ovl);
+  if (memblock == NULL)
+    free(block);
+  memset(amx, 0, sizeof *amx);
+  return result;
+}
+#endif
+
+/* add_index() adds a hash index for amx_FindPublic() and amx_FindPubVar();
+ * the program runs without one too, so a failure to allocate it is not an
+ * error
+ */
+static void add_index(AMX *amx)
+{
+  long size;
+  void *index;
+  if (amx_IndexSize(amx, &size) == AMX_ERR_NONE && (index = malloc((size_t)size)) != NULL)
+    amx_SetIndex(amx, index);
 }
 
 int AMXAPI aux_LoadProgram(AMX *amx, const char *filename, void *memblock)
+{
+  return aux_LoadProgramEx(amx, filename, memblock, 0);
+}
+
+/* aux_LoadProgramEx() is aux_LoadProgram() with options in "flags":
+ * AMX_FLAG_PREPARED accepts a prepared image (see aux_PrepareProgram()),
+ * whose code is not verified; use it only for files from a trusted location.
+ * Without this flag, a prepared image is refused with AMX_ERR_FORMAT, so
+ * aux_LoadProgram() always verifies the code.
+ * AMX_FLAG_SHARED maps the code read-only, so that it is shared between all
+ * processes that run the same script, at the expense of the optimizations
+ * that amx_Init() applies to the code (see map_program()); the flag is
+ * ignored if the program is not mapped (if "memblock" is given, or for a
+ * program with overlays or in compact encoding).
+ * AMX_FLAG_INTRINSICS lets amx_Init() replace calls to the float and fixed
+ * point natives by instructions; set it only if these natives are the ones
+ * from amxfloat.c and amxfixed.c (for example, the amxFloat and amxFixed
+ * extension modules).
+ */
+int AMXAPI aux_LoadProgramEx(AMX *amx, const char *filename, void *memblock, int flags)
 {
   FILE *fp;
   AMX_HEADER hdr;
@@ -47,39 +518,66 @@ int AMXAPI aux_LoadProgram(AMX *amx, const char *filename, void *memblock)
   if ((fp = fopen(filename, "rb")) == NULL)
     return AMX_ERR_NOTFOUND;
   fread(&hdr, sizeof hdr, 1, fp);
-  amx_Align16(&hdr.magic);
-  amx_Align32((uint32_t *)&hdr.size);
-  amx_Align32((uint32_t *)&hdr.stp);
+  align_header(&hdr);
   if (hdr.magic != AMX_MAGIC) {
     fclose(fp);
     return AMX_ERR_FORMAT;
   } /* if */
 
-  /* allocate the memblock if it is NULL */
-  didalloc = 0;
-  if (memblock == NULL) {
-    if ((memblock = malloc(hdr.stp)) == NULL) {
-      fclose(fp);
-      return AMX_ERR_MEMORY;
+  #if defined AMXOVL
+    if ((hdr.flags & AMX_FLAG_OVERLAY) != 0) {
+      result = load_overlays(amx, fp, &hdr, memblock);
+      if (result == AMX_ERR_NONE && memblock == NULL)
+        add_index(amx);
+      return result;
     } /* if */
-    didalloc = 1;
-    /* after amx_Init(), amx->base points to the memory block */
-  } /* if */
+  #endif
 
-  /* read in the file */
-  rewind(fp);
-  fread(memblock, 1, (size_t)hdr.size, fp);
-  fclose(fp);
+  /* if no memblock is given, map the file instead of reading it; programs
+   * with overlays cannot be mapped (the overlays are read into memory at run
+   * time), nor can programs in compact encoding (amx_Init() expands these in
+   * the memory block), and if mapping fails for another reason (for example,
+   * because the abstract machine core must patch the code), the file is read
+   * as well
+   */
+  result = AMX_ERR_GENERAL;
+  #if defined AUX_LOAD_MMAP
+    if (memblock == NULL && (hdr.flags & (AMX_FLAG_OVERLAY | AMX_FLAG_COMPACT)) == 0)
+      result = map_program(amx, fp, &hdr, flags);
+  #endif
+  didalloc = 1;
+  if (result != AMX_ERR_NONE) {
+    /* allocate the memblock if it is NULL */
+    didalloc = 0;
+    if (memblock == NULL) {
+      if ((memblock = malloc(hdr.stp)) == NULL) {
+        fclose(fp);
+        return AMX_ERR_MEMORY;
+      } /* if */
+      didalloc = 1;
+      /* after amx_Init(), amx->base points to the memory block */
+    } /* if */
 
-  /* initialize the abstract machine */
-  memset(amx, 0, sizeof *amx);
-  result = amx_Init(amx, memblock);
+    /* read in the file */
+    rewind(fp);
+    fread(memblock, 1, (size_t)hdr.size, fp);
 
-  /* free the memory block on error, if it was allocated here */
-  if (result != AMX_ERR_NONE && didalloc) {
-    free(memblock);
-    amx->base = NULL;                   /* avoid a double free */
+    /* initialize the abstract machine */
+    memset(amx, 0, sizeof *amx);
+    amx->flags = flags & (AMX_FLAG_PREPARED | AMX_FLAG_INTRINSICS);
+    result = amx_Init(amx, memblock);
+
+    /* free the memory block on error, if it was allocated here */
+    if (result != AMX_ERR_NONE && didalloc) {
+      free(memblock);
+      amx->base = NULL;                 /* avoid a double free */
+    } /* if */
   } /* if */
+  fclose(fp);
+
+  /* if the memory is allocated here, also add a hash index */
+  if (result == AMX_ERR_NONE && didalloc)
+    add_index(amx);
 
   return result;
 }
@@ -87,13 +585,126 @@ int AMXAPI aux_LoadProgram(AMX *amx, const char *filename, void *memblock)
 int AMXAPI aux_FreeProgram(AMX *amx)
 {
   if (amx->base!=NULL) {
+    #if defined AUX_LOAD_MMAP
+      /* a mapped program has its data section in a separate block */
+      int mapped = (amx->data!=NULL);
+    #endif
+    #if defined AMXOVL
+      AUX_OVERLAYS *ovl;
+      if (amx_GetUserData(amx, AUX_OVLTAG, (void **)&ovl)==AMX_ERR_NONE) {
+        ovl_free(ovl);
+        #if defined AUX_LOAD_MMAP
+          mapped = 0;
+        #endif
+      } /* if */
+    #endif
     amx_Cleanup(amx);
-    free(amx->base);
+    if (amx->nameindex!=NULL)
+      free(amx->nameindex);
+    #if defined AUX_LOAD_MMAP
+      if (mapped) {
+        munmap(amx->base, (size_t)((AMX_HEADER *)amx->base)->size);
+        free(amx->data);
+      } else {
+        free(amx->base);
+      } /* if */
+    #else
+      free(amx->base);
+    #endif
     memset(amx, 0, sizeof(AMX));
   } /* if */
   return AMX_ERR_NONE;
 }
 
+/* aux_PrepareProgram() loads a program and stores it as a prepared image:
+ * with the code verified for the current abstract machine core (and with
+ * superinstructions), and with the header, the tables and the code in native
+ * byte order. aux_LoadProgramEx() with AMX_FLAG_PREPARED loads such an image
+ * without verifying the code again (it only checks a checksum), so the
+ * prepared image must be kept in a trusted location; aux_LoadProgram() refuses
+ * it. The source must be a plain program. A program in compact encoding is
+ * stored expanded, which spares the expansion on every load. Any debug
+ * information is copied too.
+ */
+int AMXAPI aux_PrepareProgram(const char *source, const char *target)
+{
+  AMX amx;
+  AMX_HEADER *hdr;
+  AMX_PREPARED prep;
+  FILE *fsrc, *ftgt;
+  unsigned char *memblock, *prefix, *data;
+  size_t size, prefixsize;
+  long srcsize;
+  int i, numlibraries, result;
+  char buffer[512];
+
+  if ((size = aux_ProgramSize(source)) == 0)
+    return AMX_ERR_NOTFOUND;
+  if ((memblock = malloc(size)) == NULL)
+    return AMX_ERR_MEMORY;
+  /* load it in the memory block, so that it is not mapped and it can be
+   * patched with superinstructions
+   */
+  if ((result = aux_LoadProgram(&amx, source, memblock)) != AMX_ERR_NONE) {
+    free(memblock);
+    return result;
+  } /* if */
+  if ((result = amx_GetPrepared(&amx, &prep)) != AMX_ERR_NONE) {
+    aux_FreeProgram(&amx);
+    return result;
+  } /* if */
+
+  /* make a copy of the header and the tables, and adjust it: the record is
+   * inserted in front of the code, and the library handles that amx_Init()
+   * stored in the table are cleared
+   */
+  hdr = (AMX_HEADER *)amx.base;
+  data = (amx.data != NULL) ? amx.data : amx.base + (int)hdr->dat;
+  srcsize = hdr->size;
+  prefixsize = (size_t)hdr->cod;
+  if ((prefix = malloc(prefixsize)) == NULL) {
+    aux_FreeProgram(&amx);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  memcpy(prefix, amx.base, prefixsize);
+  hdr = (AMX_HEADER *)prefix;
+  hdr->size = hdr->hea;       /* the code and data are written expanded */
+  hdr->flags |= AMX_FLAG_PREPARED;
+  hdr->cod += sizeof prep;
+  hdr->dat += sizeof prep;
+  hdr->hea += sizeof prep;
+  hdr->stp += sizeof prep;
+  hdr->size += sizeof prep;
+  numlibraries = (int)((hdr->pubvars - hdr->libraries) / hdr->defsize);
+  for (i = 0; i < numlibraries; i++)
+    ((AMX_FUNCSTUB *)(prefix + hdr->libraries + i * hdr->defsize))->address = 0;
+
+  /* write the image, followed by the debug information from the source */
+  result = AMX_ERR_NOTFOUND;
+  fsrc = fopen(source, "rb");
+  ftgt = (fsrc != NULL) ? fopen(target, "wb") : NULL;
+  if (ftgt != NULL) {
+    fwrite(prefix, 1, prefixsize, ftgt);
+    fwrite(&prep, 1, sizeof prep, ftgt);
+    fwrite(amx.code, 1, (size_t)amx.codesize, ftgt);
+    fwrite(data, 1, (size_t)(hdr->hea - hdr->dat), ftgt);
+    fseek(fsrc, srcsize, SEEK_SET);
+    while ((size = fread(buffer, 1, sizeof buffer, fsrc)) > 0)
+      fwrite(buffer, 1, size, ftgt);
+    result = (ferror(ftgt) == 0) ? AMX_ERR_NONE : AMX_ERR_GENERAL;
+    if (fclose(ftgt) != 0)
+      result = AMX_ERR_GENERAL;
+    if (result != AMX_ERR_NONE)
+      remove(target);
+  } /* if */
+  if (fsrc != NULL)
+    fclose(fsrc);
+
+  free(prefix);
+  aux_FreeProgram(&amx);
+  return result;
+}
+
 char * AMXAPI aux_StrError(int errnum)
 {
 static char *messages[] = {
@@ -111,7 +722,7 @@ static char *messages[] = {
       /* AMX_ERR_DIVIDE    */ "Divide by zero",
       /* AMX_ERR_SLEEP     */ "(sleep mode)",
       /* AMX_ERR_INVSTATE  */ "Invalid state",
-      /* 14 */                "(reserved)",
+      /* AMX_ERR_FUEL      */ "Instruction budget exhausted",
       /* 15 */                "(reserved)",
       /* AMX_ERR_MEMORY    */ "Out of memory",
       /* AMX_ERR_FORMAT    */ "Invalid/unsupported P-code file format",
@@ -162,3 +773,460 @@ int AMXAPI aux_GetSection(const AMX *amx, int section, cell **start, size_t *siz
   } /* switch */
   return AMX_ERR_NONE;
 }
+
+#if defined AUX_POOL_MMAP
+/* write_all() writes the complete buffer, continuing after a short write or an
+ * interrupted call; it returns 0 on failure
+ */
+static int write_all(int fd, const unsigned char *buffer, size_t size)
+{
+  while (size > 0) {
+    ssize_t count = write(fd, buffer, size);
+    if (count <= 0) {
+      if (count < 0 && errno == EINTR)
+        continue;
+      return 0;
+    } /* if */
+    buffer += count;
+    size -= (size_t)count;
+  } /* while */
+  return 1;
+}
+#endif
+
+/* aux_CreatePool()
+ * Creates a pool for fast creation and reset of instances of a program. The
+ * program must be initialized and its native functions registered; if the
+ * instances run in separate threads, call amx_Freeze() on it as well.
+ *
+ * On Unix-like systems, the data block of every instance (the data section
+ * plus the heap and the stack) is a private (copy-on-write) mapping of a
+ * pristine image of the data block. Creating or resetting an instance then
+ * only costs page faults for the pages that the script actually modifies. On
+ * other systems, the pristine image is copied. (For a small data section, of
+ * a few hundred kilobytes, amx_Clone() on a malloc'ed block is just as fast.)
+ *
+ * The data section is taken from the program at the time of this call. The
+ * functions that create and release instances may be called from several
+ * threads at once (the list of released data blocks has a lock).
+ */
+int AMXAPI aux_CreatePool(AMX *amx, AUX_POOL **pool)
+{
+  AUX_POOL *p;
+  AMX_HEADER *hdr;
+  unsigned char *image;
+  long datasize, stackheap;
+  int result;
+
+  if (amx == NULL || pool == NULL)
+    return AMX_ERR_PARAMS;
+  *pool = NULL;
+  if ((amx->flags & AMX_FLAG_INIT) == 0)
+    return AMX_ERR_INIT;
+  if ((result = amx_MemInfo(amx, NULL, &datasize, &stackheap)) != AMX_ERR_NONE)
+    return result;
+  hdr = (AMX_HEADER *)amx->base;
+
+  if ((p = (AUX_POOL *)malloc(sizeof(AUX_POOL))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(p, 0, sizeof(AUX_POOL));
+  p->amx = amx;
+  p->size = (size_t)(datasize + stackheap);
+
+  /* build the pristine data block: the data section, followed by a zero-
+   * filled heap and stack (which includes the zero cell at the top of the stack)
+   */
+  if ((image = (unsigned char *)calloc(1, p->size)) == NULL) {
+    free(p);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  memcpy(image, (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat, (size_t)datasize);
+
+  #if defined AUX_POOL_MMAP
+    /* store the image in a file that lives in memory (or in the cache) */
+    {
+      long pagesize = sysconf(_SC_PAGESIZE);
+      p->size = (p->size + pagesize - 1) & ~(pagesize - 1);
+    }
+    #if defined MFD_CLOEXEC
+      p->fd = memfd_create("amx-pool", MFD_CLOEXEC);
+    #else
+      p->fd = -1;
+    #endif
+    if (p->fd < 0 && (p->fp = tmpfile()) != NULL)
+      p->fd = fileno(p->fp);
+    if (p->fd < 0 || ftruncate(p->fd, (off_t)p->size) != 0
+        || !write_all(p->fd, image, (size_t)(datasize + stackheap))) {
+      if (p->fp != NULL)
+        fclose(p->fp);
+      else if (p->fd >= 0)
+        close(p->fd);
+      free(image);
+      free(p);
+      return AMX_ERR_MEMORY;
+    } /* if */
+    free(image);
+  #else
+    p->image = image;
+  #endif
+  #if defined AUX_POOL_LOCK
+    pool_lockinit(&p->lock);
+  #endif
+
+  *pool = p;
+  return AMX_ERR_NONE;
+}
+
+/* aux_DeletePool()
+ * Frees the pool. All instances must have been released with
+ * aux_FreeInstance() before; the program itself is not freed.
+ */
+int AMXAPI aux_DeletePool(AUX_POOL *pool)
+{
+  int i;
+
+  if (pool == NULL)
+    return AMX_ERR_PARAMS;
+  for (i = 0; i < pool->numfree; i++) {
+    #if defined AUX_POOL_MMAP
+      munmap(pool->freelist[i], pool->size);
+    #else
+      free(pool->freelist[i]);
+    #endif
+  } /* for */
+  free(pool->freelist);
+  #if defined AUX_POOL_MMAP
+    if (pool->fp != NULL)
+      fclose(pool->fp);
+    else
+      close(pool->fd);
+  #else
+    free(pool->image);
+  #endif
+  #if defined AUX_POOL_LOCK
+    pool_lockdelete(&pool->lock);
+  #endif
+  free(pool);
+  return AMX_ERR_NONE;
+}
+
+/* reset_block() restores the data block to the pristine image; with mmap(),
+ * the modified (private) pages are discarded, either with madvise() (Linux
+ * then maps the pages of the file again) or by replacing the mapping by a
+ * fresh one at the same address
+ */
+static int reset_block(AUX_POOL *pool, void *block)
+{
+  #if defined AUX_POOL_MMAP
+    #if defined MADV_DONTNEED && defined __LINUX__
+      if (madvise(block, pool->size, MADV_DONTNEED) == 0)
+        return AMX_ERR_NONE;
+    #endif
+    if (mmap(block, pool->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, pool->fd, 0) == MAP_FAILED)
+      return AMX_ERR_MEMORY;
+  #else
+    memcpy(block, pool->image, pool->size);
+  #endif
+  return AMX_ERR_NONE;
+}
+
+/* aux_CloneInstance()
+ * Creates a new instance of the program in the pool; the instance is a clone
+ * (see amx_Clone()) with its own data, heap and stack. The AMX structure
+ * should be cleared to zero before the call, except perhaps for the callback
+ * and the debug hook (which are otherwise copied from the program).
+ */
+int AMXAPI aux_CloneInstance(AUX_POOL *pool, AMX *amx)
+{
+  void *block;
+  int result;
+
+  if (pool == NULL || amx == NULL)
+    return AMX_ERR_PARAMS;
+  block = NULL;
+  #if defined AUX_POOL_LOCK
+    pool_lock(&pool->lock);
+  #endif
+  if (pool->numfree > 0)
+    block = pool->freelist[--pool->numfree];
+  #if defined AUX_POOL_LOCK
+    pool_unlock(&pool->lock);
+  #endif
+  if (block == NULL) {
+    #if defined AUX_POOL_MMAP
+      block = mmap(NULL, pool->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, pool->fd, 0);
+      if (block == MAP_FAILED)
+        return AMX_ERR_MEMORY;
+    #else
+      if ((block = malloc(pool->size)) == NULL)
+        return AMX_ERR_MEMORY;
+      memcpy(block, pool->image, pool->size);
+    #endif
+  } /* if */
+
+  amx->flags = AMX_FLAG_DSEG_INIT;      /* the data block is already initialized */
+  result = amx_Clone(amx, pool->amx, block);
+  if (result != AMX_ERR_NONE) {
+    amx->data = block;
+    aux_FreeInstance(pool, amx);
+  } /* if */
+  return result;
+}
+
+/* aux_ResetInstance()
+ * Returns the instance to the state that it had right after it was created.
+ */
+int AMXAPI aux_ResetInstance(AUX_POOL *pool, AMX *amx)
+{
+  int result;
+
+  if (pool == NULL || amx == NULL || amx->data == NULL)
+    return AMX_ERR_PARAMS;
+  if ((result = reset_block(pool, amx->data)) != AMX_ERR_NONE)
+    return result;
+  amx->flags = AMX_FLAG_DSEG_INIT;
+  return amx_Clone(amx, pool->amx, amx->data);
+}
+
+/* aux_FreeInstance()
+ * Releases the instance; its data block is kept in the pool for re-use.
+ */
+int AMXAPI aux_FreeInstance(AUX_POOL *pool, AMX *amx)
+{
+  void *block;
+  int kept;
+
+  if (pool == NULL || amx == NULL || amx->data == NULL)
+    return AMX_ERR_PARAMS;
+  block = amx->data;
+  memset(amx, 0, sizeof(AMX));
+  if (reset_block(pool, block) != AMX_ERR_NONE) {
+    #if defined AUX_POOL_MMAP
+      munmap(block, pool->size);
+    #else
+      free(block);
+    #endif
+    return AMX_ERR_NONE;
+  } /* if */
+
+  kept = 1;
+  #if defined AUX_POOL_LOCK
+    pool_lock(&pool->lock);
+  #endif
+  if (pool->numfree >= pool->maxfree) {
+    int max = (pool->maxfree == 0) ? 8 : 2 * pool->maxfree;
+    void **list = (void **)realloc(pool->freelist, max * sizeof(void *));
+    if (list != NULL) {
+      pool->freelist = list;
+      pool->maxfree = max;
+    } else {
+      kept = 0;
+    } /* if */
+  } /* if */
+  if (kept)
+    pool->freelist[pool->numfree++] = block;
+  #if defined AUX_POOL_LOCK
+    pool_unlock(&pool->lock);
+  #endif
+  if (!kept) {
+    #if defined AUX_POOL_MMAP
+      munmap(block, pool->size);
+    #else
+      free(block);
+    #endif
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+#if defined AUX_SNAPSHOT_MPROTECT
+static AUX_SNAPSHOT *snapshots = NULL;  /* all snapshots with tracked pages */
+static struct sigaction oldaction;      /* the SIGSEGV handler to chain to */
+static int handler_installed = 0;       /* snapshot_fault() is in the handler chain */
+static size_t pagesize;
+
+/* snapshot_fault() is the SIGSEGV handler: a write to a protected page marks
+ * the page as dirty and makes it writable again; any other fault is passed on
+ * to the previous handler
+ */
+static void snapshot_fault(int sig, siginfo_t *info, void *context)
+{
+  unsigned char *addr = (unsigned char *)info->si_addr;
+  AUX_SNAPSHOT *s;
+  int found = 0;
+
+  for (s = snapshots; s != NULL; s = s->next) {
+    if (addr >= s->pages && addr < s->pages + s->numpages * pagesize) {
+      size_t page = (size_t)(addr - s->pages) / pagesize;
+      if (!s->dirty[page]) {
+        s->dirty[page] = 1;
+        mprotect(s->pages + page * pagesize, pagesize, PROT_READ | PROT_WRITE);
+        found = 1;
+      } /* if */
+    } /* if */
+  } /* for */
+  if (found)
+    return;
+
+  if ((oldaction.sa_flags & SA_SIGINFO) != 0) {
+    oldaction.sa_sigaction(sig, info, context);
+  } else if (oldaction.sa_handler == SIG_DFL || oldaction.sa_handler == SIG_IGN) {
+    /* restore the default handler and return; the fault then happens again */
+    sigaction(SIGSEGV, &oldaction, NULL);
+  } else {
+    oldaction.sa_handler(sig);
+  } /* if */
+}
+#endif
+
+/* aux_Snapshot()
+ * Records the data section and the heap and stack pointers of an abstract
+ * machine (or a clone), so that aux_Restore() can later return the abstract
+ * machine to this state. Typically, the snapshot is made right after
+ * initialization.
+ *
+ * On Unix-like systems, the pages of the data section are write-protected
+ * after the snapshot; the first write to a page (by the script or by a native
+ * function) marks it as dirty, and aux_Restore() only copies back the dirty
+ * pages. A SIGSEGV handler is installed for this purpose (it passes on any
+ * other fault). Note that a system call (like read()) that writes directly
+ * into a protected page fails with EFAULT, rather than causing a fault. On
+ * other systems, aux_Restore() copies the complete data section.
+ *
+ * Snapshots should be made and freed while no script runs.
+ */
+int AMXAPI aux_Snapshot(AMX *amx, AUX_SNAPSHOT **snapshot)
+{
+  AUX_SNAPSHOT *s;
+  AMX_HEADER *hdr;
+
+  if (amx == NULL || snapshot == NULL)
+    return AMX_ERR_PARAMS;
+  *snapshot = NULL;
+  if ((amx->flags & AMX_FLAG_INIT) == 0)
+    return AMX_ERR_INIT;
+  hdr = (AMX_HEADER *)amx->base;
+
+  if ((s = (AUX_SNAPSHOT *)malloc(sizeof(AUX_SNAPSHOT))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(s, 0, sizeof(AUX_SNAPSHOT));
+  s->amx = amx;
+  s->data = (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat;
+  s->size = (size_t)(hdr->hea - hdr->dat);
+  s->hea = amx->hea;
+  s->stk = amx->stk;
+  if ((s->copy = (unsigned char *)malloc(s->size)) == NULL) {
+    free(s);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  memcpy(s->copy, s->data, s->size);
+
+  #if defined AUX_SNAPSHOT_MPROTECT
+    /* only whole pages are protected; the partial pages at the start and the
+     * end of the data section are always copied (other data may share them)
+     */
+    if (pagesize == 0)
+      pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    s->pages = (unsigned char *)(((uintptr_t)s->data + pagesize - 1) & ~(uintptr_t)(pagesize - 1));
+    if (s->pages + pagesize <= s->data + s->size)
+      s->numpages = (size_t)(s->data + s->size - s->pages) / pagesize;
+    if (s->numpages > 0) {
+      if ((s->dirty = (volatile unsigned char *)calloc(s->numpages, 1)) == NULL) {
+        free(s->copy);
+        free(s);
+        return AMX_ERR_MEMORY;
+      } /* if */
+      if (!handler_installed) {
+        struct sigaction action;
+        memset(&action, 0, sizeof action);
+        action.sa_sigaction = snapshot_fault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &oldaction);
+        handler_installed = 1;
+      } /* if */
+      s->next = snapshots;
+      snapshots = s;
+      mprotect(s->pages, s->numpages * pagesize, PROT_READ);
+    } /* if */
+  #endif
+
+  *snapshot = s;
+  return AMX_ERR_NONE;
+}
+
+/* aux_Restore()
+ * Returns the abstract machine to the state that was recorded in the
+ * snapshot. The abstract machine must not be running (or sleeping).
+ */
+int AMXAPI aux_Restore(AUX_SNAPSHOT *snapshot)
+{
+  AUX_SNAPSHOT *s = snapshot;
+
+  if (s == NULL)
+    return AMX_ERR_PARAMS;
+  #if defined AUX_SNAPSHOT_MPROTECT
+    if (s->numpages > 0) {
+      size_t head = (size_t)(s->pages - s->data);
+      size_t tail = head + s->numpages * pagesize;
+      size_t page;
+      int count = 0;
+      memcpy(s->data, s->copy, head);
+      memcpy(s->data + tail, s->copy + tail, s->size - tail);
+      for (page = 0; page < s->numpages; page++) {
+        if (s->dirty[page]) {
+          memcpy(s->pages + page * pagesize, s->copy + head + page * pagesize, pagesize);
+          s->dirty[page] = 0;
+          count++;
+        } /* if */
+      } /* for */
+      /* protect all pages in a single call (this also lets the kernel merge
+       * the mappings that were split by the fault handler)
+       */
+      if (count > 0)
+        mprotect(s->pages, s->numpages * pagesize, PROT_READ);
+    } else {
+      memcpy(s->data, s->copy, s->size);
+    } /* if */
+  #else
+    memcpy(s->data, s->copy, s->size);
+  #endif
+  s->amx->hea = s->hea;
+  s->amx->stk = s->stk;
+  s->amx->error = AMX_ERR_NONE;
+  return AMX_ERR_NONE;
+}
+
+/* aux_FreeSnapshot()
+ * Stops tracking the data section and frees the snapshot.
+ */
+int AMXAPI aux_FreeSnapshot(AUX_SNAPSHOT *snapshot)
+{
+  if (snapshot == NULL)
+    return AMX_ERR_PARAMS;
+  #if defined AUX_SNAPSHOT_MPROTECT
+    if (snapshot->numpages > 0) {
+      AUX_SNAPSHOT **link;
+      for (link = &snapshots; *link != NULL && *link != snapshot; link = &(*link)->next)
+        /* nothing */;
+      assert(*link == snapshot);
+      *link = snapshot->next;
+      mprotect(snapshot->pages, snapshot->numpages * pagesize, PROT_READ | PROT_WRITE);
+      if (snapshots == NULL) {
+        /* only remove the handler if no other handler was installed on top of
+         * it (that handler may chain to this one, which then just passes all
+         * faults on)
+         */
+        struct sigaction current;
+        if (sigaction(SIGSEGV, NULL, &current) == 0 && (current.sa_flags & SA_SIGINFO) != 0
+            && current.sa_sigaction == snapshot_fault) {
+          sigaction(SIGSEGV, &oldaction, NULL);
+          handler_installed = 0;
+        } /* if */
+      } /* if */
+      free((void *)snapshot->dirty);
+    } /* if */
+  #endif
+  free(snapshot->copy);
+  free(snapshot);
+  return AMX_ERR_NONE;
+}
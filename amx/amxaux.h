@@ -28,7 +28,9 @@ extern  "C" {
 /* loading and freeing programs */
 size_t AMXAPI aux_ProgramSize(const char *filename);
 int AMXAPI aux_LoadProgram(AMX *amx, const char *filename, void *memblock);
+int AMXAPI aux_LoadProgramEx(AMX *amx, const char *filename, void *memblock, int flags);
 int AMXAPI aux_FreeProgram(AMX *amx);
+int AMXAPI aux_PrepareProgram(const char *source, const char *target);
 
 /* a readable error message from an error code */
 char * AMXAPI aux_StrError(int errnum);
@@ -43,6 +45,20 @@ enum {
 };
 int AMXAPI aux_GetSection(const AMX *amx, int section, cell **start, size_t *size);
 
+/* a pool of instances (clones) of a single program */
+typedef struct tagAUX_POOL AUX_POOL;
+int AMXAPI aux_CreatePool(AMX *amx, AUX_POOL **pool);
+int AMXAPI aux_DeletePool(AUX_POOL *pool);
+int AMXAPI aux_CloneInstance(AUX_POOL *pool, AMX *amx);
+int AMXAPI aux_ResetInstance(AUX_POOL *pool, AMX *amx);
+int AMXAPI aux_FreeInstance(AUX_POOL *pool, AMX *amx);
+
+/* restoring an abstract machine to an earlier state */
+typedef struct tagAUX_SNAPSHOT AUX_SNAPSHOT;
+int AMXAPI aux_Snapshot(AMX *amx, AUX_SNAPSHOT **snapshot);
+int AMXAPI aux_Restore(AUX_SNAPSHOT *snapshot);
+int AMXAPI aux_FreeSnapshot(AUX_SNAPSHOT *snapshot);
+
 #ifdef  __cplusplus
 }
 #endif
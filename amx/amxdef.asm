@@ -30,6 +30,10 @@ IFDEF JIT
     ; the non-JIT version of the abstract machine
     _reloc_size DD ?            ; memory block for relocations
 ENDIF
+    _nameindex  DD ?            ; hash index on public names
+    _fuel       DD ?            ; budget of branches and calls
+    _fuelhook   DD ?            ; called when the budget drops to zero
+    _opstats    DD ?            ; opcode counters
 amx_s   ENDS
 
 amxhead_s   STRUC
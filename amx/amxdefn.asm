@@ -30,6 +30,10 @@ _codesize:   resd 1          ; memory size of the overlay or of the native code
         ; the non-JIT version of the abstract machine
 _reloc_size: resd 1          ; memory block for relocations
 %endif
+_nameindex:  resd 1          ; hash index on public names
+_fuel:       resd 1          ; budget of branches and calls
+_fuelhook:   resd 1          ; called when the budget drops to zero
+_opstats:    resd 1          ; opcode counters
 endstruc
 
 struc amxhead_s
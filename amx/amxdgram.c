@@ -217,9 +217,7 @@ static cell AMX_NATIVE_CALL n_sendstring(AMX *amx, const cell *params)
     message[2]='\xbf';
     /* if this is a wide string, convert it to UTF-8 */
     if ((ucell)*cstr<=UNPACKEDMAX) {
-      ptr=message+3;
-      while (*cstr!=0)
-        amx_UTF8Put(ptr, &ptr, length - (int)(ptr-message), *cstr++);
+      amx_UTF8Encode(message+3, &ptr, length, cstr, NULL);
       *ptr='\0';
     } else {
       amx_GetString(message+3, cstr, 0, UNLIMITED);
@@ -303,21 +301,18 @@ static int AMXAPI amx_DGramIdle(AMX *amx, int AMXAPI Exec(AMX *, cell *, int))
       err=Exec(amx,NULL,idxReceivePacket);
     } else {
       const char *msg=message;
+      cell *array;
       if (msg[0]=='\xef' && msg[1]=='\xbb' && msg[2]=='\xbf')
         msg+=3;                 /* skip BOM */
-      /* optionally convert from UTF-8 to a wide string */
-      if (amx_UTF8Check(msg,&chars)==AMX_ERR_NONE) {
-        cell *array=alloca((chars+1)*sizeof(cell));
-        cell *ptr=array;
-        if (array!=NULL) {
-          while (err==AMX_ERR_NONE && *msg!='\0')
-            amx_UTF8Get(msg,&msg,ptr++);
-          *ptr=0;               /* zero-terminate */
-          amx_PushArray(amx,NULL,array,chars+1);
-        } /* if */
-      } else {
+      /* optionally convert from UTF-8 to a wide string (a UTF-8 string never
+       * has more characters than bytes)
+       */
+      chars=(int)strlen(msg);
+      array=alloca((chars+1)*sizeof(cell));
+      if (array!=NULL && amx_UTF8Decode(msg,NULL,array,chars+1,&chars)==AMX_ERR_NONE)
+        amx_PushArray(amx,NULL,array,chars+1);
+      else
         amx_PushString(amx,NULL,msg,1,0);
-      } /* if */
       err=Exec(amx,NULL,idxReceiveString);
     } /* if */
     while (err==AMX_ERR_SLEEP)
@@ -77,6 +77,12 @@
 #if !defined SKIPPARAM
   #define SKIPPARAM(n)  ( cip=(cell *)cip+(n) ) /* for obsolete opcodes */
 #endif
+#if !defined SKIPOPCODE
+  #define SKIPOPCODE()  ( cip=(cell *)cip+1 )   /* for superinstructions */
+#endif
+#if defined AMX_DONT_RELOCATE && !defined AMX_NO_SUPERINSTR
+  #define AMX_NO_SUPERINSTR     /* superinstructions are created by patching the P-code */
+#endif
 
 /* PUSH() and POP() are defined in terms of the _R() and _W() macros */
 #define PUSH(v)         ( stk-=sizeof(cell), _W(data,stk,v) )
@@ -85,9 +91,34 @@
 #define ABORT(amx,v)    { (amx)->stk=reset_stk; (amx)->hea=reset_hea; return v; }
 
 #define STKMARGIN       ((cell)(16*sizeof(cell)))
-#define CHKMARGIN()     if (hea+STKMARGIN>stk) return AMX_ERR_STACKERR
+#if defined AMX_GUARDPAGES
+  /* the heap and the stack each have their limit, see amx_SetGuard() */
+  #define CHKMARGIN()   if (hea>amx->guard || stk<amx->guard+amx->guardsize) return AMX_ERR_STACKERR
+#elif defined AMX_GROWABLE
+  /* a growable data block commits more memory on demand, see amx_Grow() */
+  #define CHKMARGIN()   if (amx->guardsize!=0 ? (hea>amx->guard || stk-STKMARGIN<amx->guard+amx->guardsize) \
+                                                && amx_Grow(amx,hea,stk)!=AMX_ERR_NONE                      \
+                                              : hea+STKMARGIN>stk) return AMX_ERR_STACKERR
+#else
+  #define CHKMARGIN()   if (hea+STKMARGIN>stk) return AMX_ERR_STACKERR
+#endif
 #define CHKSTACK()      if (stk>amx->stp) return AMX_ERR_STACKLOW
 #define CHKHEAP()       if (hea<amx->hlw) return AMX_ERR_HEAPLOW
+#if defined AMX_SANDBOX
+  /* an invalid address faults, see guard_execute() in AMX.C */
+  #define CHKADDR(a)
+  #define CHKEND(a)
+#else
+  /* an address must lie in the data section, the heap or the stack;
+   * CHKEND() verifies the end of a range (exclusive) */
+  #define CHKADDR(a)    if (((a)>=hea && (a)<stk) || (ucell)(a)>=(ucell)amx->stp) ABORT(amx,AMX_ERR_MEMACCESS)
+  #define CHKEND(a)     if (((a)>hea && (a)<stk) || (ucell)(a)>(ucell)amx->stp) ABORT(amx,AMX_ERR_MEMACCESS)
+#endif
+#if defined AMX_NO_FUEL
+  #define CHKFUEL()
+#else
+  #define CHKFUEL()     if (--amx->fuel<=0) goto __fuel
+#endif
 
 #define JUMPREL(ip)     ((cell*)((unsigned long)(ip)+*(cell*)(ip)-sizeof(cell)))
 
@@ -95,18 +126,99 @@
 #if !defined AMX_NO_PACKED_OPC && !defined AMX_TOKENTHREADING
   #define AMX_TOKENTHREADING    /* packed opcodes require token threading */
 #endif
-#if defined AMX_TOKENTHREADING
+#if defined AMX_TOKENTHREADING && defined AMX_OPSTATS
+  /* the dispatch goes through "optable"; when counting is enabled (see
+   * amx_SetStats()), every entry in this table jumps to label __count, which
+   * counts the pair of opcodes and then jumps through amx_opcodelist; when
+   * counting is disabled, "optable" is amx_opcodelist itself, so that there is
+   * no test in the dispatch
+   */
+  #if defined AMX_NO_PACKED_OPC
+    #define NEXT(cip,op) do { o_=(int)*cip++; goto *optable[o_]; } while (0)
+  #else
+    #define NEXT(cip,op) do { o_=(int)((op=*cip++) & ((1 << sizeof(cell)*4)-1)); goto *optable[o_]; } while (0)
+  #endif
+#elif defined AMX_TOKENTHREADING
   #if defined AMX_NO_PACKED_OPC
     #define NEXT(cip,op) goto *amx_opcodelist[*cip++]
   #else
     #define NEXT(cip,op) goto *amx_opcodelist[(op=*cip++) & ((1 << sizeof(cell)*4)-1)]
   #endif
 #else
+  #if defined AMX_OPSTATS
+    #error Opcode statistics require token threading
+  #endif
   #if !defined AMX_NO_PACKED_OPC
     #error Packed opcodes support requires token threading
   #endif
   #define NEXT(cip,op)   goto **cip++
 #endif
+/* ISLABEL() tests whether a (relocated) opcode in the code is the label */
+#if defined AMX_TOKENTHREADING
+  #define ISLABEL(c,label)  (amx_opcodelist[(c) & ((1 << sizeof(cell)*4)-1)]==&&label)
+#else
+  #define ISLABEL(c,label)  ((const void *)(intptr_t)(c)==&&label)
+#endif
+
+/* see AMX.C */
+#define CALLNATIVE(amx,index,result,params) \
+        (((amx)->natives!=NULL && (index)>=0) \
+          ? ((amx)->error=AMX_ERR_NONE, *(result)=(amx)->natives[(int)(index)]((amx),(params)), (amx)->error) \
+          : (amx)->callback((amx),(index),(result),(params)))
+#if defined AMX_GUARDPAGES || defined AMX_SANDBOX
+  extern __thread int amx_guardcore;
+  #define HOSTCALL(call)  (amx_guardcore=0, (call), amx_guardcore=1)
+#else
+  #define HOSTCALL(call)  (call)
+#endif
+
+#if !defined AMX_NO_SUPERINSTR
+/* the arguments of an intrinsic are where the native function would find
+ * them, see set_intrinsic() in AMX.C; GETARGS() sets "a" to the address of
+ * the first argument
+ */
+#define GETARGS(a)      { GETPARAM(a); if (a==0) { a=stk+sizeof(cell); } else { stk+=a; a=stk-a; SKIPPARAM(1); } }
+
+#if PAWN_CELL_SIZE==32
+  #define REAL          float
+#elif PAWN_CELL_SIZE==64
+  #define REAL          double
+#endif
+#if defined REAL
+static inline REAL ctof(cell c)
+{
+  REAL f;
+  memcpy(&f,&c,sizeof f);
+  return f;
+}
+
+static inline cell ftoc(REAL f)
+{
+  cell c;
+  memcpy(&c,&f,sizeof c);
+  return c;
+}
+
+/* roundreal() is the same as in AMX.C */
+static cell roundreal(REAL f,cell mode)
+{
+  double lim=(double)((ucell)1 << (PAWN_CELL_SIZE-1));
+  double d=(double)f;
+  cell c;
+
+  if (mode<1 || mode>3)
+    d+=.5;              /* round = floor(f+.5) */
+  if (!(d>-lim-1.0 && d<lim))
+    return (cell)(REAL)d; /* out of range (or NaN) */
+  c=(cell)d;            /* truncates */
+  if (mode!=2 && mode!=3 && (double)c>d)
+    c=(cell)((ucell)c-1);
+  else if (mode==2 && (double)c<d)
+    c=(cell)((ucell)c+1);
+  return c;
+}
+#endif
+#endif
 
 cell amx_exec_run(AMX *amx,cell *retval,unsigned char *data)
 {
@@ -167,6 +279,22 @@ static const void * const amx_opcodelist[] = {
         &&op_dec_p,       &&op_dec_p_s,     &&op_movs_p,      &&op_cmps_p,
         &&op_fill_p,      &&op_halt_p,      &&op_bounds_p,
 #endif
+#if !defined AMX_NO_SUPERINSTR
+        /* superinstructions (must follow the list in amx.c) */
+        &&op_load_s_push, &&op_const_push,  &&op_push_load_s, &&op_load_s_const_alt,
+        &&op_const_alt_add,&&op_pop_alt_add,&&op_add_push,    &&op_const_stor_s,
+        &&op_load_i_pop_alt,&&op_bounds_shl_c,&&op_eq_jzer,   &&op_neq_jzer,
+        &&op_sless_jzer,  &&op_sleq_jzer,   &&op_sgrtr_jzer,  &&op_sgeq_jzer,
+  #if !defined AMX_NO_MACRO_INSTR
+        &&op_push_c_call, &&op_zero_retn,   &&op_load_s_add_c,&&op_idxaddr_b_load_i,
+  #endif
+        &&op_casetbl_dense,&&op_casetbl_sorted,
+        /* intrinsics */
+        &&op_float,       &&op_floatadd,    &&op_floatsub,    &&op_floatmul,
+        &&op_floatdiv,    &&op_floatcmp,    &&op_floatabs,    &&op_floatround,
+        &&op_floatint,    &&op_fixed,       &&op_fmul,        &&op_fdiv,
+        &&op_fabs,        &&op_fint,
+#endif
 };
   AMX_HEADER *hdr;
   cell pri,alt,stk,frm,hea;
@@ -176,6 +304,12 @@ static const void * const amx_opcodelist[] = {
   #if !defined AMX_NO_PACKED_OPC
     int op;
   #endif
+  #if defined AMX_OPSTATS
+    uint64_t (*pairs)[AMX_STATS_OPCODES],*row;
+    const void *countlist[sizearray(amx_opcodelist)];
+    const void * const *optable;
+    int o_;
+  #endif
 
   assert(amx!=NULL);
   /* HACK: return label table and opcode count (for VerifyPcode()) if amx
@@ -198,8 +332,24 @@ static const void * const amx_opcodelist[] = {
   stk=amx->stk;
   reset_stk=stk;
   reset_hea=hea;
-  alt=frm=pri=0;/* just to avoid compiler warnings */
+  /* pri, alt and frm must be restored when resuming after sleep or when the
+   * budget ran out
+   */
+  pri=amx->pri;
+  alt=amx->alt;
+  frm=amx->frm;
   num=0;        /* just to avoid compiler warnings */
+  #if defined AMX_OPSTATS
+    pairs=(amx->opstats!=NULL) ? ((AMX_STATS *)amx->opstats)->pairs : NULL;
+    row=(pairs!=NULL) ? pairs[AMX_STATS_ENTRY] : NULL;
+    optable=amx_opcodelist;
+    if (pairs!=NULL) {
+      for (i=0; i<(int)sizearray(countlist); i++)
+        countlist[i]=&&__count;
+      optable=countlist;
+    } /* if */
+    o_=0;
+  #endif
 
   /* start running */
   assert(amx->code!=NULL);
@@ -207,6 +357,15 @@ static const void * const amx_opcodelist[] = {
   cip=(cell *)(amx->code+(int)amx->cip);
   NEXT(cip,op);
 
+  #if defined AMX_OPSTATS
+  __count:
+    /* count the pair of opcodes (the counts per opcode are derived from the
+     * pairs), then run the opcode */
+    row[o_]++;
+    row=pairs[o_];
+    goto *amx_opcodelist[o_];
+  #endif
+
   op_nop:
     NEXT(cip,op);
   op_load_pri:
@@ -237,16 +396,14 @@ static const void * const amx_opcodelist[] = {
     NEXT(cip,op);
   op_load_i:
     /* verify address */
-    if (pri>=hea && pri<stk || (ucell)pri>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
+    CHKADDR(pri);
     pri=_R(data,pri);
     NEXT(cip,op);
   op_lodb_i:
     GETPARAM(offs);
   __lodb_i:
     /* verify address */
-    if (pri>=hea && pri<stk || (ucell)pri>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
+    CHKADDR(pri);
     switch (offs) {
     case 1:
       pri=_R8(data,pri);
@@ -288,16 +445,14 @@ static const void * const amx_opcodelist[] = {
     NEXT(cip,op);
   op_stor_i:
     /* verify address */
-    if (alt>=hea && alt<stk || (ucell)alt>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
+    CHKADDR(alt);
     _W(data,alt,pri);
     NEXT(cip,op);
   op_strb_i:
     GETPARAM(offs);
   __strb_i:
     /* verify address */
-    if (alt>=hea && alt<stk || (ucell)alt>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
+    CHKADDR(alt);
     switch (offs) {
     case 1:
       _W8(data,alt,pri);
@@ -406,7 +561,9 @@ static const void * const amx_opcodelist[] = {
   op_proc:
     PUSH(frm);
     frm=stk;
-    CHKMARGIN();
+    #if !defined AMX_GUARDPAGES
+      CHKMARGIN();              /* with guard pages, an overflow faults */
+    #endif
     NEXT(cip,op);
   op_ret:
     POP(frm);
@@ -428,23 +585,29 @@ static const void * const amx_opcodelist[] = {
   op_call:
     PUSH(((unsigned char *)cip-amx->code)+sizeof(cell));/* push address behind instruction */
     cip=JUMPREL(cip);                   /* jump to the address */
+    CHKFUEL();
     NEXT(cip,op);
   op_jump:
     /* since the GETPARAM() macro modifies cip, you cannot
      * do GETPARAM(cip) directly */
     cip=JUMPREL(cip);
+    CHKFUEL();
     NEXT(cip,op);
   op_jzer:
-    if (pri==0)
+    if (pri==0) {
       cip=JUMPREL(cip);
-    else
+      CHKFUEL();
+    } else {
       SKIPPARAM(1);
+    } /* if */
     NEXT(cip,op);
   op_jnz:
-    if (pri!=0)
+    if (pri!=0) {
       cip=JUMPREL(cip);
-    else
+      CHKFUEL();
+    } else {
       SKIPPARAM(1);
+    } /* if */
     NEXT(cip,op);
   op_shl:
     pri<<=alt;
@@ -563,14 +726,10 @@ static const void * const amx_opcodelist[] = {
     /* verify top & bottom memory addresses, for both source and destination
      * addresses
      */
-    if (pri>=hea && pri<stk || (ucell)pri>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
-    if ((pri+offs)>hea && (pri+offs)<stk || (ucell)(pri+offs)>(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
-    if (alt>=hea && alt<stk || (ucell)alt>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
-    if ((alt+offs)>hea && (alt+offs)<stk || (ucell)(alt+offs)>(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
+    CHKADDR(pri);
+    CHKEND(pri+offs);
+    CHKADDR(alt);
+    CHKEND(alt+offs);
     #if defined _R_DEFAULT
       memcpy(data+(int)alt, data+(int)pri, (int)offs);
     #else
@@ -590,14 +749,10 @@ static const void * const amx_opcodelist[] = {
     /* verify top & bottom memory addresses, for both source and destination
      * addresses
      */
-    if (pri>=hea && pri<stk || (ucell)pri>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
-    if ((pri+offs)>hea && (pri+offs)<stk || (ucell)(pri+offs)>(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
-    if (alt>=hea && alt<stk || (ucell)alt>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
-    if ((alt+offs)>hea && (alt+offs)<stk || (ucell)(alt+offs)>(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
+    CHKADDR(pri);
+    CHKEND(pri+offs);
+    CHKADDR(alt);
+    CHKEND(alt+offs);
     #if defined _R_DEFAULT
       pri=memcmp(data+(int)alt, data+(int)pri, (int)offs);
     #else
@@ -612,10 +767,8 @@ static const void * const amx_opcodelist[] = {
     GETPARAM(offs);
   __fill:
     /* verify top & bottom memory addresses */
-    if (alt>=hea && alt<stk || (ucell)alt>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
-    if ((alt+offs)>hea && (alt+offs)<stk || (ucell)(alt+offs)>(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
+    CHKADDR(alt);
+    CHKEND(alt+offs);
     for (i=(int)alt; offs>=(int)sizeof(cell); i+=sizeof(cell), offs-=sizeof(cell))
       _W32(data,i,pri);
     NEXT(cip,op);
@@ -637,6 +790,35 @@ static const void * const amx_opcodelist[] = {
       return (int)offs;
     } /* if */
     ABORT(amx,(int)offs);
+#if !defined AMX_NO_FUEL
+  __fuel:
+    if (amx->fuelhook!=NULL) {
+      /* store the registers, so that the hook can walk the stack */
+      amx->frm=frm;
+      amx->pri=pri;
+      amx->alt=alt;
+      amx->cip=(cell)((unsigned char*)cip-amx->code);
+      amx->stk=stk;
+      amx->hea=hea;
+      HOSTCALL(amx->fuelhook(amx));
+      if (amx->fuel>0)
+        NEXT(cip,op);           /* the hook set a new count */
+    } /* if */
+    if ((amx->flags & AMX_FLAG_FUEL)==0) {
+      amx->fuel=LONG_MAX;       /* no budget was set, just restart the counter */
+      NEXT(cip,op);
+    } /* if */
+    /* store complete status, so that AMX_EXEC_CONT continues at cip */
+    amx->frm=frm;
+    amx->pri=pri;
+    amx->alt=alt;
+    amx->cip=(cell)((unsigned char*)cip-amx->code);
+    amx->stk=stk;
+    amx->hea=hea;
+    amx->reset_stk=reset_stk;
+    amx->reset_hea=reset_hea;
+    return AMX_ERR_FUEL;
+#endif
   op_bounds:
     GETPARAM(offs);
     if ((ucell)pri>(ucell)offs) {
@@ -651,7 +833,7 @@ static const void * const amx_opcodelist[] = {
     amx->hea=hea;
     amx->frm=frm;
     amx->stk=stk;
-    num=amx->callback(amx,offs,&pri,(cell *)(data+(int)stk));
+    HOSTCALL(num=CALLNATIVE(amx,offs,&pri,(cell *)(data+(int)stk)));
     if (num!=AMX_ERR_NONE) {
       if (num==AMX_ERR_SLEEP) {
         amx->pri=pri;
@@ -667,10 +849,35 @@ static const void * const amx_opcodelist[] = {
     cell *cptr=JUMPREL(cip)+1;  /* +1, to skip the "casetbl" opcode */
     cip=JUMPREL(cptr+1);        /* preset to "none-matched" case */
     num=(int)*cptr;             /* number of records in the case table */
-    for (cptr+=2; num>0 && *cptr!=pri; num--,cptr+=2)
-      /* nothing */;
-    if (num>0)
-      cip=JUMPREL(cptr+1);      /* case found */
+#if !defined AMX_NO_SUPERINSTR
+    if (ISLABEL(cptr[-1],op_casetbl_dense)) {
+      /* the jump table is at the end of the case table, see casetable() in AMX.C */
+      if ((ucell)pri-(ucell)cptr[2]<=(ucell)cptr[3]-(ucell)cptr[2])
+        cip=JUMPREL(cptr+2*num+1-(cell)((ucell)cptr[3]-(ucell)pri));
+    } else if (ISLABEL(cptr[-1],op_casetbl_sorted)) {
+      /* binary search for the first record with the value */
+      cell *end=cptr+2*num+2;
+      int half;
+      for (cptr+=2; num>0; ) {
+        half=num/2;
+        if (cptr[2*half]<pri) {
+          cptr+=2*half+2;
+          num-=half+1;
+        } else {
+          num=half;
+        } /* if */
+      } /* for */
+      if (cptr<end && *cptr==pri)
+        cip=JUMPREL(cptr+1);    /* case found */
+    } else
+#endif
+    {
+      for (cptr+=2; num>0 && *cptr!=pri; num--,cptr+=2)
+        /* nothing */;
+      if (num>0)
+        cip=JUMPREL(cptr+1);    /* case found */
+    }
+    CHKFUEL();
     NEXT(cip,op);
     }
   op_swap_pri:
@@ -691,7 +898,7 @@ static const void * const amx_opcodelist[] = {
       amx->stk=stk;
       amx->hea=hea;
       amx->cip=(cell)((unsigned char*)cip-amx->code);
-      num=amx->debug(amx);
+      HOSTCALL(num=amx->debug(amx));
       if (num!=AMX_ERR_NONE) {
         if (num==AMX_ERR_SLEEP) {
           amx->pri=pri;
@@ -766,9 +973,11 @@ static const void * const amx_opcodelist[] = {
     PUSH((offs<<(sizeof(cell)*4)) | amx->ovl_index);
     amx->ovl_index=(int)*cip;
     assert(amx->overlay!=NULL);
-    if ((num=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
+    HOSTCALL(num=amx->overlay(amx,amx->ovl_index));
+    if (num!=AMX_ERR_NONE)
       ABORT(amx,num);
     cip=(cell*)amx->code;
+    CHKFUEL();
     NEXT(cip,op);
   op_retn_ovl:
     assert(amx->overlay!=NULL);
@@ -778,7 +987,7 @@ static const void * const amx_opcodelist[] = {
     offs=(ucell)offs >> (sizeof(cell)*4);
     /* verify the index */
     stk+=_R(data,stk)+sizeof(cell);   /* remove parameters from the stack */
-    num=amx->overlay(amx,amx->ovl_index); /* reload overlay */
+    HOSTCALL(num=amx->overlay(amx,amx->ovl_index)); /* reload overlay */
     if (num!=AMX_ERR_NONE || (long)offs>=amx->codesize)
       ABORT(amx,AMX_ERR_MEMACCESS);
     cip=(cell *)(amx->code+(int)offs);
@@ -792,9 +1001,11 @@ static const void * const amx_opcodelist[] = {
     if (num>0)
       amx->ovl_index=*(cptr+1); /* case found */
     assert(amx->overlay!=NULL);
-    if ((num=amx->overlay(amx,amx->ovl_index))!=AMX_ERR_NONE)
+    HOSTCALL(num=amx->overlay(amx,amx->ovl_index));
+    if (num!=AMX_ERR_NONE)
       ABORT(amx,num);
     cip=(cell*)amx->code;
+    CHKFUEL();
     NEXT(cip,op);
     }
 #else
@@ -812,16 +1023,14 @@ static const void * const amx_opcodelist[] = {
   op_lidx:
     offs=pri*sizeof(cell)+alt;  /* implicit shift value for a cell */
     /* verify address */
-    if (offs>=hea && offs<stk || (ucell)offs>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
+    CHKADDR(offs);
     pri=_R(data,offs);
     NEXT(cip,op);
   op_lidx_b:
     GETPARAM(offs);
     offs=(pri << (int)offs)+alt;
     /* verify address */
-    if (offs>=hea && offs<stk || (ucell)offs>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
+    CHKADDR(offs);
     pri=_R(data,offs);
     NEXT(cip,op);
   op_idxaddr:
@@ -860,40 +1069,52 @@ static const void * const amx_opcodelist[] = {
     PUSH(data+frm+offs);
     NEXT(cip,op);
   op_jeq:
-    if (pri==alt)
+    if (pri==alt) {
       cip=JUMPREL(cip);
-    else
+      CHKFUEL();
+    } else {
       SKIPPARAM(1);
+    } /* if */
     NEXT(cip,op);
   op_jneq:
-    if (pri!=alt)
+    if (pri!=alt) {
       cip=JUMPREL(cip);
-    else
+      CHKFUEL();
+    } else {
       SKIPPARAM(1);
+    } /* if */
     NEXT(cip,op);
   op_jsless:
-    if (pri<alt)
+    if (pri<alt) {
       cip=JUMPREL(cip);
-    else
+      CHKFUEL();
+    } else {
       SKIPPARAM(1);
+    } /* if */
     NEXT(cip,op);
   op_jsleq:
-    if (pri<=alt)
+    if (pri<=alt) {
       cip=JUMPREL(cip);
-    else
+      CHKFUEL();
+    } else {
       SKIPPARAM(1);
+    } /* if */
     NEXT(cip,op);
   op_jsgrtr:
-    if (pri>alt)
+    if (pri>alt) {
       cip=JUMPREL(cip);
-    else
+      CHKFUEL();
+    } else {
       SKIPPARAM(1);
+    } /* if */
     NEXT(cip,op);
   op_jsgeq:
-    if (pri>=alt)
+    if (pri>=alt) {
       cip=JUMPREL(cip);
-    else
+      CHKFUEL();
+    } else {
       SKIPPARAM(1);
+    } /* if */
     NEXT(cip,op);
   op_sdiv_inv:
     if (alt==0)
@@ -994,7 +1215,7 @@ static const void * const amx_opcodelist[] = {
     amx->hea=hea;
     amx->frm=frm;
     amx->stk=stk;
-    num=amx->callback(amx,offs,&pri,(cell *)(data+(int)stk));
+    HOSTCALL(num=CALLNATIVE(amx,offs,&pri,(cell *)(data+(int)stk)));
     stk+=val+4;
     if (num!=AMX_ERR_NONE) {
       if (num==AMX_ERR_SLEEP) {
@@ -1145,8 +1366,7 @@ static const void * const amx_opcodelist[] = {
     GETPARAM_P(offs,op);
     offs=(pri << (int)offs)+alt;
     /* verify address */
-    if (offs>=hea && offs<stk || (ucell)offs>=(ucell)amx->stp)
-      ABORT(amx,AMX_ERR_MEMACCESS);
+    CHKADDR(offs);
     pri=_R(data,offs);
     NEXT(cip,op);
   op_idxaddr_p_b:
@@ -1339,6 +1559,227 @@ static const void * const amx_opcodelist[] = {
     } /* if */
     NEXT(cip,op);
 #endif
+
+#if !defined AMX_NO_SUPERINSTR
+  /* superinstructions: the opcode of the second instruction is skipped */
+  op_load_s_push:
+    GETPARAM(offs);
+    pri=_R(data,frm+offs);
+    SKIPOPCODE();
+    PUSH(pri);
+    NEXT(cip,op);
+  op_const_push:
+    GETPARAM(pri);
+    SKIPOPCODE();
+    PUSH(pri);
+    NEXT(cip,op);
+  op_push_load_s:
+    PUSH(pri);
+    SKIPOPCODE();
+    GETPARAM(offs);
+    pri=_R(data,frm+offs);
+    NEXT(cip,op);
+  op_load_s_const_alt:
+    GETPARAM(offs);
+    pri=_R(data,frm+offs);
+    SKIPOPCODE();
+    GETPARAM(alt);
+    NEXT(cip,op);
+  op_const_alt_add:
+    GETPARAM(alt);
+    SKIPOPCODE();
+    pri+=alt;
+    NEXT(cip,op);
+  op_pop_alt_add:
+    POP(alt);
+    SKIPOPCODE();
+    pri+=alt;
+    NEXT(cip,op);
+  op_add_push:
+    pri+=alt;
+    SKIPOPCODE();
+    PUSH(pri);
+    NEXT(cip,op);
+  op_const_stor_s:
+    GETPARAM(pri);
+    SKIPOPCODE();
+    GETPARAM(offs);
+    _W(data,frm+offs,pri);
+    NEXT(cip,op);
+  op_load_i_pop_alt:
+    /* verify address */
+    CHKADDR(pri);
+    pri=_R(data,pri);
+    SKIPOPCODE();
+    POP(alt);
+    NEXT(cip,op);
+  op_bounds_shl_c:
+    GETPARAM(offs);
+    if ((ucell)pri>(ucell)offs) {
+      amx->cip=(cell)((unsigned char *)cip-amx->code);
+      ABORT(amx,AMX_ERR_BOUNDS);
+    } /* if */
+    SKIPOPCODE();
+    GETPARAM(offs);
+    pri<<=offs;
+    NEXT(cip,op);
+  op_eq_jzer:
+    pri= pri==alt ? 1 : 0;
+    goto __jzer;
+  op_neq_jzer:
+    pri= pri!=alt ? 1 : 0;
+    goto __jzer;
+  op_sless_jzer:
+    pri= pri<alt ? 1 : 0;
+    goto __jzer;
+  op_sleq_jzer:
+    pri= pri<=alt ? 1 : 0;
+    goto __jzer;
+  op_sgrtr_jzer:
+    pri= pri>alt ? 1 : 0;
+    goto __jzer;
+  op_sgeq_jzer:
+    pri= pri>=alt ? 1 : 0;
+  __jzer:
+    SKIPOPCODE();
+    if (pri==0) {
+      cip=JUMPREL(cip);
+      CHKFUEL();
+    } else {
+      SKIPPARAM(1);
+    } /* if */
+    NEXT(cip,op);
+#if !defined AMX_NO_MACRO_INSTR
+  op_push_c_call:
+    GETPARAM(offs);
+    PUSH(offs);
+    SKIPOPCODE();
+    PUSH(((unsigned char *)cip-amx->code)+sizeof(cell));/* skip address */
+    cip=JUMPREL(cip);                   /* jump to the address */
+    CHKFUEL();
+    NEXT(cip,op);
+  op_zero_retn:
+    pri=0;
+    POP(frm);
+    POP(offs);
+    /* verify the return address */
+    if ((long)offs>=amx->codesize)
+      ABORT(amx,AMX_ERR_MEMACCESS);
+    cip=(cell *)(amx->code+(int)offs);
+    stk+= _R(data,stk) + sizeof(cell);  /* remove parameters from the stack */
+    NEXT(cip,op);
+  op_load_s_add_c:
+    GETPARAM(offs);
+    pri=_R(data,frm+offs);
+    SKIPOPCODE();
+    GETPARAM(offs);
+    pri+=offs;
+    NEXT(cip,op);
+  op_idxaddr_b_load_i:
+    GETPARAM(offs);
+    pri=(pri << (int)offs)+alt;
+    SKIPOPCODE();
+    /* verify address */
+    CHKADDR(pri);
+    pri=_R(data,pri);
+    NEXT(cip,op);
+#endif
+  op_casetbl_dense:
+    assert(0);                  /* case tables are not executed */
+    ABORT(amx,AMX_ERR_INVINSTR);
+  op_casetbl_sorted:
+    assert(0);
+    ABORT(amx,AMX_ERR_INVINSTR);
+
+  /* intrinsics: see set_intrinsic() in AMX.C */
+#if defined REAL
+  op_float:
+    GETARGS(offs);
+    pri=ftoc((REAL)_R(data,offs));
+    NEXT(cip,op);
+  op_floatadd:
+    GETARGS(offs);
+    pri=ftoc(ctof(_R(data,offs))+ctof(_R(data,offs+sizeof(cell))));
+    NEXT(cip,op);
+  op_floatsub:
+    GETARGS(offs);
+    pri=ftoc(ctof(_R(data,offs))-ctof(_R(data,offs+sizeof(cell))));
+    NEXT(cip,op);
+  op_floatmul:
+    GETARGS(offs);
+    pri=ftoc(ctof(_R(data,offs))*ctof(_R(data,offs+sizeof(cell))));
+    NEXT(cip,op);
+  op_floatdiv:
+    GETARGS(offs);
+    pri=ftoc(ctof(_R(data,offs))/ctof(_R(data,offs+sizeof(cell))));
+    NEXT(cip,op);
+  op_floatcmp: {
+    REAL a,b;
+    GETARGS(offs);
+    a=ctof(_R(data,offs));
+    b=ctof(_R(data,offs+sizeof(cell)));
+    pri=(a==b) ? 0 : (a>b) ? 1 : -1;
+    NEXT(cip,op);
+  }
+  op_floatabs: {
+    REAL a;
+    GETARGS(offs);
+    a=ctof(_R(data,offs));
+    pri=ftoc((a>=0) ? a : -a);
+    NEXT(cip,op);
+  }
+  op_floatround:
+    GETARGS(offs);
+    pri=roundreal(ctof(_R(data,offs)),_R(data,offs+sizeof(cell)));
+    NEXT(cip,op);
+  op_floatint:
+    GETARGS(offs);
+    pri=roundreal(ctof(_R(data,offs)),3);
+    NEXT(cip,op);
+#else
+  op_float:
+  op_floatadd:
+  op_floatsub:
+  op_floatmul:
+  op_floatdiv:
+  op_floatcmp:
+  op_floatabs:
+  op_floatround:
+  op_floatint:
+    assert(0);                  /* never set for 16-bit cells */
+    ABORT(amx,AMX_ERR_INVINSTR);
+#endif
+  op_fixed:
+    GETARGS(offs);
+    pri=(cell)(_R(data,offs)*1000L);
+    NEXT(cip,op);
+  op_fmul: {
+    long long a;
+    GETARGS(offs);
+    a=(long long)_R(data,offs)*(long long)_R(data,offs+sizeof(cell));
+    pri=(cell)((a+500)/1000);
+    NEXT(cip,op);
+  }
+  op_fdiv:
+    GETARGS(offs);
+    val=_R(data,offs+sizeof(cell));
+    if (val==0) {
+      amx->cip=(cell)((unsigned char*)cip-amx->code);
+      ABORT(amx,AMX_ERR_DIVIDE);
+    } /* if */
+    pri=(cell)(((long long)_R(data,offs)*1000+(long long)(val/2))/(long long)val);
+    NEXT(cip,op);
+  op_fabs:
+    GETARGS(offs);
+    pri=_R(data,offs);
+    if (pri<0)
+      pri=-pri;
+    NEXT(cip,op);
+  op_fint:
+    GETARGS(offs);
+    pri=_R(data,offs)/1000L;
+    NEXT(cip,op);
+#endif /* AMX_NO_SUPERINSTR */
 }
 
 void amx_exec_list(const AMX *amx,const cell **opcodelist,int *numopcodes)
@@ -144,6 +144,65 @@ enum seek_whence {
 };
 
 
+#define UTF8BUFSIZE 256
+
+/* fgets_utf8() reads a line in blocks and converts it with amx_UTF8Decode().
+ * An incomplete UTF-8 code at the end of a block is held back for the next
+ * block. The function returns 0 if the text is not valid UTF-8.
+ */
+static int fgets_utf8(FILE *fp,cell *string,size_t max,size_t *count)
+{
+  char buffer[UTF8BUFSIZE+1],held[6];
+  size_t index,keep,num,tail,room,k;
+  unsigned char lead;
+  int chars,eol;
+
+  index=0;
+  keep=0;
+  for ( ;; ) {
+    assert(index<max);
+    /* each byte gives at most one character, so never read more bytes than
+     * there is room for characters
+     */
+    room=max-1-index;
+    if (room==0)
+      break;                    /* string fully filled */
+    if (room>UTF8BUFSIZE-keep)
+      room=UTF8BUFSIZE-keep;
+    if (fgets(buffer+keep,(int)room+1,fp)==NULL) {
+      if (keep>0)
+        return 0;               /* EOF halfway an UTF-8 code */
+      break;                    /* no more characters */
+    } /* if */
+    num=keep+strlen(buffer+keep);
+    eol=(num>0 && buffer[num-1]=='\n');
+    /* find an incomplete UTF-8 code at the end of the block */
+    tail=0;
+    if (!eol) {
+      for (k=num; k>0 && num-k<5 && ((unsigned char)buffer[k-1] & 0xc0)==0x80; k--)
+        /* nothing */;
+      if (k>0 && (lead=(unsigned char)buffer[k-1])>=0xc0) {
+        size_t size= (lead>=0xfc) ? 6 : (lead>=0xf8) ? 5 : (lead>=0xf0) ? 4 : (lead>=0xe0) ? 3 : 2;
+        if (num-(k-1)<size)
+          tail=num-(k-1);
+      } /* if */
+    } /* if */
+    memcpy(held,buffer+num-tail,tail);
+    buffer[num-tail]='\0';
+    if (amx_UTF8Decode(buffer,NULL,string+index,(int)(max-index),&chars)!=AMX_ERR_NONE)
+      return 0;
+    index+=chars;
+    memcpy(buffer,held,tail);
+    keep=tail;
+    if (eol)
+      break;                    /* read newline, done */
+  } /* for */
+  assert(index<max);
+  string[index]=__T('\0');
+  *count=index;
+  return 1;
+}
+
 /* This function only stores unpacked strings. UTF-8 is used for
  * Unicode, and packed strings can only store 7-bit and 8-bit
  * character sets (ASCII, Latin-1).
@@ -153,8 +212,7 @@ static size_t fgets_cell(FILE *fp,cell *string,size_t max,int utf8mode)
   size_t index;
   fpos_t pos;
   cell c;
-  int follow,lastcr;
-  cell lowmark;
+  int lastcr;
 
   assert(sizeof(cell)>=4);
   assert(fp!=NULL);
@@ -162,110 +220,36 @@ static size_t fgets_cell(FILE *fp,cell *string,size_t max,int utf8mode)
   if (max==0)
     return 0;
 
-  /* get the position, in case we have to back up */
-  fgetpos(fp, &pos);
+  if (utf8mode) {
+    /* get the position, in case we have to back up */
+    fgetpos(fp, &pos);
+    if (fgets_utf8(fp,string,max,&index))
+      return index;
+    /* Non-conforming UTF-8 codes were found, which means that the string is
+     * probably not intended as UTF-8; start over again
+     */
+    fsetpos(fp, &pos);
+  } /* if */
 
   index=0;
-  follow=0;
-  lowmark=0;
   lastcr=0;
   for ( ;; ) {
     assert(index<max);
     if (index==max-1)
       break;                    /* string fully filled */
-    if ((c=fgetc(fp))==EOF) {
-      if (!utf8mode || follow==0)
-        break;                  /* no more characters */
-      /* If an EOF happened halfway an UTF-8 code, the string cannot be
-       * UTF-8 mode, and we must restart.
-       */
-      index=0;
-      fsetpos(fp, &pos);
-      continue;
-    } /* if */
-
+    if ((c=fgetc(fp))==EOF)
+      break;                    /* no more characters */
     /* 8-bit characters are unsigned */
     if (c<0)
       c=-c;
-
-    if (utf8mode) {
-      if (follow>0 && (c & 0xc0)==0x80) {
-        /* leader code is active, combine with earlier code */
-        string[index]=(string[index] << 6) | ((unsigned char)c & 0x3f);
-        if (--follow==0) {
-          /* encoding a character in more bytes than is strictly needed,
-           * is not really valid UTF-8; we are strict here to increase
-           * the chance of heuristic dectection of non-UTF-8 text
-           * (JAVA writes zero bytes as a 2-byte code UTF-8, which is invalid)
-           */
-          if (string[index]<lowmark)
-            utf8mode=0;
-          /* the code positions 0xd800--0xdfff and 0xfffe & 0xffff do not
-           * exist in UCS-4 (and hence, they do not exist in Unicode)
-           */
-          if (string[index]>=0xd800 && string[index]<=0xdfff
-              || string[index]==0xfffe || string[index]==0xffff)
-            utf8mode=0;
-          index++;
-        } /* if */
-      } else if (follow==0 && (c & 0x80)==0x80) {
-        /* UTF-8 leader code */
-        if ((c & 0xe0)==0xc0) {
-          /* 110xxxxx 10xxxxxx */
-          follow=1;
-          lowmark=0x80;
-          string[index]=c & 0x1f;
-        } else if ((c & 0xf0)==0xe0) {
-          /* 1110xxxx 10xxxxxx 10xxxxxx (16 bits, BMP plane) */
-          follow=2;
-          lowmark=0x800;
-          string[index]=c & 0x0f;
-        } else if ((c & 0xf8)==0xf0) {
-          /* 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx */
-          follow=3;
-          lowmark=0x10000;
-          string[index]=c & 0x07;
-        } else if ((c & 0xfc)==0xf8) {
-          /* 111110xx 10xxxxxx 10xxxxxx 10xxxxxx 10xxxxxx */
-          follow=4;
-          lowmark=0x200000;
-          string[index]=c & 0x03;
-        } else if ((c & 0xfe)==0xfc) {
-          /* 1111110x 10xxxxxx 10xxxxxx 10xxxxxx 10xxxxxx 10xxxxxx (31 bits) */
-          follow=5;
-          lowmark=0x4000000;
-          string[index]=c & 0x01;
-        } else {
-          /* this is invalid UTF-8 */
-          utf8mode=0;
-        } /* if */
-      } else if (follow==0 && (c & 0x80)==0x00) {
-        /* 0xxxxxxx (US-ASCII) */
-        string[index++]=c;
-        if (c==__T('\n'))
-          break;        /* read newline, done */
-      } else {
-        /* this is invalid UTF-8 */
-        utf8mode=0;
-      } /* if */
-      if (!utf8mode) {
-        /* UTF-8 mode was switched just off, which means that non-conforming
-         * UTF-8 codes were found, which means in turn that the string is
-         * probably not intended as UTF-8; start over again
-         */
-        index=0;
-        fsetpos(fp, &pos);
-      } /* if */
-    } else {
-      string[index++]=c;
-      if (c==__T('\n')) {
-        break;                  /* read newline, done */
-      } else if (lastcr) {
-        ungetc(c,fp);           /* carriage return was read, no newline follows */
-        break;
-      } /* if */
-      lastcr=(c==__T('\r'));
+    string[index++]=c;
+    if (c==__T('\n')) {
+      break;                    /* read newline, done */
+    } else if (lastcr) {
+      ungetc(c,fp);             /* carriage return was read, no newline follows */
+      break;
     } /* if */
+    lastcr=(c==__T('\r'));
   } /* for */
   assert(index<max);
   string[index]=__T('\0');
@@ -276,6 +260,9 @@ static size_t fgets_cell(FILE *fp,cell *string,size_t max,int utf8mode)
 static size_t fputs_cell(FILE *fp,cell *string,int utf8mode)
 {
   size_t count=0;
+  char buffer[UTF8BUFSIZE];
+  char *end;
+  const cell *next;
 
   assert(sizeof(cell)>=4);
   assert(fp!=NULL);
@@ -283,7 +270,18 @@ static size_t fputs_cell(FILE *fp,cell *string,int utf8mode)
 
   while (*string!=0) {
     if (utf8mode) {
-      cell c=*string;
+      cell c;
+      /* convert as many characters as fit in the buffer at once; values
+       * that amx_UTF8Encode() refuses are still written, one by one, below
+       */
+      amx_UTF8Encode(buffer,&end,sizeof buffer,string,&next);
+      if (next!=string) {
+        fwrite(buffer,1,(size_t)(end-buffer),fp);
+        count+=(size_t)(next-string);
+        string=(cell*)next;
+        continue;
+      } /* if */
+      c=*string;
       if (c<0x80) {
         /* 0xxxxxxx */
         fputc((unsigned char)c,fp);
@@ -0,0 +1,1762 @@
+/*  Just-in-time compiler for the Pawn Abstract Machine, for x86-64
+ *  processors with the System V calling convention (Linux, BSD, macOS).
+ *
+ *  The JIT translates the P-code to native code in a single pass and then
+ *  resolves the jump targets in a second pass. P-code addresses remain the
+ *  "architectural" addresses: the CIP register, return addresses on the
+ *  stack and the addresses of public functions all still refer to P-code.
+ *  A table that maps every P-code address to a native address is stored in
+ *  front of the generated code; RET, SCTRL 6 and amx_Exec() go through this
+ *  table. As a result, the "sleep" mode, the debug hook and amx_Clone() work
+ *  as with the interpreters.
+ *
+ *  Register usage in the generated code:
+ *    rbx   pointer to the AMX structure
+ *    rbp   pointer to the data segment
+ *    r12d  PRI
+ *    r13d  ALT
+ *    r14d  STK
+ *    r15d  FRM
+ *  HEA, HLW and STP are kept in the AMX structure.
+ *
+ *  Copyright (c) CompuPhase, 2020
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxjit_x64.c $
+ */
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include "osdefs.h"
+#if defined __ECOS__
+  /* eCos puts include files in cyg/package_name */
+  #include <cyg/pawn/amx.h>
+#else
+  #include "amx.h"
+#endif
+
+#if !(defined __x86_64__ || defined __amd64__)
+  #error This JIT requires an x86-64 processor
+#endif
+#if PAWN_CELL_SIZE!=32
+  #error This JIT only supports 32-bit cells
+#endif
+#if defined _WIN64
+  #error This JIT implements the System V calling convention, not the Win64 convention
+#endif
+
+#define JIT_MAXCELL     64  /* upper bound of native bytes generated per P-code cell */
+#define STKMARGIN       ((cell)(16*sizeof(cell)))
+
+#define ALIGN16(v)      (((v)+15) & ~15)
+
+extern const char *amx_jit_intrinsic(int index);  /* in AMX.C */
+
+typedef enum {
+  OP_NOP,
+  OP_LOAD_PRI,
+  OP_LOAD_ALT,
+  OP_LOAD_S_PRI,
+  OP_LOAD_S_ALT,
+  OP_LREF_S_PRI,
+  OP_LREF_S_ALT,
+  OP_LOAD_I,
+  OP_LODB_I,
+  OP_CONST_PRI,
+  OP_CONST_ALT,
+  OP_ADDR_PRI,
+  OP_ADDR_ALT,
+  OP_STOR,
+  OP_STOR_S,
+  OP_SREF_S,
+  OP_STOR_I,
+  OP_STRB_I,
+  OP_ALIGN_PRI,
+  OP_LCTRL,
+  OP_SCTRL,
+  OP_XCHG,
+  OP_PUSH_PRI,
+  OP_PUSH_ALT,
+  OP_PUSHR_PRI,
+  OP_POP_PRI,
+  OP_POP_ALT,
+  OP_PICK,
+  OP_STACK,
+  OP_HEAP,
+  OP_PROC,
+  OP_RET,
+  OP_RETN,
+  OP_CALL,
+  OP_JUMP,
+  OP_JZER,
+  OP_JNZ,
+  OP_SHL,
+  OP_SHR,
+  OP_SSHR,
+  OP_SHL_C_PRI,
+  OP_SHL_C_ALT,
+  OP_SMUL,
+  OP_SDIV,
+  OP_ADD,
+  OP_SUB,
+  OP_AND,
+  OP_OR,
+  OP_XOR,
+  OP_NOT,
+  OP_NEG,
+  OP_INVERT,
+  OP_EQ,
+  OP_NEQ,
+  OP_SLESS,
+  OP_SLEQ,
+  OP_SGRTR,
+  OP_SGEQ,
+  OP_INC_PRI,
+  OP_INC_ALT,
+  OP_INC_I,
+  OP_DEC_PRI,
+  OP_DEC_ALT,
+  OP_DEC_I,
+  OP_MOVS,
+  OP_CMPS,
+  OP_FILL,
+  OP_HALT,
+  OP_BOUNDS,
+  OP_SYSREQ,
+  OP_SWITCH,
+  OP_SWAP_PRI,
+  OP_SWAP_ALT,
+  OP_BREAK,
+  OP_CASETBL,
+  /* patched instructions */
+  OP_SYSREQ_D,
+  OP_SYSREQ_ND,
+  /* overlay instructions */
+  OP_CALL_OVL,
+  OP_RETN_OVL,
+  OP_SWITCH_OVL,
+  OP_CASETBL_OVL,
+  /* supplemental & macro instructions */
+  OP_LIDX,
+  OP_LIDX_B,
+  OP_IDXADDR,
+  OP_IDXADDR_B,
+  OP_PUSH_C,
+  OP_PUSH,
+  OP_PUSH_S,
+  OP_PUSH_ADR,
+  OP_PUSHR_C,
+  OP_PUSHR_S,
+  OP_PUSHR_ADR,
+  OP_JEQ,
+  OP_JNEQ,
+  OP_JSLESS,
+  OP_JSLEQ,
+  OP_JSGRTR,
+  OP_JSGEQ,
+  OP_SDIV_INV,
+  OP_SUB_INV,
+  OP_ADD_C,
+  OP_SMUL_C,
+  OP_ZERO_PRI,
+  OP_ZERO_ALT,
+  OP_ZERO,
+  OP_ZERO_S,
+  OP_EQ_C_PRI,
+  OP_EQ_C_ALT,
+  OP_INC,
+  OP_INC_S,
+  OP_DEC,
+  OP_DEC_S,
+  /* macro instructions */
+  OP_SYSREQ_N,
+  OP_PUSHM_C,
+  OP_PUSHM,
+  OP_PUSHM_S,
+  OP_PUSHM_ADR,
+  OP_PUSHRM_C,
+  OP_PUSHRM_S,
+  OP_PUSHRM_ADR,
+  OP_LOAD2,
+  OP_LOAD2_S,
+  OP_CONST,
+  OP_CONST_S,
+  /* packed instructions */
+  OP_LOAD_P_PRI,
+  OP_LOAD_P_ALT,
+  OP_LOAD_P_S_PRI,
+  OP_LOAD_P_S_ALT,
+  OP_LREF_P_S_PRI,
+  OP_LREF_P_S_ALT,
+  OP_LODB_P_I,
+  OP_CONST_P_PRI,
+  OP_CONST_P_ALT,
+  OP_ADDR_P_PRI,
+  OP_ADDR_P_ALT,
+  OP_STOR_P,
+  OP_STOR_P_S,
+  OP_SREF_P_S,
+  OP_STRB_P_I,
+  OP_LIDX_P_B,
+  OP_IDXADDR_P_B,
+  OP_ALIGN_P_PRI,
+  OP_PUSH_P_C,
+  OP_PUSH_P,
+  OP_PUSH_P_S,
+  OP_PUSH_P_ADR,
+  OP_PUSHR_P_C,
+  OP_PUSHR_P_S,
+  OP_PUSHR_P_ADR,
+  OP_PUSHM_P_C,
+  OP_PUSHM_P,
+  OP_PUSHM_P_S,
+  OP_PUSHM_P_ADR,
+  OP_PUSHRM_P_C,
+  OP_PUSHRM_P_S,
+  OP_PUSHRM_P_ADR,
+  OP_STACK_P,
+  OP_HEAP_P,
+  OP_SHL_P_C_PRI,
+  OP_SHL_P_C_ALT,
+  OP_ADD_P_C,
+  OP_SMUL_P_C,
+  OP_ZERO_P,
+  OP_ZERO_P_S,
+  OP_EQ_P_C_PRI,
+  OP_EQ_P_C_ALT,
+  OP_INC_P,
+  OP_INC_P_S,
+  OP_DEC_P,
+  OP_DEC_P_S,
+  OP_MOVS_P,
+  OP_CMPS_P,
+  OP_FILL_P,
+  OP_HALT_P,
+  OP_BOUNDS_P,
+  /* ----- */
+  OP_NUM_OPCODES
+} OPCODE;
+
+/* x86-64 registers, in encoding order */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+#define NOINDEX   (-1)
+
+/* registers of the abstract machine */
+#define REG_AMX   RBX
+#define REG_DAT   RBP
+#define REG_PRI   R12
+#define REG_ALT   R13
+#define REG_STK   R14
+#define REG_FRM   R15
+
+/* condition codes for Jcc and SETcc */
+#define CC_B      0x2
+#define CC_AE     0x3
+#define CC_E      0x4
+#define CC_NE     0x5
+#define CC_BE     0x6
+#define CC_A      0x7
+#define CC_S      0x8
+#define CC_NS     0x9
+#define CC_NP     0xb
+#define CC_L      0xc
+#define CC_GE     0xd
+#define CC_LE     0xe
+#define CC_G      0xf
+#define CC_ALWAYS (-1)
+
+/* opcode extensions for the "group 1" arithmetic instructions */
+#define ALU_ADD   0
+#define ALU_OR    1
+#define ALU_AND   4
+#define ALU_SUB   5
+#define ALU_XOR   6
+#define ALU_CMP   7
+
+#define AMXFIELD(f) ((int32_t)offsetof(AMX,f))
+
+/* The JIT region (at "hdr->cod" in the compiled image) starts with this
+ * structure, followed by the address map (one 32-bit native offset for every
+ * cell of P-code) and the native code. All native offsets are relative to the
+ * start of the region, so that the compiled image may be moved in memory.
+ */
+typedef struct tagJITINFO {
+  int32_t mapsize;          /* size of the P-code (and of the address map), in bytes */
+  int32_t entry;            /* offset of the entry stub */
+  int32_t cod;              /* COD of the P-code file, for LCTRL 0 */
+  int32_t dat;              /* DAT of the P-code file, for LCTRL 1 */
+} JITINFO;
+
+typedef int (*JIT_ENTRY)(AMX *amx,unsigned char *data,void *target,cell *retval);
+
+typedef struct tagJITGEN {
+  unsigned char *base;      /* start of the JIT region */
+  unsigned char *ip;        /* current output position */
+  int32_t *map;             /* P-code address to native offset */
+  cell *reloc;              /* pending jumps: native position & P-code target */
+  int numrelocs;
+  int32_t exit;             /* offsets of the run-time stubs */
+  int32_t halt;
+  int32_t dispatch;
+  int32_t sdiv;
+  int32_t debug;
+  int32_t err_memaccess;
+  int32_t err_stackerr;
+  int32_t err_stacklow;
+  int32_t err_heaplow;
+  int32_t err_divide;
+  int32_t err_bounds;
+} JITGEN;
+
+
+/* ----- instruction encoding ----- */
+
+static void emit8(JITGEN *g,int v)
+{
+  *g->ip++=(unsigned char)v;
+}
+
+static void emit32(JITGEN *g,int32_t v)
+{
+  memcpy(g->ip,&v,sizeof v);
+  g->ip+=sizeof v;
+}
+
+static void emit64(JITGEN *g,uint64_t v)
+{
+  memcpy(g->ip,&v,sizeof v);
+  g->ip+=sizeof v;
+}
+
+static int32_t here(const JITGEN *g)
+{
+  return (int32_t)(g->ip-g->base);
+}
+
+static void emit_rex(JITGEN *g,int w,int reg,int index,int base)
+{
+  int rex=0x40;
+  if (w)
+    rex|=0x08;
+  if (reg & 8)
+    rex|=0x04;
+  if (index>=0 && (index & 8))
+    rex|=0x02;
+  if (base & 8)
+    rex|=0x01;
+  if (rex!=0x40)
+    emit8(g,rex);
+}
+
+static void emit_opcode(JITGEN *g,int opcode)
+{
+  if (opcode>0xff)
+    emit8(g,opcode>>8);       /* two-byte opcode, 0x0f prefix */
+  emit8(g,opcode);
+}
+
+/* instruction with a register operand and a register r/m operand; "reg" may
+ * also be an opcode extension
+ */
+static void emit_rr(JITGEN *g,int w,int opcode,int reg,int rm)
+{
+  emit_rex(g,w,reg,NOINDEX,rm);
+  emit_opcode(g,opcode);
+  emit8(g,0xc0 | ((reg & 7)<<3) | (rm & 7));
+}
+
+/* instruction with a register operand and a memory operand [base+index+disp];
+ * "reg" may also be an opcode extension
+ */
+static void emit_rm(JITGEN *g,int w,int opcode,int reg,int base,int index,int32_t disp)
+{
+  int mod;
+
+  assert(index!=RSP);
+  emit_rex(g,w,reg,index,base);
+  emit_opcode(g,opcode);
+  if (disp==0 && (base & 7)!=RBP)
+    mod=0;
+  else if (disp>=-128 && disp<=127)
+    mod=1;
+  else
+    mod=2;
+  if (index<0 && (base & 7)!=RSP) {
+    emit8(g,(mod<<6) | ((reg & 7)<<3) | (base & 7));
+  } else {
+    emit8(g,(mod<<6) | ((reg & 7)<<3) | 4);
+    emit8(g,(((index<0) ? RSP : index) & 7)<<3 | (base & 7));
+  } /* if */
+  if (mod==1)
+    emit8(g,disp);
+  else if (mod==2)
+    emit32(g,disp);
+}
+
+static void mov_rr(JITGEN *g,int dest,int source)
+{
+  emit_rr(g,0,0x89,source,dest);
+}
+
+static void mov_ri(JITGEN *g,int reg,int32_t v)
+{
+  emit_rex(g,0,0,NOINDEX,reg);
+  emit8(g,0xb8+(reg & 7));
+  emit32(g,v);
+}
+
+static void alu_ri(JITGEN *g,int op,int reg,int32_t v)
+{
+  if (v>=-128 && v<=127) {
+    emit_rr(g,0,0x83,op,reg);
+    emit8(g,v);
+  } else {
+    emit_rr(g,0,0x81,op,reg);
+    emit32(g,v);
+  } /* if */
+}
+
+static void alu_mi(JITGEN *g,int op,int base,int index,int32_t disp,int32_t v)
+{
+  if (v>=-128 && v<=127) {
+    emit_rm(g,0,0x83,op,base,index,disp);
+    emit8(g,v);
+  } else {
+    emit_rm(g,0,0x81,op,base,index,disp);
+    emit32(g,v);
+  } /* if */
+}
+
+static void load(JITGEN *g,int reg,int base,int index,int32_t disp)
+{
+  emit_rm(g,0,0x8b,reg,base,index,disp);
+}
+
+static void store(JITGEN *g,int base,int index,int32_t disp,int reg)
+{
+  emit_rm(g,0,0x89,reg,base,index,disp);
+}
+
+static void store_imm(JITGEN *g,int base,int index,int32_t disp,int32_t v)
+{
+  emit_rm(g,0,0xc7,0,base,index,disp);
+  emit32(g,v);
+}
+
+static void lea(JITGEN *g,int reg,int base,int index,int32_t disp)
+{
+  emit_rm(g,0,0x8d,reg,base,index,disp);  /* 32-bit result */
+}
+
+static void setcc_pri(JITGEN *g,int cc)
+{
+  emit8(g,0x0f);                /* setcc al */
+  emit8(g,0x90+cc);
+  emit8(g,0xc0);
+  emit_rr(g,0,0x0fb6,REG_PRI,RAX);  /* movzx r12d, al */
+}
+
+static void jump_to(JITGEN *g,int cc,int32_t target)
+{
+  if (cc==CC_ALWAYS) {
+    emit8(g,0xe9);
+  } else {
+    emit8(g,0x0f);
+    emit8(g,0x80+cc);
+  } /* if */
+  emit32(g,target-(here(g)+4));
+}
+
+static void call_to(JITGEN *g,int32_t target)
+{
+  emit8(g,0xe8);
+  emit32(g,target-(here(g)+4));
+}
+
+/* jump to a P-code address, to be resolved after all code is generated */
+static void jump_pcode(JITGEN *g,int cc,cell target)
+{
+  if (cc==CC_ALWAYS) {
+    emit8(g,0xe9);
+  } else {
+    emit8(g,0x0f);
+    emit8(g,0x80+cc);
+  } /* if */
+  assert(g->reloc!=NULL);
+  g->reloc[2*g->numrelocs]=here(g);
+  g->reloc[2*g->numrelocs+1]=target;
+  g->numrelocs++;
+  emit32(g,0);
+}
+
+/* short forward jump, resolved with resolve_short() */
+static unsigned char *jump_short(JITGEN *g,int cc)
+{
+  emit8(g,(cc==CC_ALWAYS) ? 0xeb : 0x70+cc);
+  emit8(g,0);
+  return g->ip-1;
+}
+
+static void resolve_short(JITGEN *g,unsigned char *pos)
+{
+  assert(g->ip-(pos+1)<128);
+  *pos=(unsigned char)(g->ip-(pos+1));
+}
+
+static void call_helper(JITGEN *g,int (*func)(AMX*,unsigned char*,cell))
+{
+  emit_rex(g,1,0,NOINDEX,RAX);  /* mov rax, imm64 */
+  emit8(g,0xb8);
+  emit64(g,(uint64_t)(uintptr_t)func);
+  emit8(g,0xff);                /* call rax */
+  emit8(g,0xd0);
+}
+
+
+/* ----- abstract machine operations ----- */
+
+static void vm_push(JITGEN *g,int reg)
+{
+  alu_ri(g,ALU_SUB,REG_STK,sizeof(cell));
+  store(g,REG_DAT,REG_STK,0,reg);
+}
+
+static void vm_push_imm(JITGEN *g,int32_t v)
+{
+  alu_ri(g,ALU_SUB,REG_STK,sizeof(cell));
+  store_imm(g,REG_DAT,REG_STK,0,v);
+}
+
+static void vm_pop(JITGEN *g,int reg)
+{
+  load(g,reg,REG_DAT,REG_STK,0);
+  alu_ri(g,ALU_ADD,REG_STK,sizeof(cell));
+}
+
+/* store the registers that are kept in native registers in the AMX structure */
+static void vm_save(JITGEN *g)
+{
+  store(g,REG_AMX,NOINDEX,AMXFIELD(pri),REG_PRI);
+  store(g,REG_AMX,NOINDEX,AMXFIELD(alt),REG_ALT);
+  store(g,REG_AMX,NOINDEX,AMXFIELD(stk),REG_STK);
+  store(g,REG_AMX,NOINDEX,AMXFIELD(frm),REG_FRM);
+}
+
+/* verify a data address, the same way as the interpreter does:
+ * abort if (addr>=hea && addr<stk) || (ucell)addr>=(ucell)stp
+ */
+static void vm_checkaddr(JITGEN *g,int reg)
+{
+  unsigned char *ok;
+  emit_rm(g,0,0x3b,reg,REG_AMX,NOINDEX,AMXFIELD(stp));  /* cmp reg,[amx.stp] */
+  jump_to(g,CC_AE,g->err_memaccess);
+  emit_rm(g,0,0x3b,reg,REG_AMX,NOINDEX,AMXFIELD(hea));  /* cmp reg,[amx.hea] */
+  ok=jump_short(g,CC_L);
+  emit_rr(g,0,0x39,REG_STK,reg);                        /* cmp reg,stk */
+  jump_to(g,CC_L,g->err_memaccess);
+  resolve_short(g,ok);
+}
+
+/* abort if hea+STKMARGIN>stk; HEA must be in eax */
+static void vm_checkmargin(JITGEN *g)
+{
+  lea(g,RCX,RAX,NOINDEX,STKMARGIN);
+  emit_rr(g,0,0x39,REG_STK,RCX);                        /* cmp ecx,stk */
+  jump_to(g,CC_G,g->err_stackerr);
+}
+
+/* values for the various "push" instructions, see vm_pushvalue() */
+enum {
+  PV_CONST,     /* constant */
+  PV_DATA,      /* global variable */
+  PV_STACK,     /* local variable */
+  PV_ADDR,      /* address of a local variable */
+  PV_RCONST,    /* relocated constant (physical address) */
+  PV_RSTACK,    /* relocated local variable */
+  PV_RADDR,     /* relocated address of a local variable */
+};
+
+/* store the value for a push instruction at [data+stk+disp] */
+static void vm_pushvalue(JITGEN *g,int kind,cell v,int32_t disp)
+{
+  switch (kind) {
+  case PV_CONST:
+    store_imm(g,REG_DAT,REG_STK,disp,v);
+    return;
+  case PV_DATA:
+    load(g,RAX,REG_DAT,NOINDEX,v);
+    break;
+  case PV_STACK:
+    load(g,RAX,REG_DAT,REG_FRM,v);
+    break;
+  case PV_ADDR:
+    lea(g,RAX,REG_FRM,NOINDEX,v);
+    break;
+  case PV_RCONST:
+    lea(g,RAX,REG_DAT,NOINDEX,v);
+    break;
+  case PV_RSTACK:
+    load(g,RAX,REG_DAT,REG_FRM,v);
+    lea(g,RAX,REG_DAT,RAX,0);
+    break;
+  case PV_RADDR:
+    lea(g,RAX,REG_DAT,REG_FRM,v);
+    break;
+  default:
+    assert(0);
+  } /* switch */
+  store(g,REG_DAT,REG_STK,disp,RAX);
+}
+
+/* push "count" values from the code stream, return the updated code pointer */
+static cell *vm_pushmulti(JITGEN *g,int kind,cell *cip,int count)
+{
+  int i;
+  for (i=0; i<count; i++)
+    vm_pushvalue(g,kind,*cip++,-(int32_t)((i+1)*sizeof(cell)));
+  if (count>0)
+    alu_ri(g,ALU_SUB,REG_STK,count*sizeof(cell));
+  return cip;
+}
+
+/* signed floored division: PRI or ALT is the divisor */
+static void vm_sdiv(JITGEN *g,int dividend,int divisor)
+{
+  mov_rr(g,RAX,dividend);
+  mov_rr(g,RCX,divisor);
+  emit_rr(g,0,0x85,RCX,RCX);            /* test ecx,ecx */
+  jump_to(g,CC_E,g->err_divide);
+  call_to(g,g->sdiv);
+  mov_rr(g,REG_PRI,RAX);
+  mov_rr(g,REG_ALT,RDX);
+}
+
+static void vm_lodb(JITGEN *g,cell size)
+{
+  vm_checkaddr(g,REG_PRI);
+  switch ((int)size) {
+  case 1:
+    emit_rm(g,0,0x0fb6,REG_PRI,REG_DAT,REG_PRI,0);  /* movzx r12d, byte [data+pri] */
+    break;
+  case 2:
+    emit_rm(g,0,0x0fb7,REG_PRI,REG_DAT,REG_PRI,0);  /* movzx r12d, word [data+pri] */
+    break;
+  case 4:
+    load(g,REG_PRI,REG_DAT,REG_PRI,0);
+    break;
+  } /* switch */
+}
+
+static void vm_strb(JITGEN *g,cell size)
+{
+  vm_checkaddr(g,REG_ALT);
+  switch ((int)size) {
+  case 1:
+    emit_rm(g,0,0x88,REG_PRI,REG_DAT,REG_ALT,0);    /* mov [data+alt], r12b */
+    break;
+  case 2:
+    emit8(g,0x66);
+    emit_rm(g,0,0x89,REG_PRI,REG_DAT,REG_ALT,0);    /* mov [data+alt], r12w */
+    break;
+  case 4:
+    store(g,REG_DAT,REG_ALT,0,REG_PRI);
+    break;
+  } /* switch */
+}
+
+static void vm_lidx(JITGEN *g,cell shift)
+{
+  mov_rr(g,RAX,REG_PRI);
+  emit_rr(g,0,0xc1,4,RAX);              /* shl eax, shift */
+  emit8(g,(int)shift);
+  emit_rr(g,0,0x01,REG_ALT,RAX);        /* add eax,alt */
+  vm_checkaddr(g,RAX);
+  load(g,REG_PRI,REG_DAT,RAX,0);
+}
+
+static void vm_idxaddr(JITGEN *g,cell shift)
+{
+  emit_rr(g,0,0xc1,4,REG_PRI);          /* shl pri, shift */
+  emit8(g,(int)shift);
+  emit_rr(g,0,0x01,REG_ALT,REG_PRI);    /* add pri,alt */
+}
+
+static void vm_stack(JITGEN *g,cell offs)
+{
+  alu_ri(g,ALU_ADD,REG_STK,offs);
+  mov_rr(g,REG_ALT,REG_STK);
+  load(g,RAX,REG_AMX,NOINDEX,AMXFIELD(hea));
+  vm_checkmargin(g);
+  emit_rm(g,0,0x3b,REG_STK,REG_AMX,NOINDEX,AMXFIELD(stp));  /* cmp stk,[amx.stp] */
+  jump_to(g,CC_G,g->err_stacklow);
+}
+
+static void vm_heap(JITGEN *g,cell offs)
+{
+  load(g,RAX,REG_AMX,NOINDEX,AMXFIELD(hea));
+  mov_rr(g,REG_ALT,RAX);
+  alu_ri(g,ALU_ADD,RAX,offs);
+  store(g,REG_AMX,NOINDEX,AMXFIELD(hea),RAX);
+  vm_checkmargin(g);
+  emit_rm(g,0,0x3b,RAX,REG_AMX,NOINDEX,AMXFIELD(hlw));      /* cmp eax,[amx.hlw] */
+  jump_to(g,CC_L,g->err_heaplow);
+}
+
+static void vm_halt(JITGEN *g,cell offs,cell next)
+{
+  store_imm(g,REG_AMX,NOINDEX,AMXFIELD(cip),next);
+  mov_ri(g,RAX,offs);
+  jump_to(g,CC_ALWAYS,g->halt);
+}
+
+static void vm_bounds(JITGEN *g,cell limit,cell next)
+{
+  unsigned char *ok;
+  alu_ri(g,ALU_CMP,REG_PRI,limit);
+  ok=jump_short(g,CC_BE);
+  store_imm(g,REG_AMX,NOINDEX,AMXFIELD(cip),next);
+  jump_to(g,CC_ALWAYS,g->err_bounds);
+  resolve_short(g,ok);
+}
+
+/* call a helper function in C; the helper gets the AMX, the data pointer and
+ * a parameter, it may modify PRI in the AMX structure and it returns an error
+ * code
+ */
+static void vm_helper(JITGEN *g,int (*func)(AMX*,unsigned char*,cell),cell param)
+{
+  vm_save(g);
+  emit_rr(g,1,0x89,REG_AMX,RDI);        /* mov rdi,rbx */
+  emit_rr(g,1,0x89,REG_DAT,RSI);        /* mov rsi,rbp */
+  mov_ri(g,RDX,param);
+  call_helper(g,func);
+  load(g,REG_PRI,REG_AMX,NOINDEX,AMXFIELD(pri));
+  emit_rr(g,0,0x85,RAX,RAX);            /* test eax,eax */
+  jump_to(g,CC_NE,g->exit);
+}
+
+/* call a native function, through the table of amx_SetNatives() if there is
+ * one (a negative index is for AMX_NATIVETABLE), or else through the
+ * callback; eax holds the error code afterwards
+ */
+static void vm_sysreq(JITGEN *g,cell index,cell next)
+{
+  unsigned char *nocall,*done=NULL;
+
+  store_imm(g,REG_AMX,NOINDEX,AMXFIELD(cip),next);
+  store(g,REG_AMX,NOINDEX,AMXFIELD(frm),REG_FRM);
+  store(g,REG_AMX,NOINDEX,AMXFIELD(stk),REG_STK);
+  emit_rr(g,1,0x89,REG_AMX,RDI);        /* mov rdi,rbx */
+  if (index>=0) {
+    emit_rm(g,1,0x8b,RAX,REG_AMX,NOINDEX,AMXFIELD(natives)); /* mov rax,[amx.natives] */
+    emit_rr(g,1,0x85,RAX,RAX);          /* test rax,rax */
+    nocall=jump_short(g,CC_E);
+    store_imm(g,REG_AMX,NOINDEX,AMXFIELD(error),AMX_ERR_NONE);
+    emit_rm(g,1,0x8d,RSI,REG_DAT,REG_STK,0);            /* lea rsi,[data+stk] */
+    emit_rm(g,0,0xff,2,RAX,NOINDEX,(int32_t)(index*sizeof(AMX_NATIVE))); /* call [rax+index*8] */
+    mov_rr(g,REG_PRI,RAX);
+    load(g,RAX,REG_AMX,NOINDEX,AMXFIELD(error));
+    done=jump_short(g,CC_ALWAYS);
+    resolve_short(g,nocall);
+  } /* if */
+  mov_ri(g,RSI,index);
+  emit_rm(g,1,0x8d,RDX,REG_AMX,NOINDEX,AMXFIELD(pri));  /* lea rdx,[amx.pri] */
+  emit_rm(g,1,0x8d,RCX,REG_DAT,REG_STK,0);              /* lea rcx,[data+stk] */
+  emit_rm(g,0,0xff,2,REG_AMX,NOINDEX,AMXFIELD(callback)); /* call [amx.callback] */
+  load(g,REG_PRI,REG_AMX,NOINDEX,AMXFIELD(pri));
+  if (done!=NULL)
+    resolve_short(g,done);
+}
+
+/* inline the intrinsic that AMX.C marked in a SYSREQ(.N) (the index plus one
+ * is in the upper half of the opcode), if it is one of the basic operations
+ * of the floating point library; the arguments are at [data+stk+args]. On
+ * x86-64, SSE gives the same results for these as the C code in amxfloat.c.
+ * Returns 0 if the call must be compiled as usual.
+ */
+static int vm_intrinsic(JITGEN *g,int index,int32_t args)
+{
+  static const struct {
+    const char *name;
+    int opcode;
+  } sse[] = {
+    { "floatadd", 0x0f58 },
+    { "floatsub", 0x0f5c },
+    { "floatmul", 0x0f59 },
+    { "floatdiv", 0x0f5e },
+  };
+  const char *name;
+  int i;
+
+  if (index<=0 || (name=amx_jit_intrinsic(index-1))==NULL)
+    return 0;
+  for (i=0; i<(int)(sizeof sse / sizeof sse[0]) && strcmp(sse[i].name,name)!=0; i++)
+    /* nothing */;
+  if (i<(int)(sizeof sse / sizeof sse[0])) {
+    emit8(g,0xf3);
+    emit_rm(g,0,0x0f10,0,REG_DAT,REG_STK,args);       /* movss xmm0,[data+stk+args] */
+    emit8(g,0xf3);
+    emit_rm(g,0,sse[i].opcode,0,REG_DAT,REG_STK,args+sizeof(cell)); /* addss/subss/... xmm0,[...] */
+  } else if (strcmp(name,"float")==0) {
+    emit8(g,0xf3);
+    emit_rm(g,0,0x0f2a,0,REG_DAT,REG_STK,args);       /* cvtsi2ss xmm0,dword [data+stk+args] */
+  } else if (strcmp(name,"floatcmp")==0) {
+    /* 1 if a>b, 0 if a==b, else -1 (also for NaN): 2*above + equal - 1 */
+    emit8(g,0xf3);
+    emit_rm(g,0,0x0f10,0,REG_DAT,REG_STK,args);       /* movss xmm0,[data+stk+args] */
+    emit_rm(g,0,0x0f2e,0,REG_DAT,REG_STK,args+sizeof(cell)); /* ucomiss xmm0,[...] */
+    emit_rr(g,0,0x0f90+CC_A,0,RAX);                   /* seta al */
+    emit_rr(g,0,0x0f90+CC_E,0,RCX);                   /* sete cl */
+    emit_rr(g,0,0x0f90+CC_NP,0,RDX);                  /* setnp dl */
+    emit_rr(g,0,0x20,RDX,RCX);                        /* and cl,dl */
+    emit_rr(g,0,0x0fb6,RAX,RAX);                      /* movzx eax,al */
+    emit_rr(g,0,0x0fb6,RCX,RCX);                      /* movzx ecx,cl */
+    emit_rr(g,0,0x01,RAX,RAX);                        /* add eax,eax */
+    lea(g,REG_PRI,RAX,RCX,-1);
+    return 1;
+  } else {
+    return 0;
+  } /* if */
+  emit8(g,0x66);
+  emit_rr(g,0,0x0f7e,0,REG_PRI);                      /* movd r12d,xmm0 */
+  return 1;
+}
+
+
+/* ----- helper functions, called from the generated code ----- */
+
+#define BADADDR(a)  (((a)>=amx->hea && (a)<amx->stk) || (ucell)(a)>=(ucell)amx->stp)
+#define BADEND(a)   (((a)>amx->hea && (a)<amx->stk) || (ucell)(a)>(ucell)amx->stp)
+
+static int jit_movs(AMX *amx,unsigned char *data,cell offs)
+{
+  if (BADADDR(amx->pri) || BADEND(amx->pri+offs) || BADADDR(amx->alt) || BADEND(amx->alt+offs))
+    return AMX_ERR_MEMACCESS;
+  memcpy(data+(int)amx->alt,data+(int)amx->pri,(int)offs);
+  return AMX_ERR_NONE;
+}
+
+static int jit_cmps(AMX *amx,unsigned char *data,cell offs)
+{
+  if (BADADDR(amx->pri) || BADEND(amx->pri+offs) || BADADDR(amx->alt) || BADEND(amx->alt+offs))
+    return AMX_ERR_MEMACCESS;
+  amx->pri=memcmp(data+(int)amx->alt,data+(int)amx->pri,(int)offs);
+  return AMX_ERR_NONE;
+}
+
+static int jit_fill(AMX *amx,unsigned char *data,cell offs)
+{
+  cell i;
+  if (BADADDR(amx->alt) || BADEND(amx->alt+offs))
+    return AMX_ERR_MEMACCESS;
+  for (i=amx->alt; (size_t)offs>=sizeof(cell); i+=sizeof(cell), offs-=sizeof(cell))
+    *(cell *)(data+(int)i)=amx->pri;
+  return AMX_ERR_NONE;
+}
+
+
+/* ----- run-time stubs ----- */
+
+static int32_t gen_error(JITGEN *g,int error)
+{
+  int32_t pos=here(g);
+  mov_ri(g,RAX,error);
+  jump_to(g,CC_ALWAYS,g->exit);
+  return pos;
+}
+
+static void gen_stubs(JITGEN *g,JITINFO *info)
+{
+  int reg;
+
+  /* entry: int entry(AMX *amx, unsigned char *data, void *target, cell *retval)
+   * saves the callee-saved registers, loads the abstract machine registers and
+   * jumps to the target; the "retval" pointer is kept on the native stack
+   */
+  info->entry=here(g);
+  emit8(g,0x53);                        /* push rbx */
+  emit8(g,0x55);                        /* push rbp */
+  for (reg=R12; reg<=R15; reg++) {
+    emit8(g,0x41);                      /* push r12 .. r15 */
+    emit8(g,0x50+(reg & 7));
+  } /* for */
+  emit_rr(g,1,0x83,ALU_SUB,RSP);        /* sub rsp,8 (stack is now 16-byte aligned) */
+  emit8(g,8);
+  emit_rm(g,1,0x89,RCX,RSP,NOINDEX,0);  /* mov [rsp],rcx */
+  emit_rr(g,1,0x89,RDI,REG_AMX);        /* mov rbx,rdi */
+  emit_rr(g,1,0x89,RSI,REG_DAT);        /* mov rbp,rsi */
+  load(g,REG_PRI,REG_AMX,NOINDEX,AMXFIELD(pri));
+  load(g,REG_ALT,REG_AMX,NOINDEX,AMXFIELD(alt));
+  load(g,REG_STK,REG_AMX,NOINDEX,AMXFIELD(stk));
+  load(g,REG_FRM,REG_AMX,NOINDEX,AMXFIELD(frm));
+  emit8(g,0xff);                        /* jmp rdx */
+  emit8(g,0xe2);
+
+  /* exit: eax holds the return code */
+  g->exit=here(g);
+  vm_save(g);
+  emit_rr(g,1,0x83,ALU_ADD,RSP);        /* add rsp,8 */
+  emit8(g,8);
+  for (reg=R15; reg>=R12; reg--) {
+    emit8(g,0x41);                      /* pop r15 .. r12 */
+    emit8(g,0x58+(reg & 7));
+  } /* for */
+  emit8(g,0x5d);                        /* pop rbp */
+  emit8(g,0x5b);                        /* pop rbx */
+  emit8(g,0xc3);                        /* ret */
+
+  /* halt: store PRI in "retval" (if not NULL), eax holds the return code */
+  g->halt=here(g);
+  emit_rm(g,1,0x8b,RCX,RSP,NOINDEX,0);  /* mov rcx,[rsp] */
+  emit_rr(g,1,0x85,RCX,RCX);            /* test rcx,rcx */
+  { unsigned char *skip=jump_short(g,CC_E);
+    store(g,RCX,NOINDEX,0,REG_PRI);
+    resolve_short(g,skip);
+  }
+  jump_to(g,CC_ALWAYS,g->exit);
+
+  /* errors */
+  g->err_memaccess=gen_error(g,AMX_ERR_MEMACCESS);
+  g->err_stackerr=gen_error(g,AMX_ERR_STACKERR);
+  g->err_stacklow=gen_error(g,AMX_ERR_STACKLOW);
+  g->err_heaplow=gen_error(g,AMX_ERR_HEAPLOW);
+  g->err_divide=gen_error(g,AMX_ERR_DIVIDE);
+  g->err_bounds=gen_error(g,AMX_ERR_BOUNDS);
+
+  /* dispatch: jump to the P-code address in eax (for RET, RETN and SCTRL 6) */
+  g->dispatch=here(g);
+  emit8(g,0x3d);                        /* cmp eax,mapsize */
+  emit32(g,info->mapsize);
+  jump_to(g,CC_AE,g->err_memaccess);
+  emit8(g,0xa8);                        /* test al,3 */
+  emit8(g,sizeof(cell)-1);
+  jump_to(g,CC_NE,g->err_memaccess);
+  emit_rex(g,1,RCX,NOINDEX,0);          /* lea rcx,[rip+region] */
+  emit8(g,0x8d);
+  emit8(g,0x0d);
+  emit32(g,-(here(g)+4));
+  emit_rm(g,1,0x63,RAX,RCX,RAX,sizeof(JITINFO)); /* movsxd rax,[rcx+rax+map] */
+  emit_rr(g,1,0x01,RCX,RAX);            /* add rax,rcx */
+  emit8(g,0xff);                        /* jmp rax */
+  emit8(g,0xe0);
+
+  /* floored division: eax = dividend, ecx = divisor (not zero); returns the
+   * quotient in eax and the remainder in edx
+   */
+  g->sdiv=here(g);
+  { unsigned char *div,*done1,*done2;
+    alu_ri(g,ALU_CMP,RCX,-1);
+    div=jump_short(g,CC_NE);
+    emit_rr(g,0,0xf7,3,RAX);            /* neg eax (avoids overflow trap) */
+    emit_rr(g,0,0x31,RDX,RDX);          /* xor edx,edx */
+    emit8(g,0xc3);                      /* ret */
+    resolve_short(g,div);
+    emit8(g,0x99);                      /* cdq */
+    emit_rr(g,0,0xf7,7,RCX);            /* idiv ecx */
+    emit_rr(g,0,0x85,RDX,RDX);          /* test edx,edx */
+    done1=jump_short(g,CC_E);
+    mov_rr(g,RSI,RDX);
+    emit_rr(g,0,0x31,RCX,RSI);          /* xor esi,ecx */
+    done2=jump_short(g,CC_NS);
+    emit_rr(g,0,0xff,1,RAX);            /* dec eax */
+    emit_rr(g,0,0x01,RCX,RDX);          /* add edx,ecx */
+    resolve_short(g,done1);
+    resolve_short(g,done2);
+    emit8(g,0xc3);                      /* ret */
+  }
+
+  /* debug hook: called (with a native "call") from BREAK, with amx->cip set */
+  g->debug=here(g);
+  { unsigned char *fail;
+    vm_save(g);
+    emit_rr(g,1,0x83,ALU_SUB,RSP);      /* sub rsp,8 (re-align the stack) */
+    emit8(g,8);
+    emit_rr(g,1,0x89,REG_AMX,RDI);      /* mov rdi,rbx */
+    emit_rm(g,0,0xff,2,REG_AMX,NOINDEX,AMXFIELD(debug)); /* call [amx.debug] */
+    emit_rr(g,1,0x83,ALU_ADD,RSP);      /* add rsp,8 */
+    emit8(g,8);
+    emit_rr(g,0,0x85,RAX,RAX);          /* test eax,eax */
+    fail=jump_short(g,CC_NE);
+    emit8(g,0xc3);                      /* ret */
+    resolve_short(g,fail);
+    emit_rr(g,1,0x83,ALU_ADD,RSP);      /* add rsp,8 (drop the return address) */
+    emit8(g,8);
+    jump_to(g,CC_ALWAYS,g->exit);
+  }
+}
+
+
+/* ----- the compiler ----- */
+
+#define CODEOFFS(p)     ((cell)((unsigned char *)(p)-(unsigned char *)code))
+#define JUMPTARGET(p)   (CODEOFFS(p)+*(p)-(cell)sizeof(cell))
+#define PACKEDPARAM(op) ((cell)(op)>>(int)(sizeof(cell)*4))
+
+static int compile(JITGEN *g,JITINFO *info,cell *code)
+{
+  cell *cip,*end,*start;
+  cell op,offs,val;
+  unsigned char *nstart;
+  int i;
+
+  end=(cell *)((unsigned char *)code+info->mapsize);
+  for (cip=code; cip<end; ) {
+    start=cip;
+    nstart=g->ip;
+    g->map[cip-code]=here(g);
+    op=*cip++;
+    switch ((OPCODE)(op & ((1 << sizeof(cell)*4)-1))) {
+    case OP_NOP:
+      break;
+    case OP_LOAD_PRI:
+      load(g,REG_PRI,REG_DAT,NOINDEX,*cip++);
+      break;
+    case OP_LOAD_ALT:
+      load(g,REG_ALT,REG_DAT,NOINDEX,*cip++);
+      break;
+    case OP_LOAD_S_PRI:
+      load(g,REG_PRI,REG_DAT,REG_FRM,*cip++);
+      break;
+    case OP_LOAD_S_ALT:
+      load(g,REG_ALT,REG_DAT,REG_FRM,*cip++);
+      break;
+    case OP_LREF_S_PRI:
+      load(g,RAX,REG_DAT,REG_FRM,*cip++);
+      load(g,REG_PRI,REG_DAT,RAX,0);
+      break;
+    case OP_LREF_S_ALT:
+      load(g,RAX,REG_DAT,REG_FRM,*cip++);
+      load(g,REG_ALT,REG_DAT,RAX,0);
+      break;
+    case OP_LOAD_I:
+      vm_checkaddr(g,REG_PRI);
+      load(g,REG_PRI,REG_DAT,REG_PRI,0);
+      break;
+    case OP_LODB_I:
+      vm_lodb(g,*cip++);
+      break;
+    case OP_CONST_PRI:
+      mov_ri(g,REG_PRI,*cip++);
+      break;
+    case OP_CONST_ALT:
+      mov_ri(g,REG_ALT,*cip++);
+      break;
+    case OP_ADDR_PRI:
+      lea(g,REG_PRI,REG_FRM,NOINDEX,*cip++);
+      break;
+    case OP_ADDR_ALT:
+      lea(g,REG_ALT,REG_FRM,NOINDEX,*cip++);
+      break;
+    case OP_STOR:
+      store(g,REG_DAT,NOINDEX,*cip++,REG_PRI);
+      break;
+    case OP_STOR_S:
+      store(g,REG_DAT,REG_FRM,*cip++,REG_PRI);
+      break;
+    case OP_SREF_S:
+      load(g,RAX,REG_DAT,REG_FRM,*cip++);
+      store(g,REG_DAT,RAX,0,REG_PRI);
+      break;
+    case OP_STOR_I:
+      vm_checkaddr(g,REG_ALT);
+      store(g,REG_DAT,REG_ALT,0,REG_PRI);
+      break;
+    case OP_STRB_I:
+      vm_strb(g,*cip++);
+      break;
+    case OP_ALIGN_PRI:
+      offs=*cip++;
+      if ((size_t)offs<sizeof(cell))
+        alu_ri(g,ALU_XOR,REG_PRI,sizeof(cell)-offs);
+      break;
+    case OP_LCTRL:
+      switch ((int)*cip++) {
+      case 0:
+        mov_ri(g,REG_PRI,info->cod);
+        break;
+      case 1:
+        mov_ri(g,REG_PRI,info->dat);
+        break;
+      case 2:
+        load(g,REG_PRI,REG_AMX,NOINDEX,AMXFIELD(hea));
+        break;
+      case 3:
+        load(g,REG_PRI,REG_AMX,NOINDEX,AMXFIELD(stp));
+        break;
+      case 4:
+        mov_rr(g,REG_PRI,REG_STK);
+        break;
+      case 5:
+        mov_rr(g,REG_PRI,REG_FRM);
+        break;
+      case 6:
+        mov_ri(g,REG_PRI,CODEOFFS(cip));
+        break;
+      } /* switch */
+      break;
+    case OP_SCTRL:
+      switch ((int)*cip++) {
+      case 2:
+        store(g,REG_AMX,NOINDEX,AMXFIELD(hea),REG_PRI);
+        break;
+      case 4:
+        mov_rr(g,REG_STK,REG_PRI);
+        break;
+      case 5:
+        mov_rr(g,REG_FRM,REG_PRI);
+        break;
+      case 6:
+        mov_rr(g,RAX,REG_PRI);
+        jump_to(g,CC_ALWAYS,g->dispatch);
+        break;
+      } /* switch */
+      break;
+    case OP_XCHG:
+      emit_rr(g,0,0x87,REG_ALT,REG_PRI);
+      break;
+    case OP_PUSH_PRI:
+      vm_push(g,REG_PRI);
+      break;
+    case OP_PUSH_ALT:
+      vm_push(g,REG_ALT);
+      break;
+    case OP_PUSHR_PRI:
+      lea(g,RAX,REG_DAT,REG_PRI,0);
+      vm_push(g,RAX);
+      break;
+    case OP_POP_PRI:
+      vm_pop(g,REG_PRI);
+      break;
+    case OP_POP_ALT:
+      vm_pop(g,REG_ALT);
+      break;
+    case OP_PICK:
+      load(g,REG_PRI,REG_DAT,REG_STK,*cip++);
+      break;
+    case OP_STACK:
+      vm_stack(g,*cip++);
+      break;
+    case OP_HEAP:
+      vm_heap(g,*cip++);
+      break;
+    case OP_PROC:
+      vm_push(g,REG_FRM);
+      mov_rr(g,REG_FRM,REG_STK);
+      load(g,RAX,REG_AMX,NOINDEX,AMXFIELD(hea));
+      vm_checkmargin(g);
+      break;
+    case OP_RET:
+      vm_pop(g,REG_FRM);
+      vm_pop(g,RAX);
+      jump_to(g,CC_ALWAYS,g->dispatch);
+      break;
+    case OP_RETN:
+      vm_pop(g,REG_FRM);
+      vm_pop(g,RAX);
+      load(g,RCX,REG_DAT,REG_STK,0);    /* remove parameters from the stack */
+      lea(g,REG_STK,REG_STK,RCX,sizeof(cell));
+      jump_to(g,CC_ALWAYS,g->dispatch);
+      break;
+    case OP_CALL:
+      vm_push_imm(g,CODEOFFS(cip+1));
+      jump_pcode(g,CC_ALWAYS,JUMPTARGET(cip));
+      cip++;
+      break;
+    case OP_JUMP:
+      jump_pcode(g,CC_ALWAYS,JUMPTARGET(cip));
+      cip++;
+      break;
+    case OP_JZER:
+    case OP_JNZ:
+      emit_rr(g,0,0x85,REG_PRI,REG_PRI);
+      jump_pcode(g,((op & 0xffff)==OP_JZER) ? CC_E : CC_NE,JUMPTARGET(cip));
+      cip++;
+      break;
+    case OP_SHL:
+    case OP_SHR:
+    case OP_SSHR:
+      mov_rr(g,RCX,REG_ALT);
+      emit_rr(g,0,0xd3,((op & 0xffff)==OP_SHL) ? 4 : ((op & 0xffff)==OP_SHR) ? 5 : 7,REG_PRI);
+      break;
+    case OP_SHL_C_PRI:
+      emit_rr(g,0,0xc1,4,REG_PRI);
+      emit8(g,(int)*cip++);
+      break;
+    case OP_SHL_C_ALT:
+      emit_rr(g,0,0xc1,4,REG_ALT);
+      emit8(g,(int)*cip++);
+      break;
+    case OP_SMUL:
+      emit_rr(g,0,0x0faf,REG_PRI,REG_ALT);
+      break;
+    case OP_SDIV:
+      vm_sdiv(g,REG_ALT,REG_PRI);
+      break;
+    case OP_ADD:
+      emit_rr(g,0,0x01,REG_ALT,REG_PRI);
+      break;
+    case OP_SUB:
+      emit_rr(g,0,0xf7,3,REG_PRI);      /* neg pri */
+      emit_rr(g,0,0x01,REG_ALT,REG_PRI);
+      break;
+    case OP_AND:
+      emit_rr(g,0,0x21,REG_ALT,REG_PRI);
+      break;
+    case OP_OR:
+      emit_rr(g,0,0x09,REG_ALT,REG_PRI);
+      break;
+    case OP_XOR:
+      emit_rr(g,0,0x31,REG_ALT,REG_PRI);
+      break;
+    case OP_NOT:
+      emit_rr(g,0,0x85,REG_PRI,REG_PRI);
+      setcc_pri(g,CC_E);
+      break;
+    case OP_NEG:
+      emit_rr(g,0,0xf7,3,REG_PRI);
+      break;
+    case OP_INVERT:
+      emit_rr(g,0,0xf7,2,REG_PRI);
+      break;
+    case OP_EQ:
+    case OP_NEQ:
+    case OP_SLESS:
+    case OP_SLEQ:
+    case OP_SGRTR:
+    case OP_SGEQ: {
+      static const unsigned char cc[] = { CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE };
+      emit_rr(g,0,0x39,REG_ALT,REG_PRI);  /* cmp pri,alt */
+      setcc_pri(g,cc[(op & 0xffff)-OP_EQ]);
+      break;
+    } /* case */
+    case OP_INC_PRI:
+      alu_ri(g,ALU_ADD,REG_PRI,1);
+      break;
+    case OP_INC_ALT:
+      alu_ri(g,ALU_ADD,REG_ALT,1);
+      break;
+    case OP_INC_I:
+      alu_mi(g,ALU_ADD,REG_DAT,REG_PRI,0,1);
+      break;
+    case OP_DEC_PRI:
+      alu_ri(g,ALU_SUB,REG_PRI,1);
+      break;
+    case OP_DEC_ALT:
+      alu_ri(g,ALU_SUB,REG_ALT,1);
+      break;
+    case OP_DEC_I:
+      alu_mi(g,ALU_SUB,REG_DAT,REG_PRI,0,1);
+      break;
+    case OP_MOVS:
+      vm_helper(g,jit_movs,*cip++);
+      break;
+    case OP_CMPS:
+      vm_helper(g,jit_cmps,*cip++);
+      break;
+    case OP_FILL:
+      vm_helper(g,jit_fill,*cip++);
+      break;
+    case OP_HALT:
+      offs=*cip++;
+      vm_halt(g,offs,CODEOFFS(cip));
+      break;
+    case OP_BOUNDS:
+      offs=*cip++;
+      vm_bounds(g,offs,CODEOFFS(cip));
+      break;
+    case OP_SYSREQ:
+      offs=*cip++;
+      if (vm_intrinsic(g,(int)PACKEDPARAM(op),sizeof(cell)))
+        break;          /* the arguments are behind the argument count */
+      vm_sysreq(g,offs,CODEOFFS(cip));
+      emit_rr(g,0,0x85,RAX,RAX);        /* test eax,eax */
+      jump_to(g,CC_NE,g->exit);
+      break;
+    case OP_SWITCH:
+      /* jump to the case table, which is compiled to a sequence of compares */
+      jump_pcode(g,CC_ALWAYS,JUMPTARGET(cip));
+      cip++;
+      break;
+    case OP_SWAP_PRI:
+    case OP_SWAP_ALT: {
+      int reg=((op & 0xffff)==OP_SWAP_PRI) ? REG_PRI : REG_ALT;
+      load(g,RAX,REG_DAT,REG_STK,0);
+      store(g,REG_DAT,REG_STK,0,reg);
+      mov_rr(g,reg,RAX);
+      break;
+    } /* case */
+    case OP_BREAK: {
+      unsigned char *skip;
+      emit_rm(g,1,0x83,ALU_CMP,REG_AMX,NOINDEX,AMXFIELD(debug));  /* cmp qword [amx.debug],0 */
+      emit8(g,0);
+      skip=jump_short(g,CC_E);
+      store_imm(g,REG_AMX,NOINDEX,AMXFIELD(cip),CODEOFFS(cip));
+      call_to(g,g->debug);
+      resolve_short(g,skip);
+      break;
+    } /* case */
+    case OP_CASETBL:
+      val=*cip++;                       /* number of records */
+      offs=JUMPTARGET(cip);             /* default case */
+      cip++;
+      for (i=0; i<(int)val; i++) {
+        alu_ri(g,ALU_CMP,REG_PRI,cip[0]);
+        jump_pcode(g,CC_E,JUMPTARGET(cip+1));
+        cip+=2;
+      } /* for */
+      jump_pcode(g,CC_ALWAYS,offs);
+      break;
+
+    /* supplemental and macro instructions */
+    case OP_LIDX:
+      vm_lidx(g,2);
+      break;
+    case OP_LIDX_B:
+      vm_lidx(g,*cip++);
+      break;
+    case OP_IDXADDR:
+      vm_idxaddr(g,2);
+      break;
+    case OP_IDXADDR_B:
+      vm_idxaddr(g,*cip++);
+      break;
+    case OP_PUSH_C:
+      cip=vm_pushmulti(g,PV_CONST,cip,1);
+      break;
+    case OP_PUSH:
+      cip=vm_pushmulti(g,PV_DATA,cip,1);
+      break;
+    case OP_PUSH_S:
+      cip=vm_pushmulti(g,PV_STACK,cip,1);
+      break;
+    case OP_PUSH_ADR:
+      cip=vm_pushmulti(g,PV_ADDR,cip,1);
+      break;
+    case OP_PUSHR_C:
+      cip=vm_pushmulti(g,PV_RCONST,cip,1);
+      break;
+    case OP_PUSHR_S:
+      cip=vm_pushmulti(g,PV_RSTACK,cip,1);
+      break;
+    case OP_PUSHR_ADR:
+      cip=vm_pushmulti(g,PV_RADDR,cip,1);
+      break;
+    case OP_JEQ:
+    case OP_JNEQ:
+    case OP_JSLESS:
+    case OP_JSLEQ:
+    case OP_JSGRTR:
+    case OP_JSGEQ: {
+      static const unsigned char cc[] = { CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE };
+      emit_rr(g,0,0x39,REG_ALT,REG_PRI);  /* cmp pri,alt */
+      jump_pcode(g,cc[(op & 0xffff)-OP_JEQ],JUMPTARGET(cip));
+      cip++;
+      break;
+    } /* case */
+    case OP_SDIV_INV:
+      vm_sdiv(g,REG_PRI,REG_ALT);
+      break;
+    case OP_SUB_INV:
+      emit_rr(g,0,0x29,REG_ALT,REG_PRI);
+      break;
+    case OP_ADD_C:
+      alu_ri(g,ALU_ADD,REG_PRI,*cip++);
+      break;
+    case OP_SMUL_C:
+      emit_rr(g,0,0x69,REG_PRI,REG_PRI);
+      emit32(g,*cip++);
+      break;
+    case OP_ZERO_PRI:
+      emit_rr(g,0,0x31,REG_PRI,REG_PRI);
+      break;
+    case OP_ZERO_ALT:
+      emit_rr(g,0,0x31,REG_ALT,REG_ALT);
+      break;
+    case OP_ZERO:
+      store_imm(g,REG_DAT,NOINDEX,*cip++,0);
+      break;
+    case OP_ZERO_S:
+      store_imm(g,REG_DAT,REG_FRM,*cip++,0);
+      break;
+    case OP_EQ_C_PRI:
+      alu_ri(g,ALU_CMP,REG_PRI,*cip++);
+      setcc_pri(g,CC_E);
+      break;
+    case OP_EQ_C_ALT:
+      alu_ri(g,ALU_CMP,REG_ALT,*cip++);
+      setcc_pri(g,CC_E);
+      break;
+    case OP_INC:
+      alu_mi(g,ALU_ADD,REG_DAT,NOINDEX,*cip++,1);
+      break;
+    case OP_INC_S:
+      alu_mi(g,ALU_ADD,REG_DAT,REG_FRM,*cip++,1);
+      break;
+    case OP_DEC:
+      alu_mi(g,ALU_SUB,REG_DAT,NOINDEX,*cip++,1);
+      break;
+    case OP_DEC_S:
+      alu_mi(g,ALU_SUB,REG_DAT,REG_FRM,*cip++,1);
+      break;
+    case OP_SYSREQ_N:
+      offs=*cip++;
+      val=*cip++;
+      if (vm_intrinsic(g,(int)PACKEDPARAM(op),0)) {
+        alu_ri(g,ALU_ADD,REG_STK,val);
+        break;
+      } /* if */
+      vm_push_imm(g,val);
+      vm_sysreq(g,offs,CODEOFFS(cip));
+      alu_ri(g,ALU_ADD,REG_STK,val+sizeof(cell));
+      emit_rr(g,0,0x85,RAX,RAX);        /* test eax,eax */
+      jump_to(g,CC_NE,g->exit);
+      break;
+    case OP_PUSHM_C:
+      val=*cip++;
+      cip=vm_pushmulti(g,PV_CONST,cip,(int)val);
+      break;
+    case OP_PUSHM:
+      val=*cip++;
+      cip=vm_pushmulti(g,PV_DATA,cip,(int)val);
+      break;
+    case OP_PUSHM_S:
+      val=*cip++;
+      cip=vm_pushmulti(g,PV_STACK,cip,(int)val);
+      break;
+    case OP_PUSHM_ADR:
+      val=*cip++;
+      cip=vm_pushmulti(g,PV_ADDR,cip,(int)val);
+      break;
+    case OP_PUSHRM_C:
+      val=*cip++;
+      cip=vm_pushmulti(g,PV_RCONST,cip,(int)val);
+      break;
+    case OP_PUSHRM_S:
+      val=*cip++;
+      cip=vm_pushmulti(g,PV_RSTACK,cip,(int)val);
+      break;
+    case OP_PUSHRM_ADR:
+      val=*cip++;
+      cip=vm_pushmulti(g,PV_RADDR,cip,(int)val);
+      break;
+    case OP_LOAD2:
+      load(g,REG_PRI,REG_DAT,NOINDEX,*cip++);
+      load(g,REG_ALT,REG_DAT,NOINDEX,*cip++);
+      break;
+    case OP_LOAD2_S:
+      load(g,REG_PRI,REG_DAT,REG_FRM,*cip++);
+      load(g,REG_ALT,REG_DAT,REG_FRM,*cip++);
+      break;
+    case OP_CONST:
+      offs=*cip++;
+      store_imm(g,REG_DAT,NOINDEX,offs,*cip++);
+      break;
+    case OP_CONST_S:
+      offs=*cip++;
+      store_imm(g,REG_DAT,REG_FRM,offs,*cip++);
+      break;
+
+    /* packed instructions */
+    case OP_LOAD_P_PRI:
+      load(g,REG_PRI,REG_DAT,NOINDEX,PACKEDPARAM(op));
+      break;
+    case OP_LOAD_P_ALT:
+      load(g,REG_ALT,REG_DAT,NOINDEX,PACKEDPARAM(op));
+      break;
+    case OP_LOAD_P_S_PRI:
+      load(g,REG_PRI,REG_DAT,REG_FRM,PACKEDPARAM(op));
+      break;
+    case OP_LOAD_P_S_ALT:
+      load(g,REG_ALT,REG_DAT,REG_FRM,PACKEDPARAM(op));
+      break;
+    case OP_LREF_P_S_PRI:
+      load(g,RAX,REG_DAT,REG_FRM,PACKEDPARAM(op));
+      load(g,REG_PRI,REG_DAT,RAX,0);
+      break;
+    case OP_LREF_P_S_ALT:
+      load(g,RAX,REG_DAT,REG_FRM,PACKEDPARAM(op));
+      load(g,REG_ALT,REG_DAT,RAX,0);
+      break;
+    case OP_LODB_P_I:
+      vm_lodb(g,PACKEDPARAM(op));
+      break;
+    case OP_CONST_P_PRI:
+      mov_ri(g,REG_PRI,PACKEDPARAM(op));
+      break;
+    case OP_CONST_P_ALT:
+      mov_ri(g,REG_ALT,PACKEDPARAM(op));
+      break;
+    case OP_ADDR_P_PRI:
+      lea(g,REG_PRI,REG_FRM,NOINDEX,PACKEDPARAM(op));
+      break;
+    case OP_ADDR_P_ALT:
+      lea(g,REG_ALT,REG_FRM,NOINDEX,PACKEDPARAM(op));
+      break;
+    case OP_STOR_P:
+      store(g,REG_DAT,NOINDEX,PACKEDPARAM(op),REG_PRI);
+      break;
+    case OP_STOR_P_S:
+      store(g,REG_DAT,REG_FRM,PACKEDPARAM(op),REG_PRI);
+      break;
+    case OP_SREF_P_S:
+      load(g,RAX,REG_DAT,REG_FRM,PACKEDPARAM(op));
+      store(g,REG_DAT,RAX,0,REG_PRI);
+      break;
+    case OP_STRB_P_I:
+      vm_strb(g,PACKEDPARAM(op));
+      break;
+    case OP_LIDX_P_B:
+      vm_lidx(g,PACKEDPARAM(op));
+      break;
+    case OP_IDXADDR_P_B:
+      vm_idxaddr(g,PACKEDPARAM(op));
+      break;
+    case OP_ALIGN_P_PRI:
+      offs=PACKEDPARAM(op);
+      if ((size_t)offs<sizeof(cell))
+        alu_ri(g,ALU_XOR,REG_PRI,sizeof(cell)-offs);
+      break;
+    case OP_PUSH_P_C:
+      vm_pushvalue(g,PV_CONST,PACKEDPARAM(op),-(int32_t)sizeof(cell));
+      alu_ri(g,ALU_SUB,REG_STK,sizeof(cell));
+      break;
+    case OP_PUSH_P:
+      vm_pushvalue(g,PV_DATA,PACKEDPARAM(op),-(int32_t)sizeof(cell));
+      alu_ri(g,ALU_SUB,REG_STK,sizeof(cell));
+      break;
+    case OP_PUSH_P_S:
+      vm_pushvalue(g,PV_STACK,PACKEDPARAM(op),-(int32_t)sizeof(cell));
+      alu_ri(g,ALU_SUB,REG_STK,sizeof(cell));
+      break;
+    case OP_PUSH_P_ADR:
+      vm_pushvalue(g,PV_ADDR,PACKEDPARAM(op),-(int32_t)sizeof(cell));
+      alu_ri(g,ALU_SUB,REG_STK,sizeof(cell));
+      break;
+    case OP_PUSHR_P_C:
+      vm_pushvalue(g,PV_RCONST,PACKEDPARAM(op),-(int32_t)sizeof(cell));
+      alu_ri(g,ALU_SUB,REG_STK,sizeof(cell));
+      break;
+    case OP_PUSHR_P_S:
+      vm_pushvalue(g,PV_RSTACK,PACKEDPARAM(op),-(int32_t)sizeof(cell));
+      alu_ri(g,ALU_SUB,REG_STK,sizeof(cell));
+      break;
+    case OP_PUSHR_P_ADR:
+      vm_pushvalue(g,PV_RADDR,PACKEDPARAM(op),-(int32_t)sizeof(cell));
+      alu_ri(g,ALU_SUB,REG_STK,sizeof(cell));
+      break;
+    case OP_PUSHM_P_C:
+      cip=vm_pushmulti(g,PV_CONST,cip,(int)PACKEDPARAM(op));
+      break;
+    case OP_PUSHM_P:
+      cip=vm_pushmulti(g,PV_DATA,cip,(int)PACKEDPARAM(op));
+      break;
+    case OP_PUSHM_P_S:
+      cip=vm_pushmulti(g,PV_STACK,cip,(int)PACKEDPARAM(op));
+      break;
+    case OP_PUSHM_P_ADR:
+      cip=vm_pushmulti(g,PV_ADDR,cip,(int)PACKEDPARAM(op));
+      break;
+    case OP_PUSHRM_P_C:
+      cip=vm_pushmulti(g,PV_RCONST,cip,(int)PACKEDPARAM(op));
+      break;
+    case OP_PUSHRM_P_S:
+      cip=vm_pushmulti(g,PV_RSTACK,cip,(int)PACKEDPARAM(op));
+      break;
+    case OP_PUSHRM_P_ADR:
+      cip=vm_pushmulti(g,PV_RADDR,cip,(int)PACKEDPARAM(op));
+      break;
+    case OP_STACK_P:
+      vm_stack(g,PACKEDPARAM(op));
+      break;
+    case OP_HEAP_P:
+      vm_heap(g,PACKEDPARAM(op));
+      break;
+    case OP_SHL_P_C_PRI:
+      emit_rr(g,0,0xc1,4,REG_PRI);
+      emit8(g,(int)PACKEDPARAM(op));
+      break;
+    case OP_SHL_P_C_ALT:
+      emit_rr(g,0,0xc1,4,REG_ALT);
+      emit8(g,(int)PACKEDPARAM(op));
+      break;
+    case OP_ADD_P_C:
+      alu_ri(g,ALU_ADD,REG_PRI,PACKEDPARAM(op));
+      break;
+    case OP_SMUL_P_C:
+      emit_rr(g,0,0x69,REG_PRI,REG_PRI);
+      emit32(g,PACKEDPARAM(op));
+      break;
+    case OP_ZERO_P:
+      store_imm(g,REG_DAT,NOINDEX,PACKEDPARAM(op),0);
+      break;
+    case OP_ZERO_P_S:
+      store_imm(g,REG_DAT,REG_FRM,PACKEDPARAM(op),0);
+      break;
+    case OP_EQ_P_C_PRI:
+      alu_ri(g,ALU_CMP,REG_PRI,PACKEDPARAM(op));
+      setcc_pri(g,CC_E);
+      break;
+    case OP_EQ_P_C_ALT:
+      alu_ri(g,ALU_CMP,REG_ALT,PACKEDPARAM(op));
+      setcc_pri(g,CC_E);
+      break;
+    case OP_INC_P:
+      alu_mi(g,ALU_ADD,REG_DAT,NOINDEX,PACKEDPARAM(op),1);
+      break;
+    case OP_INC_P_S:
+      alu_mi(g,ALU_ADD,REG_DAT,REG_FRM,PACKEDPARAM(op),1);
+      break;
+    case OP_DEC_P:
+      alu_mi(g,ALU_SUB,REG_DAT,NOINDEX,PACKEDPARAM(op),1);
+      break;
+    case OP_DEC_P_S:
+      alu_mi(g,ALU_SUB,REG_DAT,REG_FRM,PACKEDPARAM(op),1);
+      break;
+    case OP_MOVS_P:
+      vm_helper(g,jit_movs,PACKEDPARAM(op));
+      break;
+    case OP_CMPS_P:
+      vm_helper(g,jit_cmps,PACKEDPARAM(op));
+      break;
+    case OP_FILL_P:
+      vm_helper(g,jit_fill,PACKEDPARAM(op));
+      break;
+    case OP_HALT_P:
+      vm_halt(g,PACKEDPARAM(op),CODEOFFS(cip));
+      break;
+    case OP_BOUNDS_P:
+      vm_bounds(g,PACKEDPARAM(op),CODEOFFS(cip));
+      break;
+
+    default:
+      /* SYSREQ.D and SYSREQ.ND are never generated for the JIT, overlays are
+       * not supported (and both were already rejected in VerifyPcode())
+       */
+      return AMX_ERR_INVINSTR;
+    } /* switch */
+    (void)nstart;
+    (void)start;
+    assert(g->ip-nstart<=JIT_MAXCELL*(cip-start));
+  } /* for */
+  return AMX_ERR_NONE;
+}
+
+
+/* amx_jit_compile()
+ * Compiles the P-code in "pcode" (the image that was passed to amx_Init())
+ * into "nativecode". The native image starts with a copy of the header,
+ * followed by the address map and the native code, and then the data section
+ * plus the stack and heap; the header fields "cod", "dat", "hea" and "stp"
+ * are adjusted for this layout. The "jumparray" must be at least
+ * amx->reloc_size bytes. Returns 0 on success.
+ */
+cell amx_jit_compile(void *pcode, void *jumparray, void *nativecode)
+{
+  AMX_HEADER *hdr,*nhdr;
+  JITGEN g;
+  JITINFO *info;
+  cell *code;
+  int32_t region,dat,delta,target;
+  int i,err;
+
+  assert(pcode!=NULL && nativecode!=NULL);
+  hdr=(AMX_HEADER *)pcode;
+  nhdr=(AMX_HEADER *)nativecode;
+  assert(hdr->magic==AMX_MAGIC);
+  code=(cell *)((unsigned char *)pcode+(int)hdr->cod);
+
+  /* the header (with all tables) is assumed to be already copied */
+  region=ALIGN16(hdr->cod);
+  memset(&g,0,sizeof g);
+  g.base=(unsigned char *)nativecode+region;
+  info=(JITINFO *)g.base;
+  info->mapsize=hdr->dat-hdr->cod;
+  info->cod=hdr->cod;
+  info->dat=hdr->dat;
+  g.map=(int32_t *)(g.base+sizeof(JITINFO));
+  g.ip=g.base+sizeof(JITINFO)+info->mapsize;
+  g.reloc=(cell *)jumparray;
+
+  gen_stubs(&g,info);
+  /* any P-code address that is not the start of an instruction is invalid */
+  for (i=0; i<(int)(info->mapsize/sizeof(cell)); i++)
+    g.map[i]=g.err_memaccess;
+  if ((err=compile(&g,info,code))!=AMX_ERR_NONE)
+    return err;
+
+  /* resolve the jumps */
+  for (i=0; i<g.numrelocs; i++) {
+    int32_t pos=(int32_t)g.reloc[2*i];
+    cell tgt=g.reloc[2*i+1];
+    if (tgt>=0 && tgt<info->mapsize && (tgt % sizeof(cell))==0)
+      target=g.map[tgt/sizeof(cell)];
+    else
+      target=g.err_memaccess;
+    target-=pos+4;
+    memcpy(g.base+pos,&target,sizeof target);
+  } /* for */
+
+  /* copy the data section behind the native code, and adjust the header */
+  dat=ALIGN16((int32_t)(g.ip-(unsigned char *)nativecode));
+  memcpy((unsigned char *)nativecode+dat,(unsigned char *)pcode+(int)hdr->dat,(size_t)(hdr->hea-hdr->dat));
+  delta=dat-hdr->dat;
+  nhdr->cod=region;
+  nhdr->dat=dat;
+  nhdr->hea=hdr->hea+delta;
+  nhdr->stp=hdr->stp+delta;
+  nhdr->size=hdr->size+delta;
+  /* set a zero cell at the top of the stack (sentinel for strings) */
+  *(cell *)((unsigned char *)nativecode+(int)(nhdr->stp-sizeof(cell)))=0;
+  return 0;
+}
+
+/* amx_jit_run()
+ * Runs the compiled code, starting at the P-code address in amx->cip. The
+ * registers PRI, ALT, FRM and STK are taken from the AMX structure.
+ */
+cell amx_jit_run(AMX *amx,cell *retval,unsigned char *data)
+{
+  AMX_HEADER *hdr;
+  unsigned char *base;
+  const JITINFO *info;
+  const int32_t *map;
+  JIT_ENTRY entry;
+  void *ptr;
+
+  assert(amx!=NULL);
+  assert((amx->flags & AMX_FLAG_JITC)!=0);
+  hdr=(AMX_HEADER *)amx->base;
+  base=amx->base+(int)hdr->cod;
+  info=(const JITINFO *)base;
+  map=(const int32_t *)(base+sizeof(JITINFO));
+  if ((ucell)amx->cip>=(ucell)info->mapsize || (amx->cip % sizeof(cell))!=0)
+    return AMX_ERR_MEMACCESS;
+  ptr=base+info->entry;
+  memcpy(&entry,&ptr,sizeof entry);
+  return entry(amx,data,base+map[amx->cip/sizeof(cell)],retval);
+}
+
+/* amx_jit_list()
+ * The JIT uses the opcodes as they are, so there is no opcode list. The
+ * return value is the maximum size of the native code per cell of P-code.
+ */
+int amx_jit_list(const AMX *amx,const cell **opcodelist,int *numopcodes)
+{
+  (void)amx;
+  assert(opcodelist!=NULL);
+  *opcodelist=NULL;
+  assert(numopcodes!=NULL);
+  *numopcodes=OP_NUM_OPCODES;
+  return JIT_MAXCELL;
+}
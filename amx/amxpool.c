@@ -1,15 +1,23 @@
 /*  Simple allocation from a memory pool, with automatic release of
  *  least-recently used blocks (LRU blocks).
  *
- *  These routines are as simple as possible, and they are neither re-entrant
- *  nor thread-safe. Their purpose is to have a standard implementation for
- *  systems where overlays are used and malloc() is not available.
+ *  The purpose of these routines is to have a standard implementation for
+ *  systems where overlays are used and malloc() is not available. All state
+ *  is kept in the pool itself (the pool starts with an AMX_POOL structure),
+ *  so the routines are re-entrant: every abstract machine may have a pool of
+ *  its own, and different pools may be used from different threads. A single
+ *  pool is not locked, however; it must not be used by two threads at the
+ *  same time.
  *
- *  The algorithm uses a first-fit strategy. It keeps all blocks in a single
- *  list (both used blocks and free blocks are in the same list). Every memory
- *  block must have a unique number that identifies the block. This unique
- *  number allows to search for the presence of the block in the pool and for
- *  "conditional allocation".
+ *  Every memory block must have a unique number that identifies the block.
+ *  This unique number allows to search for the presence of the block in the
+ *  pool and for "conditional allocation". The blocks are found through a hash
+ *  table on this number. The used blocks are in a doubly-linked list in the
+ *  order of their use, so that touching a block and finding the least-recently
+ *  used block take constant time. The free blocks are in lists per size class
+ *  (a power of two), and every block has the size of its predecessor in its
+ *  header, so that a freed block is coalesced with its neighbours without
+ *  walking through the pool.
  *
  *
  *  Copyright (c) CompuPhase, 2007-2020
@@ -29,6 +37,7 @@
  *  Version: $Id: amxpool.c 6131 2020-04-29 19:47:15Z thiadmer $
  */
 #include <assert.h>
+#include <limits.h>
 #include "amx.h"
 #include "amxpool.h"
 
@@ -37,36 +46,163 @@
 #endif
 
 #define MIN_BLOCKSIZE 32
-#define PROTECT_LRU   0xffff
+#define NUM_CLASSES   (int)(8*sizeof(unsigned))
+#define MAX_BUCKETS   256
+
+/* the arena header and the blocks are aligned to both a cell and a pointer */
+#define POOL_ALIGN    (sizeof(cell)>sizeof(void*) ? sizeof(cell) : sizeof(void*))
+#define ALIGNUP(v)    (((v)+POOL_ALIGN-1) & ~(POOL_ALIGN-1))
+
+#define FLAG_USED     0x01
+#define FLAG_PROTECT  0x02
 
 typedef struct tagARENA {
-  unsigned blocksize;
-  short index;      /* overlay index, -1 if free */
-  unsigned short lru;
+  unsigned blocksize;           /* size of the block (excluding the header) */
+  unsigned prevsize;            /* size of the preceding block, 0 for the first */
+  int index;                    /* overlay index, -1 if free */
+  int flags;
+  struct tagARENA *prev,*next;  /* LRU list (used blocks) or free list */
+  struct tagARENA *hashnext;    /* next block in the same hash bucket */
 } ARENA;
 
-static void *pool_base;
-static unsigned pool_size;
-static unsigned short pool_lru;
+struct tagAMX_POOL {
+  ARENA *first;                 /* first block */
+  char *top;                    /* end of the pool */
+  ARENA *lru,*mru;              /* least- and most-recently used blocks */
+  ARENA *freelist[NUM_CLASSES]; /* free blocks, per power of two */
+  unsigned freemask;            /* bit set for every non-empty free list */
+  unsigned hashmask;            /* number of hash buckets - 1 */
+  ARENA *hash[1];               /* hashmask+1 buckets follow */
+};
+
+#define HDRSIZE       ALIGNUP(sizeof(ARENA))
+#define BLOCK(hdr)    ((void*)((char*)(hdr)+HDRSIZE))
+#define ARENAOF(blk)  ((ARENA*)((char*)(blk)-HDRSIZE))
+#define NEXTARENA(hdr) ((ARENA*)((char*)(hdr)+HDRSIZE+(hdr)->blocksize))
+#define PREVARENA(hdr) ((ARENA*)((char*)(hdr)-HDRSIZE-(hdr)->prevsize))
+
+static int sizeclass(unsigned size)
+{
+  int c=0;
+  assert(size>0);
+  #if defined __GNUC__
+    c=NUM_CLASSES-1-__builtin_clz(size);
+  #else
+    while ((size>>=1)!=0)
+      c++;
+  #endif
+  return c;
+}
+
+static int lowestclass(unsigned mask)
+{
+  int c=0;
+  assert(mask!=0);
+  #if defined __GNUC__
+    c=__builtin_ctz(mask);
+  #else
+    while ((mask & 1)==0) {
+      mask>>=1;
+      c++;
+    } /* while */
+  #endif
+  return c;
+}
+
+static void list_unlink(ARENA **head,ARENA **tail,ARENA *hdr)
+{
+  if (hdr->prev!=NULL)
+    hdr->prev->next=hdr->next;
+  else
+    *head=hdr->next;
+  if (hdr->next!=NULL)
+    hdr->next->prev=hdr->prev;
+  else if (tail!=NULL)
+    *tail=hdr->prev;
+  hdr->prev=hdr->next=NULL;
+}
+
+static void free_insert(AMX_POOL *pool,ARENA *hdr)
+{
+  int c=sizeclass(hdr->blocksize);
+  hdr->index=-1;
+  hdr->flags=0;
+  hdr->prev=NULL;
+  hdr->next=pool->freelist[c];
+  if (hdr->next!=NULL)
+    hdr->next->prev=hdr;
+  pool->freelist[c]=hdr;
+  pool->freemask|=1u << c;
+}
+
+static void free_remove(AMX_POOL *pool,ARENA *hdr)
+{
+  int c=sizeclass(hdr->blocksize);
+  assert(hdr->index==-1);
+  list_unlink(&pool->freelist[c],NULL,hdr);
+  if (pool->freelist[c]==NULL)
+    pool->freemask&=~(1u << c);
+}
+
+static ARENA *findblock(const AMX_POOL *pool,int index)
+{
+  ARENA *hdr;
+  assert(index>=0);
+  for (hdr=pool->hash[index & pool->hashmask]; hdr!=NULL && hdr->index!=index; hdr=hdr->hashnext)
+    /* nothing */;
+  return hdr;
+}
+
+static void lru_append(AMX_POOL *pool,ARENA *hdr)
+{
+  hdr->next=NULL;
+  hdr->prev=pool->mru;
+  if (pool->mru!=NULL)
+    pool->mru->next=hdr;
+  else
+    pool->lru=hdr;
+  pool->mru=hdr;
+}
 
-static void touchblock(ARENA *hdr);
-static ARENA *findblock(int index);
+static void touchblock(AMX_POOL *pool,ARENA *hdr)
+{
+  assert(hdr!=NULL && (hdr->flags & FLAG_USED)!=0);
+  if ((hdr->flags & FLAG_PROTECT)!=0 || hdr==pool->mru)
+    return;
+  list_unlink(&pool->lru,&pool->mru,hdr);
+  lru_append(pool,hdr);
+}
 
-/* amx_poolinit() initializes the memory pool for the allocated blocks.
- * If parameter pool is NULL, the existing pool is cleared (without changing
- * its position or size).
+/* amx_poolinit() initializes the memory pool for the allocated blocks and
+ * returns the pool, which is at the start of the memory (or a few bytes
+ * further, for alignment). If parameter pool is NULL, the function returns
+ * NULL; it also returns NULL if the memory is too small to hold even a small
+ * block.
  */
-void amx_poolinit(void *pool, unsigned size)
+AMX_POOL *amx_poolinit(void *pool, unsigned size)
 {
-  assert(pool!=NULL || pool_base!=NULL);
-  if (pool!=NULL) {
-    assert(size>sizeof(ARENA));
-    /* save parameters in global variables, then "free" the entire pool */
-    pool_base=pool;
-    pool_size=size;
-  } /* if */
-  pool_lru=0;
-  amx_poolfree(NULL);
+  AMX_POOL *p;
+  unsigned skip,buckets,overhead;
+
+  if (pool==NULL)
+    return NULL;
+  skip=(unsigned)(ALIGNUP((size_t)pool)-(size_t)pool);
+  if (size<=skip)
+    return NULL;
+  size=(size-skip) & ~(unsigned)(POOL_ALIGN-1);
+  p=(AMX_POOL*)((char*)pool+skip);
+
+  /* about one hash bucket per 512 bytes, as a power of two */
+  for (buckets=8; buckets<MAX_BUCKETS && buckets*512<size; buckets*=2)
+    /* nothing */;
+  overhead=(unsigned)ALIGNUP(sizeof(AMX_POOL)+(buckets-1)*sizeof(ARENA*));
+  if (size<overhead+HDRSIZE+MIN_BLOCKSIZE)
+    return NULL;
+  p->first=(ARENA*)((char*)p+overhead);
+  p->top=(char*)p+size;
+  p->hashmask=buckets-1;
+  amx_poolfree(p,NULL);
+  return p;
 }
 
 /* amx_poolfree() releases a block allocated earlier. The parameter must have
@@ -76,48 +212,64 @@ void amx_poolinit(void *pool, unsigned size)
  * When parameter "block" is NULL, the pool is re-initialized (meaning that
  * all blocks are freed).
  */
-void amx_poolfree(void *block)
+void amx_poolfree(AMX_POOL *pool, void *block)
 {
-  ARENA *hdr,*hdr2;
-  unsigned sz;
+  ARENA *hdr,*hdr2,**link;
 
-  assert(pool_base!=NULL);
-  assert(pool_size>sizeof(ARENA));
+  assert(pool!=NULL);
 
   /* special case: if "block" is NULL, create a single free space */
   if (block==NULL) {
-    /* store an arena header at the start of the pool */
-    hdr=(ARENA*)pool_base;
-    hdr->blocksize=pool_size-sizeof(ARENA);
-    hdr->index=-1;
-    hdr->lru=0;
-  } else {
-    hdr=(ARENA*)((char*)block-sizeof(ARENA));
-    assert((char*)hdr>=(char*)pool_base && (char*)hdr<(char*)pool_base+pool_size);
-    assert(hdr->blocksize<pool_size);
-
-    /* free this block */
-    hdr->index=-1;
-
-    /* try to coalesce with the next block */
-    hdr2=(ARENA*)((char*)hdr+hdr->blocksize+sizeof(ARENA));
-    if (hdr2->index==-1)
-      hdr->blocksize+=hdr2->blocksize+sizeof(ARENA);
-
-    /* try to coalesce with the previous block */
-    if ((void*)hdr!=pool_base) {
-      sz=pool_size;
-      hdr2=(ARENA*)pool_base;
-      while (sz>0 && (char*)hdr2+hdr2->blocksize+sizeof(ARENA)!=(char*)hdr) {
-        assert(sz<=pool_size);
-        sz-=hdr2->blocksize+sizeof(ARENA);
-        hdr2=(ARENA*)((char*)hdr2+hdr2->blocksize+sizeof(ARENA));
-      } /* while */
-      assert((char*)hdr2+hdr2->blocksize+sizeof(ARENA)==(char*)hdr);
-      if (hdr2->index==-1)
-        hdr2->blocksize+=hdr->blocksize+sizeof(ARENA);
+    unsigned i;
+    pool->lru=pool->mru=NULL;
+    for (i=0; i<(unsigned)NUM_CLASSES; i++)
+      pool->freelist[i]=NULL;
+    pool->freemask=0;
+    for (i=0; i<=pool->hashmask; i++)
+      pool->hash[i]=NULL;
+    hdr=pool->first;
+    hdr->blocksize=(unsigned)((pool->top-(char*)hdr)-HDRSIZE);
+    hdr->prevsize=0;
+    hdr->hashnext=NULL;
+    free_insert(pool,hdr);
+    return;
+  } /* if */
+
+  hdr=ARENAOF(block);
+  assert((char*)hdr>=(char*)pool->first && (char*)hdr<pool->top);
+  assert((hdr->flags & FLAG_USED)!=0);
+
+  /* remove the block from the hash table and from the LRU list */
+  for (link=&pool->hash[hdr->index & pool->hashmask]; *link!=hdr; link=&(*link)->hashnext)
+    assert(*link!=NULL);
+  *link=hdr->hashnext;
+  hdr->hashnext=NULL;
+  if ((hdr->flags & FLAG_PROTECT)==0)
+    list_unlink(&pool->lru,&pool->mru,hdr);
+  hdr->index=-1;
+
+  /* try to coalesce with the next block */
+  hdr2=NEXTARENA(hdr);
+  if ((char*)hdr2<pool->top && hdr2->index==-1) {
+    free_remove(pool,hdr2);
+    hdr->blocksize+=hdr2->blocksize+HDRSIZE;
+  } /* if */
+
+  /* try to coalesce with the previous block */
+  if (hdr!=pool->first) {
+    hdr2=PREVARENA(hdr);
+    assert(NEXTARENA(hdr2)==hdr);
+    if (hdr2->index==-1) {
+      free_remove(pool,hdr2);
+      hdr2->blocksize+=hdr->blocksize+HDRSIZE;
+      hdr=hdr2;
     } /* if */
   } /* if */
+
+  free_insert(pool,hdr);
+  hdr2=NEXTARENA(hdr);
+  if ((char*)hdr2<pool->top)
+    hdr2->prevsize=hdr->blocksize;
 }
 
 /* amx_poolalloc() allocates the requested number of bytes from the pool and
@@ -136,133 +288,92 @@ void amx_poolfree(void *block)
  * every iteration (without considering the size of the block or whether that
  * block is adjacent to a free block).
  */
-void *amx_poolalloc(unsigned size,int index)
+void *amx_poolalloc(AMX_POOL *pool, unsigned size, int index)
 {
-  ARENA *hdr,*hdrlru;
-  unsigned sz;
-  unsigned short minlru;
+  ARENA *hdr;
+  unsigned mask;
+  int c;
 
+  assert(pool!=NULL);
   assert(size>0);
-  assert(index>=0 && index<=SHRT_MAX);
-  assert(findblock(index)==NULL);
+  assert(index>=0 && index<=INT_MAX);
+  assert(findblock(pool,index)==NULL);
 
-  /* align the size to a cell boundary */
-  if ((size % sizeof(cell))!=0)
-    size+=sizeof(cell)-(size % sizeof(cell));
-  if (size+sizeof(ARENA)>pool_size)
+  /* align the size to a cell (and pointer) boundary */
+  size=(unsigned)ALIGNUP(size);
+  if (size+HDRSIZE>(unsigned)(pool->top-(char*)pool->first))
     return NULL;  /* requested block does not fit in the pool */
 
-  /* find a block large enough to get the size plus an arena header; at
-   * the same time, detect the block with the lowest LRU
-   * if no block of sufficient size can be found, the routine then frees
-   * the block with the lowest LRU count and tries again
+  /* look for a block in the free list for the size class of the request
+   * (where blocks may be too small), or take the first block of a higher
+   * size class (where all blocks are large enough); if there is none, free
+   * the least-recently used block and try again
    */
-  do {
-    sz=pool_size;
-    hdr=(ARENA*)pool_base;
-    hdrlru=hdr;
-    minlru=USHRT_MAX;
-    while (sz>0) {
-      assert(sz<=pool_size);
-      assert((char*)hdr>=(char*)pool_base && (char*)hdr<(char*)pool_base+pool_size);
-      if (hdr->index==-1 && hdr->blocksize>=size)
-        break;
-      if (hdr->index!=-1 && hdr->lru<minlru) {
-        minlru=hdr->lru;
-        hdrlru=hdr;
-      } /* if */
-      sz-=hdr->blocksize+sizeof(ARENA);
-      hdr=(ARENA*)((char*)hdr+hdr->blocksize+sizeof(ARENA));
-    } /* while */
-    assert(sz<=pool_size);
-    if (sz==0) {
-      /* free up memory and try again */
-      assert(hdrlru->index!=-1);
-      amx_poolfree((char*)hdrlru+sizeof(ARENA));
-    } /* if */
-  } while (sz==0);
+  for ( ;; ) {
+    c=sizeclass(size);
+    for (hdr=pool->freelist[c]; hdr!=NULL && hdr->blocksize<size; hdr=hdr->next)
+      /* nothing */;
+    if (hdr==NULL && c+1<NUM_CLASSES && (mask=pool->freemask & ~((2u << c)-1))!=0)
+      hdr=pool->freelist[lowestclass(mask)];
+    if (hdr!=NULL)
+      break;
+    if (pool->lru==NULL)
+      return NULL;  /* all blocks are protected, or the pool is fragmented */
+    amx_poolfree(pool,BLOCK(pool->lru));
+  } /* for */
+  free_remove(pool,hdr);
 
   /* see whether to allocate the entire free block, or to cut it in two blocks */
-  if (hdr->blocksize>size+MIN_BLOCKSIZE+sizeof(ARENA)) {
+  if (hdr->blocksize>size+MIN_BLOCKSIZE+HDRSIZE) {
     /* cut the block in two */
-    ARENA *next=(ARENA*)((char*)hdr+size+sizeof(ARENA));
-    next->blocksize=hdr->blocksize-size-sizeof(ARENA);
-    next->index=-1;
-    next->lru=0;
-  } else {
-    size=hdr->blocksize;
+    ARENA *next=(ARENA*)((char*)hdr+size+HDRSIZE);
+    ARENA *after;
+    next->blocksize=hdr->blocksize-size-HDRSIZE;
+    next->prevsize=size;
+    next->hashnext=NULL;
+    hdr->blocksize=size;
+    after=NEXTARENA(next);
+    if ((char*)after<pool->top)
+      after->prevsize=next->blocksize;
+    free_insert(pool,next);
   } /* if */
-  hdr->blocksize=size;
-  hdr->index=(short)index;
-  touchblock(hdr);    /* set LRU field */
+  hdr->index=index;
+  hdr->flags=FLAG_USED;
+  hdr->hashnext=pool->hash[index & pool->hashmask];
+  pool->hash[index & pool->hashmask]=hdr;
+  lru_append(pool,hdr);
 
-  return (void*)((char*)hdr+sizeof(ARENA));
+  return BLOCK(hdr);
 }
 
 /* amx_poolfind() returns the address of the memory block with the given index,
  * or NULL if no such block exists. Parameter "index" should not be -1, because
  * -1 represents a free block (actually, only positive values are valid).
- * When amx_poolfind() finds the block, it increments its LRU count.
+ * When amx_poolfind() finds the block, it marks it as the most-recently used
+ * block.
  */
-void *amx_poolfind(int index)
+void *amx_poolfind(AMX_POOL *pool, int index)
 {
-  ARENA *hdr=findblock(index);
-  if (hdr==NULL)
+  ARENA *hdr;
+  assert(pool!=NULL);
+  if ((hdr=findblock(pool,index))==NULL)
     return NULL;
-  touchblock(hdr);
-  return (void*)((char*)hdr+sizeof(ARENA));
-}
-
-int amx_poolprotect(int index)
-{
-  ARENA *hdr=findblock(index);
-  if (hdr==NULL)
-    return AMX_ERR_GENERAL;
-  hdr->lru=PROTECT_LRU;
-  return AMX_ERR_NONE;
+  touchblock(pool,hdr);
+  return BLOCK(hdr);
 }
 
-static ARENA *findblock(int index)
+/* amx_poolprotect() excludes a block from the automatic release, it is only
+ * freed by an explicit call to amx_poolfree()
+ */
+int amx_poolprotect(AMX_POOL *pool, int index)
 {
   ARENA *hdr;
-  unsigned sz;
-
-  assert(index>=0);
-  sz=pool_size;
-  hdr=(ARENA*)pool_base;
-  while (sz>0 && hdr->index!=index) {
-    assert(sz<=pool_size);
-    assert((char*)hdr>=(char*)pool_base && (char*)hdr<(char*)pool_base+pool_size);
-    sz-=hdr->blocksize+sizeof(ARENA);
-    hdr=(ARENA*)((char*)hdr+hdr->blocksize+sizeof(ARENA));
-  } /* while */
-  assert(sz<=pool_size);
-  return (sz>0 && hdr->index==index) ? hdr : NULL;
-}
-
-static void touchblock(ARENA *hdr)
-{
-  assert(hdr!=NULL);
-  if (++pool_lru >= PROTECT_LRU)
-    pool_lru=0;
-  hdr->lru=pool_lru;
-
-  /* special case: if the overlay LRU count wrapped back to zero, set the
-   * LRU count of all blocks to zero, but set the count of the block just
-   * touched to 1 (skip blocks marked as protected, too)
-   */
-  if (pool_lru==0) {
-    ARENA *hdr2;
-    unsigned sz=pool_size;
-    hdr2=(ARENA*)pool_base;
-    while (sz>0) {
-      assert(sz<=pool_size);
-      if (hdr2->lru!=PROTECT_LRU)
-        hdr2->lru=0;
-      sz-=hdr2->blocksize+sizeof(ARENA);
-      hdr2=(ARENA*)((char*)hdr2+hdr2->blocksize+sizeof(ARENA));
-    } /* while */
-    assert(sz==0);
-    hdr->lru=++pool_lru;
+  assert(pool!=NULL);
+  if ((hdr=findblock(pool,index))==NULL)
+    return AMX_ERR_GENERAL;
+  if ((hdr->flags & FLAG_PROTECT)==0) {
+    list_unlink(&pool->lru,&pool->mru,hdr);
+    hdr->flags|=FLAG_PROTECT;
   } /* if */
+  return AMX_ERR_NONE;
 }
@@ -20,11 +20,28 @@
 #ifndef AMXPOOL_H_INCLUDED
 #define AMXPOOL_H_INCLUDED
 
-void  amx_poolinit(void *pool, unsigned size);
-void *amx_poolalloc(unsigned size, int index);
-void  amx_poolfree(void *block);
-void *amx_poolfind(int index);
-int   amx_poolprotect(int index);
+#include "amx.h"
 
+#ifdef  __cplusplus
+extern  "C" {
+#endif
+
+/* a pool is kept in the memory block that is passed to amx_poolinit() */
+typedef struct tagAMX_POOL AMX_POOL;
+
+/* tag for amx_SetUserData(), for a host that keeps the overlay pool of an
+ * abstract machine in the user data of that abstract machine
+ */
+#define AMX_POOLTAG   AMX_USERTAG('P','o','o','l')
+
+AMX_POOL *amx_poolinit(void *pool, unsigned size);
+void *amx_poolalloc(AMX_POOL *pool, unsigned size, int index);
+void  amx_poolfree(AMX_POOL *pool, void *block);
+void *amx_poolfind(AMX_POOL *pool, int index);
+int   amx_poolprotect(AMX_POOL *pool, int index);
+
+#ifdef  __cplusplus
+}
+#endif
 
 #endif /* AMXPOOL_H_INCLUDED */
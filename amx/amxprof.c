@@ -0,0 +1,556 @@
+/*  Sampling profiler for the Pawn Abstract Machine
+ *
+ *  The profiler takes a sample of the call stack of a running script, either
+ *  on a timer signal (SIGPROF, so that it measures CPU time) or every so many
+ *  taken branches and calls. It uses the "fuel" counter of the abstract
+ *  machine (see amx_SetFuelHook()): the signal handler only sets the counter
+ *  to zero, and the abstract machine calls the profiler at the next branch or
+ *  call. As a result, the cost of the profiler is nil between samples, and
+ *  a sample is never taken in the middle of an instruction.
+ *
+ *  A sample holds the function that the script is in, followed by the
+ *  functions that called it (found by walking the chain of stack frames).
+ *  Identical stacks are counted in a hash table. When debug information is
+ *  available, all addresses are mapped to the start of their function while
+ *  sampling, and to function names when writing the report; otherwise the
+ *  report shows code addresses. The profiler reports:
+ *  o  "folded" stacks, one line per stack with the count, the input format
+ *     for flame graph tools;
+ *  o  a summary with the "self" and "total" samples for every function.
+ *
+ *  Time spent in native functions is attributed to the first branch or call
+ *  after the native function returns. The JIT does not support the profiler.
+ *
+ *  Copyright (c) CompuPhase, 2020
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxprof.c $
+ */
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "osdefs.h"
+#include "amx.h"
+#include "amxdbg.h"
+#include "amxprof.h"
+#if defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+  #include <signal.h>
+  #include <sys/time.h>
+  #define PROF_SIGNAL
+#endif
+
+#define TAG_PROF      AMX_USERTAG('P','r','o','f')
+#define PROF_MAXDEPTH 64      /* deeper stacks are truncated (callers are dropped) */
+
+typedef struct tagPROF_FUNC {
+  ucell start, end;           /* code range of the function */
+} PROF_FUNC;
+
+typedef struct tagPROF_STACK {
+  unsigned long hash;
+  long count;                 /* number of samples, 0 for a free slot */
+  size_t frames;              /* index of the first frame (the leaf) in the pool */
+  int depth;
+} PROF_STACK;
+
+typedef struct tagPROF_ENTRY {
+  ucell key;
+  long self, total;
+  size_t mark;
+} PROF_ENTRY;
+
+struct tagAMX_PROF {
+  AMX *amx;
+  AMX_DBG *amxdbg;            /* may be NULL */
+  PROF_FUNC *funcs;           /* functions sorted on address (from the debug info) */
+  int numfuncs;
+  int mode;
+  long interval;
+  int running;
+  #if defined PROF_SIGNAL
+    volatile sig_atomic_t pending;  /* set by the signal handler */
+    struct sigaction oldaction;
+  #endif
+  long savedfuel;             /* "fuel" counter at the time of the signal */
+  PROF_STACK *stacks;         /* hash table with the stacks (size is a power of 2) */
+  size_t numstacks, maxstacks;
+  ucell *frames;              /* pool with the frames of all stacks */
+  size_t numframes, maxframes;
+  long samples, lost;
+};
+
+#if defined PROF_SIGNAL
+  static AMX_PROF *volatile sigprof = NULL; /* the profiler that runs on the timer */
+#endif
+
+static int cmpfunc(const void *a, const void *b)
+{
+  ucell s1 = ((const PROF_FUNC *)a)->start;
+  ucell s2 = ((const PROF_FUNC *)b)->start;
+  return (s1 < s2) ? -1 : (s1 > s2) ? 1 : 0;
+}
+
+/* funckey() returns the start address of the function that "address" is in,
+ * or the address itself if no function is found; "isstart" is set if the
+ * address is the first instruction of a function
+ */
+static ucell funckey(const AMX_PROF *prof, ucell address, int *isstart)
+{
+  int low = 0, high = prof->numfuncs - 1;
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    if (address < prof->funcs[mid].start) {
+      high = mid - 1;
+    } else if (address >= prof->funcs[mid].end) {
+      low = mid + 1;
+    } else {
+      if (isstart != NULL)
+        *isstart = (address == prof->funcs[mid].start);
+      return prof->funcs[mid].start;
+    } /* if */
+  } /* while */
+  if (isstart != NULL)
+    *isstart = 0;
+  return address;
+}
+
+static unsigned long stackhash(const ucell *stack, int depth)
+{
+  unsigned long hash = 2166136261UL;  /* FNV-1a */
+  int i;
+  for (i = 0; i < depth; i++) {
+    hash ^= (unsigned long)stack[i];
+    hash *= 16777619UL;
+  } /* for */
+  return hash;
+}
+
+static PROF_STACK *findslot(PROF_STACK *table, size_t size, const ucell *frames,
+                            unsigned long hash, const ucell *stack, int depth)
+{
+  size_t mask = size - 1;
+  size_t idx = hash & mask;
+  while (table[idx].count != 0) {
+    if (table[idx].hash == hash && table[idx].depth == depth
+        && memcmp(frames + table[idx].frames, stack, depth * sizeof(ucell)) == 0)
+      break;
+    idx = (idx + 1) & mask;
+  } /* while */
+  return &table[idx];
+}
+
+static int record(AMX_PROF *prof, const ucell *stack, int depth)
+{
+  unsigned long hash = stackhash(stack, depth);
+  PROF_STACK *slot;
+
+  /* keep the hash table at most half full */
+  if (2 * (prof->numstacks + 1) > prof->maxstacks) {
+    size_t size = (prof->maxstacks > 0) ? 2 * prof->maxstacks : 256;
+    PROF_STACK *table = (PROF_STACK *)calloc(size, sizeof(PROF_STACK));
+    size_t i;
+    if (table == NULL)
+      return AMX_ERR_MEMORY;
+    for (i = 0; i < prof->maxstacks; i++) {
+      PROF_STACK *old = &prof->stacks[i];
+      if (old->count != 0)
+        *findslot(table, size, prof->frames, old->hash, prof->frames + old->frames, old->depth) = *old;
+    } /* for */
+    free(prof->stacks);
+    prof->stacks = table;
+    prof->maxstacks = size;
+  } /* if */
+
+  slot = findslot(prof->stacks, prof->maxstacks, prof->frames, hash, stack, depth);
+  if (slot->count == 0) {
+    if (prof->numframes + depth > prof->maxframes) {
+      size_t size = (prof->maxframes > 0) ? 2 * prof->maxframes : 1024;
+      ucell *frames;
+      while (size < prof->numframes + depth)
+        size *= 2;
+      if ((frames = (ucell *)realloc(prof->frames, size * sizeof(ucell))) == NULL)
+        return AMX_ERR_MEMORY;
+      prof->frames = frames;
+      prof->maxframes = size;
+    } /* if */
+    memcpy(prof->frames + prof->numframes, stack, depth * sizeof(ucell));
+    slot->hash = hash;
+    slot->frames = prof->numframes;
+    slot->depth = depth;
+    prof->numframes += depth;
+    prof->numstacks++;
+  } /* if */
+  slot->count++;
+  return AMX_ERR_NONE;
+}
+
+static void sample(AMX_PROF *prof, AMX *amx)
+{
+  AMX_HEADER *hdr = (AMX_HEADER *)amx->base;
+  unsigned char *data = (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat;
+  ucell stack[PROF_MAXDEPTH];
+  int depth, isstart;
+  cell frm, ret, prev;
+
+  depth = 0;
+  stack[depth++] = funckey(prof, (ucell)amx->cip, &isstart);
+  if (isstart && amx->stk + (cell)sizeof(cell) <= amx->stp) {
+    /* a call was just made: "frm" is still the frame of the caller, and the
+     * return address is on the top of the stack */
+    ret = *(cell *)(data + (int)amx->stk);
+    if (ret > 0 && ret < amx->codesize)
+      stack[depth++] = funckey(prof, (ucell)(ret - 1), NULL);
+  } /* if */
+  /* every frame holds the previous frame pointer and the return address;
+   * amx_Exec() pushes a zero return address for the function that it calls */
+  frm = amx->frm;
+  while (depth < PROF_MAXDEPTH && frm >= amx->stk && frm + 2 * (cell)sizeof(cell) <= amx->stp) {
+    prev = *(cell *)(data + (int)frm);
+    ret = *(cell *)(data + (int)frm + sizeof(cell));
+    if (ret <= 0 || ret >= amx->codesize)
+      break;
+    stack[depth++] = funckey(prof, (ucell)(ret - 1), NULL);
+    if (prev <= frm)
+      break;
+    frm = prev;
+  } /* while */
+
+  prof->samples++;
+  if (record(prof, stack, depth) != AMX_ERR_NONE)
+    prof->lost++;
+}
+
+static int AMXAPI prof_Hook(AMX *amx)
+{
+  AMX_PROF *prof;
+
+  if (amx_GetUserData(amx, TAG_PROF, (void **)&prof) != AMX_ERR_NONE || prof == NULL)
+    return AMX_ERR_NONE;
+  if (prof->mode == PROF_COUNT) {
+    amx->fuel = prof->interval;
+  } else {
+    #if defined PROF_SIGNAL
+      if (!prof->pending)
+        return AMX_ERR_NONE;  /* the budget ran out, not a timer tick */
+      amx->fuel = prof->savedfuel;
+      prof->pending = 0;
+    #endif
+  } /* if */
+  sample(prof, amx);
+  return AMX_ERR_NONE;
+}
+
+#if defined PROF_SIGNAL
+static void prof_Signal(int sig)
+{
+  AMX_PROF *prof = sigprof;
+  (void)sig;
+  if (prof != NULL) {
+    /* make the abstract machine call prof_Hook() at the next branch; the
+     * counter is cleared on every tick, because the abstract machine may
+     * overwrite the value if the signal arrives while it updates the counter
+     */
+    if (!prof->pending) {
+      prof->savedfuel = prof->amx->fuel;
+      prof->pending = 1;
+    } /* if */
+    prof->amx->fuel = 0;
+  } /* if */
+}
+#endif
+
+/* prof_Create()
+ * Creates a profiler for the abstract machine. The debug information is
+ * optional, but without it the report shows addresses instead of function
+ * names. The debug information must remain valid while the profiler exists.
+ */
+int AMXAPI prof_Create(AMX_PROF **prof, AMX *amx, AMX_DBG *amxdbg)
+{
+  AMX_PROF *p;
+  int i;
+
+  assert(prof != NULL);
+  assert(amx != NULL);
+  *prof = NULL;
+  if ((p = (AMX_PROF *)malloc(sizeof(AMX_PROF))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(p, 0, sizeof(AMX_PROF));
+  p->amx = amx;
+  p->amxdbg = amxdbg;
+
+  if (amxdbg != NULL && amxdbg->hdr->symbols > 0) {
+    p->funcs = (PROF_FUNC *)malloc(amxdbg->hdr->symbols * sizeof(PROF_FUNC));
+    if (p->funcs == NULL) {
+      free(p);
+      return AMX_ERR_MEMORY;
+    } /* if */
+    for (i = 0; i < amxdbg->hdr->symbols; i++) {
+      const AMX_DBG_SYMBOL *sym = amxdbg->symboltbl[i];
+      if (sym->ident == iFUNCTN && sym->codeend > sym->codestart) {
+        p->funcs[p->numfuncs].start = sym->codestart;
+        p->funcs[p->numfuncs].end = sym->codeend;
+        p->numfuncs++;
+      } /* if */
+    } /* for */
+    qsort(p->funcs, p->numfuncs, sizeof(PROF_FUNC), cmpfunc);
+  } /* if */
+
+  if (amx_SetUserData(amx, TAG_PROF, p) != AMX_ERR_NONE) {
+    free(p->funcs);
+    free(p);
+    return AMX_ERR_USERDATA;
+  } /* if */
+  *prof = p;
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI prof_Delete(AMX_PROF *prof)
+{
+  assert(prof != NULL);
+  if (prof->running)
+    prof_Stop(prof);
+  amx_SetUserData(prof->amx, TAG_PROF, NULL);
+  free(prof->funcs);
+  free(prof->stacks);
+  free(prof->frames);
+  free(prof);
+  return AMX_ERR_NONE;
+}
+
+/* prof_Start()
+ * Starts (or continues) sampling. In the PROF_TIMER mode, the interval is in
+ * microseconds of CPU time (on many systems, the timer cannot run faster than
+ * the clock tick of the kernel), and only one profiler in the process can use
+ * the timer at any time. In the PROF_COUNT mode, the interval is the number of
+ * taken branches and calls between samples; this mode cannot be combined
+ * with a budget set with amx_SetFuel(). The JIT does not call the fuel hook,
+ * so a JIT-compiled abstract machine cannot be profiled (AMX_ERR_INIT).
+ */
+int AMXAPI prof_Start(AMX_PROF *prof, int mode, long interval)
+{
+  AMX *amx;
+
+  assert(prof != NULL);
+  amx = prof->amx;
+  if ((amx->flags & AMX_FLAG_JITC) != 0)
+    return AMX_ERR_INIT;
+  if (prof->running || interval <= 0 || amx->fuelhook != NULL)
+    return AMX_ERR_PARAMS;
+  if (mode == PROF_COUNT) {
+    if ((amx->flags & AMX_FLAG_FUEL) != 0)
+      return AMX_ERR_PARAMS;
+    amx->fuel = interval;
+  } else if (mode == PROF_TIMER) {
+    #if defined PROF_SIGNAL
+      struct sigaction action;
+      struct itimerval timer;
+      if (sigprof != NULL)
+        return AMX_ERR_PARAMS;
+      prof->pending = 0;
+      sigprof = prof;
+      memset(&action, 0, sizeof action);
+      action.sa_handler = prof_Signal;
+      sigemptyset(&action.sa_mask);
+      action.sa_flags = SA_RESTART;
+      sigaction(SIGPROF, &action, &prof->oldaction);
+      timer.it_interval.tv_sec = interval / 1000000L;
+      timer.it_interval.tv_usec = interval % 1000000L;
+      timer.it_value = timer.it_interval;
+      if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        sigaction(SIGPROF, &prof->oldaction, NULL);
+        sigprof = NULL;
+        return AMX_ERR_GENERAL;
+      } /* if */
+    #else
+      return AMX_ERR_PARAMS;
+    #endif
+  } else {
+    return AMX_ERR_PARAMS;
+  } /* if */
+  prof->mode = mode;
+  prof->interval = interval;
+  prof->running = 1;
+  amx_SetFuelHook(amx, prof_Hook);
+  return AMX_ERR_NONE;
+}
+
+int AMXAPI prof_Stop(AMX_PROF *prof)
+{
+  AMX *amx;
+
+  assert(prof != NULL);
+  if (!prof->running)
+    return AMX_ERR_NONE;
+  amx = prof->amx;
+  #if defined PROF_SIGNAL
+    if (prof->mode == PROF_TIMER) {
+      struct itimerval timer;
+      memset(&timer, 0, sizeof timer);
+      setitimer(ITIMER_PROF, &timer, NULL);
+      sigaction(SIGPROF, &prof->oldaction, NULL);
+      sigprof = NULL;
+      if (prof->pending) {
+        amx->fuel = prof->savedfuel;
+        prof->pending = 0;
+      } /* if */
+    } /* if */
+  #endif
+  if ((amx->flags & AMX_FLAG_FUEL) == 0)
+    amx->fuel = LONG_MAX;
+  amx_SetFuelHook(amx, NULL);
+  prof->running = 0;
+  return AMX_ERR_NONE;
+}
+
+/* prof_Samples()
+ * Returns the number of samples taken, and the number of samples that could
+ * not be recorded (for lack of memory). Either parameter may be NULL.
+ */
+int AMXAPI prof_Samples(AMX_PROF *prof, long *samples, long *lost)
+{
+  assert(prof != NULL);
+  if (samples != NULL)
+    *samples = prof->samples;
+  if (lost != NULL)
+    *lost = prof->lost;
+  return AMX_ERR_NONE;
+}
+
+static void writename(const AMX_PROF *prof, ucell key, FILE *fp)
+{
+  const char *name = NULL;
+  if (prof->amxdbg != NULL)
+    dbg_LookupFunction(prof->amxdbg, key, &name);
+  if (name != NULL)
+    fputs(name, fp);
+  else
+    fprintf(fp, "0x%lx", (unsigned long)key);
+}
+
+/* prof_WriteFolded()
+ * Writes a line for every distinct call stack: the functions from the
+ * outermost to the innermost, separated by semicolons, followed by a space
+ * and the number of samples. This is the input for flamegraph.pl and
+ * compatible tools.
+ */
+int AMXAPI prof_WriteFolded(AMX_PROF *prof, FILE *fp)
+{
+  size_t i;
+  int j;
+
+  assert(prof != NULL);
+  assert(fp != NULL);
+  for (i = 0; i < prof->maxstacks; i++) {
+    const PROF_STACK *stack = &prof->stacks[i];
+    if (stack->count == 0)
+      continue;
+    for (j = stack->depth - 1; j >= 0; j--) {
+      writename(prof, prof->frames[stack->frames + j], fp);
+      if (j > 0)
+        fputc(';', fp);
+    } /* for */
+    fprintf(fp, " %ld\n", stack->count);
+  } /* for */
+  return ferror(fp) ? AMX_ERR_GENERAL : AMX_ERR_NONE;
+}
+
+static int cmpkey(const void *a, const void *b)
+{
+  ucell k1 = ((const PROF_ENTRY *)a)->key;
+  ucell k2 = ((const PROF_ENTRY *)b)->key;
+  return (k1 < k2) ? -1 : (k1 > k2) ? 1 : 0;
+}
+
+static int cmpself(const void *a, const void *b)
+{
+  const PROF_ENTRY *e1 = (const PROF_ENTRY *)a;
+  const PROF_ENTRY *e2 = (const PROF_ENTRY *)b;
+  if (e1->self != e2->self)
+    return (e1->self > e2->self) ? -1 : 1;
+  if (e1->total != e2->total)
+    return (e1->total > e2->total) ? -1 : 1;
+  return cmpkey(a, b);
+}
+
+static PROF_ENTRY *findentry(PROF_ENTRY *entries, size_t count, ucell key)
+{
+  PROF_ENTRY entry;
+  entry.key = key;
+  return (PROF_ENTRY *)bsearch(&entry, entries, count, sizeof(PROF_ENTRY), cmpkey);
+}
+
+/* prof_WriteSummary()
+ * Writes a table with the number of samples for each function, sorted on
+ * the "self" count. The "self" count is the number of samples in which the
+ * function was running; the "total" count includes the samples where the
+ * function was waiting on a function that it called.
+ */
+int AMXAPI prof_WriteSummary(AMX_PROF *prof, FILE *fp)
+{
+  PROF_ENTRY *entries;
+  size_t i, count, total;
+  int j;
+
+  assert(prof != NULL);
+  assert(fp != NULL);
+
+  /* collect the distinct functions */
+  entries = (PROF_ENTRY *)malloc((prof->numframes + 1) * sizeof(PROF_ENTRY));
+  if (entries == NULL)
+    return AMX_ERR_MEMORY;
+  for (i = 0; i < prof->numframes; i++) {
+    entries[i].key = prof->frames[i];
+    entries[i].self = entries[i].total = 0;
+    entries[i].mark = 0;
+  } /* for */
+  qsort(entries, prof->numframes, sizeof(PROF_ENTRY), cmpkey);
+  for (i = count = 0; i < prof->numframes; i++)
+    if (count == 0 || entries[count - 1].key != entries[i].key)
+      entries[count++] = entries[i];
+
+  /* count the samples, a recursive function only once per stack */
+  total = 0;
+  for (i = 0; i < prof->maxstacks; i++) {
+    const PROF_STACK *stack = &prof->stacks[i];
+    if (stack->count == 0)
+      continue;
+    total += stack->count;
+    findentry(entries, count, prof->frames[stack->frames])->self += stack->count;
+    for (j = 0; j < stack->depth; j++) {
+      PROF_ENTRY *entry = findentry(entries, count, prof->frames[stack->frames + j]);
+      if (entry->mark != i + 1) {
+        entry->mark = i + 1;
+        entry->total += stack->count;
+      } /* if */
+    } /* for */
+  } /* for */
+
+  qsort(entries, count, sizeof(PROF_ENTRY), cmpself);
+  fprintf(fp, "%8s %7s %8s %7s  %s\n", "self", "", "total", "", "function");
+  for (i = 0; i < count; i++) {
+    fprintf(fp, "%8ld %6.2f%% %8ld %6.2f%%  ",
+            entries[i].self, 100.0 * entries[i].self / total,
+            entries[i].total, 100.0 * entries[i].total / total);
+    writename(prof, entries[i].key, fp);
+    fputc('\n', fp);
+  } /* for */
+  fprintf(fp, "%ld samples", prof->samples);
+  if (prof->lost > 0)
+    fprintf(fp, " (%ld not recorded)", prof->lost);
+  fputc('\n', fp);
+  free(entries);
+  return ferror(fp) ? AMX_ERR_GENERAL : AMX_ERR_NONE;
+}
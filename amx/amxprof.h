@@ -0,0 +1,48 @@
+/*  Sampling profiler for the Pawn Abstract Machine
+ *
+ *  Copyright (c) CompuPhase, 2020
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxprof.h $
+ */
+#ifndef AMXPROF_H_INCLUDED
+#define AMXPROF_H_INCLUDED
+
+#include <stdio.h>
+#include "amx.h"
+#include "amxdbg.h"
+
+#ifdef  __cplusplus
+extern  "C" {
+#endif
+
+/* modes for prof_Start() */
+#define PROF_TIMER    0   /* sample on a timer signal, interval in microseconds of CPU time */
+#define PROF_COUNT    1   /* sample every "interval" taken branches and calls */
+
+typedef struct tagAMX_PROF AMX_PROF;
+
+int AMXAPI prof_Create(AMX_PROF **prof, AMX *amx, AMX_DBG *amxdbg);
+int AMXAPI prof_Delete(AMX_PROF *prof);
+int AMXAPI prof_Start(AMX_PROF *prof, int mode, long interval);
+int AMXAPI prof_Stop(AMX_PROF *prof);
+int AMXAPI prof_Samples(AMX_PROF *prof, long *samples, long *lost);
+int AMXAPI prof_WriteFolded(AMX_PROF *prof, FILE *fp);
+int AMXAPI prof_WriteSummary(AMX_PROF *prof, FILE *fp);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* AMXPROF_H_INCLUDED */
@@ -0,0 +1,641 @@
+/*  Event-loop scheduler for the Pawn Abstract Machine
+ *
+ *  The scheduler owns any number of abstract machines. A script that must
+ *  wait for a timer or for a file descriptor (socket, pipe, terminal) calls
+ *  a native function that registers the wait with sched_WaitTimer() or
+ *  sched_WaitFD() and then puts the abstract machine in "sleep" mode. The
+ *  scheduler parks the abstract machine and resumes it with AMX_EXEC_CONT
+ *  when the event occurs. While it is parked, an abstract machine costs no
+ *  thread and no polling: a single loop thread waits on an epoll descriptor
+ *  and a timer heap for all parked machines. Runnable machines go into a run
+ *  queue, which is served by a pool of worker threads.
+ *
+ *  When the scheduler is created with a "fuel" budget, a script that runs
+ *  that many taken branches and calls without waiting is put at the back of
+ *  the run queue (see amx_SetFuel()), so that a busy script cannot starve the
+ *  others.
+ *
+ *  This module requires Linux (epoll and eventfd) and POSIX threads.
+ *
+ *  Copyright (c) CompuPhase, 2020
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxsched.c $
+ */
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "amx.h"
+#include "amxsched.h"
+
+#define TAG_SCHED   AMX_USERTAG('S','c','h','d')
+#define MAXEVENTS   256       /* events handled per call to epoll_wait() */
+#define MAXWORKERS  256
+
+typedef struct tagTASK {
+  struct tagTASK *next;       /* link in the run queue or the parked list */
+  struct tagTASK *prev_all, *next_all;  /* list of all tasks */
+  AMX *amx;
+  int index;                  /* entry point, AMX_EXEC_CONT after the first run */
+  SCHED_DONE done;
+  void *userdata;
+  /* the event that the task waits for */
+  int waiting;                /* set by sched_WaitTimer() and sched_WaitFD() */
+  int fd;                     /* file descriptor, or -1 */
+  int dupfd;                  /* set if "fd" is a duplicate made by park() */
+  uint32_t events;            /* epoll events for "fd" */
+  long long due;              /* time-out (absolute, in ms), or -1 */
+  int heapidx;                /* position in the timer heap, or -1 */
+  cell result;                /* return value of the native function that waited */
+} TASK;
+
+struct tagSCHED {
+  int epfd;                   /* epoll descriptor */
+  int evfd;                   /* eventfd to wake up the loop thread */
+  long fuel;                  /* time slice (in branches & calls), 0 = none */
+  pthread_mutex_t lock;       /* protects the fields below */
+  pthread_cond_t ready;       /* signalled when a task is put in the run queue */
+  TASK *runhead, *runtail;    /* run queue */
+  TASK *parked;               /* tasks that started to wait, for the loop thread */
+  TASK *all;                  /* all tasks that have not finished */
+  long live;                  /* number of tasks that have not finished */
+  int stop, quit;
+  pthread_t threads[MAXWORKERS];
+  int numthreads;
+  /* the timer heap is only accessed by the loop thread */
+  TASK **heap;
+  int heapsize, heapmax;
+};
+
+static long long timestamp(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void wakeloop(SCHED *sched)
+{
+  uint64_t one = 1;
+  ssize_t n = write(sched->evfd, &one, sizeof one);
+  (void)n;  /* a failed write means that the counter is already non-zero */
+}
+
+/* enqueue() must be called with the lock held */
+static void enqueue(SCHED *sched, TASK *task)
+{
+  task->next = NULL;
+  if (sched->runtail != NULL)
+    sched->runtail->next = task;
+  else
+    sched->runhead = task;
+  sched->runtail = task;
+  pthread_cond_signal(&sched->ready);
+}
+
+/* ----- timer heap (a binary min-heap on the time-out) ----- */
+
+static void heap_set(SCHED *sched, int idx, TASK *task)
+{
+  sched->heap[idx] = task;
+  task->heapidx = idx;
+}
+
+static void heap_up(SCHED *sched, int idx)
+{
+  TASK *task = sched->heap[idx];
+  while (idx > 0) {
+    int parent = (idx - 1) / 2;
+    if (sched->heap[parent]->due <= task->due)
+      break;
+    heap_set(sched, idx, sched->heap[parent]);
+    idx = parent;
+  } /* while */
+  heap_set(sched, idx, task);
+}
+
+static void heap_down(SCHED *sched, int idx)
+{
+  TASK *task = sched->heap[idx];
+  for ( ;; ) {
+    int child = 2 * idx + 1;
+    if (child >= sched->heapsize)
+      break;
+    if (child + 1 < sched->heapsize && sched->heap[child + 1]->due < sched->heap[child]->due)
+      child++;
+    if (task->due <= sched->heap[child]->due)
+      break;
+    heap_set(sched, idx, sched->heap[child]);
+    idx = child;
+  } /* for */
+  heap_set(sched, idx, task);
+}
+
+static int heap_insert(SCHED *sched, TASK *task)
+{
+  if (sched->heapsize >= sched->heapmax) {
+    int max = (sched->heapmax > 0) ? 2 * sched->heapmax : 64;
+    TASK **heap = (TASK **)realloc(sched->heap, max * sizeof(TASK *));
+    if (heap == NULL)
+      return AMX_ERR_MEMORY;
+    sched->heap = heap;
+    sched->heapmax = max;
+  } /* if */
+  heap_set(sched, sched->heapsize++, task);
+  heap_up(sched, task->heapidx);
+  return AMX_ERR_NONE;
+}
+
+static void heap_remove(SCHED *sched, TASK *task)
+{
+  int idx = task->heapidx;
+  assert(idx >= 0 && idx < sched->heapsize && sched->heap[idx] == task);
+  task->heapidx = -1;
+  if (--sched->heapsize > idx) {
+    heap_set(sched, idx, sched->heap[sched->heapsize]);
+    heap_up(sched, idx);
+    heap_down(sched, sched->heap[idx]->heapidx);
+  } /* if */
+}
+
+/* ----- loop thread ----- */
+
+/* wake() moves a parked task to the run queue; "result" is the value that the
+ * waiting native function returns to the script
+ */
+static void wake(SCHED *sched, TASK *task, cell result)
+{
+  if (task->fd >= 0) {
+    epoll_ctl(sched->epfd, EPOLL_CTL_DEL, task->fd, NULL);
+    if (task->dupfd)
+      close(task->fd);
+    task->fd = -1;
+    task->dupfd = 0;
+  } /* if */
+  if (task->heapidx >= 0)
+    heap_remove(sched, task);
+  task->result = result;
+  pthread_mutex_lock(&sched->lock);
+  enqueue(sched, task);
+  pthread_mutex_unlock(&sched->lock);
+}
+
+static cell fdresult(uint32_t events, uint32_t requested)
+{
+  cell result = 0;
+  if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0 && (requested & EPOLLIN) != 0)
+    result |= SCHED_READ;
+  if ((events & (EPOLLOUT | EPOLLERR)) != 0 && (requested & EPOLLOUT) != 0)
+    result |= SCHED_WRITE;
+  return result;
+}
+
+/* addfd() returns 0 on success and an "errno" code on failure */
+static int addfd(SCHED *sched, TASK *task)
+{
+  struct epoll_event ev;
+  int fd, err;
+
+  ev.events = task->events;
+  ev.data.ptr = task;
+  if (epoll_ctl(sched->epfd, EPOLL_CTL_ADD, task->fd, &ev) == 0)
+    return 0;
+  if (errno != EEXIST)
+    return errno;
+  /* another task already waits on this descriptor; epoll registers a
+   * duplicate of the descriptor separately
+   */
+  if ((fd = dup(task->fd)) < 0)
+    return errno;
+  if (epoll_ctl(sched->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    err = errno;
+    close(fd);
+    return err;
+  } /* if */
+  task->fd = fd;
+  task->dupfd = 1;
+  return 0;
+}
+
+/* park() registers the event that a task waits for */
+static void park(SCHED *sched, TASK *task)
+{
+  int err;
+
+  if (task->fd >= 0 && (err = addfd(sched, task)) != 0) {
+    /* regular files cannot be polled, but are always "ready"; for other
+     * errors (such as an invalid descriptor), the script gets -1
+     */
+    task->fd = -1;
+    wake(sched, task, (err == EPERM) ? fdresult(task->events, task->events) : -1);
+    return;
+  } /* if */
+  if (task->due >= 0 && heap_insert(sched, task) != AMX_ERR_NONE)
+    wake(sched, task, 0);     /* no memory for the timer, time out at once */
+}
+
+/* ----- worker threads ----- */
+
+static void *worker(void *arg)
+{
+  SCHED *sched = (SCHED *)arg;
+  TASK *task;
+  AMX *amx;
+  cell retval;
+  int err;
+
+  pthread_mutex_lock(&sched->lock);
+  for ( ;; ) {
+    while (sched->runhead == NULL && !sched->quit)
+      pthread_cond_wait(&sched->ready, &sched->lock);
+    if (sched->quit)
+      break;
+    task = sched->runhead;
+    sched->runhead = task->next;
+    if (sched->runhead == NULL)
+      sched->runtail = NULL;
+    pthread_mutex_unlock(&sched->lock);
+
+    amx = task->amx;
+    if (task->waiting) {
+      amx->pri = task->result;  /* value returned by the waiting native function */
+      task->waiting = 0;
+    } /* if */
+    retval = 0;
+    err = amx_Exec(amx, &retval, task->index);
+    task->index = AMX_EXEC_CONT;
+    if (err == AMX_ERR_FUEL)
+      amx_SetFuel(amx, sched->fuel);
+
+    if (err == AMX_ERR_SLEEP && task->waiting) {
+      pthread_mutex_lock(&sched->lock);
+      task->next = sched->parked;
+      sched->parked = task;
+      wakeloop(sched);
+    } else if (err == AMX_ERR_SLEEP || err == AMX_ERR_FUEL) {
+      /* the script yields (or used up its time slice), put it at the back of
+       * the run queue */
+      pthread_mutex_lock(&sched->lock);
+      enqueue(sched, task);
+    } else {
+      amx_SetUserData(amx, TAG_SCHED, NULL);
+      if (task->done != NULL)
+        task->done(amx, err, retval, task->userdata);
+      pthread_mutex_lock(&sched->lock);
+      if (task->prev_all != NULL)
+        task->prev_all->next_all = task->next_all;
+      else
+        sched->all = task->next_all;
+      if (task->next_all != NULL)
+        task->next_all->prev_all = task->prev_all;
+      free(task);
+      if (--sched->live == 0)
+        wakeloop(sched);
+    } /* if */
+  } /* for */
+  pthread_mutex_unlock(&sched->lock);
+  return NULL;
+}
+
+/* ----- public interface ----- */
+
+/* sched_Create()
+ * Creates a scheduler with the given number of worker threads. If "fuel" is
+ * not zero, every script is pre-empted after this number of taken branches
+ * and calls (and put at the back of the run queue).
+ */
+int AMXAPI sched_Create(SCHED **sched, int workers, long fuel)
+{
+  SCHED *s;
+  struct epoll_event ev;
+
+  assert(sched != NULL);
+  *sched = NULL;
+  if (workers < 1 || workers > MAXWORKERS || fuel < 0)
+    return AMX_ERR_PARAMS;
+  if ((s = (SCHED *)malloc(sizeof(SCHED))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(s, 0, sizeof(SCHED));
+  s->fuel = fuel;
+  s->epfd = epoll_create1(EPOLL_CLOEXEC);
+  s->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (s->epfd < 0 || s->evfd < 0)
+    goto fail;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;         /* NULL marks the eventfd */
+  if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->evfd, &ev) < 0)
+    goto fail;
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->ready, NULL);
+  for (s->numthreads = 0; s->numthreads < workers; s->numthreads++)
+    if (pthread_create(&s->threads[s->numthreads], NULL, worker, s) != 0)
+      break;
+  if (s->numthreads == 0) {
+    pthread_cond_destroy(&s->ready);
+    pthread_mutex_destroy(&s->lock);
+    goto fail;
+  } /* if */
+  *sched = s;
+  return AMX_ERR_NONE;
+
+fail:
+  if (s->epfd >= 0)
+    close(s->epfd);
+  if (s->evfd >= 0)
+    close(s->evfd);
+  free(s);
+  return AMX_ERR_GENERAL;
+}
+
+/* sched_Delete()
+ * Stops the worker threads and frees the scheduler. A script that is running
+ * is allowed to finish its time slice, all other scripts that have not
+ * finished are dropped (without calling their "done" callback). The abstract
+ * machines themselves are owned by the caller.
+ */
+int AMXAPI sched_Delete(SCHED *sched)
+{
+  TASK *task, *next;
+  int i;
+
+  assert(sched != NULL);
+  pthread_mutex_lock(&sched->lock);
+  sched->quit = 1;
+  pthread_cond_broadcast(&sched->ready);
+  pthread_mutex_unlock(&sched->lock);
+  for (i = 0; i < sched->numthreads; i++)
+    pthread_join(sched->threads[i], NULL);
+
+  for (task = sched->all; task != NULL; task = next) {
+    next = task->next_all;
+    if (task->fd >= 0) {
+      /* a parked task that waits on a descriptor: drop the registration, and
+       * close the duplicate that addfd() may have made (the descriptor itself
+       * belongs to the script)
+       */
+      epoll_ctl(sched->epfd, EPOLL_CTL_DEL, task->fd, NULL);
+      if (task->dupfd)
+        close(task->fd);
+    } /* if */
+    amx_SetUserData(task->amx, TAG_SCHED, NULL);
+    free(task);
+  } /* for */
+  free(sched->heap);
+  close(sched->evfd);
+  close(sched->epfd);
+  pthread_cond_destroy(&sched->ready);
+  pthread_mutex_destroy(&sched->lock);
+  free(sched);
+  return AMX_ERR_NONE;
+}
+
+/* sched_Spawn()
+ * Adds an abstract machine to the scheduler, to run the public function at
+ * "index" (which may be AMX_EXEC_MAIN). The "done" callback is called from a
+ * worker thread when the function returns or aborts; it may be NULL. An
+ * abstract machine may only be added once, and it must not be run outside the
+ * scheduler until it is done. Scripts may be spawned while sched_Run() runs.
+ * If the scheduler has a time slice, the abstract machine must be metered:
+ * a JIT-compiled script is refused (see amx_SetFuel()).
+ */
+int AMXAPI sched_Spawn(SCHED *sched, AMX *amx, int index, SCHED_DONE done, void *userdata)
+{
+  TASK *task;
+  int err;
+
+  assert(sched != NULL);
+  assert(amx != NULL);
+  if (sched->fuel > 0 && (err = amx_SetFuel(amx, sched->fuel)) != AMX_ERR_NONE)
+    return err;
+  if ((task = (TASK *)malloc(sizeof(TASK))) == NULL)
+    return AMX_ERR_MEMORY;
+  memset(task, 0, sizeof(TASK));
+  task->amx = amx;
+  task->index = index;
+  task->done = done;
+  task->userdata = userdata;
+  task->fd = -1;
+  task->due = -1;
+  task->heapidx = -1;
+  if ((err = amx_SetUserData(amx, TAG_SCHED, task)) != AMX_ERR_NONE) {
+    free(task);
+    return AMX_ERR_USERDATA;
+  } /* if */
+
+  pthread_mutex_lock(&sched->lock);
+  task->next_all = sched->all;
+  if (sched->all != NULL)
+    sched->all->prev_all = task;
+  sched->all = task;
+  sched->live++;
+  enqueue(sched, task);
+  pthread_mutex_unlock(&sched->lock);
+  return AMX_ERR_NONE;
+}
+
+/* sched_Run()
+ * Runs the event loop on the calling thread, until all scripts are done or
+ * until sched_Stop() is called.
+ */
+int AMXAPI sched_Run(SCHED *sched)
+{
+  struct epoll_event events[MAXEVENTS];
+  TASK *task, *next;
+  long long now;
+  int i, n, timeout;
+
+  assert(sched != NULL);
+  for ( ;; ) {
+    pthread_mutex_lock(&sched->lock);
+    if (sched->stop || sched->live == 0) {
+      sched->stop = 0;
+      pthread_mutex_unlock(&sched->lock);
+      break;
+    } /* if */
+    task = sched->parked;
+    sched->parked = NULL;
+    pthread_mutex_unlock(&sched->lock);
+    for ( ; task != NULL; task = next) {
+      next = task->next;
+      park(sched, task);
+    } /* for */
+
+    timeout = -1;
+    if (sched->heapsize > 0) {
+      long long delta = sched->heap[0]->due - timestamp();
+      timeout = (delta < 0) ? 0 : (delta > INT_MAX) ? INT_MAX : (int)delta;
+    } /* if */
+    n = epoll_wait(sched->epfd, events, MAXEVENTS, timeout);
+    if (n < 0 && errno != EINTR)
+      return AMX_ERR_GENERAL;
+    for (i = 0; i < n; i++) {
+      task = (TASK *)events[i].data.ptr;
+      if (task == NULL) {
+        uint64_t count;
+        ssize_t r = read(sched->evfd, &count, sizeof count);
+        (void)r;
+      } else {
+        wake(sched, task, fdresult(events[i].events, task->events));
+      } /* if */
+    } /* for */
+    now = timestamp();
+    while (sched->heapsize > 0 && sched->heap[0]->due <= now)
+      wake(sched, sched->heap[0], 0);
+  } /* for */
+  return AMX_ERR_NONE;
+}
+
+/* sched_Stop()
+ * Makes sched_Run() return; it may be called from any thread (including from
+ * a native function or a "done" callback).
+ */
+int AMXAPI sched_Stop(SCHED *sched)
+{
+  assert(sched != NULL);
+  pthread_mutex_lock(&sched->lock);
+  sched->stop = 1;
+  pthread_mutex_unlock(&sched->lock);
+  wakeloop(sched);
+  return AMX_ERR_NONE;
+}
+
+static TASK *gettask(AMX *amx)
+{
+  void *ptr;
+  if (amx_GetUserData(amx, TAG_SCHED, &ptr) != AMX_ERR_NONE)
+    return NULL;
+  return (TASK *)ptr;
+}
+
+/* sched_WaitTimer()
+ * For native functions: parks the script for the given number of
+ * milliseconds. The native function must return after calling this function;
+ * the script resumes when the time has elapsed, and the native function then
+ * returns 0 to the script. Returns AMX_ERR_PARAMS if the abstract machine is
+ * not run by the scheduler.
+ */
+int AMXAPI sched_WaitTimer(AMX *amx, long milliseconds)
+{
+  TASK *task = gettask(amx);
+  if (task == NULL)
+    return AMX_ERR_PARAMS;
+  task->fd = -1;
+  task->due = timestamp() + ((milliseconds > 0) ? milliseconds : 0);
+  task->result = 0;
+  task->waiting = 1;
+  amx_RaiseError(amx, AMX_ERR_SLEEP);
+  return AMX_ERR_NONE;
+}
+
+/* sched_WaitFD()
+ * For native functions: parks the script until the file descriptor is ready
+ * for reading and/or writing (SCHED_READ, SCHED_WRITE), or until the time-out
+ * (in milliseconds) elapses; a negative time-out waits indefinitely. The
+ * native function then returns the events that occurred, or 0 on a time-out,
+ * or -1 if the descriptor cannot be waited for.
+ */
+int AMXAPI sched_WaitFD(AMX *amx, int fd, int events, long timeout)
+{
+  TASK *task = gettask(amx);
+  if (task == NULL)
+    return AMX_ERR_PARAMS;
+  if (fd < 0 || (events & (SCHED_READ | SCHED_WRITE)) == 0)
+    return AMX_ERR_PARAMS;
+  task->fd = fd;
+  task->events = 0;
+  if ((events & SCHED_READ) != 0)
+    task->events |= EPOLLIN;
+  if ((events & SCHED_WRITE) != 0)
+    task->events |= EPOLLOUT;
+  task->due = (timeout >= 0) ? timestamp() + timeout : -1;
+  task->result = 0;
+  task->waiting = 1;
+  amx_RaiseError(amx, AMX_ERR_SLEEP);
+  return AMX_ERR_NONE;
+}
+
+/* ----- native functions ----- */
+
+/* wait(milliseconds)
+ * Suspends the script for the requested number of milliseconds. Outside the
+ * scheduler, this function blocks the calling thread.
+ */
+static cell AMX_NATIVE_CALL n_wait(AMX *amx, const cell *params)
+{
+  assert(params[0] == (int)sizeof(cell));
+  if (sched_WaitTimer(amx, (long)params[1]) != AMX_ERR_NONE)
+    poll(NULL, 0, (params[1] > 0) ? (int)params[1] : 0);
+  return 0;
+}
+
+/* waitfd(fd, events=SCHED_READ, timeout=-1)
+ * Suspends the script until the file descriptor is ready, or until the time-
+ * out elapses. Returns the events that occurred, 0 on a time-out and -1 on
+ * an error. Outside the scheduler, this function blocks the calling thread.
+ */
+static cell AMX_NATIVE_CALL n_waitfd(AMX *amx, const cell *params)
+{
+  struct pollfd pfd;
+  cell result;
+
+  assert(params[0] == (int)(3 * sizeof(cell)));
+  if (sched_WaitFD(amx, (int)params[1], (int)params[2], (long)params[3]) == AMX_ERR_NONE)
+    return 0;                 /* the actual result is set when the script resumes */
+  if (params[1] < 0 || (params[2] & (SCHED_READ | SCHED_WRITE)) == 0)
+    return -1;
+  pfd.fd = (int)params[1];
+  pfd.events = 0;
+  if ((params[2] & SCHED_READ) != 0)
+    pfd.events |= POLLIN;
+  if ((params[2] & SCHED_WRITE) != 0)
+    pfd.events |= POLLOUT;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, (params[3] >= 0) ? (int)params[3] : -1) < 0 || (pfd.revents & POLLNVAL) != 0)
+    return -1;
+  result = 0;
+  if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) != 0 && (params[2] & SCHED_READ) != 0)
+    result |= SCHED_READ;
+  if ((pfd.revents & (POLLOUT | POLLERR)) != 0 && (params[2] & SCHED_WRITE) != 0)
+    result |= SCHED_WRITE;
+  return result;
+}
+
+#if defined __cplusplus
+  extern "C"
+#endif
+const AMX_NATIVE_INFO sched_Natives[] = {
+  { "wait",   n_wait },
+  { "waitfd", n_waitfd },
+  { NULL, NULL }        /* terminator */
+};
+
+int AMXAPI amx_SchedInit(AMX *amx)
+{
+  return amx_Register(amx, sched_Natives, -1);
+}
+
+int AMXAPI amx_SchedCleanup(AMX *amx)
+{
+  (void)amx;
+  return AMX_ERR_NONE;
+}
@@ -0,0 +1,55 @@
+/*  Event-loop scheduler for the Pawn Abstract Machine
+ *
+ *  Copyright (c) CompuPhase, 2020
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ *  use this file except in compliance with the License. You may obtain a copy
+ *  of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *  License for the specific language governing permissions and limitations
+ *  under the License.
+ *
+ *  Version: $Id: amxsched.h $
+ */
+#ifndef AMXSCHED_H_INCLUDED
+#define AMXSCHED_H_INCLUDED
+
+#include "amx.h"
+
+#ifdef  __cplusplus
+extern  "C" {
+#endif
+
+/* events for sched_WaitFD() */
+#define SCHED_READ    0x01
+#define SCHED_WRITE   0x02
+
+typedef struct tagSCHED SCHED;
+
+/* called (on a worker thread) when a script finishes or aborts */
+typedef void (AMXAPI *SCHED_DONE)(AMX *amx, int error, cell retval, void *userdata);
+
+int AMXAPI sched_Create(SCHED **sched, int workers, long fuel);
+int AMXAPI sched_Delete(SCHED *sched);
+int AMXAPI sched_Spawn(SCHED *sched, AMX *amx, int index, SCHED_DONE done, void *userdata);
+int AMXAPI sched_Run(SCHED *sched);
+int AMXAPI sched_Stop(SCHED *sched);
+
+/* for native functions: park the calling script until an event occurs */
+int AMXAPI sched_WaitTimer(AMX *amx, long milliseconds);
+int AMXAPI sched_WaitFD(AMX *amx, int fd, int events, long timeout);
+
+/* native functions wait() and waitfd() */
+int AMXAPI amx_SchedInit(AMX *amx);
+int AMXAPI amx_SchedCleanup(AMX *amx);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* AMXSCHED_H_INCLUDED */
@@ -0,0 +1,80 @@
+/*  Command-line shell for the "Pawn" Abstract Machine, that calls a public
+ *  function for a series of argument sets with amx_ExecBatch().
+ *
+ *  Argument set n holds the values n, n+1, n+2, ... (as many as the number
+ *  of arguments); the shell prints the return value of every call.
+ *
+ *  Copyright (c) ITB CompuPhase, 2001-2010
+ *
+ *  This file may be freely used. No warranties of any kind.
+ */
+#include <stdio.h>
+#include <stdlib.h>     /* for exit() */
+#include <string.h>     /* for memset() (on some compilers) */
+#include "amx.h"
+#include "amxaux.c"
+
+void ErrorExit(AMX *amx, int errorcode)
+{
+  printf("Run time error %d: \"%s\" on address %ld\n",
+         errorcode, aux_StrError(errorcode),
+         (amx != NULL) ? amx->cip : 0);
+  exit(1);
+}
+
+void PrintUsage(char *program)
+{
+  printf("Usage: %s <filename> <function> <arguments> [count]\n"
+         "<filename> is a compiled script, <function> is a public function.\n", program);
+  exit(1);
+}
+
+int main(int argc,char *argv[])
+{
+  extern AMX_NATIVE_INFO console_Natives[];
+  extern AMX_NATIVE_INFO core_Natives[];
+
+  AMX amx;
+  cell *args, *results;
+  int err, i, j, index, numargs, count, done;
+
+  if (argc < 4 || argc > 5)
+    PrintUsage(argv[0]);
+  numargs = atoi(argv[3]);
+  count = (argc == 5) ? atoi(argv[4]) : 1;
+  if (numargs < 0 || count < 1)
+    PrintUsage(argv[0]);
+
+  err = aux_LoadProgram(&amx, argv[1], NULL);
+  if (err != AMX_ERR_NONE)
+    ErrorExit(&amx, err);
+
+  amx_Register(&amx, console_Natives, -1);
+  err = amx_Register(&amx, core_Natives, -1);
+  if (err)
+    ErrorExit(&amx, err);
+
+  err = amx_FindPublic(&amx, argv[2], &index);
+  if (err)
+    ErrorExit(&amx, err);
+
+  args = (cell *)malloc(((size_t)numargs * count + 1) * sizeof(cell));
+  results = (cell *)malloc(count * sizeof(cell));
+  if (args == NULL || results == NULL)
+    ErrorExit(NULL, AMX_ERR_MEMORY);
+  for (i = 0; i < count; i++)
+    for (j = 0; j < numargs; j++)
+      args[i * numargs + j] = i + j;
+
+  done = count;
+  err = amx_ExecBatch(&amx, index, args, numargs, results, &done);
+  for (i = 0; i < done; i++)
+    printf("%s (call %d) returns %ld\n", argv[2], i, (long)results[i]);
+  if (err)
+    ErrorExit(&amx, err);
+
+  free(args);
+  free(results);
+  aux_FreeProgram(&amx);
+  return 0;
+}
@@ -0,0 +1,101 @@
+/*  Command-line shell for the "Pawn" Abstract Machine, that runs several
+ *  copies of a script concurrently, one per thread.
+ *
+ *  Copyright (c) ITB CompuPhase, 2001-2010
+ *
+ *  This file may be freely used. No warranties of any kind.
+ */
+#include <stdio.h>
+#include <stdlib.h>     /* for exit() */
+#include <string.h>     /* for memset() (on some compilers) */
+#include <pthread.h>
+#include "amx.h"
+#include "amxaux.c"
+
+#define MAXTHREADS  64
+
+typedef struct tagCLONE {
+  AMX amx;
+  pthread_t thread;
+  cell ret;
+  int err;
+} CLONE;
+
+void ErrorExit(AMX *amx, int errorcode)
+{
+  printf("Run time error %d: \"%s\" on address %ld\n",
+         errorcode, aux_StrError(errorcode),
+         (amx != NULL) ? amx->cip : 0);
+  exit(1);
+}
+
+void PrintUsage(char *program)
+{
+  printf("Usage: %s <filename> [threads]\n<filename> is a compiled script.\n", program);
+  exit(1);
+}
+
+static void *RunClone(void *arg)
+{
+  CLONE *clone = (CLONE *)arg;
+  clone->err = amx_Exec(&clone->amx, &clone->ret, AMX_EXEC_MAIN);
+  return NULL;
+}
+
+int main(int argc,char *argv[])
+{
+  extern AMX_NATIVE_INFO console_Natives[];
+  extern AMX_NATIVE_INFO core_Natives[];
+
+  AMX amx;
+  CLONE clones[MAXTHREADS];
+  long datasize, stackheap;
+  int err, i, count;
+
+  if (argc < 2 || argc > 3)
+    PrintUsage(argv[0]);
+  count = (argc == 3) ? atoi(argv[2]) : 4;
+  if (count < 1 || count > MAXTHREADS)
+    PrintUsage(argv[0]);
+
+  err = aux_LoadProgram(&amx, argv[1], NULL);
+  if (err != AMX_ERR_NONE)
+    ErrorExit(&amx, err);
+
+  amx_Register(&amx, console_Natives, -1);
+  err = amx_Register(&amx, core_Natives, -1);
+  if (err)
+    ErrorExit(&amx, err);
+
+  /* bind all native functions now, so that amx_Exec() does not modify the
+   * code, which is shared by all clones
+   */
+  err = amx_Freeze(&amx);
+  if (err)
+    ErrorExit(&amx, err);
+
+  /* every clone gets its own data, stack and heap */
+  amx_MemInfo(&amx, NULL, &datasize, &stackheap);
+  for (i = 0; i < count; i++) {
+    void *data = malloc(datasize + stackheap);
+    if (data == NULL)
+      ErrorExit(NULL, AMX_ERR_MEMORY);
+    memset(&clones[i].amx, 0, sizeof(AMX));
+    err = amx_Clone(&clones[i].amx, &amx, data);
+    if (err)
+      ErrorExit(&amx, err);
+  } /* for */
+
+  for (i = 0; i < count; i++)
+    pthread_create(&clones[i].thread, NULL, RunClone, &clones[i]);
+  for (i = 0; i < count; i++) {
+    pthread_join(clones[i].thread, NULL);
+    if (clones[i].err)
+      ErrorExit(&clones[i].amx, clones[i].err);
+    printf("%s (clone %d) returns %ld\n", argv[1], i, (long)clones[i].ret);
+    free(clones[i].amx.data);
+  } /* for */
+
+  aux_FreeProgram(&amx);
+  return 0;
+}
@@ -54,17 +54,26 @@ extern int amx_CoredCleanp(AMX *amx);
   {
     VirtualFree(ptr, 0, MEM_RELEASE);
   }
-#elif defined LINUX
+#elif defined LINUX || defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
   #include <sys/mman.h>
+  /* mprotect() only works on whole pages, so the block is allocated with
+   * mmap() instead of malloc(); the size is stored in front of the block
+   */
   static void *vmalloc_exec(long size)
   {
-    void *ptr = malloc(size);
-    if (ptr)
-      mprotect(ptr, size, PROT_READ | PROT_WRITE | PROT_EXEC);
-    return ptr;
+    long *ptr = mmap(NULL, size + sizeof(long), PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+      return NULL;
+    *ptr = size + sizeof(long);
+    return ptr + 1;
   }
 
-  #define vfree(ptr)             free(ptr)
+  static void vfree(void *ptr)
+  {
+    long *block = (long *)ptr - 1;
+    munmap(block, *block);
+  }
 #else
   #define vmalloc_exec(size)     malloc(size)
   #define vfree(ptr)             free(ptr)
@@ -139,6 +148,7 @@ int AMXAPI aux_LoadProgram(AMX *amx, const char *filename)
   if ((amx->base = vmalloc_exec(amx->codesize)) == NULL)
     goto fail;
   memcpy(amx->base, ncode, amx->codesize);
+  amx->code = amx->base + (int)((AMX_HEADER *)amx->base)->cod;
   free(pcode);
   free(rt);
   free(ncode);
@@ -192,7 +202,7 @@ static char *messages[] = {
       /* AMX_ERR_DIVIDE    */ "Divide by zero",
       /* AMX_ERR_SLEEP     */ "(sleep mode)",
       /* AMX_ERR_INVSTATE  */ "Invalid state",
-      /* 14 */                "(reserved)",
+      /* AMX_ERR_FUEL      */ "Instruction budget exhausted",
       /* 15 */                "(reserved)",
       /* AMX_ERR_MEMORY    */ "Out of memory",
       /* AMX_ERR_FORMAT    */ "Invalid/unsupported P-code file format",
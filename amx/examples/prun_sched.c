@@ -0,0 +1,103 @@
+/*  Command-line shell for the "Pawn" Abstract Machine, that runs many copies
+ *  of a script in an event-loop scheduler (see amxsched.c).
+ *
+ *  Copyright (c) ITB CompuPhase, 2001-2020
+ *
+ *  This file may be freely used. No warranties of any kind.
+ */
+#include <stdio.h>
+#include <stdlib.h>     /* for exit() */
+#include <string.h>     /* for memset() (on some compilers) */
+#include "amx.h"
+#include "amxsched.h"
+#include "amxaux.c"
+
+static long failed = 0;
+
+void ErrorExit(AMX *amx, int errorcode)
+{
+  printf("Run time error %d: \"%s\" on address %ld\n",
+         errorcode, aux_StrError(errorcode),
+         (amx != NULL) ? amx->cip : 0);
+  exit(1);
+}
+
+void PrintUsage(char *program)
+{
+  printf("Usage: %s <filename> [instances [threads]]\n<filename> is a compiled script.\n", program);
+  exit(1);
+}
+
+static void AMXAPI Done(AMX *amx, int error, cell retval, void *userdata)
+{
+  (void)retval;
+  (void)userdata;
+  if (error != AMX_ERR_NONE) {
+    printf("Run time error %d: \"%s\" on address %ld\n",
+           error, aux_StrError(error), (long)amx->cip);
+    __sync_fetch_and_add(&failed, 1);
+  } /* if */
+}
+
+int main(int argc,char *argv[])
+{
+  extern AMX_NATIVE_INFO console_Natives[];
+  extern AMX_NATIVE_INFO core_Natives[];
+
+  AMX amx;
+  AMX *clones;
+  SCHED *sched;
+  long datasize, stackheap;
+  int err, i, count, threads;
+
+  if (argc < 2 || argc > 4)
+    PrintUsage(argv[0]);
+  count = (argc >= 3) ? atoi(argv[2]) : 1000;
+  threads = (argc == 4) ? atoi(argv[3]) : 4;
+  if (count < 1 || threads < 1)
+    PrintUsage(argv[0]);
+
+  err = aux_LoadProgram(&amx, argv[1], NULL);
+  if (err != AMX_ERR_NONE)
+    ErrorExit(&amx, err);
+
+  amx_Register(&amx, console_Natives, -1);
+  amx_SchedInit(&amx);
+  err = amx_Register(&amx, core_Natives, -1);
+  if (err)
+    ErrorExit(&amx, err);
+
+  /* bind all native functions now, so that the clones share the code */
+  err = amx_Freeze(&amx);
+  if (err)
+    ErrorExit(&amx, err);
+
+  err = sched_Create(&sched, threads, 100000L);
+  if (err)
+    ErrorExit(NULL, err);
+
+  amx_MemInfo(&amx, NULL, &datasize, &stackheap);
+  clones = (AMX *)calloc(count, sizeof(AMX));
+  if (clones == NULL)
+    ErrorExit(NULL, AMX_ERR_MEMORY);
+  for (i = 0; i < count; i++) {
+    void *data = malloc(datasize + stackheap);
+    if (data == NULL)
+      ErrorExit(NULL, AMX_ERR_MEMORY);
+    err = amx_Clone(&clones[i], &amx, data);
+    if (err == AMX_ERR_NONE)
+      err = sched_Spawn(sched, &clones[i], AMX_EXEC_MAIN, Done, NULL);
+    if (err)
+      ErrorExit(&amx, err);
+  } /* for */
+
+  sched_Run(sched);
+  sched_Delete(sched);
+  printf("%s: %d instances, %ld failed\n", argv[1], count, failed);
+
+  for (i = 0; i < count; i++)
+    free(clones[i].data);
+  free(clones);
+  aux_FreeProgram(&amx);
+  return failed != 0;
+}
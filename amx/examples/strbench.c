@@ -0,0 +1,75 @@
+/*  Microbenchmark for the string functions of the abstract machine:
+ *  amx_StrLen(), amx_GetString() and amx_SetString(), for packed and unpacked
+ *  strings of several lengths. Build it once normally and once with AMX_NO_SIMD
+ *  defined to compare the SSE2/AVX2 kernels with the plain C loops.
+ *
+ *  Copyright (c) ITB CompuPhase, 2001-2020
+ *
+ *  This file may be freely used. No warranties of any kind.
+ */
+#include <stdio.h>
+#include <stdlib.h>     /* for atol() */
+#include <string.h>     /* for memset() */
+#include <time.h>
+#include "amx.h"
+
+#define MAXLENGTH   4096
+
+static cell cstr[MAXLENGTH + 1];
+static char str[MAXLENGTH + 1];
+static volatile int sink;
+
+static double Seconds(void)
+{
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void Bench(int length, int pack, long rounds)
+{
+  double start, strlen_t, get_t, set_t;
+  long r;
+  int len;
+
+  memset(str, 'a', length);
+  str[length] = '\0';
+  amx_SetString(cstr, str, pack, 0, MAXLENGTH + 1);
+
+  start = Seconds();
+  for (r = 0; r < rounds; r++) {
+    amx_StrLen(cstr, &len);
+    sink += len;
+  } /* for */
+  strlen_t = Seconds() - start;
+
+  start = Seconds();
+  for (r = 0; r < rounds; r++) {
+    amx_GetString(str, cstr, 0, MAXLENGTH + 1);
+    sink += str[0];
+  } /* for */
+  get_t = Seconds() - start;
+
+  start = Seconds();
+  for (r = 0; r < rounds; r++) {
+    amx_SetString(cstr, str, pack, 0, MAXLENGTH + 1);
+    sink += (int)cstr[0];
+  } /* for */
+  set_t = Seconds() - start;
+
+  /* nanoseconds per call */
+  printf("%-8s %6d %12.1f %12.1f %12.1f\n", pack ? "packed" : "unpacked", length,
+         strlen_t * 1e9 / rounds, get_t * 1e9 / rounds, set_t * 1e9 / rounds);
+}
+
+int main(int argc, char *argv[])
+{
+  static const int lengths[] = { 8, 32, 128, 1024, MAXLENGTH };
+  long total = (argc > 1) ? atol(argv[1]) : 100000000L;
+  int i, pack;
+
+  printf("%-8s %6s %12s %12s %12s   (ns per call)\n",
+         "string", "length", "amx_StrLen", "GetString", "SetString");
+  for (pack = 0; pack <= 1; pack++)
+    for (i = 0; i < (int)(sizeof lengths / sizeof lengths[0]); i++)
+      Bench(lengths[i], pack, total / (lengths[i] + 16));
+  return 0;
+}
@@ -2801,16 +2801,19 @@ int AMXAPI prun_Overlay(AMX *amx, int index)
 {
   AMX_HEADER *hdr;
   AMX_OVERLAYINFO *tbl;
+  AMX_POOL *pool;
   FILE *ovl;
 
   assert(amx != NULL);
+  if (amx_GetUserData(amx, AMX_POOLTAG, (void**)&pool) != AMX_ERR_NONE)
+    return AMX_ERR_OVERLAY;     /* no overlay pool for this abstract machine */
   hdr = (AMX_HEADER*)amx->base;
   assert((size_t)index < (hdr->nametable - hdr->overlays) / sizeof(AMX_OVERLAYINFO));
   tbl = (AMX_OVERLAYINFO*)(amx->base + hdr->overlays) + index;
   amx->codesize = tbl->size;
-  amx->code = amx_poolfind(index);
+  amx->code = amx_poolfind(pool, index);
   if (amx->code == NULL) {
-    if ((amx->code = amx_poolalloc(tbl->size, index)) == NULL)
+    if ((amx->code = amx_poolalloc(pool, tbl->size, index)) == NULL)
       return AMX_ERR_OVERLAY;   /* failure allocating memory for the overlay */
     ovl = fopen(g_filename, "rb");
     assert(ovl != NULL);
@@ -2830,11 +2833,17 @@ static void *loadprogram(AMX *amx,const char *filename)
   AMX_HEADER hdr;
   int32_t size;
   void *program;
+  AMX_POOL *pool = NULL;
 
   if ((fp = fopen(filename,"rb")) != NULL) {
     fread(&hdr, sizeof hdr, 1, fp);
     amx_Align32((uint32_t *)&hdr.stp);
     amx_Align32((uint32_t *)&hdr.size);
+    /* overlays in compact encoding are not supported (see PAWNRUN.C) */
+    if ((hdr.flags & (AMX_FLAG_OVERLAY | AMX_FLAG_COMPACT)) == (AMX_FLAG_OVERLAY | AMX_FLAG_COMPACT)) {
+      fclose(fp);
+      return NULL;
+    } /* if */
 
     if ((hdr.flags & AMX_FLAG_OVERLAY) != 0) {
       /* allocate the block for the data + stack/heap, plus the complete file
@@ -2855,7 +2864,7 @@ static void *loadprogram(AMX *amx,const char *filename)
         fseek(fp, hdr.dat, SEEK_SET);
         fread((char*)program + hdr.cod, 1, hdr.hea - hdr.dat, fp);
         /* initialize the overlay pool */
-        amx_poolinit((char*)program + (hdr.stp - hdr.dat) + hdr.cod, OVLPOOLSIZE);
+        pool = amx_poolinit((char*)program + (hdr.stp - hdr.dat) + hdr.cod, OVLPOOLSIZE);
       } else {
         fread(program, 1, (size_t)hdr.size, fp);
       } /* if */
@@ -2865,6 +2874,7 @@ static void *loadprogram(AMX *amx,const char *filename)
       if ((hdr.flags & AMX_FLAG_OVERLAY) != 0) {
         amx->data = (unsigned char*)program + hdr.cod;
         amx->overlay = prun_Overlay;
+        amx_SetUserData(amx, AMX_POOLTAG, pool);
       } /* if */
       if (amx_Init(amx,program) == AMX_ERR_NONE)
         return program;
@@ -37,11 +37,60 @@
 #if defined AMXOVL
   #include "amxpool.h"
 #endif
-#if defined AMXDBG
+#if defined AMXDBG || defined AMXPROF
   #include "amxdbg.h"
 #endif
+#if defined AMXPROF
+  #include "amxprof.h"
+#endif
+#if defined __LINUX__ || defined __FreeBSD__ || defined __OpenBSD__ || defined __APPLE__
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+  #define PRUN_MMAP
+  #if defined AMX_JIT
+    #define PRUN_JIT
+  #endif
+#endif
+#if defined AMX_GUARDPAGES
+  /* with guard pages, the heap and the stack no longer share the free space;
+   * so that neither runs out sooner, the heap gets as much room as both had
+   * together, and the data block grows by that amount plus two pages (for the
+   * guard page and its alignment), see amx_SetGuard()
+   */
+  #define GUARDHEAP(h)  ((long)((h).stp - (h).hea))
+  #define GUARDSIZE(h)  (GUARDHEAP(h) + 2 * (long)sysconf(_SC_PAGESIZE))
+#else
+  #define GUARDSIZE(h)  0
+#endif
+#if defined AMX_GROWABLE && defined PRUN_MMAP
+  /* a mapped script gets a data block of this size in address space, of which
+   * only the parts in use are committed, see amx_Grow()
+   */
+  #if !defined PRUN_RESERVE
+    #define PRUN_RESERVE  (16L * 1024 * 1024)
+  #endif
+  #if !defined MAP_NORESERVE
+    #define MAP_NORESERVE 0
+  #endif
+  #if defined AMX_SANDBOX
+    /* the block lies inside the (larger) window of the sandbox */
+    #define RESERVEWINDOW(r)  AMX_SANDBOX_SIZE
+    #define RESERVEOFFSET     AMX_SANDBOX_OFFSET
+  #else
+    #define RESERVEWINDOW(r)  (r)
+    #define RESERVEOFFSET     0
+  #endif
+#endif
 static char g_filename[_MAX_PATH];      /* for loading the debug or information
                                          * or for loading overlays */
+#if defined PRUN_JIT
+static int g_usejit = 0;                /* run the script through the JIT */
+static size_t g_jitsize = 0;            /* size of the block with native code */
+#endif
+#if defined PRUN_MMAP
+static int g_mapped = 0;                /* the program file is mapped */
+#endif
 
 /* These initialization functions are part of the "extension modules"
  * (libraries with native functions) that this run-time uses. More
@@ -93,34 +142,204 @@ int AMXAPI prun_Monitor(AMX *amx)
 }
 
 #if defined AMXOVL
+static FILE *g_ovlfile = NULL;          /* program file, kept open for loading
+                                         * the overlays */
+static long *g_ovlpos = NULL;           /* file positions of the overlays in
+                                         * a program in compact encoding */
+static int *g_ovlnext = NULL;           /* per overlay, the overlay that was
+                                         * switched to next (the last time) */
+static int g_ovlcurrent = -1;           /* the overlay that is loaded */
+
+/* prun_Expand()
+ * Read a number of cells in compact encoding from the file; see expand() in
+ * AMX.C for the encoding.
+ */
+static void prun_Expand(FILE *fp, cell *dest, long count)
+{
+  int b;
+  ucell c;
+
+  while (count-- > 0) {
+    b = getc(fp);
+    c = ((b & 0x40) != 0) ? ~(ucell)0 : 0;  /* sign extension */
+    for ( ;; ) {
+      c = (c << 7) | (ucell)(b & 0x7f);
+      if ((b & 0x80) == 0 || b == EOF)
+        break;
+      b = getc(fp);
+    } /* for */
+    *dest++ = (cell)c;
+  } /* while */
+}
+
+/* prun_IndexCompact()
+ * The overlay table holds the offsets of the expanded code; for a program in
+ * compact encoding, look up the file positions of all overlays and of the
+ * data section. In the compact encoding, the last byte of every cell has the
+ * high bit clear. The function returns the position of the data section, or
+ * -1 on failure.
+ */
+static long prun_IndexCompact(FILE *fp, const unsigned char *header)
+{
+  const AMX_HEADER *hdr = (const AMX_HEADER *)header;
+  const AMX_OVERLAYINFO *tbl = (const AMX_OVERLAYINFO *)(header + hdr->overlays);
+  int num = (int)((hdr->nametable - hdr->overlays) / sizeof(AMX_OVERLAYINFO));
+  long pos = 0, cellnum = 0, target;
+  int i, b;
+
+  if ((g_ovlpos = (long*)malloc((num + 1) * sizeof(long))) == NULL)
+    return -1;
+  /* overlays are normally in the order of the code, so this is usually a
+   * single pass through the file; the data section comes last
+   */
+  for (i = 0; i <= num; i++) {
+    target = (i < num) ? tbl[i].offset / (long)sizeof(cell) : (hdr->dat - hdr->cod) / (long)sizeof(cell);
+    if (i == 0 || target < cellnum) {
+      pos = hdr->cod;
+      cellnum = 0;
+      fseek(fp, pos, SEEK_SET);
+    } /* if */
+    while (cellnum < target) {
+      if ((b = getc(fp)) == EOF)
+        return -1;
+      pos++;
+      if ((b & 0x80) == 0)
+        cellnum++;
+    } /* while */
+    g_ovlpos[i] = pos;
+  } /* for */
+  return g_ovlpos[num];
+}
+
 /* prun_Overlay()
- * Helper function to load overlays
+ * Helper function to load overlays; the file stays open while the program
+ * runs. On a miss, the overlay that followed the requested one the last time
+ * is read ahead by the operating system (see also AMXAUX.C).
  */
 int AMXAPI prun_Overlay(AMX *amx, int index)
 {
   AMX_HEADER *hdr;
   AMX_OVERLAYINFO *tbl;
-  FILE *ovl;
+  AMX_POOL *pool;
+  int next;
 
   assert(amx != NULL);
+  if (amx_GetUserData(amx, AMX_POOLTAG, (void**)&pool) != AMX_ERR_NONE || g_ovlfile == NULL)
+    return AMX_ERR_OVERLAY;     /* no overlay pool for this abstract machine */
   hdr = (AMX_HEADER*)amx->base;
   assert((size_t)index < (hdr->nametable - hdr->overlays) / sizeof(AMX_OVERLAYINFO));
   tbl = (AMX_OVERLAYINFO*)(amx->base + hdr->overlays) + index;
+  if (g_ovlcurrent >= 0)
+    g_ovlnext[g_ovlcurrent] = index;
+  g_ovlcurrent = index;
   amx->codesize = tbl->size;
-  amx->code = amx_poolfind(index);
+  amx->code = amx_poolfind(pool, index);
   if (amx->code == NULL) {
-    if ((amx->code = amx_poolalloc(tbl->size, index)) == NULL)
+    if ((amx->code = amx_poolalloc(pool, tbl->size, index)) == NULL)
       return AMX_ERR_OVERLAY;   /* failure allocating memory for the overlay */
-    ovl = fopen(g_filename, "rb");
-    assert(ovl != NULL);
-    fseek(ovl, (int)hdr->cod + tbl->offset, SEEK_SET);
-    fread(amx->code, 1, tbl->size, ovl);
-    fclose(ovl);
+    if (g_ovlpos != NULL) {
+      fseek(g_ovlfile, g_ovlpos[index], SEEK_SET);
+      prun_Expand(g_ovlfile, (cell*)amx->code, tbl->size / (long)sizeof(cell));
+    } else {
+      fseek(g_ovlfile, (int)hdr->cod + tbl->offset, SEEK_SET);
+      fread(amx->code, 1, tbl->size, g_ovlfile);
+    } /* if */
+    #if defined POSIX_FADV_WILLNEED
+      if ((next = g_ovlnext[index]) >= 0 && next != index) {
+        tbl = (AMX_OVERLAYINFO*)(amx->base + hdr->overlays) + next;
+        posix_fadvise(fileno(g_ovlfile),
+                      (g_ovlpos != NULL) ? g_ovlpos[next] : (int)hdr->cod + tbl->offset,
+                      tbl->size, POSIX_FADV_WILLNEED);
+      } /* if */
+    #else
+      (void)next;
+    #endif
+  } /* if */
+  return AMX_ERR_NONE;
+}
+
+/* prun_FreeOverlays()
+ * Close the file and free the tables of the overlay loader.
+ */
+static void prun_FreeOverlays(void)
+{
+  if (g_ovlfile != NULL)
+    fclose(g_ovlfile);
+  g_ovlfile = NULL;
+  free(g_ovlpos);
+  g_ovlpos = NULL;
+  free(g_ovlnext);
+  g_ovlnext = NULL;
+  g_ovlcurrent = -1;
+}
+#endif
+
+#if defined PRUN_JIT
+/* prun_CompileJIT()
+ * Compile an initialized abstract machine to native code. The native code,
+ * together with the data, stack and heap, is placed in a block that is both
+ * writable and executable; the P-code block is released.
+ */
+static int prun_CompileJIT(AMX *amx)
+{
+  unsigned char *pcode = amx->base;
+  unsigned char *ncode;
+  void *rt = NULL;
+  size_t size;
+  int err;
+
+  size = (size_t)amx->codesize;         /* estimate of the native code size */
+  ncode = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ncode == MAP_FAILED)
+    return AMX_ERR_MEMORY;
+  if (amx->reloc_size > 0 && (rt = malloc(amx->reloc_size)) == NULL) {
+    munmap(ncode, size);
+    return AMX_ERR_MEMORY;
+  } /* if */
+  err = amx_InitJIT(amx, rt, ncode);
+  free(rt);
+  if (err != AMX_ERR_NONE) {
+    munmap(ncode, size);
+    return err;
   } /* if */
+  free(pcode);
+  g_jitsize = size;
   return AMX_ERR_NONE;
 }
 #endif
 
+#if defined AMX_GROWABLE && defined PRUN_MMAP
+/* prun_Reserve()
+ * Reserve (but do not commit) a window of address space, and return the
+ * address of the data block at "offset" bytes into it. When a pointer does
+ * not fit in a cell, amx_Address() takes the upper bits of a pointer from the
+ * data block, so the block must not cross a boundary of CELLMASK + 1 bytes;
+ * it is therefore aligned to such a boundary.
+ */
+static unsigned char *prun_Reserve(size_t window, size_t offset)
+{
+  unsigned char *base, *data;
+  size_t align = 0, skip;
+
+  #if defined CELLMASK
+    align = (size_t)CELLMASK + 1;
+  #endif
+  base = (unsigned char*)mmap(NULL, window + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
+    return NULL;
+  data = base + offset;
+  if (align > 0)
+    data = (unsigned char*)(((uintptr_t)data + align - 1) & ~(uintptr_t)(align - 1));
+  /* return the unused parts of the reservation */
+  skip = (size_t)(data - offset - base);
+  if (skip > 0)
+    munmap(base, skip);
+  if (align > skip)
+    munmap(data - offset + window, align - skip);
+  return data;
+}
+#endif
+
 /* aux_LoadProgram()
  * Load a compiled Pawn script into memory and initialize the abstract machine.
  * This function is extracted out of AMXAUX.C.
@@ -132,6 +351,13 @@ int AMXAPI aux_LoadProgram(AMX *amx, char *filename)
   int result;
   int32_t size;
   unsigned char *datablock;
+  #if defined PRUN_MMAP
+    int mapfile;
+  #endif
+  #if defined AMXOVL
+    AMX_POOL *pool = NULL;
+    int numoverlays = 0;
+  #endif
   #define OVLPOOLSIZE 4096
 
   /* open the file, read and check the header */
@@ -150,47 +376,140 @@ int AMXAPI aux_LoadProgram(AMX *amx, char *filename)
     return AMX_ERR_FORMAT;
   } /* if */
 
+  /* save the filename, for optionally reading the debug information (we could
+   * also have read it here immediately); for reading overlays, we also need
+   * the filename (and in this case, note that amx_Init() already browses
+   * through all overlays)
+   */
+  strcpy(g_filename, filename);
+
+  #if defined PRUN_MMAP
+    /* map the file into memory, so that only the pages that are used are
+     * read; only the data section, with the stack and heap, is allocated
+     * (see AMXAUX.C); the mapping is private, so the pages of the code that
+     * amx_Init() patches (for superinstructions, case tables and intrinsics)
+     * become a private copy and the others are shared with other instances
+     * of pawnrun running the same script; programs with overlays, programs in
+     * compact encoding and programs for the JIT are read in completely, and
+     * so is any program that cannot be mapped
+     */
+    mapfile = (hdr.flags & (AMX_FLAG_OVERLAY | AMX_FLAG_COMPACT)) == 0;
+    #if defined PRUN_JIT
+      if (g_usejit)
+        mapfile = 0;
+    #endif
+    if (mapfile) {
+      struct stat st;
+      unsigned char *image = MAP_FAILED;
+      if (fstat(fileno(fp), &st) == 0 && st.st_size >= (off_t)hdr.size && hdr.cod < hdr.size)
+        image = (unsigned char*)mmap(NULL, (size_t)hdr.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+      if (image != MAP_FAILED) {
+        #if defined AMX_GROWABLE
+          size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+          size_t reserve = ((size_t)(hdr.stp - hdr.dat) + pagesize - 1) & ~(pagesize - 1);
+          if (reserve < PRUN_RESERVE)
+            reserve = PRUN_RESERVE;
+        #endif
+        result = AMX_ERR_MEMORY;
+        #if defined AMX_GROWABLE
+          /* reserve the address space only, amx_Init() commits what it needs */
+          datablock = prun_Reserve(RESERVEWINDOW(reserve), RESERVEOFFSET);
+        #else
+          datablock = (unsigned char*)malloc(hdr.stp - hdr.dat + GUARDSIZE(hdr));
+        #endif
+        if (datablock != NULL) {
+          memset(amx, 0, sizeof *amx);
+          amx->data = datablock;
+          amx->flags = AMX_FLAG_INTRINSICS;
+          #if defined AMX_GROWABLE
+            amx->reserve = (cell)reserve;
+          #endif
+          result = amx_Init(amx, image);
+          #if defined AMX_GUARDPAGES
+            if (result == AMX_ERR_NONE && (result = amx_SetGuard(amx, GUARDHEAP(hdr), GUARDSIZE(hdr))) != AMX_ERR_NONE)
+              amx_Cleanup(amx);
+          #endif
+          if (result != AMX_ERR_NONE) {
+            #if defined AMX_GROWABLE
+              munmap(datablock - RESERVEOFFSET, RESERVEWINDOW(reserve));
+            #else
+              free(datablock);
+            #endif
+          } /* if */
+        } /* if */
+        if (result == AMX_ERR_NONE) {
+          fclose(fp);
+          g_mapped = 1;
+          return result;
+        } /* if */
+        munmap(image, (size_t)hdr.size);
+      } /* if */
+    } /* if */
+  #endif
+
   if ((hdr.flags & AMX_FLAG_OVERLAY) != 0) {
     /* allocate the block for the data + stack/heap, plus the complete file
      * header, plus the overlay pool
      */
     #if defined AMXOVL
-      size = (hdr.stp - hdr.dat) + hdr.cod + OVLPOOLSIZE;
+      size = (hdr.stp - hdr.dat) + hdr.cod + GUARDSIZE(hdr) + OVLPOOLSIZE;
     #else
 	  fclose(fp);
       return AMX_ERR_OVERLAY;
     #endif
   } else {
-    size = hdr.stp;
+    size = hdr.stp + GUARDSIZE(hdr);
   } /* if */
   if ((datablock = (unsigned char*)malloc(size)) == NULL) {
     fclose(fp);
     return AMX_ERR_MEMORY;
   } /* if */
 
-  /* save the filename, for optionally reading the debug information (we could
-   * also have read it here immediately); for reading overlays, we also need
-   * the filename (and in this case, note that amx_Init() already browses
-   * through all overlays)
-   */
-  strcpy(g_filename, filename);
-
   /* read in the file, in two parts; first the header and then the data section */
   rewind(fp);
   if ((hdr.flags & AMX_FLAG_OVERLAY) != 0) {
     #if defined AMXOVL
-      /* read the entire header */
+      /* read the entire header, keep the file open for the overlays */
       fread(datablock, 1, hdr.cod, fp);
-      /* read the data section, put it behind the header in the block */
-      fseek(fp, hdr.dat, SEEK_SET);
-      fread(datablock + hdr.cod, 1, hdr.hea - hdr.dat, fp);
+      g_ovlfile = fp;
+      numoverlays = (int)((hdr.nametable - hdr.overlays) / sizeof(AMX_OVERLAYINFO));
+      if ((g_ovlnext = (int*)malloc((numoverlays + 1) * sizeof(int))) == NULL) {
+        prun_FreeOverlays();
+        free(datablock);
+        return AMX_ERR_MEMORY;
+      } /* if */
+      if ((hdr.flags & AMX_FLAG_COMPACT) != 0) {
+        /* find the overlays and the data section, expand the data section
+         * behind the header in the block
+         */
+        long datapos = prun_IndexCompact(fp, datablock);
+        if (datapos < 0) {
+          prun_FreeOverlays();
+          free(datablock);
+          return AMX_ERR_FORMAT;
+        } /* if */
+        fseek(fp, datapos, SEEK_SET);
+        prun_Expand(fp, (cell*)(datablock + hdr.cod), (hdr.hea - hdr.dat) / (long)sizeof(cell));
+      } else {
+        /* read the data section, put it behind the header in the block */
+        fseek(fp, hdr.dat, SEEK_SET);
+        fread(datablock + hdr.cod, 1, hdr.hea - hdr.dat, fp);
+      } /* if */
       /* initialize the overlay pool */
-      amx_poolinit(datablock + (hdr.stp - hdr.dat) + hdr.cod, OVLPOOLSIZE);
+      pool = amx_poolinit(datablock + (hdr.stp - hdr.dat) + hdr.cod + GUARDSIZE(hdr), OVLPOOLSIZE);
+      if (pool == NULL) {
+        prun_FreeOverlays();
+        free(datablock);
+        return AMX_ERR_MEMORY;
+      } /* if */
     #endif
   } else {
     fread(datablock, 1, (size_t)hdr.size, fp);
   } /* if */
-  fclose(fp);
+  #if defined AMXOVL
+    if (fp != g_ovlfile)
+  #endif
+      fclose(fp);
 
   /* initialize the abstract machine */
   memset(amx, 0, sizeof *amx);
@@ -198,14 +517,47 @@ int AMXAPI aux_LoadProgram(AMX *amx, char *filename)
     if ((hdr.flags & AMX_FLAG_OVERLAY) != 0) {
       amx->data = datablock + hdr.cod;
       amx->overlay = prun_Overlay;
+      amx_SetUserData(amx, AMX_POOLTAG, pool);
     } /* if */
   #endif
+  /* the float and fixed point natives come from the standard extension
+   * modules (amxFloat and amxFixed), so amx_Init() may replace them by
+   * intrinsics
+   */
+  amx->flags = AMX_FLAG_INTRINSICS;
+  #if defined PRUN_JIT
+    if (g_usejit)
+      amx->flags |= AMX_FLAG_JITC;
+  #endif
   result = amx_Init(amx, datablock);
+  #if defined PRUN_JIT
+    if (result == AMX_ERR_NONE && g_usejit) {
+      result = prun_CompileJIT(amx);
+      if (result != AMX_ERR_NONE)
+        amx_Cleanup(amx);
+    } /* if */
+  #endif
+  #if defined AMX_GUARDPAGES
+    if (result == AMX_ERR_NONE && (amx->flags & AMX_FLAG_JITC) == 0) {
+      result = amx_SetGuard(amx, GUARDHEAP(hdr), GUARDSIZE(hdr));
+      if (result != AMX_ERR_NONE)
+        amx_Cleanup(amx);
+    } /* if */
+  #endif
 
   /* free the memory block on error, if it was allocated here */
   if (result != AMX_ERR_NONE) {
     free(datablock);
     amx->base = NULL;                   /* avoid a double free */
+    #if defined AMXOVL
+      prun_FreeOverlays();
+  } else if (g_ovlnext != NULL) {
+    /* amx_Init() loaded all overlays in turn, which is not how they are called */
+    int i;
+    for (i = 0; i < numoverlays; i++)
+      g_ovlnext[i] = -1;
+    g_ovlcurrent = -1;
+    #endif
   } /* if */
 
   return result;
@@ -219,7 +571,27 @@ int AMXAPI aux_FreeProgram(AMX *amx)
 {
   if (amx->base!=NULL) {
     amx_Cleanup(amx);
-    free(amx->base);
+    #if defined PRUN_JIT
+      if ((amx->flags & AMX_FLAG_JITC) != 0)
+        munmap(amx->base, g_jitsize);
+      else
+    #endif
+    #if defined PRUN_MMAP
+      if (g_mapped) {
+        g_mapped = 0;
+        munmap(amx->base, (size_t)((AMX_HEADER *)amx->base)->size);
+        #if defined AMX_GROWABLE
+          if (amx->reserve != 0)
+            munmap(amx->data - RESERVEOFFSET, RESERVEWINDOW((size_t)amx->reserve));
+          else
+        #endif
+            free(amx->data);
+      } else
+    #endif
+        free(amx->base);
+    #if defined AMXOVL
+      prun_FreeOverlays();
+    #endif
     memset(amx,0,sizeof(AMX));
   } /* if */
   return AMX_ERR_NONE;
@@ -246,7 +618,7 @@ static char *messages[] = {
       /* AMX_ERR_DIVIDE    */ "Divide by zero",
       /* AMX_ERR_SLEEP     */ "(sleep mode)",
       /* AMX_ERR_INVSTATE  */ "Invalid state",
-      /* 14 */                "(reserved)",
+      /* AMX_ERR_FUEL      */ "Instruction budget exhausted",
       /* 15 */                "(reserved)",
       /* AMX_ERR_MEMORY    */ "Out of memory",
       /* AMX_ERR_FORMAT    */ "Invalid/unsupported P-code file format",
@@ -297,11 +669,102 @@ void ExitOnError(AMX *amx, int error)
   } /* if */
 }
 
+#if defined PRUN_JIT
+  #define OPT_JIT "\t-jit\tto compile the script to native code\n"
+#else
+  #define OPT_JIT ""
+#endif
+#if defined AMXPROF
+  #define OPT_PROF "\t-profile[=file]\tto profile the script; the folded stacks are written to the file\n"
+#else
+  #define OPT_PROF ""
+#endif
+#if defined AMX_OPSTATS
+  #define OPT_OPSTATS "\t-opstats\tto count the executed opcodes and opcode pairs\n"
+#else
+  #define OPT_OPSTATS ""
+#endif
+
+#if defined AMX_OPSTATS
+typedef struct tagOPPAIR {
+  uint64_t count;
+  int first, second;
+} OPPAIR;
+
+static int cmppair(const void *a, const void *b)
+{
+  uint64_t c1 = ((const OPPAIR *)a)->count;
+  uint64_t c2 = ((const OPPAIR *)b)->count;
+  return (c1 > c2) ? -1 : (c1 < c2) ? 1 : 0;
+}
+
+/* prun_OpStats()
+ * Prints the opcodes sorted on their execution count, and the most frequent
+ * pairs of opcodes (the candidates for superinstructions).
+ */
+static void prun_OpStats(AMX *amx)
+{
+  #define MAXPAIRS  40
+  AMX_STATS *stats;
+  OPPAIR *list;
+  uint64_t total;
+  const char *name, *name2;
+  int i, j, num;
+
+  if (amx_GetStats(amx, &stats) != AMX_ERR_NONE)
+    return;
+  if ((list = (OPPAIR *)malloc(AMX_STATS_OPCODES * AMX_STATS_OPCODES * sizeof(OPPAIR))) == NULL)
+    return;
+
+  total = 0;
+  for (num = i = 0; i < stats->numopcodes; i++) {
+    if (stats->count[i] == 0)
+      continue;
+    list[num].count = stats->count[i];
+    list[num].first = i;
+    num++;
+    total += stats->count[i];
+  } /* for */
+  if (total == 0)
+    total = 1;
+  qsort(list, num, sizeof(OPPAIR), cmppair);
+  printf("\n%14s %7s  %s\n", "count", "", "opcode");
+  for (i = 0; i < num; i++) {
+    amx_OpcodeName(list[i].first, &name);
+    printf("%14llu %6.2f%%  %s\n", (unsigned long long)list[i].count,
+           100.0 * list[i].count / total, name);
+  } /* for */
+
+  for (num = i = 0; i < stats->numopcodes; i++) {
+    for (j = 0; j < stats->numopcodes; j++) {
+      if (stats->pairs[i][j] == 0)
+        continue;
+      list[num].count = stats->pairs[i][j];
+      list[num].first = i;
+      list[num].second = j;
+      num++;
+    } /* for */
+  } /* for */
+  qsort(list, num, sizeof(OPPAIR), cmppair);
+  printf("\n%14s %7s  %s\n", "count", "", "opcode pair");
+  for (i = 0; i < num && i < MAXPAIRS; i++) {
+    amx_OpcodeName(list[i].first, &name);
+    amx_OpcodeName(list[i].second, &name2);
+    printf("%14llu %6.2f%%  %s, %s\n", (unsigned long long)list[i].count,
+           100.0 * list[i].count / total, name, name2);
+  } /* for */
+  free(list);
+}
+#endif
+
 void PrintUsage(char *program)
 {
   printf("Usage: %s <filename> [options]\n\n"
          "Options:\n"
          "\t-stack\tto monitor stack usage\n"
+         OPT_JIT
+         OPT_PROF
+         OPT_OPSTATS
          "\t...\tother options are passed to the script\n"
          , program);
   exit(1);
@@ -316,6 +779,17 @@ int main(int argc,char *argv[])
   clock_t start = 0, end = 0;
   STACKINFO stackinfo = { 0 };
   AMX_IDLE idlefunc;
+  AMX_NATIVE *natives = NULL;
+  int numnatives;
+  #if defined AMXPROF
+    AMX_PROF *prof = NULL;
+    AMX_DBG amxdbg;
+    int hasdbg = 0;
+    const char *foldedfile = NULL;
+  #endif
+  #if defined AMX_OPSTATS
+    AMX_STATS *opstats = NULL;
+  #endif
 
   if (argc < 2)
     PrintUsage(argv[0]);        /* function "usage" aborts the program */
@@ -329,6 +803,24 @@ int main(int argc,char *argv[])
     } /* if */
   #endif
 
+  #if defined PRUN_JIT
+    /* the JIT must be selected before loading the program */
+    for (i = 2; i < argc; i++)
+      if (strcmp(argv[i],"-jit") == 0)
+        g_usejit = 1;
+    #if defined AMXPROF
+      /* the JIT does not call the fuel hook, so the profiler would get no
+       * samples
+       */
+      for (i = 2; g_usejit && i < argc; i++) {
+        if (strncmp(argv[i],"-profile",8) == 0 && (argv[i][8] == '\0' || argv[i][8] == '=')) {
+          printf("The options -jit and -profile cannot be combined.\n\n");
+          PrintUsage(argv[0]);
+        } /* if */
+      } /* for */
+    #endif
+  #endif
+
   /* Load the program and initialize the abstract machine. */
   err = aux_LoadProgram(&amx, argv[1]);
   if (err != AMX_ERR_NONE) {
@@ -355,6 +847,16 @@ int main(int argc,char *argv[])
   err = amx_CoreInit(&amx);
   ExitOnError(&amx, err);
 
+  /* all native functions are registered at this point, so the abstract
+   * machine can call them through a table instead of through the callback
+   */
+  if (amx_NumNatives(&amx, &numnatives) == AMX_ERR_NONE && numnatives > 0
+      && (natives = (AMX_NATIVE*)malloc(numnatives * sizeof(AMX_NATIVE))) != NULL
+      && amx_SetNatives(&amx, natives) != AMX_ERR_NONE) {
+    free(natives);
+    natives = NULL;
+  } /* if */
+
   /* save the idle function, if set by any of the extension modules */
   if (amx_GetUserData(&amx, AMX_USERTAG('I','d','l','e'), (void**)&idlefunc) != AMX_ERR_NONE)
     idlefunc = NULL;
@@ -379,6 +881,28 @@ int main(int argc,char *argv[])
       amx_SetDebugHook(&amx, prun_Monitor);
     } else if (strcmp(argv[i],"-time") == 0) {
       start=clock();
+    #if defined AMXPROF
+      } else if (strncmp(argv[i],"-profile",8) == 0 && (argv[i][8] == '\0' || argv[i][8] == '=')) {
+        /* sample the script every millisecond (of CPU time); the debug
+         * information is used for the function names, if available
+         */
+        FILE *fp;
+        if ((fp=fopen(g_filename,"rb")) != NULL) {
+          hasdbg = (dbg_LoadInfo(&amxdbg,fp) == AMX_ERR_NONE);
+          fclose(fp);
+        } /* if */
+        if (argv[i][8] == '=')
+          foldedfile = argv[i] + 9;
+        err = prof_Create(&prof, &amx, hasdbg ? &amxdbg : NULL);
+        if (err == AMX_ERR_NONE)
+          err = prof_Start(prof, PROF_TIMER, 1000);
+        ExitOnError(&amx, err);
+    #endif
+    #if defined AMX_OPSTATS
+      } else if (strcmp(argv[i],"-opstats") == 0 || strcmp(argv[i],"--opstats") == 0) {
+        if (opstats == NULL && (opstats = (AMX_STATS *)malloc(sizeof(AMX_STATS))) != NULL)
+          amx_SetStats(&amx, opstats);
+    #endif
     } /* if */
   } /* for */
 
@@ -429,10 +953,39 @@ int main(int argc,char *argv[])
   if (start!=0)
     end=clock();
 
+  #if defined AMXPROF
+    if (prof != NULL) {
+      prof_Stop(prof);
+      printf("\nProfile:\n");
+      prof_WriteSummary(prof, stdout);
+      if (foldedfile != NULL) {
+        FILE *fp = fopen(foldedfile, "w");
+        if (fp != NULL) {
+          prof_WriteFolded(prof, fp);
+          fclose(fp);
+        } else {
+          printf("Cannot create %s\n", foldedfile);
+        } /* if */
+      } /* if */
+      prof_Delete(prof);
+      if (hasdbg)
+        dbg_FreeInfo(&amxdbg);
+    } /* if */
+  #endif
+  #if defined AMX_OPSTATS
+    if (opstats != NULL) {
+      prun_OpStats(&amx);
+      amx_SetStats(&amx, NULL);
+      free(opstats);
+    } /* if */
+  #endif
+
   /* Free the compiled script and resources. This also unloads and DLLs or
    * shared libraries that were registered automatically by amx_Init().
    */
   aux_FreeProgram(&amx);
+  if (natives != NULL)
+    free(natives);
 
   /* Print the return code of the compiled script (often not very useful),
    * its run time, and its stack usage.
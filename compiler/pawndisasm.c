@@ -276,6 +276,36 @@ static const char *label_get(cell address)
   return str;
 }
 
+/* expand() reads cells in compact encoding (see expand() in AMX.C) from the
+ * input file and stores them with the cell size of the script
+ */
+static void expand(unsigned char *code,long size)
+{
+  int b;
+  ucell c;
+
+  for ( ; size>=pc_cellsize; size-=pc_cellsize, code+=pc_cellsize) {
+    b=getc(fpamx);
+    c=((b & 0x40)!=0) ? ~(ucell)0 : 0;  /* sign extension */
+    for ( ;; ) {
+      c=(c << 7) | (ucell)(b & 0x7f);
+      if ((b & 0x80)==0 || b==EOF)
+        break;
+      b=getc(fpamx);
+    } /* for */
+    switch (pc_cellsize) {
+    case 2:
+      *(uint16_t*)code=(uint16_t)c;
+      break;
+    case 4:
+      *(uint32_t*)code=(uint32_t)c;
+      break;
+    default:
+      *(uint64_t*)code=(uint64_t)c;
+    } /* switch */
+  } /* for */
+}
+
 static void label_deletall(void)
 {
   LABEL *item;
@@ -286,6 +316,71 @@ static void label_deletall(void)
   }
 }
 
+/* Statistics on pairs of adjacent instructions (option -s), as a guide for
+ * choosing superinstructions. The count is static: it says how often a pair
+ * occurs in the code, not how often it runs.
+ */
+typedef struct tagSEQUENCE {
+  int first, second;
+  unsigned long count;
+} SEQUENCE;
+
+static unsigned long *seqcount = NULL;  /* matrix of opcode pairs */
+static int seqprev = -1;                /* previous opcode, -1 if none */
+
+static void seq_add(int opcode)
+{
+  int num=sizearray(opcodelist);
+  if (seqcount==NULL || opcode<0 || opcode>=num)
+    return;
+  if (opcode==73)       /* "break" is transparent (it only occurs in debug builds) */
+    return;
+  if (seqprev>=0)
+    seqcount[seqprev*num+opcode]++;
+  /* "casetbl" is data, not an instruction that precedes the next one */
+  seqprev=(opcode==74 || opcode==80) ? -1 : opcode;
+}
+
+static int seq_compare(const void *a,const void *b)
+{
+  const SEQUENCE *s1=(const SEQUENCE*)a;
+  const SEQUENCE *s2=(const SEQUENCE*)b;
+  if (s1->count!=s2->count)
+    return (s1->count<s2->count) ? 1 : -1;
+  if (s1->first!=s2->first)
+    return s1->first-s2->first;
+  return s1->second-s2->second;
+}
+
+static void seq_dump(FILE *ftxt)
+{
+  int num=sizearray(opcodelist);
+  int idx,total;
+  SEQUENCE *list;
+
+  assert(seqcount!=NULL);
+  for (total=0, idx=0; idx<num*num; idx++)
+    if (seqcount[idx]>0)
+      total++;
+  if ((list=(SEQUENCE*)malloc((total+1)*sizeof(SEQUENCE)))==NULL)
+    return;
+  for (total=0, idx=0; idx<num*num; idx++) {
+    if (seqcount[idx]>0) {
+      list[total].first=idx/num;
+      list[total].second=idx%num;
+      list[total].count=seqcount[idx];
+      total++;
+    } /* if */
+  } /* for */
+  qsort(list,total,sizeof(SEQUENCE),seq_compare);
+  fprintf(ftxt,"\n\n;SEQUENCES");
+  for (idx=0; idx<total; idx++)
+    fprintf(ftxt,"\n%8lu  %s + %s",list[idx].count,
+            opcodelist[list[idx].first].name,opcodelist[list[idx].second].name);
+  fprintf(ftxt,"\n");
+  free(list);
+}
+
 static void print_opcode(FILE *ftxt,cell opcode,cell cip)
 {
   assert(ftxt!=NULL);
@@ -564,9 +659,20 @@ int main(int argc,char *argv[])
   unsigned char *code,*cip;
   OPCODE_PROC func;
   cell opc;
+  int opidx;
 
+  if (argc>=2 && strcmp(argv[1],"-s")==0) {
+    /* option -s appends statistics on instruction pairs to the listing */
+    if ((seqcount=(unsigned long*)calloc(sizearray(opcodelist)*sizearray(opcodelist),sizeof(unsigned long)))==NULL) {
+      printf("Insufficient memory\n");
+      return 1;
+    } /* if */
+    argc--;
+    argv++;
+  } /* if */
   if (argc<2 || argc>3) {
-    printf("Usage: pawndisasm <input> [output]\n");
+    printf("Usage: pawndisasm [-s] <input> [output]\n\n"
+           "Option -s appends a list of the most common instruction pairs.\n");
     return 1;
   } /* if */
   if (argc==2) {
@@ -619,6 +725,8 @@ int main(int argc,char *argv[])
     fprintf(fplist,"overlays ");
   if ((amxhdr.flags & AMX_FLAG_DEBUG)!=0)
     fprintf(fplist,"debug-info ");
+  if ((amxhdr.flags & AMX_FLAG_COMPACT)!=0)
+    fprintf(fplist,"compact ");
   fprintf(fplist,"\n\n");
   /* load the code block */
   if ((code=(unsigned char*)malloc(codesize))==NULL) {
@@ -629,7 +737,10 @@ int main(int argc,char *argv[])
 
   /* read the file */
   fseek(fpamx,amxhdr.cod,SEEK_SET);
-  fread(code,1,codesize,fpamx);
+  if ((amxhdr.flags & AMX_FLAG_COMPACT)!=0)
+    expand(code,codesize);
+  else
+    fread(code,1,codesize,fpamx);
 
   /* do a first run through the code to get jump targets (for labels) */
   cip=code;
@@ -662,19 +773,23 @@ int main(int argc,char *argv[])
     switch (pc_cellsize) {
     case 2:
       opc=(cell)*(uint16_t*)cip;
-      func=opcodelist[(int)(opc&0xff)].func;
+      opidx=(int)(opc&0xff);
+      func=opcodelist[opidx].func;
       break;
     case 4:
       opc=(cell)*(uint32_t*)cip;
-      func=opcodelist[(int)(opc&0xffff)].func;
+      opidx=(int)(opc&0xffff);
+      func=opcodelist[opidx].func;
       break;
     case 8:
       opc=(cell)*(uint64_t*)cip;
-      func=opcodelist[(int)(opc&0xffffffffLU)].func;
+      opidx=(int)(opc&0xffffffffLU);
+      func=opcodelist[opidx].func;
       break;
     default:
       assert(0);
     } /* switch */
+    seq_add(opidx);
     if (func==do_jump)
       label_add(get_param((cell*)(cip+pc_cellsize),0)+(cell)(cip-code));
     opc=func(fplist,(cell*)(cip+pc_cellsize),opc,(cell)(cip-code));
@@ -717,6 +832,11 @@ int main(int argc,char *argv[])
   if (strlen(name)>0)
     fprintf(fplist," %s",name);
 
+  if (seqcount!=NULL) {
+    seq_dump(fplist);
+    free(seqcount);
+  } /* if */
+
   free(code);
   label_deletall();
   fclose(fpamx);
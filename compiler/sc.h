@@ -907,6 +907,7 @@ SC_VDECL int pc_overlays;     /* generate overlay table + instructions? (abstrac
 SC_VDECL int pc_ovl0size[][2];/* size (in bytes) of the first (special) overlays */
 SC_VDECL int pc_cellsize;     /* size (in bytes) of a cell */
 SC_VDECL uint64_t pc_cryptkey;/* key for encryption of the generated script */
+SC_VDECL int pc_compact;      /* write code and data sections in compact encoding? */
 
 SC_VDECL constvalue sc_automaton_tab; /* automaton table */
 SC_VDECL constvalue sc_state_tab;     /* state table */
@@ -1009,6 +1009,7 @@ static void initglobals(void)
   for (i=0; i<ovlFIRST; i++)
     pc_ovl0size[i][0]=pc_ovl0size[i][1]=0;
   pc_cryptkey=0;
+  pc_compact=FALSE;     /* write plain (uncompressed) code and data */
 
   outfname[0]='\0';     /* output file name */
   errfname[0]='\0';     /* error file name */
@@ -1314,6 +1315,9 @@ static void parseoptions(int argc,char **argv,char *oname,char *ename,char *pnam
             about();
         } /* if */
         break;
+      case 'z':
+        pc_compact=toggle_option(ptr,pc_compact);
+        break;
       case '\\':                /* use \ instead for escape characters */
         sc_ctrlchar='\\';
         break;
@@ -1506,6 +1510,8 @@ static void setopt(int argc,char **argv,char *oname,char *ename,char *pname,
     about();
   if (pc_cryptkey!=0 && pc_cellsize<4)
     error(104,"-k","cell size < 32-bits");
+  if (pc_cryptkey!=0 && pc_compact)
+    error(104,"-k","-z");
 }
 
 #if defined __BORLANDC__ || defined __WATCOMC__
@@ -1652,6 +1658,7 @@ static void about(void)
     pc_printf("         -w<num>  disable a specific warning by its number\n");
     pc_printf("         -X<num>  abstract machine size limit in bytes\n");
     pc_printf("         -XD<num> abstract machine data/stack size limit in bytes\n");
+    pc_printf("         -z[+/-]  write code and data in compact encoding (default=%c)\n", pc_compact ? '+' : '-');
     pc_printf("         -\\       use '\\' for escape characters\n");
     pc_printf("         -^       use '^' for escape characters\n");
     pc_printf("         -;[+/-]  require a semicolon to end each statement (default=%c)\n", sc_needsemicolon ? '+' : '-');
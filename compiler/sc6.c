@@ -193,9 +193,37 @@ static char *stripcomment(char *str)
   return str;
 }
 
+static long bytes_in,bytes_out; /* plain and compact sizes of the code and data written */
+
 static void write_cell(FILE *fbin,ucell c)
 {
   assert(fbin!=NULL);
+  if (pc_compact) {
+    /* compact encoding: the value is stored in groups of 7 bits, most
+     * significant group first, where all bytes but the last have the high bit
+     * set; bit 6 of the first byte is the sign (see expand() in AMX.C)
+     */
+    int shift=8*(int)(sizeof(cell)-pc_cellsize);
+    cell v=(cell)(c << shift) >> shift;   /* sign-extend from the cell size */
+    unsigned char t[(8*sizeof(cell)+6)/7];
+    int num=0;
+    do {
+      assert(num<(int)sizeof t);
+      t[num++]=(unsigned char)(v & 0x7f);
+      v>>=7;
+    } while ((v!=0 || (t[num-1] & 0x40)!=0) && (v!=-1 || (t[num-1] & 0x40)==0));
+    while (num-->0) {
+      unsigned char code=(unsigned char)((num>0) ? (t[num] | 0x80) : t[num]);
+      writeerror |= !pc_writebin(fbin,&code,1);
+      bytes_out++;
+    } /* while */
+    bytes_in+=pc_cellsize;
+    /* amx_Init() can hold back only so many cells that it cannot store yet */
+    assert(AMX_COMPACTMARGIN>2);
+    if (bytes_out-bytes_in>=AMX_COMPACTMARGIN-2)
+      error(113);               /* compact encoding exceeds the expansion margin */
+    return;
+  } /* if */
   assert((pc_lengthbin(fbin) % pc_cellsize) == 0);
   if (pc_cryptkey!=0) {
     uint32_t *ptr=(uint32_t*)&c;
@@ -789,6 +817,8 @@ SC_FUNC int assemble(FILE *fout,FILE *fin)
     hdr.flags|=AMX_FLAG_OVERLAY;
   if (pc_cryptkey!=0)
     hdr.flags|=AMX_FLAG_CRYPT;
+  if (pc_compact)
+    hdr.flags|=AMX_FLAG_COMPACT;
   hdr.defsize=sizeof(AMX_FUNCSTUB);
   hdr.publics=sizeof hdr; /* public table starts right after the header */
   hdr.natives=hdr.publics + numpublics*sizeof(AMX_FUNCSTUB);
@@ -1016,6 +1046,7 @@ SC_FUNC int assemble(FILE *fout,FILE *fin)
     } /* for */
   } /* if */
   pc_resetbin(fout,hdr.cod);
+  bytes_in=bytes_out=0;
 
   /* First pass: relocate all labels */
   /* This pass is necessary because the code addresses of labels is only known
@@ -1091,6 +1122,11 @@ SC_FUNC int assemble(FILE *fout,FILE *fin)
     #endif
   } /* if */
 
+  /* in the compact encoding, the file is smaller than the memory image; the
+   * header fields for the sections keep their (expanded) memory offsets
+   */
+  if (pc_compact)
+    hdr.size=(int32_t)pc_lengthbin(fout);
   assert(hdr.size==pc_lengthbin(fout));
   if (!writeerror && (sc_debug & sSYMBOLIC)!=0)
     append_dbginfo(fout);       /* optionally append debug file */
@@ -1116,9 +1152,12 @@ SC_FUNC int assemble(FILE *fout,FILE *fin)
     align32(&hdr.hea);
     align32(&hdr.stp);
     align32(&hdr.cip);
-    pc_resetbin(fout,0);
-    pc_writebin(fout,&hdr,sizeof hdr);
   #endif
+  /* write the header again, with the final file size (for the compact
+   * encoding) and with the fields swapped (for Big Endian architectures)
+   */
+  pc_resetbin(fout,0);
+  pc_writebin(fout,&hdr,sizeof hdr);
 
   /* return the size of the header (including name tables, but excluding code
    * or data sections)
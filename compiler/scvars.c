@@ -90,6 +90,7 @@ SC_VDEFINE int pc_memflags=0;      /* special flags for the stack/heap usage */
 SC_VDEFINE int pc_overlays=0;      /* generate overlay table + instructions? */
 SC_VDEFINE int pc_ovl0size[ovlFIRST][2];/* offset & size (in bytes) of the first (special) overlays */
 SC_VDEFINE uint64_t pc_cryptkey=0; /* key for encryption of the generated script */
+SC_VDEFINE int pc_compact=FALSE;   /* write code and data sections in compact encoding? */
 
 SC_VDEFINE constvalue sc_automaton_tab = { NULL, "", 0, 0}; /* automaton table */
 SC_VDEFINE constvalue sc_state_tab = { NULL, "", 0, 0};   /* state table */
@@ -0,0 +1,18 @@
+/* Public functions for amx_ExecBatch(), run with the "prun_batch" shell */
+#include <core>
+
+forward public sum(a, b, c)
+forward public count(...)
+
+public sum(a, b, c)
+    return a + b + c
+
+/* the arguments of a variable argument list are passed by reference, but
+ * amx_ExecBatch() passes values; so only count them
+ */
+public count(...)
+    return numargs()
+
+main()
+    {
+    }
@@ -0,0 +1,111 @@
+/* Case tables: the abstract machine turns the case table of a "switch" into
+ * a jump table (for a small range of values) or a sorted table (for a sparse
+ * set) at load time. Every function below is called for values inside and
+ * outside its cases, and it must return the same as a chain of "if" tests.
+ */
+#include <console>
+
+dense(v)                        /* a jump table without gaps */
+    {
+    new r
+    switch (v)
+        {
+        case 0: r = 10
+        case 1: r = 11
+        case 2: r = 12
+        case 3: r = 13
+        case 4: r = 14
+        case 5: r = 15
+        default: r = -1
+        }
+    return r
+    }
+
+gaps(v)                         /* a jump table with gaps (to "default") */
+    {
+    new r
+    switch (v)
+        {
+        case -3: r = 1
+        case -2: r = 2
+        case 0: r = 3
+        case 1: r = 4
+        case 3: r = 5
+        default: r = -1
+        }
+    return r
+    }
+
+sparse(v)                       /* a sorted table */
+    {
+    new r
+    switch (v)
+        {
+        case -50000: r = 1
+        case 7: r = 2
+        case 100: r = 3
+        case 1000: r = 4
+        case 10 .. 12: r = 5
+        case 99999: r = 6
+        default: r = -1
+        }
+    return r
+    }
+
+extremes(v)                     /* the range does not fit in a cell */
+    {
+    new r
+    switch (v)
+        {
+        case cellmin: r = 1
+        case 0: r = 2
+        case cellmax: r = 3
+        default: r = -1
+        }
+    return r
+    }
+
+single(v)                       /* a single record is never a jump table */
+    {
+    new r
+    switch (v)
+        {
+        case 42: r = 1
+        default: r = -1
+        }
+    return r
+    }
+
+nodefault(v)                    /* a jump table without "default" */
+    {
+    new r = 0
+    switch (v)
+        {
+        case 1: r = 1
+        case 2: r = 2
+        case 3: r = 3
+        }
+    return r
+    }
+
+main()
+    {
+    new i
+
+    printf "dense:"
+    for (i = -2; i <= 7; i++)
+        printf " %d", dense(i)
+    printf "\ngaps:"
+    for (i = -5; i <= 4; i++)
+        printf " %d", gaps(i)
+    printf "\nsparse:"
+    printf " %d %d %d", sparse(-50000), sparse(-49999), sparse(7)
+    printf " %d %d %d", sparse(9), sparse(10), sparse(11)
+    printf " %d %d %d", sparse(12), sparse(13), sparse(100)
+    printf " %d %d %d", sparse(1000), sparse(99999), sparse(100000)
+    printf "\nextremes:"
+    printf " %d %d %d", extremes(cellmin), extremes(cellmin + 1), extremes(0)
+    printf " %d %d\n", extremes(cellmax - 1), extremes(cellmax)
+    printf "single: %d %d %d\n", single(41), single(42), single(43)
+    printf "nodefault: %d %d %d %d %d\n", nodefault(0), nodefault(1), nodefault(2), nodefault(3), nodefault(4)
+    }
@@ -0,0 +1,52 @@
+/* Intrinsics: the abstract machine replaces the calls to a few float and
+ * fixed point natives by instructions at load time. The results, printed as
+ * bit patterns, must be the same as those of the native functions, also for
+ * signed zeros, infinities, NaNs and values that do not fit in a cell.
+ * Compile with FIXED_POINT defined for the fixed point natives.
+ */
+#include <console>
+
+#if defined FIXED_POINT
+
+#include <fixed>
+native fint(Fixed:value);       /* not in the include file */
+
+main()
+    {
+    new Fixed:zero = 0.0
+    printf "fixed: %d %d %d %d\n", fixed(7), fixed(-7), fixed(-2147483), fixed(2147484)
+    printf "fabs: %d %d %d %d\n", fabs(-1.250), fabs(1.250), fabs(-0.001), fabs(zero)
+    printf "fint: %d %d %d %d\n", fint(3.500), fint(-3.500), fint(-0.001), fint(0.999)
+    printf "fmul: %d %d\n", fmul(2.5, -1.5), fmul(-0.001, 0.001)
+    printf "fdiv: %d %d\n", fdiv(7.0, 2.0), fdiv(-1.0, 3.0)
+    }
+
+#else
+
+#include <float>
+native floatint(Float:value);   /* not in the include file */
+
+main()
+    {
+    new Float:big = 1.0e38
+    new Float:inf = big * 10.0
+    new Float:nan = inf - inf
+    new Float:half[] = [ 2.5, -2.5, 1.5, -1.5, 0.49999997, -0.5 ]
+    new i, m
+
+    printf "float: %d %d %d %d\n", float(0), float(-7), float(2147483647), float(-2147483648)
+    printf "add: %d %d %d %d\n", 1.5 + 2.25, big + big, inf + -inf, -0.0 + 0.0
+    printf "sub: %d %d %d\n", 1.5 - 2.25, 0.0 - 0.0, -inf - -inf
+    printf "mul: %d %d %d\n", -3.0 * 0.5, 0.0 * -1.0, inf * 0.0
+    printf "div: %d %d %d %d\n", 7.0 / 2.0, 1.0 / 0.0, -1.0 / 0.0, 0.0 / 0.0
+    printf "cmp: %d %d %d %d %d\n", floatcmp(1.0, 2.0), floatcmp(2.0, 1.0), floatcmp(-0.0, 0.0), floatcmp(nan, 1.0), floatcmp(1.0, nan)
+    printf "nan: %d %d %d %d\n", nan < 1.0, nan == nan, nan >= 1.0, nan != nan
+    printf "abs: %d %d %d\n", floatabs(-0.0), floatabs(-3.5), floatabs(-inf)
+    printf "round:"
+    for (i = 0; i < sizeof half; i++)
+        for (m = 0; m < 5; m++)
+            printf " %d", floatround(half[i], floatround_method:m)
+    printf "\nint: %d %d %d %d\n", floatint(3.7), floatint(-3.7), floatint(1.0e9), floatint(-0.9)
+    }
+
+#endif
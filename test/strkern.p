@@ -0,0 +1,99 @@
+/* String kernels: amx_StrLen(), amx_GetString() and amx_SetString() have
+ * vectorized paths for longer strings. The strings below have lengths around
+ * the vector widths and start at every cell offset modulo 32 bytes (the rows
+ * of "src" are 121 cells long). The counts of errors must all be zero.
+ */
+#include <console>
+#include <core>
+#include <string>
+
+const ROWLEN = 121
+new lengths[] = [ 0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 47, 48, 49, 63, 64, 65, 100, 119 ]
+new src[8][ROWLEN]
+new dest[ROWLEN]
+new packed[ROWLEN]
+new packed2[ROWLEN]
+
+fill(row[], n, seed)
+    {
+    new i
+    for (i = 0; i < n; i++)
+        row[i] = 'A' + (i * 7 + seed) % 26
+    row[n] = '\0'
+    }
+
+/* compare the first "n" characters and the terminator */
+same(const a[], const b[], n)
+    {
+    new i
+    for (i = 0; i <= n; i++)
+        if (a[i] != b[i])
+            return false
+    return true
+    }
+
+samepacked(const a{}, const b{}, n)
+    {
+    new i
+    for (i = 0; i <= n; i++)
+        if (a{i} != b{i})
+            return false
+    return true
+    }
+
+main()
+    {
+    new errlen, errpacklen, errunpack, errpack, errtrunc, errget, checked
+    new i, k, n, m
+
+    for (i = 0; i < sizeof lengths; i++)
+        {
+        n = lengths[i]
+        for (k = 0; k < 8; k++)
+            {
+            fill(src[k], n, k + i)
+
+            /* amx_StrLen() on unpacked and packed strings */
+            if (strlen(src[k]) != n)
+                errlen++
+            strpack(packed, src[k])
+            if (strlen(packed) != n)
+                errpacklen++
+
+            /* amx_SetString(), unpacked and packed */
+            strformat(dest, sizeof dest, false, "%s", src[k])
+            if (!same(dest, src[k], n))
+                errunpack++
+            strformat(packed2, sizeof packed2, true, "%s", src[k])
+            if (!samepacked(packed2, packed, n))
+                errpack++
+
+            /* amx_SetString() with a size below the length */
+            m = n / 2 + 1
+            strformat(dest, m, false, "%s", src[k])
+            if (strlen(dest) != n / 2 || !same(dest, src[k], n / 2 - 1))
+                errtrunc++
+            m = n / 8 + 1
+            strformat(packed2, m, true, "%s", src[k])
+            if (strlen(packed2) != min(n, m * 4 - 1))
+                errtrunc++
+
+            /* amx_GetString(): the property names are converted to C strings
+             * (from unpacked and from packed strings); an empty name selects
+             * a property by its value instead
+             */
+            if (n > 0)
+                {
+                setproperty(1, src[k], n + 1)
+                if (getproperty(1, packed) != n + 1 || !existproperty(1, src[k]))
+                    errget++
+                deleteproperty(1, packed)
+                }
+            checked++
+            }
+        }
+    printf "strlen: %d %d\n", errlen, errpacklen
+    printf "setstring: %d %d %d\n", errunpack, errpack, errtrunc
+    printf "getstring: %d\n", errget
+    printf "checked: %d\n", checked
+    }
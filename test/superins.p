@@ -0,0 +1,70 @@
+/* Superinstructions: the abstract machine fuses frequent instruction pairs
+ * at load time. Every function below compiles to one or more of these pairs;
+ * the printed values must be the same with and without fusion.
+ */
+#include <console>
+
+sum3(a, b, c)
+    return a + b + c            /* load.s.pri + push.pri, pop.alt + add */
+
+addconst(a)
+    return a + 1000             /* load.s.pri + add.c (-O2 only) */
+
+pick(const grid[][], i, j)
+    return grid[i][j]           /* idxaddr.b + load.i (-O2 only) */
+
+nothing(a)
+    {
+    if (a < 0)
+        return 1
+    return 0                    /* zero.pri + retn (-O2 only) */
+    }
+
+compare(a, b)
+    {
+    new r = 0
+    if (a == b)                 /* eq + jzer */
+        r |= 1
+    if (a != b)                 /* neq + jzer */
+        r |= 2
+    if (a < b)                  /* sless + jzer */
+        r |= 4
+    if (a <= b)                 /* sleq + jzer */
+        r |= 8
+    if (a > b)                  /* sgrtr + jzer */
+        r |= 16
+    if (a >= b)                 /* sgeq + jzer */
+        r |= 32
+    return r
+    }
+
+main()
+    {
+    new table[10]
+    new grid[3][3] = [ [ 1, 2, 3 ], [ 4, 5, 6 ], [ 7, 8, 9 ] ]
+    new str{} = "fused"
+    new i, total
+
+    for (i = 0; i < sizeof table; i++)
+        table[i] = i * i        /* bounds + shl.c.pri, load.i + pop.alt */
+    total = 0
+    for (i = 0; i < sizeof table; i++)
+        total += table[i]
+    printf "squares: %d\n", total
+
+    total = 0
+    for (i = 0; str{i} != '\0'; i++)
+        total += str{i}         /* idxaddr.b + load.i */
+    printf "string: %d\n", total
+
+    total = 0
+    for (i = 0; i < 3; i++)
+        total = total * 10 + pick(grid, i, 2 - i)
+    printf "grid: %d\n", total
+
+    new x = 7                   /* const.pri + stor.s */
+    printf "sum3: %d %d\n", sum3(x, 2, 3), sum3(-x, x * 2, 1)
+    printf "addconst: %d %d\n", addconst(x), addconst(-2000)
+    printf "nothing: %d %d\n", nothing(5), nothing(-5)
+    printf "compare: %d %d %d\n", compare(1, 2), compare(2, 2), compare(3, -2)
+    }
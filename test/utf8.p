@@ -0,0 +1,180 @@
+/* UTF-8: fread() and fwrite() on unpacked strings decode and encode UTF-8 in
+ * blocks, with a fast path for runs of ASCII characters. The lines below put
+ * multi-byte characters and invalid sequences behind ASCII runs of various
+ * lengths and across the block boundary of the decoder. A line with invalid
+ * UTF-8 must be read as 8-bit characters. The counts of errors must all be
+ * zero. The file natives need a writable directory in AMXFILE (or TMP).
+ */
+#include <console>
+#include <file>
+
+new const FILENAME{} = "utf8test.txt"
+const MAXLINE = 600
+new prefixes[] = [ 0, 1, 2, 15, 16, 17, 31, 32, 33, 70, 253, 254, 255, 256, 300 ]
+new bytes[MAXLINE]
+new expect[MAXLINE]
+new line[MAXLINE]
+new checked
+
+/* valid sequences: the encoding and the decoded character */
+new valid[][] = [ [ 0xc3, 0xa9, -1 ],                   /* U+00E9 */
+                  [ 0xe2, 0x82, 0xac, -1 ],             /* U+20AC */
+                  [ 0xf0, 0x9f, 0x98, 0x80, -1 ],       /* U+1F600 */
+                  [ 0xc2, 0x80, -1 ] ]                  /* U+0080 */
+new validchar[] = [ 0xe9, 0x20ac, 0x1f600, 0x80 ]
+
+/* invalid sequences */
+new invalid[][] = [ [ 0x80, -1 ],                       /* lone follower */
+                    [ 0xe2, 0x82, 'x', -1 ],            /* truncated */
+                    [ 0xc0, 0xaf, -1 ],                 /* overlong */
+                    [ 0xed, 0xa0, 0x80, -1 ],           /* surrogate */
+                    [ 0xef, 0xbf, 0xbf, -1 ],           /* U+FFFF */
+                    [ 0xfe, -1 ] ]                      /* never valid */
+
+/* fill the start of "bytes" and "expect" with "n" ASCII characters */
+prefix(n)
+    {
+    new i
+    for (i = 0; i < n; i++)
+        bytes[i] = expect[i] = 'a' + i % 26
+    return n
+    }
+
+/* append a sequence, terminated by -1, to "bytes" */
+append(pos, const seq[])
+    {
+    new i
+    for (i = 0; seq[i] > 0; i++)
+        bytes[pos++] = seq[i]
+    return pos
+    }
+
+writebytes(n)
+    {
+    new File: f = fopen(FILENAME, io_write)
+    new i
+    if (!f)
+        return false
+    for (i = 0; i < n; i++)
+        fputchar(f, bytes[i], false)
+    fclose(f)
+    return true
+    }
+
+/* read a line in UTF-8 mode and compare it to the "n" cells in "expect" */
+readcheck(n)
+    {
+    new File: f = fopen(FILENAME, io_read)
+    new i, count
+    if (!f)
+        return false
+    count = fread(f, line, sizeof line, false)
+    fclose(f)
+    checked++
+    if (count != n)
+        return false
+    for (i = 0; i <= n; i++)
+        if (line[i] != (i < n ? expect[i] : 0))
+            return false
+    return true
+    }
+
+/* read all bytes of the file and compare them to the "n" bytes in "bytes" */
+bytecheck(n)
+    {
+    new File: f = fopen(FILENAME, io_read)
+    new i, c, ok = true
+    if (!f)
+        return false
+    for (i = 0; i < n; i++)
+        if (fgetchar(f, false) != bytes[i])
+            ok = false
+    c = fgetchar(f, false)
+    fclose(f)
+    checked++
+    return ok && c == EOF
+    }
+
+main()
+    {
+    new errdecode, errinvalid, errtail, errencode, errlong
+    new i, k, p, n, pos
+
+    for (i = 0; i < sizeof prefixes; i++)
+        {
+        p = prefixes[i]
+
+        /* valid multi-byte characters behind the ASCII run */
+        for (k = 0; k < sizeof valid; k++)
+            {
+            n = prefix(p)
+            pos = append(n, valid[k])
+            expect[n++] = validchar[k]
+            bytes[pos++] = expect[n++] = 'z'
+            bytes[pos++] = expect[n++] = '\n'
+            if (!writebytes(pos) || !readcheck(n))
+                errdecode++
+            }
+
+        /* invalid sequences: the whole line is read as 8-bit characters */
+        for (k = 0; k < sizeof invalid; k++)
+            {
+            prefix(p)
+            pos = append(p, invalid[k])
+            bytes[pos++] = 'z'
+            bytes[pos++] = '\n'
+            for (n = p; n < pos; n++)
+                expect[n] = bytes[n]
+            if (!writebytes(pos) || !readcheck(n))
+                errinvalid++
+            }
+
+        /* a multi-byte character cut off by the end of the file */
+        prefix(p)
+        pos = append(p, [ 0xe2, 0x82, -1 ])
+        for (n = p; n < pos; n++)
+            expect[n] = bytes[n]
+        if (!writebytes(pos) || !readcheck(n))
+            errtail++
+
+        /* fwrite() encodes; U+D800 is refused by the bulk encoder, but it is
+         * still written (as a three-byte sequence)
+         */
+        n = prefix(p)
+        expect[n++] = 0xe9
+        expect[n++] = 0x1f600
+        expect[n++] = 0xd800
+        expect[n++] = 'z'
+        expect[n] = '\0'
+        pos = append(p, [ 0xc3, 0xa9, 0xf0, 0x9f, 0x98, 0x80, 0xed, 0xa0, 0x80, 'z', -1 ])
+        new File: f = fopen(FILENAME, io_write)
+        if (f)
+            {
+            fwrite(f, expect)
+            fclose(f)
+            }
+        if (!bytecheck(pos))
+            errencode++
+        }
+
+    /* a long line of three-byte characters crosses the buffers of both the
+     * encoder and the decoder in the middle of a character
+     */
+    for (n = 0; n < 200; n++)
+        expect[n] = 0x20ac + n % 3
+    expect[n] = '\0'
+    new File: f = fopen(FILENAME, io_write)
+    if (f)
+        {
+        fwrite(f, expect)
+        fclose(f)
+        }
+    if (!readcheck(n))
+        errlong++
+
+    fremove(FILENAME)
+    printf "decode: %d\n", errdecode
+    printf "invalid: %d %d\n", errinvalid, errtail
+    printf "encode: %d %d\n", errencode, errlong
+    printf "checked: %d\n", checked
+    }